@@ -15,21 +15,46 @@
  */
 
 #include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
 
 #include <utils/log.h>
 #include <utils/assert.h>
+#include <utils/common.h>
 #include <utils/list.h>
+#include <thread/thread.h>
 #include <lib/alsa/asoundlib.h>
 #include <audio/alsa/mixer_controller.h>
 
 #define LOG_TAG "mixer_controller"
 
+#define ELEMENT_HASH_SIZE    64
+#define RAMP_TICK_MS         5
+#define EVENT_BATCH          16
+
 #define convert_prange1(val, min, max) \
     ceil((val) * ((max) - (min)) * 0.01 + (min))
 
-struct mixer_element_id {
-    snd_mixer_selem_id_t* sid;
-    struct list_head node;
+/*
+ * Simple elements are looked up by name once, when the mixer loads
+ * or the driver adds them, and keep their handle until removed
+ */
+struct mixer_element {
+    char* name;
+    snd_mixer_elem_t* elem;
+    int changed;
+
+    struct {
+        int active;
+        long from;
+        long to;
+        uint64_t start_us;
+        uint64_t duration_us;
+    } ramp[2];
+
+    struct hlist_node node;
 };
 
 struct volume_ops {
@@ -38,52 +63,91 @@ struct volume_ops {
            long *value);
     int (*set)(snd_mixer_elem_t *elem, snd_mixer_selem_channel_id_t c,
            long value);
+    int (*set_all)(snd_mixer_elem_t *elem, long value);
 };
 
 struct volume_ops_set {
     int (*has_volume)(snd_mixer_elem_t *elem);
+    int (*has_channel)(snd_mixer_elem_t *elem,
+            snd_mixer_selem_channel_id_t c);
     struct volume_ops v;
 };
 
 static const struct volume_ops_set vol_ops[2] = {
     [PLAYBACK] = {
         .has_volume = snd_mixer_selem_has_playback_volume,
+        .has_channel = snd_mixer_selem_has_playback_channel,
         .v = {
                 snd_mixer_selem_get_playback_volume_range,
                 snd_mixer_selem_get_playback_volume,
-                snd_mixer_selem_set_playback_volume ,
+                snd_mixer_selem_set_playback_volume,
+                snd_mixer_selem_set_playback_volume_all,
         },
     },
 
     [CAPTURE] = {
         .has_volume = snd_mixer_selem_has_capture_volume,
+        .has_channel = snd_mixer_selem_has_capture_channel,
         .v = {
                 snd_mixer_selem_get_capture_volume_range,
                 snd_mixer_selem_get_capture_volume,
                 snd_mixer_selem_set_capture_volume,
+                snd_mixer_selem_set_capture_volume_all,
         },
     },
 };
 
 static snd_mixer_t *handle;
 static char card[64] = "default";
-static pthread_mutex_t list_lock = PTHREAD_MUTEX_INITIALIZER;
-static LIST_HEAD(element_id_list);
+
+/*
+ * alsa-lib mixer handles are not thread safe, the lock covers the
+ * handle, the element table and the ramps
+ */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static struct hlist_head element_table[ELEMENT_HASH_SIZE];
+static mixer_event_listener_t event_listener;
+
+static struct thread* ramp_thread;
+static int ramp_count;
+static int quit;
+
+static uint64_t monotonic_us(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint32_t hash_name(const char* name) {
+    uint32_t hash = 5381;
+
+    while (*name)
+        hash = hash * 33 + (uint8_t) *name++;
+
+    return hash % ELEMENT_HASH_SIZE;
+}
 
 static void dump_control_id(void) {
-    pthread_mutex_lock(&list_lock);
+    struct mixer_element* element;
+
+    pthread_mutex_lock(&lock);
 
     LOGD("========================================\n");
     LOGD("Dump control id.\n");
 
-    struct mixer_element_id* node = NULL;
-    list_for_each_entry(node, &element_id_list, node) {
-        LOGD("'%s',%i\n", snd_mixer_selem_id_get_name(node->sid),
-                snd_mixer_selem_id_get_index(node->sid));
+    for (int i = 0; i < ELEMENT_HASH_SIZE; i++) {
+        hlist_for_each_entry(element, &element_table[i], node) {
+            if (element->elem)
+                LOGD("'%s',%i\n", element->name,
+                        snd_mixer_selem_get_index(element->elem));
+        }
     }
     LOGD("========================================\n");
 
-    pthread_mutex_unlock(&list_lock);
+    pthread_mutex_unlock(&lock);
 }
 
 static int convert_prange(long val, long min, long max) {
@@ -97,210 +161,449 @@ static int convert_prange(long val, long min, long max) {
     return tmp;
 }
 
-static struct mixer_element_id* get_elem_id_by_name(const char* name) {
-    struct mixer_element_id* node = NULL;
+/*
+ * Called with lock held
+ */
+static struct mixer_element* lookup_element(const char* name) {
+    struct mixer_element* element;
+
+    hlist_for_each_entry(element, &element_table[hash_name(name)], node) {
+        if (!strcmp(element->name, name))
+            return element;
+    }
+
+    return NULL;
+}
+
+static struct mixer_element* get_element(const char* name) {
+    struct mixer_element* element = lookup_element(name);
+
+    if (element == NULL || element->elem == NULL) {
+        LOGE("Failed to find control '%s'\n", name);
+        return NULL;
+    }
 
-    pthread_mutex_lock(&list_lock);
+    return element;
+}
 
-    list_for_each_entry(node, &element_id_list, node) {
-        if (!strcmp(name, snd_mixer_selem_id_get_name(node->sid)))
-            break;
+static void cancel_ramp(struct mixer_element* element, int dir) {
+    if (element->ramp[dir].active) {
+        element->ramp[dir].active = 0;
+        ramp_count--;
     }
+}
+
+static void free_elements(void) {
+    struct mixer_element* element;
+    struct hlist_node* next;
 
-    pthread_mutex_unlock(&list_lock);
+    for (int i = 0; i < ELEMENT_HASH_SIZE; i++) {
+        hlist_for_each_entry_safe(element, next, &element_table[i], node) {
+            hlist_del(&element->node);
+            free(element->name);
+            free(element);
+        }
+    }
 
-    return node;
+    ramp_count = 0;
 }
 
-static int set_volume_simple(snd_mixer_elem_t* elem,
-        snd_mixer_selem_channel_id_t chn, int dir, int volume) {
-    int error = 0;
-    int invalid = 0;
-    int val = 0;
+/*
+ * alsa-lib callbacks, they run inside snd_mixer_load(),
+ * snd_mixer_handle_events() and snd_mixer_close() with lock held
+ */
+static int element_event(snd_mixer_elem_t* elem, unsigned int mask) {
+    struct mixer_element* element = snd_mixer_elem_get_callback_private(elem);
+
+    if (mask == SND_CTL_EVENT_MASK_REMOVE) {
+        cancel_ramp(element, PLAYBACK);
+        cancel_ramp(element, CAPTURE);
+        element->elem = NULL;
+        element->changed = 1;
+        return 0;
+    }
+
+    if (mask & SND_CTL_EVENT_MASK_VALUE)
+        element->changed = 1;
+
+    return 0;
+}
+
+static int mixer_event(snd_mixer_t* mixer, unsigned int mask,
+        snd_mixer_elem_t* elem) {
+    struct mixer_element* element;
+    const char* name;
+
+    if (!(mask & SND_CTL_EVENT_MASK_ADD) || !snd_mixer_selem_is_active(elem))
+        return 0;
+
+    /*
+     * Entries are kept on removal so names handed to the listener stay
+     * valid, a re-added control takes its old entry back. The first
+     * index of a name wins, as the name is all callers pass.
+     */
+    name = snd_mixer_selem_get_name(elem);
+    element = lookup_element(name);
+    if (element == NULL) {
+        element = calloc(1, sizeof(struct mixer_element));
+        if (element == NULL)
+            return -ENOMEM;
+
+        element->name = strdup(name);
+        if (element->name == NULL) {
+            free(element);
+            return -ENOMEM;
+        }
+
+        hlist_add_head(&element->node, &element_table[hash_name(name)]);
+
+    } else if (element->elem) {
+        return 0;
+    }
+
+    element->elem = elem;
+    snd_mixer_elem_set_callback(elem, element_event);
+    snd_mixer_elem_set_callback_private(elem, element);
+
+    return 0;
+}
+
+static int first_channel(snd_mixer_elem_t* elem, int dir) {
+    for (snd_mixer_selem_channel_id_t chn = 0; chn <= SND_MIXER_SCHN_LAST;
+            chn++) {
+        if (vol_ops[dir].has_channel(elem, chn))
+            return chn;
+    }
+
+    return -1;
+}
+
+/*
+ * One control write for all channels, alsa-lib skips it when the
+ * value is unchanged
+ */
+static int set_volume_simple(snd_mixer_elem_t* elem, int dir, int volume) {
     long min, max;
 
     if (!vol_ops[dir].has_volume(elem))
-        invalid = 1;
+        return 0;
 
     if (vol_ops[dir].v.get_range(elem, &min, &max) < 0)
-        invalid = 1;
-
-    val = (long)convert_prange1(volume, min, max);
-    if (!invalid) {
-        error = vol_ops[dir].v.set(elem, chn, val);
-        if (error) {
-            LOGE("Failed to set volume\n");
-            return -1;
-        }
+        return 0;
+
+    if (vol_ops[dir].v.set_all(elem, (long)convert_prange1(volume, min, max))) {
+        LOGE("Failed to set volume\n");
+        return -1;
     }
 
     return 0;
 }
 
-static int get_volume_simple(snd_mixer_elem_t* elem,
-        snd_mixer_selem_channel_id_t chn, int dir, long *volume) {
-    int error = 0;
-    int invalid = 0;
+/*
+ * Reads the value alsa-lib keeps, which handle_events() refreshes
+ */
+static int get_volume_simple(snd_mixer_elem_t* elem, int dir, long *volume) {
     long val = 0;
     long min, max;
+    int chn;
 
     if (!vol_ops[dir].has_volume(elem))
-        invalid = 1;
+        return 0;
 
     if (vol_ops[dir].v.get_range(elem, &min, &max) < 0)
-        invalid = 1;
+        return 0;
 
-    if (!invalid) {
-        error = vol_ops[dir].v.get(elem, chn, &val);
-        if (error) {
-            LOGE("Failed to set playback volume\n");
-            return -1;
-        }
+    chn = first_channel(elem, dir);
+    if (chn < 0)
+        return 0;
 
-        *volume = (long)convert_prange(val, min, max);
+    if (vol_ops[dir].v.get(elem, chn, &val)) {
+        LOGE("Failed to get volume\n");
+        return -1;
     }
 
+    *volume = (long)convert_prange(val, min, max);
+
     return 0;
 }
 
 static int set_volume(const char* name, int dir, int volume) {
     assert_die_if(name == NULL, "name is NULL\n");
+    assert_die_if(dir != PLAYBACK && dir != CAPTURE, "Invalid dir\n");
 
-    int error = 0;
-    struct mixer_element_id* elem_id;
-    snd_mixer_elem_t *elem = NULL;
+    struct mixer_element* element;
+    int error;
 
     if (volume > 100)
         volume = 100;
     if (volume < 0)
         volume = 0;
 
-    elem_id = get_elem_id_by_name(name);
-    if (elem_id == NULL) {
-        LOGE("Failed to get element id by name: %s\n", name);
+    pthread_mutex_lock(&lock);
+
+    element = get_element(name);
+    if (element == NULL) {
+        pthread_mutex_unlock(&lock);
         return -1;
     }
 
-    elem = snd_mixer_find_selem(handle, elem_id->sid);
-    if (elem == NULL) {
-        LOGE("Failed to find control '%s',%i\n",
-                snd_mixer_selem_id_get_name(elem_id->sid),
-                snd_mixer_selem_id_get_index(elem_id->sid));
+    cancel_ramp(element, dir);
+
+    error = set_volume_simple(element->elem, dir, volume);
+
+    pthread_mutex_unlock(&lock);
+
+    if (error < 0)
+        LOGE("Failed to set %s volume\n", dir == PLAYBACK ? "playback"
+                : "capture");
+
+    return error;
+}
+
+static int get_volume(const char* name, int dir) {
+    assert_die_if(name == NULL, "name is NULL\n");
+    assert_die_if(dir != PLAYBACK && dir != CAPTURE, "Invalid dir\n");
+
+    struct mixer_element* element;
+    long volume = 0;
+    int error;
+
+    pthread_mutex_lock(&lock);
+
+    element = get_element(name);
+    if (element == NULL) {
+        pthread_mutex_unlock(&lock);
         return -1;
     }
 
-    for (snd_mixer_selem_channel_id_t chn = 0; chn <= SND_MIXER_SCHN_LAST;
-            chn++) {
+    error = get_volume_simple(element->elem, dir, &volume);
 
-        if (dir == PLAYBACK && snd_mixer_selem_has_playback_channel(elem, chn)) {
-            error = set_volume_simple(elem, chn, PLAYBACK, volume);
-            if (error < 0) {
-                LOGE("Failed to set playback volume\n");
-                return -1;
-            }
-        }
+    pthread_mutex_unlock(&lock);
 
-        if (dir == CAPTURE && snd_mixer_selem_has_capture_channel(elem, chn)) {
-            error = set_volume_simple(elem, chn, CAPTURE, volume);
-            if (error < 0) {
-                LOGE("Failed to set capture volume\n");
-                return -1;
-            }
-        }
+    if (error < 0) {
+        LOGE("Failed to get %s volume\n", dir == PLAYBACK ? "playback"
+                : "capture");
+        return -1;
     }
 
-    return 0;
+    return volume;
 }
 
-static int get_volume(const char* name, int dir) {
+static int mute(const char* name, int mute) {
     assert_die_if(name == NULL, "name is NULL\n");
+    assert_die_if(mute != 0 && mute != 1, "Invalid mute\n");
 
+    struct mixer_element* element;
     int error = 0;
-    long volume = 0;;
-    struct mixer_element_id* elem_id;
-    snd_mixer_elem_t *elem = NULL;
 
-    elem_id = get_elem_id_by_name(name);
-    if (elem_id == NULL) {
-        LOGE("Failed to get element id by name: %s\n", name);
+    pthread_mutex_lock(&lock);
+
+    element = get_element(name);
+    if (element == NULL) {
+        pthread_mutex_unlock(&lock);
         return -1;
     }
 
-    elem = snd_mixer_find_selem(handle, elem_id->sid);
-    if (elem == NULL) {
-        LOGE("Failed to find control '%s',%i\n",
-                snd_mixer_selem_id_get_name(elem_id->sid),
-                snd_mixer_selem_id_get_index(elem_id->sid));
+    if (snd_mixer_selem_has_playback_switch(element->elem))
+        error = snd_mixer_selem_set_playback_switch_all(element->elem, mute);
+
+    pthread_mutex_unlock(&lock);
+
+    if (error) {
+        LOGE("Failed to set playback mute\n");
         return -1;
     }
 
-    for (snd_mixer_selem_channel_id_t chn = 0; chn <= SND_MIXER_SCHN_LAST;
-            chn++) {
+    return 0;
+}
 
-        if (dir == PLAYBACK && snd_mixer_selem_has_playback_channel(elem, chn)) {
-            error = get_volume_simple(elem, chn, PLAYBACK, &volume);
-            if (error < 0) {
-                LOGE("Failed to set playback volume\n");
-                return -1;
-            }
+/*
+ * Raw steps of codec volume controls are dB steps, so a linear walk
+ * through the raw range is a linear fade in dB. Each tick moves a
+ * few steps at most instead of one jump, which is what zippers.
+ */
+static void ramp_step(struct mixer_element* element, int dir, uint64_t now) {
+    uint64_t elapsed = now - element->ramp[dir].start_us;
+    long from = element->ramp[dir].from;
+    long to = element->ramp[dir].to;
+    long value = to;
+
+    if (elapsed < element->ramp[dir].duration_us)
+        value = from + (to - from) * (double) elapsed
+                / element->ramp[dir].duration_us;
+    else
+        cancel_ramp(element, dir);
+
+    if (vol_ops[dir].v.set_all(element->elem, value)) {
+        LOGE("Failed to ramp '%s'\n", element->name);
+        cancel_ramp(element, dir);
+    }
+}
+
+static void ramp_loop(struct pthread_wrapper* thread, void* param) {
+    struct mixer_element* element;
+    uint64_t now;
+
+    pthread_mutex_lock(&lock);
+
+    while (!quit) {
+        if (ramp_count == 0) {
+            pthread_cond_wait(&cond, &lock);
+            continue;
         }
 
-        if (dir == CAPTURE && snd_mixer_selem_has_capture_channel(elem, chn)) {
-            error = get_volume_simple(elem, chn, CAPTURE, &volume);
-            if (error < 0) {
-                LOGE("Failed to set capture volume\n");
-                return -1;
+        now = monotonic_us();
+
+        for (int i = 0; i < ELEMENT_HASH_SIZE; i++) {
+            hlist_for_each_entry(element, &element_table[i], node) {
+                for (int dir = PLAYBACK; dir <= CAPTURE; dir++) {
+                    if (element->ramp[dir].active)
+                        ramp_step(element, dir, now);
+                }
             }
         }
+
+        pthread_mutex_unlock(&lock);
+        usleep(RAMP_TICK_MS * 1000);
+        pthread_mutex_lock(&lock);
     }
 
-    return volume;
+    pthread_mutex_unlock(&lock);
 }
 
-static int mute(const char* name, int mute) {
+static int ramp_volume(const char* name, int dir, int volume,
+        uint32_t duration_ms) {
     assert_die_if(name == NULL, "name is NULL\n");
-    assert_die_if(mute != 0 && mute != 1, "Invalid mute\n");
+    assert_die_if(dir != PLAYBACK && dir != CAPTURE, "Invalid dir\n");
 
-    int error = 0;
-    struct mixer_element_id* elem_id;
-    snd_mixer_elem_t *elem = NULL;
+    struct mixer_element* element;
+    snd_mixer_elem_t* elem;
+    long min, max;
+    long from;
+    int chn;
 
-    elem_id = get_elem_id_by_name(name);
-    if (elem_id == NULL) {
-        LOGE("Failed to get element id by name: %s\n", name);
+    if (duration_ms == 0)
+        return set_volume(name, dir, volume);
+
+    if (volume > 100)
+        volume = 100;
+    if (volume < 0)
+        volume = 0;
+
+    pthread_mutex_lock(&lock);
+
+    element = get_element(name);
+    if (element == NULL) {
+        pthread_mutex_unlock(&lock);
         return -1;
     }
 
-    elem = snd_mixer_find_selem(handle, elem_id->sid);
-    if (elem == NULL) {
-        LOGE("Failed to find control '%s',%i\n",
-                snd_mixer_selem_id_get_name(elem_id->sid),
-                snd_mixer_selem_id_get_index(elem_id->sid));
+    elem = element->elem;
+
+    if (!vol_ops[dir].has_volume(elem)
+            || vol_ops[dir].v.get_range(elem, &min, &max) < 0
+            || (chn = first_channel(elem, dir)) < 0) {
+        pthread_mutex_unlock(&lock);
+        return 0;
+    }
+
+    /*
+     * A ramp already running restarts from where it got to
+     */
+    if (vol_ops[dir].v.get(elem, chn, &from)) {
+        pthread_mutex_unlock(&lock);
+        LOGE("Failed to get volume of '%s'\n", name);
         return -1;
     }
 
-    for (snd_mixer_selem_channel_id_t chn = 0; chn <= SND_MIXER_SCHN_LAST;
-            chn++) {
+    element->ramp[dir].from = from;
+    element->ramp[dir].to = (long)convert_prange1(volume, min, max);
+    element->ramp[dir].start_us = monotonic_us();
+    element->ramp[dir].duration_us = (uint64_t) duration_ms * 1000;
 
-        if (snd_mixer_selem_has_playback_channel(elem, chn)) {
-            if (snd_mixer_selem_has_playback_switch(elem)) {
-                error = snd_mixer_selem_set_playback_switch(elem, chn, mute);
-                if (error) {
-                    LOGE("Failed to set playback mute\n");
-                    return -1;
-                }
+    if (!element->ramp[dir].active) {
+        element->ramp[dir].active = 1;
+        ramp_count++;
+        pthread_cond_signal(&cond);
+    }
+
+    pthread_mutex_unlock(&lock);
+
+    return 0;
+}
+
+static int get_event_fd(void) {
+    struct pollfd pfd;
+    int count;
+
+    pthread_mutex_lock(&lock);
+    count = snd_mixer_poll_descriptors(handle, &pfd, 1);
+    pthread_mutex_unlock(&lock);
+
+    if (count != 1) {
+        LOGE("Failed to get mixer poll descriptor\n");
+        return -1;
+    }
+
+    return pfd.fd;
+}
+
+static int handle_events(void) {
+    struct mixer_element* changed[EVENT_BATCH];
+    struct mixer_element* element;
+    mixer_event_listener_t listener;
+    int count;
+    int error;
+
+    pthread_mutex_lock(&lock);
+    error = snd_mixer_handle_events(handle);
+    pthread_mutex_unlock(&lock);
+
+    if (error < 0) {
+        LOGE("Failed to handle mixer events: %s\n", snd_strerror(error));
+        return -1;
+    }
+
+    /*
+     * The listener runs unlocked so it may call back in
+     */
+    do {
+        count = 0;
+
+        pthread_mutex_lock(&lock);
+
+        listener = event_listener;
+        for (int i = 0; i < ELEMENT_HASH_SIZE && count < EVENT_BATCH; i++) {
+            hlist_for_each_entry(element, &element_table[i], node) {
+                if (!element->changed)
+                    continue;
+
+                element->changed = 0;
+                changed[count++] = element;
+                if (count == EVENT_BATCH)
+                    break;
             }
         }
-    }
+
+        pthread_mutex_unlock(&lock);
+
+        for (int i = 0; listener && i < count; i++)
+            listener(changed[i]->name);
+
+    } while (count == EVENT_BATCH);
 
     return 0;
 }
 
+static void set_event_listener(mixer_event_listener_t listener) {
+    pthread_mutex_lock(&lock);
+    event_listener = listener;
+    pthread_mutex_unlock(&lock);
+}
+
 static int init(void) {
     int error = 0;
 
-    snd_mixer_elem_t *elem;
-
     error = snd_mixer_open(&handle, 0);
     if (error < 0) {
         LOGE("Mixer %s open error: %s", card, snd_strerror(error));
@@ -319,51 +622,61 @@ static int init(void) {
         goto error;
     }
 
+    pthread_mutex_lock(&lock);
+
+    snd_mixer_set_callback(handle, mixer_event);
     error = snd_mixer_load(handle);
+
+    pthread_mutex_unlock(&lock);
+
     if (error < 0) {
         LOGE("Mixer load %s error: %s", card, snd_strerror(error));
         goto error;
     }
 
-    pthread_mutex_lock(&list_lock);
-
-    for (elem = snd_mixer_first_elem(handle); elem;
-            elem = snd_mixer_elem_next(elem)) {
-        if (!snd_mixer_selem_is_active(elem))
-            continue;
-
-        struct mixer_element_id* node = calloc(1,
-                sizeof(struct mixer_element_id));
-
-        node->sid = calloc(1, snd_mixer_selem_id_sizeof());
+    dump_control_id();
 
-        snd_mixer_selem_get_id(elem, node->sid);
+    quit = 0;
 
-        list_add_tail(&node->node, &element_id_list);
+    ramp_thread = _new(struct thread, thread);
+    ramp_thread->runnable.run = ramp_loop;
+    if (ramp_thread->start(ramp_thread, NULL) < 0) {
+        LOGE("Failed to start ramp thread\n");
+        _delete(ramp_thread);
+        ramp_thread = NULL;
+        error = -1;
+        goto error;
     }
-    pthread_mutex_unlock(&list_lock);
-
-    dump_control_id();
 
     return 0;
 
 error:
+    pthread_mutex_lock(&lock);
     snd_mixer_close(handle);
+    free_elements();
+    pthread_mutex_unlock(&lock);
     return error;
 }
 
 static int deinit(void) {
-    pthread_mutex_lock(&list_lock);
-
-    struct mixer_element_id* node = NULL, *next_node = NULL;
-    list_for_each_entry_safe(node, next_node, &element_id_list, node) {
-        free(node->sid);
-        free(node);
+    pthread_mutex_lock(&lock);
+    quit = 1;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&lock);
+
+    if (ramp_thread) {
+        ramp_thread->wait(ramp_thread);
+        _delete(ramp_thread);
+        ramp_thread = NULL;
     }
 
-    pthread_mutex_unlock(&list_lock);
-
+    /*
+     * Close first, removal events still reach the entries
+     */
+    pthread_mutex_lock(&lock);
     snd_mixer_close(handle);
+    free_elements();
+    pthread_mutex_unlock(&lock);
 
     return 0;
 }
@@ -374,6 +687,10 @@ static struct mixer_controller this = {
         .set_volume = set_volume,
         .get_volume = get_volume,
         .mute = mute,
+        .ramp_volume = ramp_volume,
+        .get_event_fd = get_event_fd,
+        .handle_events = handle_events,
+        .set_event_listener = set_event_listener,
 };
 
 struct mixer_controller* get_mixer_controller(void) {
@@ -0,0 +1,626 @@
+/*
+ *  Copyright (C) 2017, Zhang YanMing <yanmin.zhang@ingenic.com, jamincheung@126.com>
+ *
+ *  Ingenic Linux plarform SDK project
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include <utils/log.h>
+#include <utils/assert.h>
+#include <utils/common.h>
+#include <audio/alsa/pcm_convert.h>
+
+#define LOG_TAG "pcm_convert"
+
+/*
+ * Input frames decoded per step, and the most filter phases kept;
+ * ratios with more phases use the nearest one
+ */
+#define BLOCK_FRAMES            256
+#define MAX_PHASES              256
+#define MAX_DOWN_STRETCH        4
+
+struct pcm_convert_handle {
+    struct pcm_convert_param param;
+    uint32_t in_frame_bytes;
+    uint32_t out_frame_bytes;
+
+    /*
+     * Working channel count, channel mapping is done while decoding
+     */
+    int channels;
+
+    int resample;
+    uint32_t up;
+    uint32_t down;
+    uint32_t taps;
+    uint32_t half;
+    uint32_t phases;
+    float* coeffs;
+
+    /*
+     * Decoded input; the next output sits between buffer[pos] and
+     * buffer[pos + 1] at frac / up
+     */
+    float* buffer;
+    uint32_t capacity;
+    uint32_t avail;
+    uint32_t pos;
+    uint32_t frac;
+
+    uint64_t in_total;
+    uint64_t out_total;
+    uint32_t flush_frames;
+};
+
+static uint32_t get_sample_bytes(enum pcm_sample_format format) {
+    switch (format) {
+    case PCM_SAMPLE_S16:
+        return 2;
+    case PCM_SAMPLE_S24_3:
+        return 3;
+    case PCM_SAMPLE_S24:
+    case PCM_SAMPLE_S32:
+    case PCM_SAMPLE_FLOAT:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+static inline float read_sample(enum pcm_sample_format format,
+        const uint8_t* p) {
+    int32_t value;
+    float f;
+
+    switch (format) {
+    case PCM_SAMPLE_S16:
+        return (int16_t) (p[0] | (p[1] << 8)) * (1.0f / 32768);
+
+    case PCM_SAMPLE_S24:
+    case PCM_SAMPLE_S24_3:
+        value = p[0] | (p[1] << 8) | (p[2] << 16);
+        return ((value << 8) >> 8) * (1.0f / 8388608);
+
+    case PCM_SAMPLE_S32:
+        value = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+        return value * (1.0f / 2147483648.0f);
+
+    case PCM_SAMPLE_FLOAT:
+    default:
+        memcpy(&f, p, sizeof(f));
+        return f;
+    }
+}
+
+static inline int32_t clamp_scale(float f, float scale, int32_t max) {
+    float v = f * scale;
+
+    if (v >= max)
+        return max;
+    if (v <= -max - 1.0f)
+        return -max - 1;
+
+    return lrintf(v);
+}
+
+static inline void write_sample(enum pcm_sample_format format, uint8_t* p,
+        float f) {
+    int32_t value;
+
+    switch (format) {
+    case PCM_SAMPLE_S16:
+        value = clamp_scale(f, 32768.0f, INT16_MAX);
+        p[0] = value;
+        p[1] = value >> 8;
+        break;
+
+    case PCM_SAMPLE_S24:
+        value = clamp_scale(f, 8388608.0f, 8388607);
+        p[0] = value;
+        p[1] = value >> 8;
+        p[2] = value >> 16;
+        p[3] = value < 0 ? 0xff : 0;
+        break;
+
+    case PCM_SAMPLE_S24_3:
+        value = clamp_scale(f, 8388608.0f, 8388607);
+        p[0] = value;
+        p[1] = value >> 8;
+        p[2] = value >> 16;
+        break;
+
+    case PCM_SAMPLE_S32:
+        /*
+         * float can't hold INT32_MAX, clamp just below it
+         */
+        value = clamp_scale(f, 2147483648.0f, 2147483520);
+        p[0] = value;
+        p[1] = value >> 8;
+        p[2] = value >> 16;
+        p[3] = value >> 24;
+        break;
+
+    case PCM_SAMPLE_FLOAT:
+    default:
+        memcpy(p, &f, sizeof(f));
+        break;
+    }
+}
+
+/*
+ * Decode @frames into working channel layout: mono is copied to every
+ * channel, down to mono averages, otherwise channels are taken in order
+ */
+static void decode(struct pcm_convert_handle* handle, const uint8_t* in,
+        uint32_t frames, float* out) {
+    enum pcm_sample_format format = handle->param.in_format;
+    uint32_t sample_bytes = get_sample_bytes(format);
+    int in_channels = handle->param.in_channels;
+    int channels = handle->channels;
+    float sum;
+
+    for (uint32_t i = 0; i < frames; i++) {
+        if (in_channels == channels) {
+            for (int ch = 0; ch < channels; ch++, in += sample_bytes)
+                *out++ = read_sample(format, in);
+
+        } else if (in_channels == 1) {
+            float f = read_sample(format, in);
+
+            for (int ch = 0; ch < channels; ch++)
+                *out++ = f;
+            in += sample_bytes;
+
+        } else if (channels == 1) {
+            sum = 0;
+            for (int ch = 0; ch < in_channels; ch++, in += sample_bytes)
+                sum += read_sample(format, in);
+            *out++ = sum / in_channels;
+
+        } else {
+            for (int ch = 0; ch < channels; ch++)
+                *out++ = ch < in_channels
+                        ? read_sample(format, in + ch * sample_bytes) : 0;
+            in += in_channels * sample_bytes;
+        }
+    }
+}
+
+static void encode(struct pcm_convert_handle* handle, const float* in,
+        uint32_t frames, uint8_t* out) {
+    enum pcm_sample_format format = handle->param.out_format;
+    uint32_t sample_bytes = get_sample_bytes(format);
+    uint32_t samples = frames * handle->channels;
+
+    for (uint32_t i = 0; i < samples; i++, out += sample_bytes)
+        write_sample(format, out, in[i]);
+}
+
+/*
+ * Windowed sinc (Blackman) polyphase bank. FAST degenerates to the
+ * two tap linear interpolation kernel.
+ */
+static void build_filter(struct pcm_convert_handle* handle) {
+    double cutoff;
+    double rolloff;
+    double sum;
+    double t;
+    double x;
+    float* coeff;
+
+    rolloff = handle->param.quality == PCM_CONVERT_HIGH ? 0.95 : 0.9;
+    cutoff = 0.5 * rolloff * MIN(1.0, (double) handle->up / handle->down);
+
+    for (uint32_t p = 0; p < handle->phases; p++) {
+        coeff = handle->coeffs + p * handle->taps;
+        t = (double) p / handle->phases;
+
+        if (handle->param.quality == PCM_CONVERT_FAST) {
+            coeff[0] = 1.0 - t;
+            coeff[1] = t;
+            continue;
+        }
+
+        sum = 0;
+        for (uint32_t k = 0; k < handle->taps; k++) {
+            double h;
+            double w;
+
+            x = (double) k - (handle->half - 1) - t;
+
+            h = x == 0 ? 2 * cutoff : sin(2 * M_PI * cutoff * x) / (M_PI * x);
+            w = 0.42 + 0.5 * cos(M_PI * x / handle->half)
+                    + 0.08 * cos(2 * M_PI * x / handle->half);
+
+            coeff[k] = h * w;
+            sum += coeff[k];
+        }
+
+        /*
+         * Unity DC gain for every phase
+         */
+        for (uint32_t k = 0; k < handle->taps; k++)
+            coeff[k] /= sum;
+    }
+}
+
+static uint32_t gcd(uint32_t a, uint32_t b) {
+    while (b) {
+        uint32_t t = a % b;
+
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+static void reset_state(struct pcm_convert_handle* handle) {
+    /*
+     * Prime with silence so the first output lines up with the
+     * first input frame
+     */
+    handle->avail = handle->half - 1;
+    handle->pos = handle->half - 1;
+    handle->frac = 0;
+    memset(handle->buffer, 0,
+            handle->avail * handle->channels * sizeof(float));
+
+    handle->in_total = 0;
+    handle->out_total = 0;
+    handle->flush_frames = handle->half;
+}
+
+static void compact(struct pcm_convert_handle* handle) {
+    uint32_t shift;
+
+    if (handle->pos + 1 <= handle->half)
+        return;
+
+    shift = MIN(handle->pos + 1 - handle->half, handle->avail);
+    if (shift == 0)
+        return;
+
+    memmove(handle->buffer, handle->buffer + shift * handle->channels,
+            (handle->avail - shift) * handle->channels * sizeof(float));
+
+    handle->avail -= shift;
+    handle->pos -= shift;
+}
+
+/*
+ * Produce outputs while the filter window is covered by input
+ */
+static uint32_t resample(struct pcm_convert_handle* handle, uint8_t* out,
+        uint32_t out_frames, uint64_t limit) {
+    int channels = handle->channels;
+    uint32_t taps = handle->taps;
+    float frame[PCM_CONVERT_MAX_CHANNELS];
+    uint32_t produced = 0;
+
+    while (produced < out_frames && handle->out_total < limit
+            && handle->pos + handle->half < handle->avail) {
+        uint32_t phase = handle->phases == handle->up ? handle->frac
+                : (uint64_t) handle->frac * handle->phases / handle->up;
+        const float* coeff = handle->coeffs + phase * taps;
+        const float* src = handle->buffer
+                + (handle->pos + 1 - handle->half) * channels;
+
+        if (channels == 1) {
+            float acc = 0;
+
+            for (uint32_t k = 0; k < taps; k++)
+                acc += coeff[k] * src[k];
+            frame[0] = acc;
+
+        } else if (channels == 2) {
+            float left = 0;
+            float right = 0;
+
+            for (uint32_t k = 0; k < taps; k++) {
+                left += coeff[k] * src[2 * k];
+                right += coeff[k] * src[2 * k + 1];
+            }
+            frame[0] = left;
+            frame[1] = right;
+
+        } else {
+            for (int ch = 0; ch < channels; ch++)
+                frame[ch] = 0;
+
+            for (uint32_t k = 0; k < taps; k++, src += channels)
+                for (int ch = 0; ch < channels; ch++)
+                    frame[ch] += coeff[k] * src[ch];
+        }
+
+        encode(handle, frame, 1, out);
+        out += handle->out_frame_bytes;
+        produced++;
+        handle->out_total++;
+
+        handle->frac += handle->down;
+        handle->pos += handle->frac / handle->up;
+        handle->frac %= handle->up;
+    }
+
+    return produced;
+}
+
+static int convert_direct(struct pcm_convert_handle* handle, const uint8_t* in,
+        uint32_t* in_frames, uint8_t* out, uint32_t out_frames) {
+    uint32_t frames = MIN(*in_frames, out_frames);
+    uint32_t done = 0;
+    uint32_t n;
+
+    if (handle->param.in_format == handle->param.out_format
+            && handle->param.in_channels == handle->channels) {
+        memcpy(out, in, frames * handle->in_frame_bytes);
+        done = frames;
+    }
+
+    while (done < frames) {
+        n = MIN(frames - done, BLOCK_FRAMES);
+
+        decode(handle, in + done * handle->in_frame_bytes, n, handle->buffer);
+        encode(handle, handle->buffer, n, out + done * handle->out_frame_bytes);
+
+        done += n;
+    }
+
+    *in_frames = frames;
+
+    return frames;
+}
+
+static int process(struct pcm_convert_handle* handle, const uint8_t* in,
+        uint32_t* in_frames, uint8_t* out, uint32_t out_frames) {
+    assert_die_if(handle == NULL, "handle is NULL\n");
+    assert_die_if(in_frames == NULL, "in_frames is NULL\n");
+    assert_die_if(in == NULL && *in_frames, "in is NULL\n");
+    assert_die_if(out == NULL && out_frames, "out is NULL\n");
+
+    uint32_t consumed = 0;
+    uint32_t produced = 0;
+    uint32_t n;
+
+    if (!handle->resample)
+        return convert_direct(handle, in, in_frames, out, out_frames);
+
+    for (;;) {
+        produced += resample(handle, out + produced * handle->out_frame_bytes,
+                out_frames - produced, UINT64_MAX);
+
+        if (produced == out_frames || consumed == *in_frames)
+            break;
+
+        compact(handle);
+
+        n = MIN(*in_frames - consumed, handle->capacity - handle->avail);
+        decode(handle, in + consumed * handle->in_frame_bytes, n,
+                handle->buffer + handle->avail * handle->channels);
+
+        handle->avail += n;
+        handle->in_total += n;
+        consumed += n;
+    }
+
+    *in_frames = consumed;
+
+    return produced;
+}
+
+static int flush(struct pcm_convert_handle* handle, uint8_t* out,
+        uint32_t out_frames) {
+    assert_die_if(handle == NULL, "handle is NULL\n");
+    assert_die_if(out == NULL && out_frames, "out is NULL\n");
+
+    uint32_t produced = 0;
+    uint64_t expected;
+    uint32_t n;
+
+    if (!handle->resample)
+        return 0;
+
+    /*
+     * Exactly in_total * up / down frames in all, the padding must not
+     * add a tail of its own
+     */
+    expected = (handle->in_total * handle->up + handle->down - 1)
+            / handle->down;
+
+    for (;;) {
+        produced += resample(handle, out + produced * handle->out_frame_bytes,
+                out_frames - produced, expected);
+
+        if (produced == out_frames || handle->out_total >= expected
+                || handle->flush_frames == 0)
+            break;
+
+        compact(handle);
+
+        n = MIN(handle->flush_frames, handle->capacity - handle->avail);
+        memset(handle->buffer + handle->avail * handle->channels, 0,
+                n * handle->channels * sizeof(float));
+
+        handle->avail += n;
+        handle->flush_frames -= n;
+    }
+
+    return produced;
+}
+
+static int reset(struct pcm_convert_handle* handle) {
+    assert_die_if(handle == NULL, "handle is NULL\n");
+
+    if (handle->resample)
+        reset_state(handle);
+
+    return 0;
+}
+
+static uint32_t get_out_frames(struct pcm_convert_handle* handle,
+        uint32_t in_frames) {
+    assert_die_if(handle == NULL, "handle is NULL\n");
+
+    if (!handle->resample)
+        return in_frames;
+
+    return ((uint64_t) in_frames + handle->taps) * handle->up / handle->down
+            + 2;
+}
+
+static int check_param(const struct pcm_convert_param* param) {
+    if (get_sample_bytes(param->in_format) == 0
+            || get_sample_bytes(param->out_format) == 0) {
+        LOGE("Invalid sample format %d -> %d\n", param->in_format,
+                param->out_format);
+        return -1;
+    }
+
+    if (param->in_channels <= 0 || param->out_channels <= 0
+            || param->in_channels > PCM_CONVERT_MAX_CHANNELS
+            || param->out_channels > PCM_CONVERT_MAX_CHANNELS) {
+        LOGE("Invalid channels %d -> %d\n", param->in_channels,
+                param->out_channels);
+        return -1;
+    }
+
+    if (param->in_rate <= 0 || param->out_rate <= 0) {
+        LOGE("Invalid sample rate %d -> %d\n", param->in_rate,
+                param->out_rate);
+        return -1;
+    }
+
+    return 0;
+}
+
+static struct pcm_convert_handle* pcm_convert_open(
+        const struct pcm_convert_param* param) {
+    assert_die_if(param == NULL, "param is NULL\n");
+
+    struct pcm_convert_handle* handle;
+    uint32_t divisor;
+
+    if (check_param(param) < 0)
+        return NULL;
+
+    handle = calloc(1, sizeof(*handle));
+    if (handle == NULL) {
+        LOGE("Failed to allocate convert handle\n");
+        return NULL;
+    }
+
+    handle->param = *param;
+    handle->channels = param->out_channels;
+    handle->in_frame_bytes = get_sample_bytes(param->in_format)
+            * param->in_channels;
+    handle->out_frame_bytes = get_sample_bytes(param->out_format)
+            * param->out_channels;
+    handle->resample = param->in_rate != param->out_rate;
+
+    if (!handle->resample) {
+        handle->capacity = BLOCK_FRAMES;
+        handle->buffer = malloc(BLOCK_FRAMES * handle->channels * sizeof(float));
+        if (handle->buffer == NULL)
+            goto error;
+
+        return handle;
+    }
+
+    divisor = gcd(param->out_rate, param->in_rate);
+    handle->up = param->out_rate / divisor;
+    handle->down = param->in_rate / divisor;
+
+    switch (param->quality) {
+    case PCM_CONVERT_FAST:
+        handle->taps = 2;
+        break;
+    case PCM_CONVERT_MEDIUM:
+        handle->taps = 16;
+        break;
+    case PCM_CONVERT_HIGH:
+    default:
+        handle->taps = 48;
+        break;
+    }
+
+    /*
+     * Downsampling narrows the passband, widen the window with it so
+     * the filter keeps the same length in output samples
+     */
+    if (param->quality != PCM_CONVERT_FAST && handle->down > handle->up)
+        handle->taps *= MIN(MAX_DOWN_STRETCH,
+                (handle->down + handle->up - 1) / handle->up);
+
+    handle->half = handle->taps / 2;
+    handle->phases = MIN(handle->up, MAX_PHASES);
+
+    handle->coeffs = malloc(handle->phases * handle->taps * sizeof(float));
+    if (handle->coeffs == NULL)
+        goto error;
+
+    /*
+     * Downsampling can step several input frames per output, leave
+     * room for that on top of the window and one block
+     */
+    handle->capacity = handle->taps + BLOCK_FRAMES
+            + handle->down / handle->up + 1;
+    handle->buffer = malloc(handle->capacity * handle->channels * sizeof(float));
+    if (handle->buffer == NULL)
+        goto error;
+
+    build_filter(handle);
+    reset_state(handle);
+
+    LOGD("%dHz -> %dHz: %u/%u, %u taps, %u phases\n", param->in_rate,
+            param->out_rate, handle->up, handle->down, handle->taps,
+            handle->phases);
+
+    return handle;
+
+error:
+    LOGE("Failed to allocate convert buffers\n");
+    free(handle->coeffs);
+    free(handle->buffer);
+    free(handle);
+
+    return NULL;
+}
+
+static int pcm_convert_close(struct pcm_convert_handle* handle) {
+    assert_die_if(handle == NULL, "handle is NULL\n");
+
+    free(handle->coeffs);
+    free(handle->buffer);
+    free(handle);
+
+    return 0;
+}
+
+static struct pcm_convert this = {
+    .open = pcm_convert_open,
+    .close = pcm_convert_close,
+    .process = process,
+    .flush = flush,
+    .reset = reset,
+    .get_out_frames = get_out_frames,
+    .get_sample_bytes = get_sample_bytes,
+};
+
+struct pcm_convert* get_pcm_convert(void) {
+    return &this;
+}
@@ -0,0 +1,529 @@
+/*
+ *  Copyright (C) 2017, Zhang YanMing <yanmin.zhang@ingenic.com, jamincheung@126.com>
+ *
+ *  Ingenic Linux plarform SDK project
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <utils/log.h>
+#include <utils/assert.h>
+#include <utils/common.h>
+#include <audio/alsa/pcm_mmap.h>
+#include "wave_pcm_common.h"
+
+#define LOG_TAG "pcm_mmap"
+
+#define DEFAULT_PERIODS         2
+#define DEFAULT_PERIOD_MS       10
+
+struct pcm_mmap_handle {
+    snd_pcm_t* pcm;
+    enum pcm_mmap_stream stream;
+    snd_pcm_format_t format;
+    int channels;
+    uint32_t rate;
+    uint32_t frame_bytes;
+    snd_pcm_uframes_t period_size;
+    snd_pcm_uframes_t buffer_size;
+    uint32_t xruns;
+
+    /*
+     * Region handed out by the last begin()
+     */
+    snd_pcm_uframes_t offset;
+    snd_pcm_uframes_t frames;
+};
+
+static int set_hw_params(struct pcm_mmap_handle* handle,
+        const struct pcm_mmap_param* param) {
+    snd_pcm_hw_params_t* hw_params;
+    snd_pcm_uframes_t period_size;
+    snd_pcm_uframes_t buffer_size;
+    uint32_t periods;
+    uint32_t rate;
+    int error;
+
+    snd_pcm_hw_params_alloca(&hw_params);
+
+    error = snd_pcm_hw_params_any(handle->pcm, hw_params);
+    if (error < 0) {
+        LOGE("Failed to snd_pcm_hw_params_any: %s\n", snd_strerror(error));
+        return -1;
+    }
+
+    error = snd_pcm_hw_params_set_rate_resample(handle->pcm, hw_params, 1);
+    if (error < 0) {
+        LOGE("Failed to setup resample: %s\n", snd_strerror(error));
+        return -1;
+    }
+
+    error = snd_pcm_hw_params_set_access(handle->pcm, hw_params,
+            SND_PCM_ACCESS_MMAP_INTERLEAVED);
+    if (error < 0) {
+        LOGE("Failed to set mmap access: %s\n", snd_strerror(error));
+        return -1;
+    }
+
+    handle->format = pcm_format_from_bits(param->sample_length);
+    error = snd_pcm_hw_params_set_format(handle->pcm, hw_params,
+            handle->format);
+    if (error < 0) {
+        LOGE("Failed to snd_pcm_hw_params_set_format: %s\n", snd_strerror(error));
+        return -1;
+    }
+
+    error = snd_pcm_hw_params_set_channels(handle->pcm, hw_params,
+            param->channels);
+    if (error < 0) {
+        LOGE("Failed to snd_pcm_hw_params_set_channels: %s\n", snd_strerror(error));
+        return -1;
+    }
+    handle->channels = param->channels;
+
+    rate = param->sample_rate;
+    error = snd_pcm_hw_params_set_rate_near(handle->pcm, hw_params, &rate, 0);
+    if (error < 0) {
+        LOGE("Failed to snd_pcm_hw_params_set_rate_near: %s\n", snd_strerror(error));
+        return -1;
+    }
+    if (rate != param->sample_rate)
+        LOGW("Sample rate %dHz is not supported, using %dHz instead.\n",
+                param->sample_rate, rate);
+    handle->rate = rate;
+
+    period_size = param->period_frames;
+    if (period_size == 0)
+        period_size = rate * DEFAULT_PERIOD_MS / 1000;
+    periods = param->periods ? param->periods : DEFAULT_PERIODS;
+
+    error = snd_pcm_hw_params_set_period_size_near(handle->pcm, hw_params,
+            &period_size, 0);
+    if (error < 0) {
+        LOGE("Failed to snd_pcm_hw_params_set_period_size_near: %s\n",
+                snd_strerror(error));
+        return -1;
+    }
+
+    buffer_size = period_size * periods;
+    error = snd_pcm_hw_params_set_buffer_size_near(handle->pcm, hw_params,
+            &buffer_size);
+    if (error < 0) {
+        LOGE("Failed to snd_pcm_hw_params_set_buffer_size_near: %s\n",
+                snd_strerror(error));
+        return -1;
+    }
+
+    error = snd_pcm_hw_params(handle->pcm, hw_params);
+    if (error < 0) {
+        LOGE("Failed to snd_pcm_hw_params: %s\n", snd_strerror(error));
+        return -1;
+    }
+
+    snd_pcm_hw_params_get_period_size(hw_params, &handle->period_size, 0);
+    snd_pcm_hw_params_get_buffer_size(hw_params, &handle->buffer_size);
+    if (handle->period_size == handle->buffer_size) {
+        LOGE("Can't use period equal to buffer size (%lu == %lu)\n",
+                handle->period_size, handle->buffer_size);
+        return -1;
+    }
+
+    handle->frame_bytes = snd_pcm_format_physical_width(handle->format) / 8
+            * handle->channels;
+
+    return 0;
+}
+
+static int set_sw_params(struct pcm_mmap_handle* handle) {
+    snd_pcm_sw_params_t* sw_params;
+    snd_pcm_uframes_t start_threshold;
+    int error;
+
+    snd_pcm_sw_params_alloca(&sw_params);
+    snd_pcm_sw_params_current(handle->pcm, sw_params);
+
+    /*
+     * mmap commits don't trigger the kernel's auto start, the stream
+     * is started by hand once the buffer is full (playback) or on the
+     * first begin() (capture)
+     */
+    if (handle->stream == PCM_MMAP_PLAYBACK)
+        start_threshold = handle->buffer_size;
+    else
+        start_threshold = 1;
+
+    error = snd_pcm_sw_params_set_start_threshold(handle->pcm, sw_params,
+            start_threshold);
+    if (error < 0) {
+        LOGE("Failed to set start threshold\n");
+        return -1;
+    }
+
+    error = snd_pcm_sw_params_set_stop_threshold(handle->pcm, sw_params,
+            handle->buffer_size);
+    if (error < 0) {
+        LOGE("Failed to set stop threshold\n");
+        return -1;
+    }
+
+    error = snd_pcm_sw_params_set_avail_min(handle->pcm, sw_params,
+            handle->period_size);
+    if (error < 0) {
+        LOGE("Failed to set avail min\n");
+        return -1;
+    }
+
+    error = snd_pcm_sw_params(handle->pcm, sw_params);
+    if (error < 0) {
+        LOGE("Failed to snd_pcm_sw_params: %s\n", snd_strerror(error));
+        return -1;
+    }
+
+    return 0;
+}
+
+static int recover(struct pcm_mmap_handle* handle, int error) {
+    if (error == -EPIPE) {
+        handle->xruns++;
+        LOGW("%s occured\n", handle->stream == PCM_MMAP_PLAYBACK
+                ? "Underrun" : "Overrun");
+    }
+
+    error = snd_pcm_recover(handle->pcm, error, 1);
+    if (error < 0) {
+        LOGE("Failed to recover: %s\n", snd_strerror(error));
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Wait until there is room (playback) or data (capture) in the DMA
+ * buffer, returns frames available, 0 on timeout, -1 on error
+ */
+static snd_pcm_sframes_t wait_avail(struct pcm_mmap_handle* handle,
+        int timeout_ms) {
+    snd_pcm_sframes_t avail;
+    snd_pcm_state_t state;
+    int error;
+
+    for (;;) {
+        pthread_testcancel();
+
+        state = snd_pcm_state(handle->pcm);
+        if (state == SND_PCM_STATE_XRUN || state == SND_PCM_STATE_SUSPENDED) {
+            if (recover(handle, state == SND_PCM_STATE_XRUN
+                    ? -EPIPE : -ESTRPIPE) < 0)
+                return -1;
+            continue;
+        }
+
+        if (state == SND_PCM_STATE_PREPARED
+                && handle->stream == PCM_MMAP_CAPTURE) {
+            error = snd_pcm_start(handle->pcm);
+            if (error < 0) {
+                LOGE("Failed to snd_pcm_start: %s\n", snd_strerror(error));
+                return -1;
+            }
+        }
+
+        avail = snd_pcm_avail_update(handle->pcm);
+        if (avail < 0) {
+            if (recover(handle, avail) < 0)
+                return -1;
+            continue;
+        }
+
+        if (avail > 0)
+            return avail;
+
+        /*
+         * Full buffer that was never started, nothing would wake us
+         */
+        if (state == SND_PCM_STATE_PREPARED) {
+            error = snd_pcm_start(handle->pcm);
+            if (error < 0) {
+                LOGE("Failed to snd_pcm_start: %s\n", snd_strerror(error));
+                return -1;
+            }
+            continue;
+        }
+
+        error = snd_pcm_wait(handle->pcm, timeout_ms);
+        if (error == 0)
+            return 0;
+
+        if (error < 0 && recover(handle, error) < 0)
+            return -1;
+    }
+}
+
+static int begin(struct pcm_mmap_handle* handle, uint8_t** area,
+        uint32_t* frames, int timeout_ms) {
+    const snd_pcm_channel_area_t* areas;
+    snd_pcm_uframes_t offset;
+    snd_pcm_uframes_t count;
+    snd_pcm_sframes_t avail;
+    int error;
+
+    assert_die_if(handle == NULL, "handle is NULL\n");
+    assert_die_if(area == NULL || frames == NULL, "area or frames is NULL\n");
+
+    avail = wait_avail(handle, timeout_ms);
+    if (avail <= 0) {
+        *frames = 0;
+        return avail;
+    }
+
+    count = avail;
+    if (*frames && *frames < count)
+        count = *frames;
+
+    error = snd_pcm_mmap_begin(handle->pcm, &areas, &offset, &count);
+    if (error < 0) {
+        LOGE("Failed to snd_pcm_mmap_begin: %s\n", snd_strerror(error));
+        recover(handle, error);
+        *frames = 0;
+        return -1;
+    }
+
+    handle->offset = offset;
+    handle->frames = count;
+
+    *area = (uint8_t*) areas[0].addr + areas[0].first / 8
+            + offset * (areas[0].step / 8);
+    *frames = count;
+
+    return count;
+}
+
+static int commit(struct pcm_mmap_handle* handle, uint32_t frames) {
+    snd_pcm_sframes_t committed;
+    snd_pcm_sframes_t avail;
+    uint32_t done = 0;
+    int error;
+
+    assert_die_if(handle == NULL, "handle is NULL\n");
+    assert_die_if(frames > handle->frames, "Commit more than begin\n");
+
+    /*
+     * A short commit is not an xrun, hand the rest over again until
+     * it takes none
+     */
+    while (done < frames) {
+        committed = snd_pcm_mmap_commit(handle->pcm, handle->offset + done,
+                frames - done);
+        if (committed < 0) {
+            handle->frames = 0;
+            if (recover(handle, committed) < 0)
+                return -1;
+            return done;
+        }
+
+        if (committed == 0)
+            break;
+
+        done += committed;
+    }
+
+    handle->frames = 0;
+
+    if (done == 0)
+        return 0;
+
+    if (handle->stream == PCM_MMAP_PLAYBACK
+            && snd_pcm_state(handle->pcm) == SND_PCM_STATE_PREPARED) {
+        avail = snd_pcm_avail_update(handle->pcm);
+        if (avail == 0) {
+            error = snd_pcm_start(handle->pcm);
+            if (error < 0) {
+                LOGE("Failed to snd_pcm_start: %s\n", snd_strerror(error));
+                return -1;
+            }
+        }
+    }
+
+    return done;
+}
+
+static int transfer(struct pcm_mmap_handle* handle, uint8_t* buffer,
+        uint32_t frames) {
+    uint32_t done = 0;
+    uint32_t count;
+    uint8_t* area;
+    int ret;
+
+    while (done < frames) {
+        count = frames - done;
+
+        ret = begin(handle, &area, &count, -1);
+        if (ret < 0)
+            return -1;
+        if (ret == 0)
+            continue;
+
+        if (handle->stream == PCM_MMAP_PLAYBACK)
+            memcpy(area, buffer + done * handle->frame_bytes,
+                    count * handle->frame_bytes);
+        else
+            memcpy(buffer + done * handle->frame_bytes, area,
+                    count * handle->frame_bytes);
+
+        ret = commit(handle, count);
+        if (ret < 0)
+            return -1;
+
+        done += ret;
+    }
+
+    return done;
+}
+
+static int pcm_mmap_write(struct pcm_mmap_handle* handle,
+        const uint8_t* buffer, uint32_t frames) {
+    assert_die_if(handle == NULL, "handle is NULL\n");
+    assert_die_if(buffer == NULL, "buffer is NULL\n");
+    assert_die_if(handle->stream != PCM_MMAP_PLAYBACK,
+            "write on capture stream\n");
+
+    return transfer(handle, (uint8_t*) buffer, frames);
+}
+
+static int pcm_mmap_read(struct pcm_mmap_handle* handle, uint8_t* buffer,
+        uint32_t frames) {
+    assert_die_if(handle == NULL, "handle is NULL\n");
+    assert_die_if(buffer == NULL, "buffer is NULL\n");
+    assert_die_if(handle->stream != PCM_MMAP_CAPTURE,
+            "read on playback stream\n");
+
+    return transfer(handle, buffer, frames);
+}
+
+static int drain(struct pcm_mmap_handle* handle) {
+    assert_die_if(handle == NULL, "handle is NULL\n");
+
+    /*
+     * A partly filled buffer was never started
+     */
+    if (handle->stream == PCM_MMAP_PLAYBACK
+            && snd_pcm_state(handle->pcm) == SND_PCM_STATE_PREPARED
+            && snd_pcm_avail_update(handle->pcm) < handle->buffer_size)
+        snd_pcm_start(handle->pcm);
+
+    snd_pcm_drain(handle->pcm);
+
+    return snd_pcm_prepare(handle->pcm);
+}
+
+static int drop(struct pcm_mmap_handle* handle) {
+    assert_die_if(handle == NULL, "handle is NULL\n");
+
+    snd_pcm_drop(handle->pcm);
+
+    return snd_pcm_prepare(handle->pcm);
+}
+
+static int get_latency(struct pcm_mmap_handle* handle,
+        struct pcm_mmap_latency* latency) {
+    snd_pcm_sframes_t delay = 0;
+
+    assert_die_if(handle == NULL, "handle is NULL\n");
+    assert_die_if(latency == NULL, "latency is NULL\n");
+
+    if (snd_pcm_delay(handle->pcm, &delay) < 0)
+        delay = 0;
+
+    latency->sample_rate = handle->rate;
+    latency->period_frames = handle->period_size;
+    latency->buffer_frames = handle->buffer_size;
+    latency->period_us = (uint64_t) handle->period_size * 1000000
+            / handle->rate;
+    latency->buffer_us = (uint64_t) handle->buffer_size * 1000000
+            / handle->rate;
+    latency->delay_frames = delay;
+    latency->delay_us = (int64_t) delay * 1000000 / (int) handle->rate;
+    latency->xruns = handle->xruns;
+
+    return 0;
+}
+
+static uint32_t get_frame_bytes(struct pcm_mmap_handle* handle) {
+    assert_die_if(handle == NULL, "handle is NULL\n");
+
+    return handle->frame_bytes;
+}
+
+static struct pcm_mmap_handle* pcm_mmap_open(const char* snd_device,
+        enum pcm_mmap_stream stream, const struct pcm_mmap_param* param) {
+    struct pcm_mmap_handle* handle;
+    int error;
+
+    assert_die_if(snd_device == NULL, "snd_device is NULL\n");
+    assert_die_if(param == NULL, "param is NULL\n");
+
+    handle = calloc(1, sizeof(*handle));
+    if (handle == NULL) {
+        LOGE("Failed to allocate memory\n");
+        return NULL;
+    }
+
+    handle->stream = stream;
+
+    error = snd_pcm_open(&handle->pcm, snd_device,
+            stream == PCM_MMAP_PLAYBACK ? SND_PCM_STREAM_PLAYBACK
+                    : SND_PCM_STREAM_CAPTURE, 0);
+    if (error < 0) {
+        LOGE("Failed to snd_pcm_open %s: %s\n", snd_device, snd_strerror(error));
+        free(handle);
+        return NULL;
+    }
+
+    if (set_hw_params(handle, param) < 0 || set_sw_params(handle) < 0) {
+        snd_pcm_close(handle->pcm);
+        free(handle);
+        return NULL;
+    }
+
+    LOGD("%s %s: %uHz, period %lu frames, buffer %lu frames(%luus)\n",
+            snd_device, stream == PCM_MMAP_PLAYBACK ? "playback" : "capture",
+            handle->rate, handle->period_size, handle->buffer_size,
+            handle->buffer_size * 1000000 / handle->rate);
+
+    return handle;
+}
+
+static int pcm_mmap_close(struct pcm_mmap_handle* handle) {
+    assert_die_if(handle == NULL, "handle is NULL\n");
+
+    snd_pcm_drop(handle->pcm);
+    snd_pcm_close(handle->pcm);
+    free(handle);
+
+    return 0;
+}
+
+static struct pcm_mmap this = {
+        .open = pcm_mmap_open,
+        .close = pcm_mmap_close,
+        .begin = begin,
+        .commit = commit,
+        .write = pcm_mmap_write,
+        .read = pcm_mmap_read,
+        .drain = drain,
+        .drop = drop,
+        .get_latency = get_latency,
+        .get_frame_bytes = get_frame_bytes,
+};
+
+struct pcm_mmap* get_pcm_mmap(void) {
+    return &this;
+}
@@ -0,0 +1,497 @@
+/*
+ *  Copyright (C) 2017, Zhang YanMing <yanmin.zhang@ingenic.com, jamincheung@126.com>
+ *
+ *  Ingenic Linux plarform SDK project
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <utils/log.h>
+#include <utils/assert.h>
+#include <utils/common.h>
+#include <utils/wave_parser.h>
+#include <audio/alsa/wave_codec.h>
+#include <audio/alsa/sound_bank.h>
+
+#define LOG_TAG "sound_bank"
+
+/*
+ * Pcm in a pack is played in place when it is this aligned, the
+ * header of a plain wave file leaves it so
+ */
+#define PCM_ALIGN               4
+#define DECODE_GROW_FRAMES      4096
+
+struct pack {
+    uint8_t* map;
+    size_t size;
+    uint32_t refs;
+};
+
+struct sound {
+    int used;
+    struct wave_sound sound;
+
+    /*
+     * pcm is owned by the bank, pack is set when the sound points
+     * into the mapping instead
+     */
+    uint8_t* pcm;
+    struct pack* pack;
+};
+
+static struct sound sounds[SOUND_BANK_MAX_SOUNDS];
+static struct wave_codec* wave_codec;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int safe_read(int fd, void* buf, uint32_t count) {
+    uint32_t read_sofar = 0;
+    int readed;
+
+    while (count > 0) {
+        readed = read(fd, buf, count);
+        if (readed == 0)
+            break;
+
+        if (readed < 0) {
+            if (errno == EINTR)
+                continue;
+            return read_sofar > 0 ? read_sofar : readed;
+        }
+
+        count -= readed;
+        read_sofar += readed;
+        buf = (char *)buf + readed;
+    }
+
+    return read_sofar;
+}
+
+static int grow_pcm(uint8_t** pcm, uint32_t* capacity, uint32_t frame_bytes) {
+    uint8_t* grown;
+
+    grown = realloc(*pcm, (*capacity + DECODE_GROW_FRAMES) * frame_bytes);
+    if (grown == NULL) {
+        LOGE("Failed to allocate decoded sound\n");
+        return -1;
+    }
+
+    *pcm = grown;
+    *capacity += DECODE_GROW_FRAMES;
+
+    return 0;
+}
+
+/*
+ * Compressed sounds are decoded whole at load, the fact chunk gives
+ * the size up front
+ */
+static int decode_sound(const WaveContainer* container, const uint8_t* data,
+        uint32_t length, uint8_t** pcm, uint32_t* size) {
+    struct wave_codec_handle* handle;
+    uint32_t frame_bytes = LE_SHORT(container->format.channels) * 2;
+    uint32_t capacity = LE_INT(container->fact.samples);
+    uint32_t frames = 0;
+    uint32_t consumed;
+    uint8_t* out = NULL;
+    int ret;
+
+    handle = wave_codec->open_decoder(container);
+    if (handle == NULL)
+        return -1;
+
+    if (grow_pcm(&out, &capacity, frame_bytes) < 0)
+        goto error;
+
+    while (length > 0) {
+        if (frames == capacity && grow_pcm(&out, &capacity, frame_bytes) < 0)
+            goto error;
+
+        consumed = length;
+        ret = wave_codec->decode(handle, data, &consumed,
+                out + frames * frame_bytes, capacity - frames);
+        if (ret < 0)
+            goto error;
+
+        frames += ret;
+        data += consumed;
+        length -= consumed;
+
+        /*
+         * Past the end of the data chunk
+         */
+        if (ret == 0 && consumed == 0)
+            break;
+    }
+
+    for (;;) {
+        if (frames == capacity && grow_pcm(&out, &capacity, frame_bytes) < 0)
+            goto error;
+
+        consumed = 0;
+        ret = wave_codec->decode(handle, NULL, &consumed,
+                out + frames * frame_bytes, capacity - frames);
+        if (ret < 0)
+            goto error;
+        if (ret == 0)
+            break;
+
+        frames += ret;
+    }
+
+    wave_codec->close(handle);
+
+    *pcm = out;
+    *size = frames * frame_bytes;
+
+    return 0;
+
+error:
+    LOGE("Failed to decode sound\n");
+    wave_codec->close(handle);
+    free(out);
+    return -1;
+}
+
+/*
+ * Called with lock held
+ */
+static int add_sound(const WaveContainer* container, const uint8_t* data,
+        uint32_t length, struct pack* pack) {
+    struct sound* sound = NULL;
+    uint32_t frame_bytes;
+    int id;
+
+    for (id = 0; id < SOUND_BANK_MAX_SOUNDS; id++) {
+        if (!sounds[id].used) {
+            sound = &sounds[id];
+            break;
+        }
+    }
+
+    if (sound == NULL) {
+        LOGE("Sound bank is full\n");
+        return -1;
+    }
+
+    memset(sound, 0, sizeof(struct sound));
+
+    sound->sound.channels = LE_SHORT(container->format.channels);
+    sound->sound.sample_rate = LE_INT(container->format.sample_fq);
+
+    if (wave_codec->get_type(container) != WAVE_CODEC_PCM) {
+        if (decode_sound(container, data, length, &sound->pcm,
+                &sound->sound.size) < 0)
+            return -1;
+
+        sound->sound.sample_length = 16;
+        sound->sound.data = sound->pcm;
+
+    } else {
+        if (LE_SHORT(container->format.format) != WAV_FMT_PCM) {
+            LOGE("Unsupported wave format %#x\n",
+                    LE_SHORT(container->format.format));
+            return -1;
+        }
+
+        sound->sound.sample_length = LE_SHORT(container->format.bit_p_spl);
+
+        frame_bytes = sound->sound.channels * sound->sound.sample_length / 8;
+        if (frame_bytes == 0) {
+            LOGE("Invalid wave format\n");
+            return -1;
+        }
+
+        length -= length % frame_bytes;
+        if (length == 0) {
+            LOGE("No whole frame in sound\n");
+            return -1;
+        }
+
+        sound->sound.size = length;
+
+        if (pack && (uintptr_t) data % PCM_ALIGN == 0) {
+            sound->pack = pack;
+            sound->sound.data = data;
+            pack->refs++;
+
+        } else {
+            sound->pcm = malloc(length);
+            if (sound->pcm == NULL) {
+                LOGE("Failed to allocate sound\n");
+                return -1;
+            }
+
+            memcpy(sound->pcm, data, length);
+            sound->sound.data = sound->pcm;
+        }
+    }
+
+    sound->used = 1;
+
+    return id;
+}
+
+static void put_pack(struct pack* pack) {
+    if (--pack->refs > 0)
+        return;
+
+    munmap(pack->map, pack->size);
+    free(pack);
+}
+
+static void remove_sound(struct sound* sound) {
+    free(sound->pcm);
+
+    if (sound->pack)
+        put_pack(sound->pack);
+
+    memset(sound, 0, sizeof(struct sound));
+}
+
+static int load_wave(const char* path) {
+    assert_die_if(path == NULL, "path is NULL\n");
+
+    WaveContainer container;
+    uint8_t* data = NULL;
+    struct stat st;
+    uint32_t length;
+    off_t offset;
+    int id = -1;
+    int fd;
+    int ret;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        LOGE("Failed to open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    if (wave_read_header(fd, &container) < 0) {
+        LOGE("Failed to read wave header of %s\n", path);
+        goto out;
+    }
+
+    length = LE_INT(container.chunk_header.length);
+
+    /*
+     * Streamed or unfinished files carry 0xffffffff or a stale length,
+     * take no more than what follows the header
+     */
+    offset = lseek(fd, 0, SEEK_CUR);
+    if (offset < 0 || fstat(fd, &st) < 0) {
+        LOGE("Failed to stat %s: %s\n", path, strerror(errno));
+        goto out;
+    }
+
+    if (st.st_size - offset < length)
+        length = st.st_size > offset ? st.st_size - offset : 0;
+
+    if (length == 0) {
+        LOGE("No sample data in %s\n", path);
+        goto out;
+    }
+
+    data = malloc(length);
+    if (data == NULL) {
+        LOGE("Failed to allocate %u bytes for %s\n", length, path);
+        goto out;
+    }
+
+    ret = safe_read(fd, data, length);
+    if (ret < 0) {
+        LOGE("Failed to read %s: %s\n", path, strerror(errno));
+        goto out;
+    }
+
+    /*
+     * Truncated since the fstat
+     */
+    if (ret == 0) {
+        LOGE("No sample data in %s\n", path);
+        goto out;
+    }
+
+    pthread_mutex_lock(&lock);
+    id = add_sound(&container, data, ret, NULL);
+    pthread_mutex_unlock(&lock);
+
+out:
+    free(data);
+    close(fd);
+
+    return id;
+}
+
+static int load_pack(const char* path, int* ids, int max_ids) {
+    assert_die_if(path == NULL, "path is NULL\n");
+    assert_die_if(ids == NULL && max_ids > 0, "ids is NULL\n");
+
+    WaveContainer container;
+    struct pack* pack;
+    struct stat st;
+    uint32_t data_offset;
+    uint32_t riff_length;
+    uint32_t length;
+    size_t pos = 0;
+    size_t end;
+    int count = 0;
+    int fd;
+    int id;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        LOGE("Failed to open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        LOGE("Failed to stat %s\n", path);
+        close(fd);
+        return -1;
+    }
+
+    pack = calloc(1, sizeof(struct pack));
+    if (pack == NULL) {
+        LOGE("Failed to allocate pack\n");
+        close(fd);
+        return -1;
+    }
+
+    pack->size = st.st_size;
+    pack->map = mmap(NULL, pack->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (pack->map == MAP_FAILED) {
+        LOGE("Failed to mmap %s: %s\n", path, strerror(errno));
+        free(pack);
+        return -1;
+    }
+
+    /*
+     * The bank holds its own reference while loading
+     */
+    pack->refs = 1;
+
+    pthread_mutex_lock(&lock);
+
+    while (count < max_ids && pack->size - pos >= sizeof(WaveHeader)) {
+        memcpy(&riff_length, pack->map + pos + 4, sizeof(uint32_t));
+        end = pos + 8 + LE_INT(riff_length);
+        if (end > pack->size)
+            end = pack->size;
+
+        if (wave_parse_header(pack->map + pos, end - pos, &container,
+                &data_offset) < 0) {
+            LOGE("Failed to parse sound %d of %s\n", count, path);
+            break;
+        }
+
+        length = LE_INT(container.chunk_header.length);
+        length = MIN(length, end - pos - data_offset);
+
+        id = add_sound(&container, pack->map + pos + data_offset, length,
+                pack);
+        if (id < 0)
+            break;
+
+        ids[count++] = id;
+
+        /*
+         * Files are padded to an even length
+         */
+        pos = end + (end & 1);
+    }
+
+    /*
+     * Unmapped here when every sound was decoded or copied out
+     */
+    if (pack->refs > 1)
+        madvise(pack->map, pack->size, MADV_WILLNEED);
+    put_pack(pack);
+
+    pthread_mutex_unlock(&lock);
+
+    return count ? count : -1;
+}
+
+static int unload(int id) {
+    pthread_mutex_lock(&lock);
+
+    if (id < 0 || id >= SOUND_BANK_MAX_SOUNDS || !sounds[id].used) {
+        pthread_mutex_unlock(&lock);
+        LOGE("Invalid sound id %d\n", id);
+        return -1;
+    }
+
+    remove_sound(&sounds[id]);
+
+    pthread_mutex_unlock(&lock);
+
+    return 0;
+}
+
+static const struct wave_sound* get_sound(int id) {
+    const struct wave_sound* sound = NULL;
+
+    pthread_mutex_lock(&lock);
+
+    if (id >= 0 && id < SOUND_BANK_MAX_SOUNDS && sounds[id].used)
+        sound = &sounds[id].sound;
+
+    pthread_mutex_unlock(&lock);
+
+    if (sound == NULL)
+        LOGE("Invalid sound id %d\n", id);
+
+    return sound;
+}
+
+static int init(void) {
+    wave_codec = get_wave_codec();
+
+    return 0;
+}
+
+static int deinit(void) {
+    pthread_mutex_lock(&lock);
+
+    for (int i = 0; i < SOUND_BANK_MAX_SOUNDS; i++) {
+        if (sounds[i].used)
+            remove_sound(&sounds[i]);
+    }
+
+    pthread_mutex_unlock(&lock);
+
+    return 0;
+}
+
+static struct sound_bank this = {
+        .init = init,
+        .deinit = deinit,
+        .load_wave = load_wave,
+        .load_pack = load_pack,
+        .unload = unload,
+        .get_sound = get_sound,
+};
+
+struct sound_bank* get_sound_bank(void) {
+    return &this;
+}
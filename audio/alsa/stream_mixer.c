@@ -0,0 +1,877 @@
+/*
+ *  Copyright (C) 2017, Zhang YanMing <yanmin.zhang@ingenic.com, jamincheung@126.com>
+ *
+ *  Ingenic Linux plarform SDK project
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <time.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <utils/log.h>
+#include <utils/assert.h>
+#include <utils/common.h>
+#include <utils/wave_parser.h>
+#include <thread/thread.h>
+#include <audio/alsa/pcm_mmap.h>
+#include <audio/alsa/stream_mixer.h>
+
+#define LOG_TAG "stream_mixer"
+
+#define DEFAULT_PERIOD_MS       10
+#define DEFAULT_PERIODS         4
+
+/*
+ * Per source queue depth, and how much the loader reads at once
+ */
+#define SOURCE_QUEUE_MS         200
+#define LOAD_CHUNK_FRAMES       1024
+
+/*
+ * Source id: generation << SLOT_BITS | slot, so a stale id never
+ * matches a slot that was reused
+ */
+#define SLOT_BITS               4
+#define SLOT_MASK               ((1 << SLOT_BITS) - 1)
+#define GENERATION_MASK         (0x7fffffff >> SLOT_BITS)
+
+enum source_state {
+    SOURCE_FREE = 0,
+    SOURCE_PLAYING,
+    SOURCE_PAUSED,
+};
+
+struct source {
+    enum source_state state;
+    uint32_t generation;
+    int gain;
+
+    /*
+     * Wave file feeding this source, -1 for push mode
+     */
+    int fd;
+    int in_channels;
+    uint64_t remaining;
+    int loading;
+    int eos;
+
+    /*
+     * Frames queued for mixing, already at the mixer channel count
+     */
+    int16_t* queue;
+    uint32_t capacity;
+    uint32_t head;
+    uint32_t count;
+};
+
+static struct pcm_mmap* pcm_mmap;
+static struct pcm_mmap_handle* pcm_handle;
+static int mix_channels;
+static int mix_rate;
+static uint32_t period_frames;
+static int32_t* accumulator;
+
+static struct source sources[STREAM_MIXER_MAX_SOURCES];
+static uint32_t active_count;
+static uint32_t load_cursor;
+static int quit;
+
+static struct thread* mix_thread;
+static struct thread* load_thread;
+
+/*
+ * One lock and condition for every source, the mixer, the loader
+ * and blocked writers/waiters all wait on it
+ */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+static struct stream_mixer_stat stats;
+
+static uint32_t init_count;
+static pthread_mutex_t init_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t monotonic_us(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int safe_read(int fd, void* buf, uint32_t count) {
+    uint32_t read_sofar = 0;
+    int readed;
+
+    while (count > 0) {
+        readed = read(fd, buf, count);
+        if (readed == 0)
+            break;
+
+        if (readed < 0) {
+            if (errno == EINTR)
+                continue;
+            return read_sofar > 0 ? read_sofar : readed;
+        }
+
+        count -= readed;
+        read_sofar += readed;
+        buf = (char *)buf + readed;
+    }
+
+    return read_sofar;
+}
+
+static int source_id(struct source* source) {
+    return (source->generation << SLOT_BITS) | (source - sources);
+}
+
+static struct source* lookup_source(int id) {
+    struct source* source;
+    int slot;
+
+    if (id < 0)
+        return NULL;
+
+    slot = id & SLOT_MASK;
+    if (slot >= STREAM_MIXER_MAX_SOURCES)
+        return NULL;
+
+    source = &sources[slot];
+    if (source->state == SOURCE_FREE
+            || source->generation != ((uint32_t) id >> SLOT_BITS))
+        return NULL;
+
+    return source;
+}
+
+static int alloc_source(int fd, int in_channels, int gain) {
+    struct source* source = NULL;
+
+    for (int i = 0; i < STREAM_MIXER_MAX_SOURCES; i++) {
+        if (sources[i].state == SOURCE_FREE) {
+            source = &sources[i];
+            break;
+        }
+    }
+
+    if (source == NULL) {
+        LOGE("Too many sources\n");
+        return -1;
+    }
+
+    source->capacity = (uint64_t) mix_rate * SOURCE_QUEUE_MS / 1000;
+    source->capacity = MAX(source->capacity, 2 * period_frames);
+    source->queue = malloc(source->capacity * mix_channels * sizeof(int16_t));
+    if (source->queue == NULL) {
+        LOGE("Failed to allocate source queue\n");
+        return -1;
+    }
+
+    source->head = 0;
+    source->count = 0;
+    source->fd = fd;
+    source->in_channels = in_channels;
+    source->remaining = 0;
+    source->loading = 0;
+    source->eos = 0;
+    source->gain = gain;
+    source->generation = (source->generation + 1) & GENERATION_MASK;
+    source->state = SOURCE_PLAYING;
+
+    active_count++;
+    pthread_cond_broadcast(&cond);
+
+    return source_id(source);
+}
+
+static void release_source(struct source* source) {
+    if (source->state == SOURCE_PLAYING)
+        active_count--;
+
+    free(source->queue);
+    source->queue = NULL;
+    source->state = SOURCE_FREE;
+    source->generation = (source->generation + 1) & GENERATION_MASK;
+
+    pthread_cond_broadcast(&cond);
+}
+
+/*
+ * Append up to @frames input frames, mono input is copied to every
+ * output channel. Returns frames taken.
+ */
+static uint32_t queue_push(struct source* source, const int16_t* data,
+        uint32_t frames) {
+    uint32_t n = MIN(frames, source->capacity - source->count);
+    uint32_t tail = (source->head + source->count) % source->capacity;
+    uint32_t done = 0;
+    uint32_t span;
+
+    while (done < n) {
+        int16_t* dst = source->queue + tail * mix_channels;
+
+        span = MIN(n - done, source->capacity - tail);
+
+        if (source->in_channels == mix_channels) {
+            memcpy(dst, data, span * mix_channels * sizeof(int16_t));
+            data += span * mix_channels;
+        } else {
+            for (uint32_t i = 0; i < span; i++, data++)
+                for (int ch = 0; ch < mix_channels; ch++)
+                    *dst++ = *data;
+        }
+
+        done += span;
+        tail = (tail + span) % source->capacity;
+    }
+
+    source->count += n;
+
+    return n;
+}
+
+/*
+ * Accumulate @frames of every playing source into the Q8 accumulator
+ */
+static void mix_sources(uint32_t frames) {
+    uint32_t samples = frames * mix_channels;
+    uint32_t n;
+    uint32_t span;
+    int32_t* acc;
+
+    memset(accumulator, 0, samples * sizeof(int32_t));
+
+    for (int i = 0; i < STREAM_MIXER_MAX_SOURCES; i++) {
+        struct source* source = &sources[i];
+
+        if (source->state != SOURCE_PLAYING)
+            continue;
+
+        n = MIN(source->count, frames);
+        if (n < frames && !source->eos)
+            stats.starved++;
+
+        acc = accumulator;
+        while (n > 0) {
+            const int16_t* src = source->queue + source->head * mix_channels;
+            int32_t gain = source->gain;
+
+            span = MIN(n, source->capacity - source->head);
+            for (uint32_t j = 0; j < span * mix_channels; j++)
+                acc[j] += src[j] * gain;
+
+            acc += span * mix_channels;
+            source->head = (source->head + span) % source->capacity;
+            source->count -= span;
+            n -= span;
+        }
+
+        if (source->eos && source->count == 0)
+            release_source(source);
+    }
+
+    /*
+     * Writers blocked on a full queue
+     */
+    pthread_cond_broadcast(&cond);
+}
+
+static void saturate(int16_t* out, uint32_t frames) {
+    uint32_t samples = frames * mix_channels;
+    uint32_t clipped = 0;
+    int32_t value;
+
+    for (uint32_t i = 0; i < samples; i++) {
+        value = accumulator[i] >> 8;
+
+        if (value > INT16_MAX) {
+            value = INT16_MAX;
+            clipped++;
+        } else if (value < INT16_MIN) {
+            value = INT16_MIN;
+            clipped++;
+        }
+
+        out[i] = value;
+    }
+
+    stats.clipped_samples += clipped;
+}
+
+static void mix_loop(struct pthread_wrapper* thread, void* param) {
+    uint64_t begin;
+    uint32_t frames;
+    uint32_t used;
+    int16_t* area;
+    int idle = 1;
+    int ret;
+
+    for (;;) {
+        pthread_mutex_lock(&lock);
+        while (!quit && active_count == 0) {
+            /*
+             * Let the tail of the last source play out, then sleep
+             * until somebody starts a source
+             */
+            if (!idle) {
+                pthread_mutex_unlock(&lock);
+                pcm_mmap->drain(pcm_handle);
+                pthread_mutex_lock(&lock);
+                idle = 1;
+                continue;
+            }
+
+            pthread_cond_wait(&cond, &lock);
+        }
+
+        if (quit) {
+            pthread_mutex_unlock(&lock);
+            break;
+        }
+        pthread_mutex_unlock(&lock);
+
+        idle = 0;
+
+        frames = period_frames;
+        ret = pcm_mmap->begin(pcm_handle, (uint8_t**) &area, &frames, 1000);
+        if (ret < 0) {
+            LOGE("Failed to get playback area\n");
+            usleep(period_frames * 1000000ULL / mix_rate);
+            continue;
+        }
+
+        if (ret == 0)
+            continue;
+
+        pthread_mutex_lock(&lock);
+
+        begin = monotonic_us();
+        mix_sources(frames);
+        saturate(area, frames);
+        used = monotonic_us() - begin;
+
+        stats.periods++;
+        if (used > stats.max_mix_us)
+            stats.max_mix_us = used;
+
+        pthread_mutex_unlock(&lock);
+
+        if (pcm_mmap->commit(pcm_handle, frames) < 0)
+            LOGE("Failed to commit playback area\n");
+    }
+
+    pcm_mmap->drop(pcm_handle);
+}
+
+static struct source* next_loadable(void) {
+    struct source* source;
+
+    for (int i = 0; i < STREAM_MIXER_MAX_SOURCES; i++) {
+        source = &sources[(load_cursor + i) % STREAM_MIXER_MAX_SOURCES];
+
+        if (source->state == SOURCE_FREE || source->fd < 0 || source->eos)
+            continue;
+
+        /*
+         * Refill once a quarter of the queue is free
+         */
+        if (source->capacity - source->count < source->capacity / 4)
+            continue;
+
+        load_cursor = (source - sources) + 1;
+
+        return source;
+    }
+
+    return NULL;
+}
+
+/*
+ * Loader thread: keeps the queues of every wave file source topped
+ * up, so no disk read ever happens on the mixing path
+ */
+static void load_loop(struct pthread_wrapper* thread, void* param) {
+    uint32_t frame_bytes;
+    uint32_t frames;
+    uint32_t size;
+    uint8_t* buffer;
+    struct source* source;
+    int fd;
+    int ret;
+
+    buffer = malloc(LOAD_CHUNK_FRAMES * mix_channels * sizeof(int16_t));
+    if (buffer == NULL) {
+        LOGE("Failed to allocate loader buffer\n");
+        return;
+    }
+
+    for (;;) {
+        pthread_mutex_lock(&lock);
+        while (!quit && (source = next_loadable()) == NULL)
+            pthread_cond_wait(&cond, &lock);
+
+        if (quit) {
+            pthread_mutex_unlock(&lock);
+            break;
+        }
+
+        frame_bytes = source->in_channels * sizeof(int16_t);
+        frames = MIN(source->capacity - source->count, LOAD_CHUNK_FRAMES);
+        size = MIN(source->remaining, (uint64_t) frames * frame_bytes);
+        fd = source->fd;
+        source->loading = 1;
+        pthread_mutex_unlock(&lock);
+
+        ret = safe_read(fd, buffer, size);
+
+        pthread_mutex_lock(&lock);
+        source->loading = 0;
+
+        if (ret < 0)
+            LOGE("Failed to read wave data: %s\n", strerror(errno));
+
+        if (ret > 0) {
+            queue_push(source, (int16_t*) buffer, ret / frame_bytes);
+            source->remaining -= ret;
+        }
+
+        if (ret < (int) size || ret <= 0 || source->remaining == 0)
+            source->eos = 1;
+
+        pthread_cond_broadcast(&cond);
+        pthread_mutex_unlock(&lock);
+    }
+
+    free(buffer);
+}
+
+static int check_gain(int gain) {
+    if (gain < 0 || gain > STREAM_MIXER_GAIN_MAX) {
+        LOGE("Invalid gain %d\n", gain);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int check_format(int channels, int sample_rate, int sample_length) {
+    if (sample_length != 16) {
+        LOGE("Unsupported sample length %d\n", sample_length);
+        return -1;
+    }
+
+    if (sample_rate != mix_rate) {
+        LOGE("Sample rate %d differs from mixer rate %d\n", sample_rate,
+                mix_rate);
+        return -1;
+    }
+
+    if (channels != 1 && channels != mix_channels) {
+        LOGE("Can't mix %d channels into %d\n", channels, mix_channels);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int play_wave(int fd, int gain) {
+    assert_die_if(fd < 0, "Invaild fd\n");
+
+    WaveContainer container;
+    int id;
+
+    if (check_gain(gain) < 0)
+        return -1;
+
+    lseek(fd, 0, SEEK_SET);
+    if (wave_read_header(fd, &container) < 0) {
+        LOGE("Failed to read wave header\n");
+        return -1;
+    }
+
+    if (LE_SHORT(container.format.format) != WAV_FMT_PCM) {
+        LOGE("Only PCM wave files can be mixed\n");
+        return -1;
+    }
+
+    if (check_format(LE_SHORT(container.format.channels),
+            LE_INT(container.format.sample_fq),
+            LE_SHORT(container.format.bit_p_spl)) < 0)
+        return -1;
+
+    pthread_mutex_lock(&lock);
+
+    id = alloc_source(fd, LE_SHORT(container.format.channels), gain);
+    if (id >= 0) {
+        struct source* source = lookup_source(id);
+
+        source->remaining = LE_INT(container.chunk_header.length);
+        source->eos = source->remaining == 0;
+    }
+
+    pthread_mutex_unlock(&lock);
+
+    return id;
+}
+
+static int open_stream(int channels, int sample_rate, int gain) {
+    int id;
+
+    if (check_gain(gain) < 0)
+        return -1;
+
+    if (check_format(channels, sample_rate, 16) < 0)
+        return -1;
+
+    pthread_mutex_lock(&lock);
+    id = alloc_source(-1, channels, gain);
+    pthread_mutex_unlock(&lock);
+
+    return id;
+}
+
+static int write_stream(int id, uint8_t* buffer, int size) {
+    assert_die_if(buffer == NULL, "buffer is NULL\n");
+    assert_die_if(size < 0, "Invalid size\n");
+
+    struct source* source;
+    uint32_t frame_bytes;
+    uint32_t frames;
+    uint32_t done = 0;
+    int error = 0;
+
+    pthread_mutex_lock(&lock);
+
+    source = lookup_source(id);
+    if (source == NULL || source->fd >= 0 || source->eos) {
+        LOGE("Invalid stream %d\n", id);
+        error = -1;
+        goto out;
+    }
+
+    frame_bytes = source->in_channels * sizeof(int16_t);
+    frames = size / frame_bytes;
+
+    while (done < frames) {
+        while (source->count == source->capacity && !quit)
+            pthread_cond_wait(&cond, &lock);
+
+        /*
+         * Cancelled while we were blocked
+         */
+        if (quit || lookup_source(id) != source) {
+            error = -1;
+            goto out;
+        }
+
+        done += queue_push(source,
+                (int16_t*) (buffer + done * frame_bytes), frames - done);
+        pthread_cond_broadcast(&cond);
+    }
+
+out:
+    pthread_mutex_unlock(&lock);
+
+    return error < 0 ? -1 : (int) (done * frame_bytes);
+}
+
+static int close_stream(int id) {
+    struct source* source;
+    int error = 0;
+
+    pthread_mutex_lock(&lock);
+
+    source = lookup_source(id);
+    if (source == NULL || source->fd >= 0) {
+        LOGE("Invalid stream %d\n", id);
+        error = -1;
+    } else {
+        source->eos = 1;
+        if (source->count == 0)
+            release_source(source);
+    }
+
+    pthread_mutex_unlock(&lock);
+
+    return error;
+}
+
+static int set_gain(int id, int gain) {
+    struct source* source;
+    int error = 0;
+
+    if (check_gain(gain) < 0)
+        return -1;
+
+    pthread_mutex_lock(&lock);
+
+    source = lookup_source(id);
+    if (source == NULL)
+        error = -1;
+    else
+        source->gain = gain;
+
+    pthread_mutex_unlock(&lock);
+
+    return error;
+}
+
+static int pause_source(int id) {
+    struct source* source;
+    int error = 0;
+
+    pthread_mutex_lock(&lock);
+
+    source = lookup_source(id);
+    if (source == NULL) {
+        error = -1;
+    } else if (source->state == SOURCE_PLAYING) {
+        source->state = SOURCE_PAUSED;
+        active_count--;
+    }
+
+    pthread_mutex_unlock(&lock);
+
+    return error;
+}
+
+static int resume_source(int id) {
+    struct source* source;
+    int error = 0;
+
+    pthread_mutex_lock(&lock);
+
+    source = lookup_source(id);
+    if (source == NULL) {
+        error = -1;
+    } else if (source->state == SOURCE_PAUSED) {
+        source->state = SOURCE_PLAYING;
+        active_count++;
+        pthread_cond_broadcast(&cond);
+    }
+
+    pthread_mutex_unlock(&lock);
+
+    return error;
+}
+
+static int cancel_source(int id) {
+    struct source* source;
+    int error = 0;
+
+    pthread_mutex_lock(&lock);
+
+    /*
+     * The loader may be reading from the caller's fd right now
+     */
+    while ((source = lookup_source(id)) != NULL && source->loading)
+        pthread_cond_wait(&cond, &lock);
+
+    if (source == NULL)
+        error = -1;
+    else
+        release_source(source);
+
+    pthread_mutex_unlock(&lock);
+
+    return error;
+}
+
+static int wait_source(int id) {
+    pthread_mutex_lock(&lock);
+
+    while (lookup_source(id) != NULL)
+        pthread_cond_wait(&cond, &lock);
+
+    pthread_mutex_unlock(&lock);
+
+    return 0;
+}
+
+static int get_stat(struct stream_mixer_stat* stat) {
+    assert_die_if(stat == NULL, "stat is NULL\n");
+
+    struct pcm_mmap_latency latency;
+
+    pthread_mutex_lock(&lock);
+    *stat = stats;
+    stat->active_sources = active_count;
+    pthread_mutex_unlock(&lock);
+
+    if (pcm_handle && pcm_mmap->get_latency(pcm_handle, &latency) == 0)
+        stat->underruns = latency.xruns;
+
+    return 0;
+}
+
+static void stop_threads(void) {
+    pthread_mutex_lock(&lock);
+    quit = 1;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&lock);
+
+    if (mix_thread) {
+        mix_thread->wait(mix_thread);
+        _delete(mix_thread);
+        mix_thread = NULL;
+    }
+
+    if (load_thread) {
+        load_thread->wait(load_thread);
+        _delete(load_thread);
+        load_thread = NULL;
+    }
+}
+
+static int init(const char* snd_device,
+        const struct stream_mixer_param* param) {
+    assert_die_if(snd_device == NULL, "snd_device is NULL\n");
+    assert_die_if(param == NULL, "param is NULL\n");
+    assert_die_if(param->channels <= 0 || param->sample_rate <= 0,
+            "Invalid param\n");
+
+    struct pcm_mmap_param pcm_param;
+    struct pcm_mmap_latency latency;
+
+    pthread_mutex_lock(&init_lock);
+
+    if (init_count++ > 0) {
+        pthread_mutex_unlock(&init_lock);
+        return 0;
+    }
+
+    pcm_mmap = get_pcm_mmap();
+
+    pcm_param.channels = param->channels;
+    pcm_param.sample_rate = param->sample_rate;
+    pcm_param.sample_length = 16;
+    pcm_param.period_frames = param->period_frames ? param->period_frames
+            : param->sample_rate * DEFAULT_PERIOD_MS / 1000;
+    pcm_param.periods = param->periods ? param->periods : DEFAULT_PERIODS;
+
+    pcm_handle = pcm_mmap->open(snd_device, PCM_MMAP_PLAYBACK, &pcm_param);
+    if (pcm_handle == NULL) {
+        LOGE("Failed to open %s\n", snd_device);
+        goto error;
+    }
+
+    pcm_mmap->get_latency(pcm_handle, &latency);
+
+    mix_channels = param->channels;
+    mix_rate = param->sample_rate;
+    period_frames = latency.period_frames;
+
+    accumulator = malloc(period_frames * mix_channels * sizeof(int32_t));
+    if (accumulator == NULL) {
+        LOGE("Failed to allocate accumulator\n");
+        goto error;
+    }
+
+    memset(&stats, 0, sizeof(stats));
+    active_count = 0;
+    load_cursor = 0;
+    quit = 0;
+
+    mix_thread = _new(struct thread, thread);
+    mix_thread->runnable.run = mix_loop;
+    if (mix_thread->start(mix_thread, NULL) < 0) {
+        LOGE("Failed to start mix thread\n");
+        _delete(mix_thread);
+        mix_thread = NULL;
+        goto error;
+    }
+
+    load_thread = _new(struct thread, thread);
+    load_thread->runnable.run = load_loop;
+    if (load_thread->start(load_thread, NULL) < 0) {
+        LOGE("Failed to start load thread\n");
+        _delete(load_thread);
+        load_thread = NULL;
+        goto error;
+    }
+
+    LOGI("Mixing %d channels at %dHz, period %u frames, buffer %u frames\n",
+            mix_channels, mix_rate, latency.period_frames,
+            latency.buffer_frames);
+
+    pthread_mutex_unlock(&init_lock);
+
+    return 0;
+
+error:
+    stop_threads();
+
+    if (accumulator) {
+        free(accumulator);
+        accumulator = NULL;
+    }
+
+    if (pcm_handle) {
+        pcm_mmap->close(pcm_handle);
+        pcm_handle = NULL;
+    }
+
+    init_count--;
+    pthread_mutex_unlock(&init_lock);
+
+    return -1;
+}
+
+static int deinit(void) {
+    pthread_mutex_lock(&init_lock);
+
+    if (init_count == 0 || --init_count > 0) {
+        pthread_mutex_unlock(&init_lock);
+        return 0;
+    }
+
+    stop_threads();
+
+    pthread_mutex_lock(&lock);
+    for (int i = 0; i < STREAM_MIXER_MAX_SOURCES; i++)
+        if (sources[i].state != SOURCE_FREE)
+            release_source(&sources[i]);
+    pthread_mutex_unlock(&lock);
+
+    free(accumulator);
+    accumulator = NULL;
+
+    pcm_mmap->close(pcm_handle);
+    pcm_handle = NULL;
+
+    pthread_mutex_unlock(&init_lock);
+
+    return 0;
+}
+
+static struct stream_mixer this = {
+    .init = init,
+    .deinit = deinit,
+    .play_wave = play_wave,
+    .open_stream = open_stream,
+    .write_stream = write_stream,
+    .close_stream = close_stream,
+    .set_gain = set_gain,
+    .pause = pause_source,
+    .resume = resume_source,
+    .cancel = cancel_source,
+    .wait = wait_source,
+    .get_stat = get_stat,
+};
+
+struct stream_mixer* get_stream_mixer(void) {
+    return &this;
+}
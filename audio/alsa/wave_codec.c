@@ -0,0 +1,1011 @@
+/*
+ *  Copyright (C) 2017, Zhang YanMing <yanmin.zhang@ingenic.com, jamincheung@126.com>
+ *
+ *  Ingenic Linux plarform SDK project
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <string.h>
+#include <stdint.h>
+
+#include <utils/log.h>
+#include <utils/assert.h>
+#include <utils/common.h>
+#include <audio/alsa/wave_codec.h>
+
+#define LOG_TAG "wave_codec"
+
+#define MAX_CHANNELS            2
+
+/*
+ * Lossless block: LE16 frames, LE16 payload bytes, then a bit stream
+ * of [stereo mode:1] and per channel [order:3] [rice k:5] warm-up
+ * samples and rice coded residuals, or [7:3] and verbatim samples
+ */
+#define LOSSLESS_BLOCK_FRAMES   4096
+#define LOSSLESS_HEADER_BYTES   4
+#define LOSSLESS_MAX_ORDER      4
+#define LOSSLESS_VERBATIM       7
+#define LOSSLESS_MAX_RICE       23
+
+struct adpcm_state {
+    int32_t predictor;
+    int32_t index;
+};
+
+struct wave_codec_handle {
+    enum wave_codec_type type;
+    int channels;
+    int sample_rate;
+
+    /*
+     * ADPCM: bytes of a full block. Lossless: worst case block bytes.
+     */
+    uint32_t block_align;
+    uint32_t block_frames;
+
+    /*
+     * Pcm side of the current block: frames gathered for the encoder,
+     * frames decoded and handed out so far for the decoder
+     */
+    int16_t* pcm;
+    uint32_t pcm_fill;
+    uint32_t pcm_pos;
+
+    /*
+     * Coded side: bytes encoded and handed out so far, or bytes
+     * gathered of the data_need the decoder waits for
+     */
+    uint8_t* data;
+    uint32_t data_fill;
+    uint32_t data_pos;
+    uint32_t data_need;
+    int header_parsed;
+
+    uint64_t remaining;
+    uint64_t frames;
+
+    /*
+     * Decoder: frames the fact chunk has left, the last ADPCM block is
+     * padded past them
+     */
+    uint64_t frames_left;
+
+    struct adpcm_state adpcm[MAX_CHANNELS];
+
+    /*
+     * Lossless: deinterleaved left, right, side and a residual scratch
+     */
+    int32_t* work;
+};
+
+struct channel_plan {
+    int verbatim;
+    uint32_t order;
+    uint32_t rice;
+    uint64_t bits;
+};
+
+struct bit_writer {
+    uint8_t* p;
+    uint32_t acc;
+    int count;
+};
+
+struct bit_reader {
+    const uint8_t* p;
+    const uint8_t* end;
+    uint32_t acc;
+    int count;
+    int error;
+};
+
+static const int16_t ima_step_table[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+    19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+    130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+    337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+    876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+    2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+    5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+static const int8_t ima_index_table[16] = {
+    -1, -1, -1, -1, 2, 4, 6, 8,
+    -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+static inline int32_t clamp16(int32_t value) {
+    if (value > INT16_MAX)
+        return INT16_MAX;
+    if (value < INT16_MIN)
+        return INT16_MIN;
+
+    return value;
+}
+
+static inline void adpcm_update(struct adpcm_state* state, uint8_t code,
+        int32_t delta) {
+    if (code & 8)
+        state->predictor = clamp16(state->predictor - delta);
+    else
+        state->predictor = clamp16(state->predictor + delta);
+
+    state->index += ima_index_table[code];
+    if (state->index < 0)
+        state->index = 0;
+    else if (state->index > 88)
+        state->index = 88;
+}
+
+static inline uint8_t adpcm_encode_sample(struct adpcm_state* state,
+        int32_t sample) {
+    int32_t step = ima_step_table[state->index];
+    int32_t diff = sample - state->predictor;
+    int32_t delta = step >> 3;
+    uint8_t code = 0;
+
+    if (diff < 0) {
+        code = 8;
+        diff = -diff;
+    }
+
+    if (diff >= step) {
+        code |= 4;
+        diff -= step;
+        delta += step;
+    }
+
+    step >>= 1;
+    if (diff >= step) {
+        code |= 2;
+        diff -= step;
+        delta += step;
+    }
+
+    step >>= 1;
+    if (diff >= step) {
+        code |= 1;
+        delta += step;
+    }
+
+    adpcm_update(state, code, delta);
+
+    return code;
+}
+
+static inline int16_t adpcm_decode_sample(struct adpcm_state* state,
+        uint8_t code) {
+    int32_t step = ima_step_table[state->index];
+    int32_t delta = step >> 3;
+
+    if (code & 4)
+        delta += step;
+    if (code & 2)
+        delta += step >> 1;
+    if (code & 1)
+        delta += step >> 2;
+
+    adpcm_update(state, code, delta);
+
+    return state->predictor;
+}
+
+/*
+ * Standard block layout: per channel LE16 first sample, step index and
+ * a zero byte, then 4 byte words of 8 samples each, channels taking
+ * turns. A short last block is padded to 8 samples with its final one.
+ */
+static uint32_t adpcm_encode_block(struct wave_codec_handle* handle,
+        uint32_t frames) {
+    const int16_t* pcm = handle->pcm;
+    int channels = handle->channels;
+    uint32_t groups = (frames - 1 + 7) / 8;
+    uint8_t* p = handle->data;
+
+    for (int c = 0; c < channels; c++) {
+        struct adpcm_state* state = &handle->adpcm[c];
+
+        state->predictor = pcm[c];
+
+        *p++ = state->predictor;
+        *p++ = state->predictor >> 8;
+        *p++ = state->index;
+        *p++ = 0;
+    }
+
+    for (uint32_t g = 0; g < groups; g++) {
+        for (int c = 0; c < channels; c++) {
+            struct adpcm_state* state = &handle->adpcm[c];
+
+            for (int k = 0; k < 8; k += 2) {
+                uint32_t i = MIN(1 + g * 8 + k, frames - 1);
+                uint32_t j = MIN(1 + g * 8 + k + 1, frames - 1);
+                uint8_t low = adpcm_encode_sample(state, pcm[i * channels + c]);
+                uint8_t high = adpcm_encode_sample(state, pcm[j * channels + c]);
+
+                *p++ = low | (high << 4);
+            }
+        }
+    }
+
+    return p - handle->data;
+}
+
+static int adpcm_decode_block(struct wave_codec_handle* handle,
+        uint32_t bytes) {
+    const uint8_t* p = handle->data;
+    int16_t* pcm = handle->pcm;
+    int channels = handle->channels;
+    uint32_t groups;
+
+    if (bytes < 4 * channels || (bytes - 4 * channels) % (4 * channels)) {
+        LOGE("Bad ADPCM block size %u\n", bytes);
+        return -1;
+    }
+
+    groups = (bytes - 4 * channels) / (4 * channels);
+
+    for (int c = 0; c < channels; c++) {
+        struct adpcm_state* state = &handle->adpcm[c];
+
+        state->predictor = (int16_t) (p[0] | (p[1] << 8));
+        state->index = p[2];
+        if (state->index > 88) {
+            LOGE("Bad ADPCM step index %d\n", state->index);
+            return -1;
+        }
+
+        pcm[c] = state->predictor;
+        p += 4;
+    }
+
+    for (uint32_t g = 0; g < groups; g++) {
+        for (int c = 0; c < channels; c++) {
+            struct adpcm_state* state = &handle->adpcm[c];
+            int16_t* out = pcm + (1 + g * 8) * channels + c;
+
+            for (int k = 0; k < 4; k++, p++) {
+                out[0] = adpcm_decode_sample(state, *p & 0x0f);
+                out[channels] = adpcm_decode_sample(state, *p >> 4);
+                out += 2 * channels;
+            }
+        }
+    }
+
+    return 1 + groups * 8;
+}
+
+static inline void put_bits(struct bit_writer* bw, uint32_t value, int bits) {
+    bw->acc = (bw->acc << bits) | (value & ((1u << bits) - 1));
+    bw->count += bits;
+
+    while (bw->count >= 8) {
+        bw->count -= 8;
+        *bw->p++ = bw->acc >> bw->count;
+    }
+}
+
+static inline void put_rice(struct bit_writer* bw, uint32_t value, int k) {
+    uint32_t q = value >> k;
+
+    if (q + 1 + k <= 24) {
+        put_bits(bw, (1u << k) | (value & ((1u << k) - 1)), q + 1 + k);
+        return;
+    }
+
+    for (; q >= 24; q -= 24)
+        put_bits(bw, 0, 24);
+
+    put_bits(bw, 1, q + 1);
+    if (k)
+        put_bits(bw, value, k);
+}
+
+static inline void flush_bits(struct bit_writer* bw) {
+    if (bw->count)
+        put_bits(bw, 0, 8 - bw->count);
+}
+
+static inline uint32_t get_bits(struct bit_reader* br, int bits) {
+    while (br->count < bits) {
+        if (br->p < br->end) {
+            br->acc = (br->acc << 8) | *br->p++;
+        } else {
+            br->acc <<= 8;
+            br->error = 1;
+        }
+        br->count += 8;
+    }
+
+    br->count -= bits;
+
+    return (br->acc >> br->count) & ((1u << bits) - 1);
+}
+
+static inline uint32_t get_unary(struct bit_reader* br) {
+    uint32_t q = 0;
+    uint32_t bits;
+    int top;
+
+    for (;;) {
+        if (br->count == 0) {
+            if (br->p == br->end) {
+                br->error = 1;
+                return 0;
+            }
+
+            br->acc = *br->p++;
+            br->count = 8;
+        }
+
+        bits = br->acc & ((1u << br->count) - 1);
+        if (bits) {
+            top = 31 - __builtin_clz(bits);
+            q += br->count - 1 - top;
+            br->count = top;
+
+            return q;
+        }
+
+        q += br->count;
+        br->count = 0;
+    }
+}
+
+static inline uint32_t zigzag(int32_t value) {
+    return ((uint32_t) value << 1) ^ (value >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t value) {
+    return (value >> 1) ^ -(int32_t) (value & 1);
+}
+
+/*
+ * Fixed polynomial predictors of order 0 ~ 4, as in FLAC
+ */
+static inline int32_t predict(const int32_t* x, uint32_t i, uint32_t order) {
+    switch (order) {
+    case 1:
+        return x[i - 1];
+    case 2:
+        return 2 * x[i - 1] - x[i - 2];
+    case 3:
+        return 3 * x[i - 1] - 3 * x[i - 2] + x[i - 3];
+    case 4:
+        return 4 * x[i - 1] - 6 * x[i - 2] + 4 * x[i - 3] - x[i - 4];
+    default:
+        return 0;
+    }
+}
+
+static uint64_t rice_bits(const uint32_t* residual, uint32_t count,
+        uint32_t k) {
+    uint64_t bits = (uint64_t) count * (k + 1);
+
+    for (uint32_t i = 0; i < count; i++)
+        bits += residual[i] >> k;
+
+    return bits;
+}
+
+/*
+ * Pick the predictor with the smallest residual and the rice
+ * parameter around its mean, or verbatim when nothing saves bits
+ */
+static void plan_channel(const int32_t* x, uint32_t frames, int width,
+        uint32_t* residual, struct channel_plan* plan) {
+    uint64_t sums[LOSSLESS_MAX_ORDER + 1] = {0};
+    uint64_t mean;
+    uint64_t bits;
+    uint32_t order = 0;
+    uint32_t k = 0;
+
+    plan->verbatim = 1;
+    plan->order = 0;
+    plan->rice = 0;
+    plan->bits = 3 + (uint64_t) frames * width;
+
+    if (frames <= LOSSLESS_MAX_ORDER)
+        return;
+
+    for (uint32_t i = LOSSLESS_MAX_ORDER; i < frames; i++) {
+        int32_t e0 = x[i];
+        int32_t e1 = e0 - x[i - 1];
+        int32_t e2 = e1 - (x[i - 1] - x[i - 2]);
+        int32_t e3 = e2 - (x[i - 1] - 2 * x[i - 2] + x[i - 3]);
+        int32_t e4 = e3 - (x[i - 1] - 3 * x[i - 2] + 3 * x[i - 3] - x[i - 4]);
+
+        sums[0] += zigzag(e0);
+        sums[1] += zigzag(e1);
+        sums[2] += zigzag(e2);
+        sums[3] += zigzag(e3);
+        sums[4] += zigzag(e4);
+    }
+
+    for (uint32_t i = 1; i <= LOSSLESS_MAX_ORDER; i++)
+        if (sums[i] < sums[order])
+            order = i;
+
+    mean = sums[order] / (frames - LOSSLESS_MAX_ORDER);
+    while (k < LOSSLESS_MAX_RICE && (2ull << k) <= mean)
+        k++;
+
+    for (uint32_t i = order; i < frames; i++)
+        residual[i - order] = zigzag(x[i] - predict(x, i, order));
+
+    for (uint32_t r = k ? k - 1 : 0; r <= MIN(k + 1, LOSSLESS_MAX_RICE); r++) {
+        bits = 8 + (uint64_t) order * width
+                + rice_bits(residual, frames - order, r);
+        if (bits < plan->bits) {
+            plan->verbatim = 0;
+            plan->order = order;
+            plan->rice = r;
+            plan->bits = bits;
+        }
+    }
+}
+
+static void write_channel(struct bit_writer* bw, const int32_t* x,
+        uint32_t frames, int width, const struct channel_plan* plan) {
+    if (plan->verbatim) {
+        put_bits(bw, LOSSLESS_VERBATIM, 3);
+        for (uint32_t i = 0; i < frames; i++)
+            put_bits(bw, x[i], width);
+        return;
+    }
+
+    put_bits(bw, plan->order, 3);
+    put_bits(bw, plan->rice, 5);
+
+    for (uint32_t i = 0; i < plan->order; i++)
+        put_bits(bw, x[i], width);
+
+    for (uint32_t i = plan->order; i < frames; i++)
+        put_rice(bw, zigzag(x[i] - predict(x, i, plan->order)), plan->rice);
+}
+
+static int read_channel(struct bit_reader* br, int32_t* x, uint32_t frames,
+        int width) {
+    uint32_t order = get_bits(br, 3);
+    uint32_t k;
+    uint32_t u;
+
+    if (order == LOSSLESS_VERBATIM) {
+        for (uint32_t i = 0; i < frames; i++)
+            x[i] = ((int32_t) get_bits(br, width) << (32 - width))
+                    >> (32 - width);
+        return br->error ? -1 : 0;
+    }
+
+    k = get_bits(br, 5);
+    if (order > LOSSLESS_MAX_ORDER || order > frames || k > LOSSLESS_MAX_RICE)
+        return -1;
+
+    for (uint32_t i = 0; i < order; i++)
+        x[i] = ((int32_t) get_bits(br, width) << (32 - width)) >> (32 - width);
+
+    for (uint32_t i = order; i < frames; i++) {
+        u = get_unary(br) << k;
+        if (k)
+            u |= get_bits(br, k);
+
+        if (br->error)
+            return -1;
+
+        x[i] = unzigzag(u) + predict(x, i, order);
+    }
+
+    return br->error ? -1 : 0;
+}
+
+static uint32_t lossless_encode_block(struct wave_codec_handle* handle,
+        uint32_t frames) {
+    struct channel_plan plans[3];
+    struct bit_writer bw;
+    int32_t* left = handle->work;
+    int32_t* right = left + handle->block_frames;
+    int32_t* side = right + handle->block_frames;
+    uint32_t* residual = (uint32_t*) (side + handle->block_frames);
+    const int16_t* pcm = handle->pcm;
+    uint32_t bytes;
+    int use_side = 0;
+
+    bw.p = handle->data + LOSSLESS_HEADER_BYTES;
+    bw.acc = 0;
+    bw.count = 0;
+
+    if (handle->channels == 1) {
+        for (uint32_t i = 0; i < frames; i++)
+            left[i] = pcm[i];
+
+        plan_channel(left, frames, 16, residual, &plans[0]);
+        write_channel(&bw, left, frames, 16, &plans[0]);
+
+    } else {
+        for (uint32_t i = 0; i < frames; i++) {
+            left[i] = pcm[2 * i];
+            right[i] = pcm[2 * i + 1];
+            side[i] = left[i] - right[i];
+        }
+
+        plan_channel(left, frames, 16, residual, &plans[0]);
+        plan_channel(right, frames, 16, residual, &plans[1]);
+        plan_channel(side, frames, 17, residual, &plans[2]);
+
+        use_side = plans[2].bits < plans[1].bits;
+
+        put_bits(&bw, use_side, 1);
+        write_channel(&bw, left, frames, 16, &plans[0]);
+        if (use_side)
+            write_channel(&bw, side, frames, 17, &plans[2]);
+        else
+            write_channel(&bw, right, frames, 16, &plans[1]);
+    }
+
+    flush_bits(&bw);
+
+    bytes = bw.p - handle->data - LOSSLESS_HEADER_BYTES;
+
+    handle->data[0] = frames;
+    handle->data[1] = frames >> 8;
+    handle->data[2] = bytes;
+    handle->data[3] = bytes >> 8;
+
+    return bytes + LOSSLESS_HEADER_BYTES;
+}
+
+static int lossless_decode_block(struct wave_codec_handle* handle,
+        uint32_t bytes) {
+    struct bit_reader br;
+    int32_t* left = handle->work;
+    int32_t* right = left + handle->block_frames;
+    int16_t* pcm = handle->pcm;
+    uint32_t frames = handle->data[0] | (handle->data[1] << 8);
+    int use_side = 0;
+
+    if (frames == 0 || frames > handle->block_frames) {
+        LOGE("Bad lossless block of %u frames\n", frames);
+        return -1;
+    }
+
+    br.p = handle->data + LOSSLESS_HEADER_BYTES;
+    br.end = handle->data + bytes;
+    br.acc = 0;
+    br.count = 0;
+    br.error = 0;
+
+    if (handle->channels == 2)
+        use_side = get_bits(&br, 1);
+
+    if (read_channel(&br, left, frames, 16) < 0)
+        goto error;
+
+    if (handle->channels == 1) {
+        for (uint32_t i = 0; i < frames; i++)
+            pcm[i] = left[i];
+
+        return frames;
+    }
+
+    if (read_channel(&br, right, frames, use_side ? 17 : 16) < 0)
+        goto error;
+
+    for (uint32_t i = 0; i < frames; i++) {
+        pcm[2 * i] = left[i];
+        pcm[2 * i + 1] = use_side ? left[i] - right[i] : right[i];
+    }
+
+    return frames;
+
+error:
+    LOGE("Corrupt lossless block\n");
+    return -1;
+}
+
+static struct wave_codec_handle* alloc_handle(enum wave_codec_type type,
+        int channels, int sample_rate, uint32_t block_align,
+        uint32_t block_frames) {
+    struct wave_codec_handle* handle;
+
+    handle = calloc(1, sizeof(*handle));
+    if (handle == NULL)
+        return NULL;
+
+    handle->type = type;
+    handle->channels = channels;
+    handle->sample_rate = sample_rate;
+    handle->block_align = block_align;
+    handle->block_frames = block_frames;
+
+    handle->pcm = malloc(block_frames * channels * sizeof(int16_t));
+    handle->data = malloc(block_align);
+    if (handle->pcm == NULL || handle->data == NULL)
+        goto error;
+
+    if (type == WAVE_CODEC_LOSSLESS) {
+        handle->work = malloc(4 * block_frames * sizeof(int32_t));
+        if (handle->work == NULL)
+            goto error;
+    }
+
+    return handle;
+
+error:
+    LOGE("Failed to allocate codec buffers\n");
+    free(handle->pcm);
+    free(handle->data);
+    free(handle);
+
+    return NULL;
+}
+
+/*
+ * The usual block sizes: 256 bytes per channel up to 11kHz, doubled
+ * for each step up
+ */
+static uint32_t adpcm_block_align(int channels, int sample_rate) {
+    if (sample_rate <= 11025)
+        return 256 * channels;
+    if (sample_rate <= 22050)
+        return 512 * channels;
+
+    return 1024 * channels;
+}
+
+static uint32_t adpcm_block_frames(int channels, uint32_t block_align) {
+    return (block_align - 4 * channels) * 2 / channels + 1;
+}
+
+static uint32_t lossless_block_bytes(int channels, uint32_t frames) {
+    return LOSSLESS_HEADER_BYTES + (1 + channels * (3 + frames * 17) + 7) / 8;
+}
+
+static struct wave_codec_handle* open_encoder(enum wave_codec_type type,
+        int channels, int sample_rate) {
+    uint32_t block_align;
+    uint32_t block_frames;
+
+    if (channels < 1 || channels > MAX_CHANNELS || sample_rate <= 0) {
+        LOGE("Codec can't take %dch %dHz\n", channels, sample_rate);
+        return NULL;
+    }
+
+    switch (type) {
+    case WAVE_CODEC_IMA_ADPCM:
+        block_align = adpcm_block_align(channels, sample_rate);
+        block_frames = adpcm_block_frames(channels, block_align);
+        break;
+
+    case WAVE_CODEC_LOSSLESS:
+        block_frames = LOSSLESS_BLOCK_FRAMES;
+        block_align = lossless_block_bytes(channels, block_frames);
+        break;
+
+    default:
+        LOGE("No encoder for codec %d\n", type);
+        return NULL;
+    }
+
+    return alloc_handle(type, channels, sample_rate, block_align,
+            block_frames);
+}
+
+static enum wave_codec_type get_type(const WaveContainer* container) {
+    assert_die_if(container == NULL, "container is NULL\n");
+
+    switch (LE_SHORT(container->format.format)) {
+    case WAV_FMT_IMA_ADPCM:
+        return WAVE_CODEC_IMA_ADPCM;
+    case WAV_FMT_LOSSLESS:
+        return WAVE_CODEC_LOSSLESS;
+    default:
+        return WAVE_CODEC_PCM;
+    }
+}
+
+static struct wave_codec_handle* open_decoder(const WaveContainer* container) {
+    assert_die_if(container == NULL, "container is NULL\n");
+
+    struct wave_codec_handle* handle;
+    enum wave_codec_type type = get_type(container);
+    int channels = LE_SHORT(container->format.channels);
+    uint32_t block_align = LE_SHORT(container->format.byte_p_spl);
+    uint32_t block_frames;
+
+    if (channels < 1 || channels > MAX_CHANNELS) {
+        LOGE("Codec can't take %d channels\n", channels);
+        return NULL;
+    }
+
+    switch (type) {
+    case WAVE_CODEC_IMA_ADPCM:
+        if (LE_SHORT(container->format.bit_p_spl) != 4
+                || block_align <= 4 * channels
+                || (block_align - 4 * channels) % (4 * channels)) {
+            LOGE("Unsupported ADPCM block align %u\n", block_align);
+            return NULL;
+        }
+
+        block_frames = adpcm_block_frames(channels, block_align);
+        break;
+
+    case WAVE_CODEC_LOSSLESS:
+        block_frames = LE_SHORT(container->codec.samples_per_block);
+        if (block_frames == 0)
+            block_frames = LOSSLESS_BLOCK_FRAMES;
+
+        block_align = lossless_block_bytes(channels, block_frames);
+        if (block_align - LOSSLESS_HEADER_BYTES > UINT16_MAX) {
+            LOGE("Unsupported lossless block of %u frames\n", block_frames);
+            return NULL;
+        }
+        break;
+
+    default:
+        LOGE("Wave format %u is not a codec\n",
+                LE_SHORT(container->format.format));
+        return NULL;
+    }
+
+    handle = alloc_handle(type, channels, LE_INT(container->format.sample_fq),
+            block_align, block_frames);
+    if (handle == NULL)
+        return NULL;
+
+    handle->remaining = LE_INT(container->chunk_header.length);
+    handle->frames_left = container->fact.type == WAV_FACT
+            ? LE_INT(container->fact.samples) : UINT64_MAX;
+
+    return handle;
+}
+
+static int wave_codec_close(struct wave_codec_handle* handle) {
+    assert_die_if(handle == NULL, "handle is NULL\n");
+
+    free(handle->pcm);
+    free(handle->data);
+    free(handle->work);
+    free(handle);
+
+    return 0;
+}
+
+static void encode_block(struct wave_codec_handle* handle) {
+    if (handle->type == WAVE_CODEC_IMA_ADPCM)
+        handle->data_fill = adpcm_encode_block(handle, handle->pcm_fill);
+    else
+        handle->data_fill = lossless_encode_block(handle, handle->pcm_fill);
+
+    handle->data_pos = 0;
+    handle->pcm_fill = 0;
+}
+
+static uint32_t drain_data(struct wave_codec_handle* handle, uint8_t* out,
+        uint32_t out_bytes) {
+    uint32_t size = MIN(out_bytes, handle->data_fill - handle->data_pos);
+
+    memcpy(out, handle->data + handle->data_pos, size);
+    handle->data_pos += size;
+
+    return size;
+}
+
+static int encode(struct wave_codec_handle* handle, const uint8_t* in,
+        uint32_t* in_frames, uint8_t* out, uint32_t out_bytes) {
+    assert_die_if(handle == NULL, "handle is NULL\n");
+    assert_die_if(in_frames == NULL, "in_frames is NULL\n");
+
+    uint32_t frame_bytes = handle->channels * sizeof(int16_t);
+    uint32_t avail = *in_frames;
+    uint32_t taken = 0;
+    uint32_t produced = 0;
+    uint32_t size;
+
+    for (;;) {
+        if (handle->data_pos < handle->data_fill) {
+            produced += drain_data(handle, out + produced,
+                    out_bytes - produced);
+            if (produced == out_bytes)
+                break;
+            continue;
+        }
+
+        if (handle->pcm_fill == handle->block_frames) {
+            encode_block(handle);
+            continue;
+        }
+
+        if (taken == avail)
+            break;
+
+        size = MIN(handle->block_frames - handle->pcm_fill, avail - taken);
+        memcpy(handle->pcm + handle->pcm_fill * handle->channels,
+                in + taken * frame_bytes, size * frame_bytes);
+
+        handle->pcm_fill += size;
+        handle->frames += size;
+        taken += size;
+    }
+
+    *in_frames = taken;
+
+    return produced;
+}
+
+static int flush(struct wave_codec_handle* handle, uint8_t* out,
+        uint32_t out_bytes) {
+    assert_die_if(handle == NULL, "handle is NULL\n");
+
+    if (handle->data_pos == handle->data_fill && handle->pcm_fill)
+        encode_block(handle);
+
+    return drain_data(handle, out, out_bytes);
+}
+
+static int decode_block(struct wave_codec_handle* handle) {
+    int frames;
+
+    if (handle->type == WAVE_CODEC_IMA_ADPCM)
+        frames = adpcm_decode_block(handle, handle->data_fill);
+    else
+        frames = lossless_decode_block(handle, handle->data_fill);
+
+    handle->data_fill = 0;
+    handle->data_need = 0;
+    handle->header_parsed = 0;
+
+    if (frames < 0)
+        return -1;
+
+    handle->pcm_fill = MIN((uint64_t) frames, handle->frames_left);
+    handle->frames_left -= handle->pcm_fill;
+    handle->pcm_pos = 0;
+
+    return 0;
+}
+
+/*
+ * Bytes of the block being gathered, 0 at the end of the data
+ */
+static uint32_t next_block_bytes(struct wave_codec_handle* handle) {
+    uint32_t payload;
+
+    if (handle->type == WAVE_CODEC_IMA_ADPCM)
+        return MIN(handle->remaining + handle->data_fill, handle->block_align);
+
+    if (handle->data_fill < LOSSLESS_HEADER_BYTES)
+        return handle->remaining + handle->data_fill ?
+                LOSSLESS_HEADER_BYTES : 0;
+
+    payload = handle->data[2] | (handle->data[3] << 8);
+    handle->header_parsed = 1;
+
+    return LOSSLESS_HEADER_BYTES + payload;
+}
+
+static int decode(struct wave_codec_handle* handle, const uint8_t* in,
+        uint32_t* in_bytes, uint8_t* out, uint32_t out_frames) {
+    assert_die_if(handle == NULL, "handle is NULL\n");
+    assert_die_if(in_bytes == NULL, "in_bytes is NULL\n");
+
+    uint32_t frame_bytes = handle->channels * sizeof(int16_t);
+    uint32_t avail = *in_bytes;
+    uint32_t taken = 0;
+    uint32_t produced = 0;
+    uint32_t size;
+
+    for (;;) {
+        if (handle->pcm_pos < handle->pcm_fill) {
+            size = MIN(out_frames - produced,
+                    handle->pcm_fill - handle->pcm_pos);
+            memcpy(out + produced * frame_bytes,
+                    handle->pcm + handle->pcm_pos * handle->channels,
+                    size * frame_bytes);
+
+            handle->pcm_pos += size;
+            produced += size;
+            if (produced == out_frames)
+                break;
+            continue;
+        }
+
+        if (handle->data_need && handle->data_fill == handle->data_need) {
+            if (handle->type == WAVE_CODEC_LOSSLESS && !handle->header_parsed) {
+                handle->data_need = next_block_bytes(handle);
+                if (handle->data_need > handle->block_align) {
+                    LOGE("Bad lossless block size %u\n", handle->data_need);
+                    return -1;
+                }
+                continue;
+            }
+
+            if (decode_block(handle) < 0)
+                return -1;
+            continue;
+        }
+
+        if (handle->data_need == 0) {
+            handle->data_need = next_block_bytes(handle);
+            if (handle->data_need == 0)
+                break;
+        }
+
+        if (taken == avail || handle->remaining == 0)
+            break;
+
+        size = MIN(handle->data_need - handle->data_fill, avail - taken);
+        size = MIN(size, handle->remaining);
+        memcpy(handle->data + handle->data_fill, in + taken, size);
+
+        handle->data_fill += size;
+        handle->remaining -= size;
+        taken += size;
+    }
+
+    *in_bytes = taken;
+
+    return produced;
+}
+
+static int fill_header(struct wave_codec_handle* handle,
+        WaveContainer* container) {
+    assert_die_if(handle == NULL, "handle is NULL\n");
+    assert_die_if(container == NULL, "container is NULL\n");
+
+    uint32_t byte_p_sec;
+
+    container->format.format_size = LE_INT(20);
+    container->format.channels = LE_SHORT(handle->channels);
+    container->format.sample_fq = LE_INT(handle->sample_rate);
+
+    if (handle->type == WAVE_CODEC_IMA_ADPCM) {
+        container->format.format = LE_SHORT(WAV_FMT_IMA_ADPCM);
+        container->format.byte_p_spl = LE_SHORT(handle->block_align);
+        container->format.bit_p_spl = LE_SHORT(4);
+        byte_p_sec = (uint64_t) handle->sample_rate * handle->block_align
+                / handle->block_frames;
+    } else {
+        container->format.format = LE_SHORT(WAV_FMT_LOSSLESS);
+        container->format.byte_p_spl = LE_SHORT(handle->channels * 2);
+        container->format.bit_p_spl = LE_SHORT(16);
+        byte_p_sec = handle->sample_rate * handle->channels * 2;
+    }
+
+    container->format.byte_p_sec = LE_INT(byte_p_sec);
+
+    container->codec.ext_size = LE_SHORT(2);
+    container->codec.samples_per_block = LE_SHORT(handle->block_frames);
+
+    container->fact.type = WAV_FACT;
+    container->fact.length = LE_INT(4);
+    container->fact.samples = LE_INT(handle->frames);
+
+    return 0;
+}
+
+static struct wave_codec this = {
+        .open_encoder = open_encoder,
+        .open_decoder = open_decoder,
+        .close = wave_codec_close,
+        .encode = encode,
+        .decode = decode,
+        .flush = flush,
+        .fill_header = fill_header,
+        .get_type = get_type,
+};
+
+struct wave_codec* get_wave_codec(void) {
+    return &this;
+}
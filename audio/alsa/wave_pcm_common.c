@@ -20,6 +20,35 @@
 
 #define LOG_TAG "wave_pcm_common"
 
+snd_pcm_format_t pcm_format_from_bits(uint16_t bit_per_spl) {
+    switch (bit_per_spl) {
+    case 32:
+        return SND_PCM_FORMAT_S32_LE;
+    case 24:
+        return SND_PCM_FORMAT_S24_LE;
+    case 16:
+        return SND_PCM_FORMAT_S16_LE;
+    case 8:
+        return SND_PCM_FORMAT_S8;
+    default:
+        return SND_PCM_FORMAT_UNKNOWN;
+    }
+}
+
+/*
+ * Sample layout pcm_set_params() gives the device for @bit_per_spl
+ */
+enum pcm_sample_format pcm_sample_format_from_bits(uint16_t bit_per_spl) {
+    switch (bit_per_spl) {
+    case 32:
+        return PCM_SAMPLE_S32;
+    case 24:
+        return PCM_SAMPLE_S24;
+    default:
+        return PCM_SAMPLE_S16;
+    }
+}
+
 uint32_t pcm_read(struct snd_pcm_container* pcm_container, uint32_t read_count) {
     uint32_t count = read_count;
     uint32_t readed;
@@ -38,6 +67,7 @@ uint32_t pcm_read(struct snd_pcm_container* pcm_container, uint32_t read_count)
 
         } else if (readed == -EPIPE) {
             snd_pcm_prepare(pcm_container->pcm_handle);
+            pcm_container->xruns++;
             LOGW("Overrun occured\n");
 
         } else if (readed == -ESTRPIPE) {
@@ -81,6 +111,7 @@ uint32_t pcm_write(struct snd_pcm_container* pcm_container, uint32_t write_count
 
         } else if (writed == -EPIPE) {
             snd_pcm_prepare(pcm_container->pcm_handle);
+            pcm_container->xruns++;
             LOGW("Underrun occured\n");
 
         } else if (writed == -ESTRPIPE) {
@@ -101,6 +132,34 @@ uint32_t pcm_write(struct snd_pcm_container* pcm_container, uint32_t write_count
     return write_sofar;
 }
 
+/*
+ * Caller chosen period and buffer size, for low latency use
+ */
+static int set_buffer_size(struct snd_pcm_container* pcm_container,
+        snd_pcm_hw_params_t* hw_params) {
+    snd_pcm_uframes_t period_size = pcm_container->period_frames;
+    snd_pcm_uframes_t buffer_size;
+    int error;
+
+    error = snd_pcm_hw_params_set_period_size_near(pcm_container->pcm_handle,
+            hw_params, &period_size, 0);
+    if (error < 0) {
+        LOGE("Failed to snd_pcm_hw_params_set_period_size_near: %s\n", snd_strerror(error));
+        return -1;
+    }
+
+    buffer_size = period_size * MAX(2, pcm_container->periods);
+
+    error = snd_pcm_hw_params_set_buffer_size_near(pcm_container->pcm_handle,
+            hw_params, &buffer_size);
+    if (error < 0) {
+        LOGE("Failed to snd_pcm_hw_params_set_buffer_size_near: %s\n", snd_strerror(error));
+        return -1;
+    }
+
+    return 0;
+}
+
 int pcm_set_params(struct snd_pcm_container* pcm_container,
         uint16_t bit_per_spl, uint16_t channles, uint32_t sample_fq) {
     int error = 0;
@@ -134,23 +193,7 @@ int pcm_set_params(struct snd_pcm_container* pcm_container,
         return -1;
     }
 
-    switch (bit_per_spl) {
-    case 32:
-        format = SND_PCM_FORMAT_S32_LE;
-        break;
-    case 24:
-        format = SND_PCM_FORMAT_S24_LE;
-        break;
-    case 16:
-        format = SND_PCM_FORMAT_S16_LE;
-        break;
-    case 8:
-        format = SND_PCM_FORMAT_S8;
-        break;
-    default:
-        format = SND_PCM_FORMAT_UNKNOWN;
-        break;
-    }
+    format = pcm_format_from_bits(bit_per_spl);
 
     error = snd_pcm_hw_params_set_format(pcm_container->pcm_handle, hw_params,
             format);
@@ -182,28 +225,35 @@ int pcm_set_params(struct snd_pcm_container* pcm_container,
             LE_INT(sample_fq), exact_rate);
     }
 
-    error = snd_pcm_hw_params_get_buffer_time_max(hw_params, &buffer_time, 0);
-    if (error < 0) {
-        LOGE("Failed to snd_pcm_hw_params_get_buffer_time_max: %s\n", snd_strerror(error));
-        return -1;
-    }
+    if (pcm_container->period_frames) {
+        error = set_buffer_size(pcm_container, hw_params);
+        if (error < 0)
+            return -1;
 
-    if (buffer_time > 500000)
-        buffer_time = 500000;
-    period_time = buffer_time / 4;
+    } else {
+        error = snd_pcm_hw_params_get_buffer_time_max(hw_params, &buffer_time, 0);
+        if (error < 0) {
+            LOGE("Failed to snd_pcm_hw_params_get_buffer_time_max: %s\n", snd_strerror(error));
+            return -1;
+        }
 
-    error = snd_pcm_hw_params_set_buffer_time_near(pcm_container->pcm_handle,
-            hw_params, &buffer_time, 0);
-    if (error < 0) {
-        LOGE("Failed to snd_pcm_hw_params_set_buffer_time_near: %s\n", snd_strerror(error));
-        return -1;
-    }
+        if (buffer_time > 500000)
+            buffer_time = 500000;
+        period_time = buffer_time / 4;
 
-    error = snd_pcm_hw_params_set_period_time_near(pcm_container->pcm_handle,
-            hw_params, &period_time, 0);
-    if (error < 0) {
-        LOGE("Failed to snd_pcm_hw_params_set_period_time_near: %s\n", snd_strerror(error));
-        return -1;
+        error = snd_pcm_hw_params_set_buffer_time_near(pcm_container->pcm_handle,
+                hw_params, &buffer_time, 0);
+        if (error < 0) {
+            LOGE("Failed to snd_pcm_hw_params_set_buffer_time_near: %s\n", snd_strerror(error));
+            return -1;
+        }
+
+        error = snd_pcm_hw_params_set_period_time_near(pcm_container->pcm_handle,
+                hw_params, &period_time, 0);
+        if (error < 0) {
+            LOGE("Failed to snd_pcm_hw_params_set_period_time_near: %s\n", snd_strerror(error));
+            return -1;
+        }
     }
 
     error = snd_pcm_hw_params(pcm_container->pcm_handle, hw_params);
@@ -20,6 +20,7 @@
 #include <types.h>
 #include <utils/wave_parser.h>
 #include <lib/alsa/asoundlib.h>
+#include <audio/alsa/pcm_convert.h>
 
 struct snd_pcm_container {
     snd_pcm_t *pcm_handle;
@@ -33,8 +34,18 @@ struct snd_pcm_container {
     uint32_t bits_per_sample;
     uint32_t bits_per_frame;
     uint8_t *data_buf;
+    uint32_t xruns;
+
+    /*
+     * Requested period size and count, 0 for the default 500ms
+     * buffer in 4 periods
+     */
+    uint32_t period_frames;
+    uint32_t periods;
 };
 
+snd_pcm_format_t pcm_format_from_bits(uint16_t bit_per_spl);
+enum pcm_sample_format pcm_sample_format_from_bits(uint16_t bit_per_spl);
 uint32_t pcm_read(struct snd_pcm_container* pcm_container, uint32_t count);
 uint32_t pcm_write(struct snd_pcm_container* pcm_container, uint32_t count);
 int pcm_set_params(struct snd_pcm_container* pcm_container,
@@ -14,10 +14,17 @@
  *
  */
 
+#include <time.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include <utils/log.h>
 #include <utils/assert.h>
 #include <utils/common.h>
+#include <thread/thread.h>
 #include <audio/alsa/wave_player.h>
+#include <audio/alsa/wave_codec.h>
 #include "wave_pcm_common.h"
 
 #define LOG_TAG "wave_player"
@@ -29,16 +36,110 @@ static uint32_t init_count;
 
 static pthread_mutex_t init_lock = PTHREAD_MUTEX_INITIALIZER;
 
-static uint32_t safe_read(int fd, void* buf, uint32_t count) {
+/*
+ * Files at least this large are played from an mmap'd source,
+ * smaller ones through the reader thread ring
+ */
+#define MMAP_THRESHOLD          (4 * 1024 * 1024)
+#define PREFETCH_CHUNKS         8
+
+struct prefetch {
+    int fd;
+    uint8_t* buffer;
+    uint32_t chunk_bytes;
+    uint32_t lengths[PREFETCH_CHUNKS];
+    uint32_t head;
+    uint32_t count;
+    uint64_t remaining;
+    int eof;
+    int quit;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct thread* reader;
+};
+
+static struct prefetch prefetch = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static struct wave_player_stat stats;
+static pthread_mutex_t stat_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Device format pinned by set_hw_format(), channels 0 lets the
+ * device follow every source as before
+ */
+static struct {
+    int channels;
+    int sample_rate;
+    int sample_length;
+    enum pcm_convert_quality quality;
+} hw_format;
+
+/*
+ * Source to device conversion, output is gathered into whole periods
+ * so pcm_write never pads silence into the middle of a stream
+ */
+static struct pcm_convert* pcm_convert;
+static struct pcm_convert_handle* converter;
+static struct pcm_convert_param converter_param;
+static uint8_t* convert_buf;
+static uint32_t convert_fill;
+static uint32_t src_frame_bytes;
+
+/*
+ * Compressed files are decoded into whole periods before conversion
+ */
+static struct wave_codec* wave_codec;
+static struct wave_codec_handle* decoder;
+static uint8_t* decode_buf;
+static uint32_t decode_fill;
+
+/*
+ * Held by the thread playing. cancel_play() only raises cancelled and
+ * drops the PCM, the converter and bounce buffer are reset by whoever
+ * holds play_lock next, never under a play in progress.
+ */
+static pthread_mutex_t play_lock = PTHREAD_MUTEX_INITIALIZER;
+static int cancelled;
+
+static uint64_t monotonic_us(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void account_chunk(uint32_t stalls) {
+    pthread_mutex_lock(&stat_lock);
+    stats.chunks++;
+    stats.reader_stalls += stalls;
+    pthread_mutex_unlock(&stat_lock);
+}
+
+static void account_read(uint32_t read_us) {
+    pthread_mutex_lock(&stat_lock);
+    if (read_us > stats.max_read_us)
+        stats.max_read_us = read_us;
+    pthread_mutex_unlock(&stat_lock);
+}
+
+static int safe_read(int fd, void* buf, uint32_t count) {
     uint32_t read_sofar = 0;
-    uint32_t readed;
+    int readed;
 
     while (count > 0) {
-        if ((readed = read(fd, buf, count)) == 0)
+        readed = read(fd, buf, count);
+        if (readed == 0)
             break;
 
-        if (readed < 0)
+        if (readed < 0) {
+            if (errno == EINTR)
+                continue;
             return read_sofar > 0 ? read_sofar : readed;
+        }
 
         count -= readed;
         read_sofar += readed;
@@ -48,54 +149,575 @@ static uint32_t safe_read(int fd, void* buf, uint32_t count) {
     return read_sofar;
 }
 
-static int do_play_wave(struct snd_pcm_container* pcm_container,
-        WaveContainer* wave_container, int fd) {
-    uint64_t writed = 0;
-    uint64_t count = LE_INT(wave_container->chunk_header.length);
-    uint64_t c;
-    int load = 0;
+/*
+ * Reader thread: keep up to PREFETCH_CHUNKS chunks ahead of ALSA
+ */
+static void prefetch_loop(struct pthread_wrapper* thread, void* param) {
+    struct prefetch* pf = (struct prefetch*) param;
+    uint64_t begin;
+    uint32_t slot;
+    uint32_t size;
     int ret;
 
-    while (writed < count) {
-        do {
-            c = count - writed;
-            if (c > pcm_container->chunk_bytes)
-                c = pcm_container->chunk_bytes;
-            c -= load;
+    for (;;) {
+        pthread_mutex_lock(&pf->lock);
+        while (pf->count == PREFETCH_CHUNKS && !pf->quit)
+            pthread_cond_wait(&pf->cond, &pf->lock);
 
-            if (c == 0)
-                break;
+        if (pf->quit) {
+            pthread_mutex_unlock(&pf->lock);
+            break;
+        }
+
+        slot = (pf->head + pf->count) % PREFETCH_CHUNKS;
+        size = MIN(pf->remaining, pf->chunk_bytes);
+        pthread_mutex_unlock(&pf->lock);
+
+        begin = monotonic_us();
+        ret = safe_read(pf->fd, pf->buffer + slot * pf->chunk_bytes, size);
+        account_read(monotonic_us() - begin);
+
+        pthread_mutex_lock(&pf->lock);
+        if (ret <= 0) {
+            if (ret < 0)
+                LOGE("Failed to read wave data: %s\n", strerror(errno));
+            pf->eof = 1;
+        } else {
+            pf->lengths[slot] = ret;
+            pf->count++;
+            pf->remaining -= ret;
+            if (pf->remaining == 0)
+                pf->eof = 1;
+        }
+        pthread_cond_broadcast(&pf->cond);
+        pthread_mutex_unlock(&pf->lock);
+
+        if (ret <= 0 || pf->remaining == 0)
+            break;
+    }
+}
+
+static void prefetch_stop(void* param) {
+    struct prefetch* pf = (struct prefetch*) param;
+
+    if (pf->reader == NULL)
+        return;
+
+    pthread_mutex_lock(&pf->lock);
+    pf->quit = 1;
+    pthread_cond_broadcast(&pf->cond);
+    pthread_mutex_unlock(&pf->lock);
+
+    pf->reader->wait(pf->reader);
+    _delete(pf->reader);
+    pf->reader = NULL;
+
+    free(pf->buffer);
+    pf->buffer = NULL;
+}
+
+static int prefetch_start(struct prefetch* pf, int fd, uint64_t length,
+        uint32_t chunk_bytes) {
+    pf->buffer = malloc(PREFETCH_CHUNKS * chunk_bytes);
+    if (pf->buffer == NULL) {
+        LOGE("Failed to allocate prefetch buffer\n");
+        return -1;
+    }
+
+    pf->fd = fd;
+    pf->chunk_bytes = chunk_bytes;
+    pf->head = 0;
+    pf->count = 0;
+    pf->remaining = length;
+    pf->eof = length == 0;
+    pf->quit = 0;
+
+    pf->reader = _new(struct thread, thread);
+    pf->reader->runnable.run = prefetch_loop;
+    if (pf->reader->start(pf->reader, pf) < 0) {
+        LOGE("Failed to start prefetch thread\n");
+        _delete(pf->reader);
+        pf->reader = NULL;
+        free(pf->buffer);
+        pf->buffer = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+static void unlock_mutex(void* param) {
+    pthread_mutex_unlock((pthread_mutex_t*) param);
+}
+
+static int is_cancelled(void) {
+    return __atomic_load_n(&cancelled, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * With play_lock held
+ */
+static void reset_cancelled(void) {
+    if (!__atomic_exchange_n(&cancelled, 0, __ATOMIC_ACQ_REL))
+        return;
+
+    if (converter)
+        pcm_convert->reset(converter);
+    convert_fill = 0;
+
+    if (pcm_container.data_buf) {
+        free(pcm_container.data_buf);
+        pcm_container.data_buf = NULL;
+    }
+}
+
+static void enter_play(void) {
+    pthread_mutex_lock(&play_lock);
+    reset_cancelled();
+}
+
+static void leave_play(void* param) {
+    reset_cancelled();
+    pthread_mutex_unlock(&play_lock);
+}
+
+static void close_converter(void) {
+    if (converter == NULL)
+        return;
+
+    pcm_convert->close(converter);
+    converter = NULL;
+
+    free(convert_buf);
+    convert_buf = NULL;
+    convert_fill = 0;
+}
+
+static enum pcm_sample_format wave_sample_format(WaveContainer* container) {
+    uint16_t bits = LE_SHORT(container->format.bit_p_spl);
+    uint16_t block = LE_SHORT(container->format.byte_p_spl);
+
+    if (LE_SHORT(container->format.format) == WAV_FMT_IEEE_FLOAT)
+        return PCM_SAMPLE_FLOAT;
+
+    if (bits == 24 && block == 3 * LE_SHORT(container->format.channels))
+        return PCM_SAMPLE_S24_3;
+
+    return pcm_sample_format_from_bits(bits);
+}
+
+/*
+ * Configure the device on first use, and pick the converter for a
+ * source that doesn't match a pinned device format
+ */
+static int setup_output(int channels, int sample_rate, int sample_length,
+        enum pcm_sample_format format) {
+    struct pcm_convert_param param;
+    int error;
+
+    if (!hw_inited) {
+        if (hw_format.channels)
+            error = pcm_set_params(&pcm_container, hw_format.sample_length,
+                    hw_format.channels, hw_format.sample_rate);
+        else
+            error = pcm_set_params(&pcm_container, LE_SHORT(sample_length),
+                    channels, sample_rate);
+        if (error < 0) {
+            LOGE("Failed to set hw params\n");
+            return -1;
+        }
+
+        hw_inited = 1;
+    }
 
-            ret = safe_read(fd, pcm_container->data_buf + load, c);
-            if (ret < 0) {
-                LOGE("Failed to safe read\n");
+    src_frame_bytes = pcm_container.bits_per_frame / 8;
+    if (!hw_format.channels)
+        return 0;
+
+    if (sample_length != 16 && sample_length != 24 && sample_length != 32) {
+        LOGE("Can't convert %d bit samples\n", sample_length);
+        return -1;
+    }
+
+    memset(&param, 0, sizeof(param));
+    param.in_format = format;
+    param.in_channels = channels;
+    param.in_rate = sample_rate;
+    param.out_format = pcm_sample_format_from_bits(hw_format.sample_length);
+    param.out_channels = hw_format.channels;
+    param.out_rate = hw_format.sample_rate;
+    param.quality = hw_format.quality;
+
+    src_frame_bytes = channels * pcm_convert->get_sample_bytes(format);
+
+    if (param.in_format == param.out_format
+            && param.in_channels == param.out_channels
+            && param.in_rate == param.out_rate) {
+        close_converter();
+        return 0;
+    }
+
+    if (converter && !memcmp(&param, &converter_param, sizeof(param)))
+        return 0;
+
+    close_converter();
+
+    converter = pcm_convert->open(&param);
+    if (converter == NULL) {
+        LOGE("Failed to open converter\n");
+        return -1;
+    }
+
+    convert_buf = malloc(pcm_container.chunk_bytes);
+    if (convert_buf == NULL) {
+        LOGE("Failed to allocate convert buffer\n");
+        close_converter();
+        return -1;
+    }
+
+    converter_param = param;
+    convert_fill = 0;
+
+    LOGD("Converting %dch %dHz to %dch %dHz\n", channels, sample_rate,
+            hw_format.channels, hw_format.sample_rate);
+
+    return 0;
+}
+
+static int write_converted(struct snd_pcm_container* pcm_container) {
+    uint8_t* bounce = pcm_container->data_buf;
+    uint32_t frames = convert_fill;
+    uint32_t ret;
+
+    convert_fill = 0;
+
+    pcm_container->data_buf = convert_buf;
+    ret = pcm_write(pcm_container, frames);
+    pcm_container->data_buf = bounce;
+
+    return ret < frames || is_cancelled() ? -1 : 0;
+}
+
+/*
+ * Play @frames of source data. Without a converter a short count is
+ * padded with silence in place, @data must have room for a chunk.
+ */
+static int write_frames(struct snd_pcm_container* pcm_container,
+        uint8_t* data, uint32_t frames) {
+    uint8_t* bounce = pcm_container->data_buf;
+    uint32_t frame_bytes = pcm_container->bits_per_frame / 8;
+    uint32_t consumed;
+    uint32_t ret;
+
+    if (converter == NULL) {
+        pcm_container->data_buf = data;
+        ret = pcm_write(pcm_container, frames);
+        pcm_container->data_buf = bounce;
+
+        return ret < frames || is_cancelled() ? -1 : 0;
+    }
+
+    while (frames > 0 && !is_cancelled()) {
+        consumed = frames;
+        ret = pcm_convert->process(converter, data, &consumed,
+                convert_buf + convert_fill * frame_bytes,
+                pcm_container->chunk_size - convert_fill);
+
+        convert_fill += ret;
+        data += consumed * src_frame_bytes;
+        frames -= consumed;
+
+        if (convert_fill == pcm_container->chunk_size
+                && write_converted(pcm_container) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+static int flush_converter(struct snd_pcm_container* pcm_container) {
+    uint32_t frame_bytes = pcm_container->bits_per_frame / 8;
+    int error = 0;
+    int ret;
+
+    if (converter == NULL)
+        return 0;
+
+    while (!error && (ret = pcm_convert->flush(converter,
+            convert_buf + convert_fill * frame_bytes,
+            pcm_container->chunk_size - convert_fill)) > 0) {
+        convert_fill += ret;
+
+        if (convert_fill == pcm_container->chunk_size)
+            error = write_converted(pcm_container);
+    }
+
+    if (!error && convert_fill)
+        error = write_converted(pcm_container);
+
+    convert_fill = 0;
+    pcm_convert->reset(converter);
+
+    return error;
+}
+
+static void close_decoder(void) {
+    if (decoder == NULL)
+        return;
+
+    wave_codec->close(decoder);
+    decoder = NULL;
+
+    free(decode_buf);
+    decode_buf = NULL;
+    decode_fill = 0;
+}
+
+static int open_decoder(WaveContainer* container) {
+    decoder = wave_codec->open_decoder(container);
+    if (decoder == NULL)
+        return -1;
+
+    return 0;
+}
+
+/*
+ * Decode @bytes of compressed data, playing every period it fills
+ */
+static int write_decoded(struct snd_pcm_container* pcm_container,
+        uint8_t* data, uint32_t bytes) {
+    uint32_t consumed;
+    int ret;
+
+    while (bytes > 0) {
+        consumed = bytes;
+        ret = wave_codec->decode(decoder, data, &consumed,
+                decode_buf + decode_fill * src_frame_bytes,
+                pcm_container->chunk_size - decode_fill);
+        if (ret < 0)
+            return -1;
+
+        decode_fill += ret;
+        data += consumed;
+        bytes -= consumed;
+
+        if (decode_fill == pcm_container->chunk_size) {
+            if (write_frames(pcm_container, decode_buf, decode_fill) < 0)
                 return -1;
-            }
+            decode_fill = 0;
+
+        } else if (consumed == 0) {
+            /*
+             * Past the end of the data chunk
+             */
+            break;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * End of data: play what the decoder still holds and the last,
+ * short period
+ */
+static int flush_decoder(struct snd_pcm_container* pcm_container) {
+    uint32_t consumed;
+    int error = 0;
+    int ret;
+
+    if (decoder == NULL)
+        return 0;
+
+    for (;;) {
+        consumed = 0;
+        ret = wave_codec->decode(decoder, NULL, &consumed,
+                decode_buf + decode_fill * src_frame_bytes,
+                pcm_container->chunk_size - decode_fill);
+        if (ret <= 0)
+            break;
 
-            if (ret == 0)
+        decode_fill += ret;
+        if (decode_fill == pcm_container->chunk_size) {
+            error = write_frames(pcm_container, decode_buf, decode_fill);
+            decode_fill = 0;
+            if (error < 0)
                 break;
+        }
+    }
+
+    if (!error && decode_fill)
+        error = write_frames(pcm_container, decode_buf, decode_fill);
+
+    decode_fill = 0;
+
+    return error;
+}
+
+static int play_buffered(struct snd_pcm_container* pcm_container, int fd,
+        uint64_t length) {
+    struct prefetch* pf = &prefetch;
+    uint32_t chunk_bytes;
+    uint32_t stalls;
+    uint32_t size;
+    uint32_t slot;
+    int error = 0;
+    int done = 0;
+    int ret;
+
+    /*
+     * Whole source frames per read, equal to the device chunk when
+     * nothing is converted
+     */
+    chunk_bytes = pcm_container->chunk_bytes / src_frame_bytes
+            * src_frame_bytes;
+    if (chunk_bytes == 0)
+        chunk_bytes = src_frame_bytes;
+
+    if (prefetch_start(pf, fd, length, chunk_bytes) < 0)
+        return -1;
+
+    pthread_cleanup_push(prefetch_stop, pf);
 
-            load += ret;
+    while (!done) {
+        stalls = 0;
 
-        } while (load < pcm_container->chunk_bytes);
+        pthread_mutex_lock(&pf->lock);
+        pthread_cleanup_push(unlock_mutex, &pf->lock);
+        while (pf->count == 0 && !pf->eof && !pf->quit) {
+            stalls++;
+            pthread_cond_wait(&pf->cond, &pf->lock);
+        }
+        pthread_cleanup_pop(0);
 
-        load = load * 8 / pcm_container->bits_per_frame;
-        ret = pcm_write(pcm_container, load);
-        if (ret != load)
+        if (pf->count == 0 || pf->quit) {
+            pthread_mutex_unlock(&pf->lock);
             break;
+        }
 
-        ret = ret * pcm_container->bits_per_frame / 8;
-        writed += ret;
-        load = 0;
+        slot = pf->head;
+        size = pf->lengths[slot];
+        pthread_mutex_unlock(&pf->lock);
+
+        /*
+         * pcm_write pads a short chunk with silence in place, the
+         * slot has room for a whole chunk
+         */
+        if (decoder)
+            ret = write_decoded(pcm_container,
+                    pf->buffer + slot * pf->chunk_bytes, size);
+        else
+            ret = write_frames(pcm_container,
+                    pf->buffer + slot * pf->chunk_bytes,
+                    size / src_frame_bytes);
+        if (ret < 0) {
+            error = -1;
+            done = 1;
+        }
+
+        account_chunk(stalls);
+
+        pthread_mutex_lock(&pf->lock);
+        pf->head = (pf->head + 1) % PREFETCH_CHUNKS;
+        pf->count--;
+        pthread_cond_broadcast(&pf->cond);
+        pthread_mutex_unlock(&pf->lock);
     }
 
-    return 0;
+    pthread_cleanup_pop(1);
+
+    return error;
 }
 
-static int play_wave(int fd) {
+/*
+ * Large files: map the whole file, let the kernel read ahead a
+ * window of chunks with MADV_WILLNEED and hand ALSA pointers into
+ * the page cache directly
+ */
+static int play_mmap(struct snd_pcm_container* pcm_container, int fd,
+        off_t offset, uint64_t length, off_t file_size) {
+    uint8_t* bounce = pcm_container->data_buf;
+    uint32_t page_size = getpagesize();
+    uint64_t pos = 0;
+    uint64_t advised = 0;
+    uint64_t window;
+    uint32_t chunk_bytes;
+    uint32_t frames;
+    uint32_t size;
+    uint8_t* map;
+    uint8_t* data;
+    uint8_t* src;
+    int error = 0;
+
+    chunk_bytes = pcm_container->chunk_bytes / src_frame_bytes
+            * src_frame_bytes;
+    if (chunk_bytes == 0)
+        chunk_bytes = src_frame_bytes;
+
+    length = MIN(length, (uint64_t) (file_size - offset));
+
+    map = mmap(NULL, file_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        LOGE("Failed to mmap wave file: %s\n", strerror(errno));
+        return -1;
+    }
+
+    data = map + offset;
+    madvise(map, file_size, MADV_SEQUENTIAL);
+
+    while (pos < length && !is_cancelled()) {
+        pthread_testcancel();
+
+        window = MIN(length, pos + (uint64_t) PREFETCH_CHUNKS * chunk_bytes);
+        if (window > advised) {
+            uintptr_t start = (uintptr_t) (data + advised) & ~(page_size - 1);
+
+            madvise((void*) start, (uintptr_t) (data + window) - start,
+                    MADV_WILLNEED);
+            advised = window;
+        }
+
+        size = MIN(length - pos, chunk_bytes);
+        frames = size / src_frame_bytes;
+
+        /*
+         * Full chunks straight from the mapping, the tail goes
+         * through the bounce buffer because pcm_write pads it. The
+         * converter never pads its input.
+         */
+        if (converter || size == chunk_bytes) {
+            src = data + pos;
+        } else {
+            memcpy(bounce, data + pos, size);
+            src = bounce;
+        }
+
+        error = write_frames(pcm_container, src, frames);
+
+        account_chunk(0);
+
+        if (error < 0)
+            break;
+
+        pos += size;
+    }
+
+    munmap(map, file_size);
+
+    return error;
+}
+
+static int do_play_wave(int fd) {
     assert_die_if(fd < 0, "Invaild fd\n");
 
+    struct stat st;
+    uint64_t length;
+    off_t offset;
+    int use_mmap;
     int error = 0;
+    uint32_t xruns;
+
+    close_decoder();
 
     lseek(fd, 0, SEEK_SET);
     error = wave_read_header(fd, &wave_container);
@@ -104,23 +726,78 @@ static int play_wave(int fd) {
         goto error;
     }
 
-    if (!hw_inited) {
-        error = pcm_set_params(&pcm_container,
+    if (wave_codec->get_type(&wave_container) != WAVE_CODEC_PCM) {
+        error = open_decoder(&wave_container);
+        if (error < 0)
+            goto error;
+
+        error = setup_output(LE_SHORT(wave_container.format.channels),
+                LE_INT(wave_container.format.sample_fq), 16, PCM_SAMPLE_S16);
+    } else {
+        error = setup_output(LE_SHORT(wave_container.format.channels),
+                LE_INT(wave_container.format.sample_fq),
                 LE_SHORT(wave_container.format.bit_p_spl),
-                wave_container.format.channels, wave_container.format.sample_fq);
-        if (error < 0) {
-            LOGE("Failed to set hw params\n");
+                wave_sample_format(&wave_container));
+    }
+    if (error < 0)
+        goto error;
+
+    if (decoder) {
+        decode_buf = malloc(pcm_container.chunk_size * src_frame_bytes);
+        if (decode_buf == NULL) {
+            LOGE("Failed to allocate decode buffer\n");
             goto error;
         }
+    }
 
-        hw_inited = 1;
+    if (pcm_container.data_buf == NULL) {
+        pcm_container.data_buf = malloc(pcm_container.chunk_bytes);
+        if (pcm_container.data_buf == NULL) {
+            LOGE("Failed to malloc data_buffer\n");
+            goto error;
+        }
     }
 
 #ifdef LOCAL_DEBUG
     snd_pcm_dump(pcm_container.pcm_handle, pcm_container.out_log);
 #endif
 
-    error = do_play_wave(&pcm_container, &wave_container, fd);
+    offset = lseek(fd, 0, SEEK_CUR);
+    length = LE_INT(wave_container.chunk_header.length);
+    use_mmap = decoder == NULL && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)
+            && st.st_size >= MMAP_THRESHOLD;
+
+    pthread_mutex_lock(&stat_lock);
+    if (use_mmap)
+        stats.mmap_plays++;
+    else
+        stats.buffered_plays++;
+    pthread_mutex_unlock(&stat_lock);
+
+    xruns = pcm_container.xruns;
+
+    if (use_mmap)
+        error = play_mmap(&pcm_container, fd, offset, length, st.st_size);
+    else
+        error = play_buffered(&pcm_container, fd, length);
+
+    pthread_mutex_lock(&stat_lock);
+    stats.underruns += pcm_container.xruns - xruns;
+    pthread_mutex_unlock(&stat_lock);
+
+    if (is_cancelled()) {
+        close_decoder();
+        return -1;
+    }
+
+    if (error == 0)
+        error = flush_decoder(&pcm_container);
+
+    if (error == 0)
+        error = flush_converter(&pcm_container);
+
+    close_decoder();
+
     if (error < 0) {
         LOGE("Failed to do play wave file\n");
         goto error;
@@ -142,6 +819,12 @@ static int play_wave(int fd) {
     return 0;
 
 error:
+    close_decoder();
+
+    if (converter)
+        pcm_convert->reset(converter);
+    convert_fill = 0;
+
     if (pcm_container.data_buf) {
         free(pcm_container.data_buf);
         pcm_container.data_buf = NULL;
@@ -150,27 +833,103 @@ error:
     return -1;
 }
 
-static int play_stream(int channels, int sample_rate, int sample_length,
-        uint8_t* buffer, int write_count) {
-    int ret = 0;
-    int frame_count;
+/*
+ * Whole periods go to ALSA straight from the sound, only a short last
+ * period is copied. The sound is drained rather than dropped so it is
+ * heard to the end, and the device is left prepared for the next one.
+ */
+static int do_play_sound(const struct wave_sound* sound) {
+    assert_die_if(sound == NULL, "sound is NULL\n");
 
-    if (!hw_inited) {
-        ret = pcm_set_params(&pcm_container, LE_SHORT(sample_length), channels,
-                sample_rate);
-        if (ret < 0) {
-            LOGE("Failed to set hw params\n");
+    uint32_t chunk_bytes;
+    uint32_t pos = 0;
+    uint32_t size;
+    uint32_t xruns;
+    uint8_t* src;
+    int error = 0;
+
+    if (setup_output(sound->channels, sound->sample_rate,
+            sound->sample_length,
+            pcm_sample_format_from_bits(sound->sample_length)) < 0)
+        return -1;
+
+    /*
+     * Kept between sounds, only the tail goes through it
+     */
+    if (pcm_container.data_buf == NULL) {
+        pcm_container.data_buf = malloc(pcm_container.chunk_bytes);
+        if (pcm_container.data_buf == NULL) {
+            LOGE("Failed to malloc data_buffer\n");
             return -1;
         }
+    }
 
-        hw_inited = 1;
+    chunk_bytes = pcm_container.chunk_bytes / src_frame_bytes
+            * src_frame_bytes;
+    if (chunk_bytes == 0)
+        chunk_bytes = src_frame_bytes;
+
+    xruns = pcm_container.xruns;
+
+    while (pos < sound->size && !is_cancelled()) {
+        size = MIN(sound->size - pos, chunk_bytes);
+
+        if (converter || size == chunk_bytes) {
+            src = (uint8_t*) sound->data + pos;
+        } else {
+            memcpy(pcm_container.data_buf, sound->data + pos, size);
+            src = pcm_container.data_buf;
+        }
+
+        error = write_frames(&pcm_container, src, size / src_frame_bytes);
+        if (error < 0)
+            break;
+
+        pos += size;
     }
 
-    frame_count = (write_count * 8) / pcm_container.bits_per_frame;
+    if (is_cancelled())
+        return -1;
+
+    if (error == 0)
+        error = flush_converter(&pcm_container);
+
+    pthread_mutex_lock(&stat_lock);
+    stats.sound_plays++;
+    stats.underruns += pcm_container.xruns - xruns;
+    pthread_mutex_unlock(&stat_lock);
+
+    if (error < 0) {
+        LOGE("Failed to play sound\n");
+
+        if (converter)
+            pcm_convert->reset(converter);
+        convert_fill = 0;
+
+        return -1;
+    }
 
-    pcm_container.data_buf = buffer;
-    ret = pcm_write(&pcm_container, frame_count);
-    if (ret != frame_count) {
+    snd_pcm_drain(pcm_container.pcm_handle);
+    snd_pcm_prepare(pcm_container.pcm_handle);
+
+    return 0;
+}
+
+static int do_play_stream(int channels, int sample_rate, int sample_length,
+        uint8_t* buffer, int write_count) {
+    int frame_count;
+
+    if (setup_output(channels, sample_rate, sample_length,
+            pcm_sample_format_from_bits(sample_length)) < 0)
+        return -1;
+
+    /*
+     * Converted stream data goes out in whole periods, a short tail
+     * waits for the next call or flush_stream()
+     */
+    frame_count = write_count / src_frame_bytes;
+
+    if (write_frames(&pcm_container, buffer, frame_count) < 0) {
         LOGE("Failed to pcm write\n");
         return -1;
     }
@@ -178,6 +937,124 @@ static int play_stream(int channels, int sample_rate, int sample_length,
     return 0;
 }
 
+/*
+ * play_lock is dropped even when the playing thread is cancelled
+ */
+static int play_wave(int fd) {
+    int error;
+
+    enter_play();
+    pthread_cleanup_push(leave_play, NULL);
+    error = do_play_wave(fd);
+    pthread_cleanup_pop(1);
+
+    return error;
+}
+
+static int play_sound(const struct wave_sound* sound) {
+    int error;
+
+    enter_play();
+    pthread_cleanup_push(leave_play, NULL);
+    error = do_play_sound(sound);
+    pthread_cleanup_pop(1);
+
+    return error;
+}
+
+static int play_stream(int channels, int sample_rate, int sample_length,
+        uint8_t* buffer, int write_count) {
+    int error;
+
+    enter_play();
+    pthread_cleanup_push(leave_play, NULL);
+    error = do_play_stream(channels, sample_rate, sample_length, buffer,
+            write_count);
+    pthread_cleanup_pop(1);
+
+    return error;
+}
+
+static int flush_stream(void) {
+    int error;
+
+    enter_play();
+    pthread_cleanup_push(leave_play, NULL);
+    error = flush_converter(&pcm_container);
+    pthread_cleanup_pop(1);
+
+    if (error < 0)
+        LOGE("Failed to flush stream\n");
+
+    return error;
+}
+
+static int set_hw_format(int channels, int sample_rate, int sample_length,
+        enum pcm_convert_quality quality) {
+    if (channels && (sample_rate <= 0 || (sample_length != 16
+            && sample_length != 24 && sample_length != 32))) {
+        LOGE("Invalid hw format %dch %dHz %dbit\n", channels, sample_rate,
+                sample_length);
+        return -1;
+    }
+
+    pthread_mutex_lock(&init_lock);
+
+    close_converter();
+
+    if (pcm_container.data_buf) {
+        free(pcm_container.data_buf);
+        pcm_container.data_buf = NULL;
+    }
+
+    hw_format.channels = channels;
+    hw_format.sample_rate = sample_rate;
+    hw_format.sample_length = sample_length;
+    hw_format.quality = quality;
+
+    /*
+     * Applied once on the next play, then kept for every source
+     */
+    hw_inited = 0;
+
+    pthread_mutex_unlock(&init_lock);
+
+    return 0;
+}
+
+static int set_buffer_size(uint32_t period_frames, uint32_t periods) {
+    pthread_mutex_lock(&init_lock);
+
+    close_converter();
+
+    if (pcm_container.data_buf) {
+        free(pcm_container.data_buf);
+        pcm_container.data_buf = NULL;
+    }
+
+    pcm_container.period_frames = period_frames;
+    pcm_container.periods = periods;
+
+    hw_inited = 0;
+
+    pthread_mutex_unlock(&init_lock);
+
+    return 0;
+}
+
+static int get_buffer_size(uint32_t* period_frames, uint32_t* buffer_frames) {
+    assert_die_if(period_frames == NULL, "period_frames is NULL\n");
+    assert_die_if(buffer_frames == NULL, "buffer_frames is NULL\n");
+
+    if (!hw_inited)
+        return -1;
+
+    *period_frames = pcm_container.chunk_size;
+    *buffer_frames = pcm_container.buffer_size;
+
+    return 0;
+}
+
 static int pause_play(void) {
     return pcm_pause(&pcm_container);
 }
@@ -187,16 +1064,42 @@ static int resume_play(void) {
 }
 
 static int cancel_play(void) {
+    pthread_mutex_lock(&prefetch.lock);
+    prefetch.quit = 1;
+    pthread_cond_broadcast(&prefetch.cond);
+    pthread_mutex_unlock(&prefetch.lock);
+
+    __atomic_store_n(&cancelled, 1, __ATOMIC_RELEASE);
+
     int error = pcm_cancel(&pcm_container);
 
-    if (pcm_container.data_buf) {
-        free(pcm_container.data_buf);
-        pcm_container.data_buf = NULL;
-    }
+    /*
+     * Nothing playing: reset now rather than on the next play
+     */
+    if (pthread_mutex_trylock(&play_lock) == 0)
+        leave_play(NULL);
 
     return error;
 }
 
+static int get_stat(struct wave_player_stat* stat) {
+    assert_die_if(stat == NULL, "stat is NULL\n");
+
+    pthread_mutex_lock(&stat_lock);
+    *stat = stats;
+    pthread_mutex_unlock(&stat_lock);
+
+    return 0;
+}
+
+static int reset_stat(void) {
+    pthread_mutex_lock(&stat_lock);
+    memset(&stats, 0, sizeof(stats));
+    pthread_mutex_unlock(&stat_lock);
+
+    return 0;
+}
+
 static int init(const char* snd_device) {
     assert_die_if(snd_device == NULL, "snd_device is NULL\n");
 
@@ -206,6 +1109,8 @@ static int init(const char* snd_device) {
 
     if (init_count++ == 0) {
         snd_output_stdio_attach(&pcm_container.out_log, stderr, 0);
+        pcm_convert = get_pcm_convert();
+        wave_codec = get_wave_codec();
 
         error = snd_pcm_open(&pcm_container.pcm_handle, snd_device,
                 SND_PCM_STREAM_PLAYBACK, 0);
@@ -236,6 +1141,8 @@ static int deinit(void) {
 
     if (--init_count == 0) {
         hw_inited = 0;
+        close_converter();
+        close_decoder();
 
         if (pcm_container.data_buf) {
             free(pcm_container.data_buf);
@@ -256,9 +1163,16 @@ static struct wave_player this = {
         .deinit = deinit,
         .play_wave = play_wave,
         .play_stream = play_stream,
+        .flush_stream = flush_stream,
+        .play_sound = play_sound,
         .pause_play = pause_play,
         .resume_play = resume_play,
         .cancel_play = cancel_play,
+        .set_hw_format = set_hw_format,
+        .set_buffer_size = set_buffer_size,
+        .get_buffer_size = get_buffer_size,
+        .get_stat = get_stat,
+        .reset_stat = reset_stat,
 };
 
 struct wave_player* get_wave_player(void) {
@@ -14,14 +14,30 @@
  *
  */
 
+#include <poll.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+
 #include <utils/log.h>
 #include <utils/assert.h>
 #include <utils/common.h>
+#include <thread/thread.h>
 #include <audio/alsa/wave_recorder.h>
+#include <audio/alsa/wave_codec.h>
+#include <audio/alsa/wave_vad.h>
 #include "wave_pcm_common.h"
 
 #define LOG_TAG "wave_recoder"
 
+/*
+ * Capture ring depth when the caller doesn't ask, and what
+ * record_wave() keeps to ride out slow storage
+ */
+#define DEFAULT_RING_MS         500
+#define RECORD_RING_MS          2000
+#define ENCODE_BUF_BYTES        4096
+#define DEFAULT_PREROLL_MS      200
+
 static WaveContainer wave_container;
 static struct snd_pcm_container pcm_container;
 static int hw_inited;
@@ -29,6 +45,722 @@ static uint32_t init_count;
 
 static pthread_mutex_t init_lock = PTHREAD_MUTEX_INITIALIZER;
 
+/*
+ * Device format pinned by set_hw_format(), channels 0 lets the
+ * device follow every request as before
+ */
+static struct {
+    int channels;
+    int sample_rate;
+    int sample_length;
+    enum pcm_convert_quality quality;
+} hw_format;
+
+static struct pcm_convert* pcm_convert;
+static struct pcm_convert_handle* converter;
+static struct pcm_convert_param converter_param;
+static uint8_t* convert_buf;
+static uint32_t convert_frames;
+static uint32_t out_frame_bytes;
+static int hw_rate;
+
+/*
+ * File format of record_wave()
+ */
+static struct wave_codec* wave_codec;
+static enum wave_codec_type record_codec;
+static struct wave_codec_handle* encoder;
+
+/*
+ * Metering and voice activity detection of start_capture(), off
+ * while vad_enabled is 0
+ */
+static struct wave_vad* wave_vad;
+static struct wave_vad_param vad_param;
+static int vad_enabled;
+static int vad_gate;
+
+/*
+ * Continuous capture. The capture thread is the single producer and
+ * the delivery thread or a pull caller the single consumer, so the
+ * ring needs no lock: each side only writes its own index and reads
+ * the other's with acquire ordering.
+ */
+struct capture {
+    int running;
+    int quit;
+
+    uint8_t* blocks;
+    uint32_t* sizes;
+    uint32_t block_bytes;
+    uint32_t block_count;
+    uint32_t head;
+    uint32_t tail;
+
+    int event_fd;
+    wave_capture_receive receive;
+    struct thread* reader;
+    struct thread* deliver;
+
+    /*
+     * The capture thread's own view of the device, so it can read
+     * straight into ring slots without touching the shared data_buf
+     */
+    struct snd_pcm_container container;
+    uint32_t xruns_base;
+    struct wave_capture_stat stat;
+
+    /*
+     * With the gate on, blocks outside speech go to the preroll ring
+     * and only reach the consumer when a segment opens. segments
+     * holds the segment of each queued block, 0 outside speech.
+     */
+    struct wave_vad_handle* vad;
+    int gate;
+    uint32_t frame_bytes;
+    uint32_t* segments;
+    uint8_t* preroll;
+    uint32_t* preroll_sizes;
+    uint32_t preroll_count;
+    uint32_t preroll_head;
+    uint32_t preroll_fill;
+
+    /*
+     * Latest meter, a sequence count lets readers copy it without a
+     * lock the capture thread would have to take
+     */
+    struct wave_meter meter;
+    uint32_t meter_seq;
+};
+
+static struct capture capture = {
+    .event_fd = -1,
+};
+
+static void close_converter(void) {
+    if (converter == NULL)
+        return;
+
+    pcm_convert->close(converter);
+    converter = NULL;
+
+    free(convert_buf);
+    convert_buf = NULL;
+}
+
+/*
+ * Configure the device on first use, and pick the converter from a
+ * pinned device format to what the caller asked for
+ */
+static int setup_input(int channels, int sample_rate, int sample_length) {
+    struct pcm_convert_param param;
+    int error;
+
+    hw_rate = hw_format.channels ? hw_format.sample_rate : sample_rate;
+
+    if (!hw_inited) {
+        if (hw_format.channels)
+            error = pcm_set_params(&pcm_container, hw_format.sample_length,
+                    hw_format.channels, hw_format.sample_rate);
+        else
+            error = pcm_set_params(&pcm_container, LE_SHORT(sample_length),
+                    channels, sample_rate);
+        if (error < 0) {
+            LOGE("Failed to set hw params\n");
+            return -1;
+        }
+
+        hw_inited = 1;
+    }
+
+    if (pcm_container.data_buf == NULL) {
+        pcm_container.data_buf = malloc(pcm_container.chunk_bytes);
+        if (pcm_container.data_buf == NULL) {
+            LOGE("Failed to malloc data_buffer\n");
+            return -1;
+        }
+    }
+
+    if (!hw_format.channels)
+        return 0;
+
+    if (sample_length != 16 && sample_length != 24 && sample_length != 32) {
+        LOGE("Can't convert to %d bit samples\n", sample_length);
+        return -1;
+    }
+
+    memset(&param, 0, sizeof(param));
+    param.in_format = pcm_sample_format_from_bits(hw_format.sample_length);
+    param.in_channels = hw_format.channels;
+    param.in_rate = hw_format.sample_rate;
+    param.out_format = pcm_sample_format_from_bits(sample_length);
+    param.out_channels = channels;
+    param.out_rate = sample_rate;
+    param.quality = hw_format.quality;
+
+    if (param.in_format == param.out_format
+            && param.in_channels == param.out_channels
+            && param.in_rate == param.out_rate) {
+        close_converter();
+        return 0;
+    }
+
+    if (converter && !memcmp(&param, &converter_param, sizeof(param)))
+        return 0;
+
+    close_converter();
+
+    converter = pcm_convert->open(&param);
+    if (converter == NULL) {
+        LOGE("Failed to open converter\n");
+        return -1;
+    }
+
+    out_frame_bytes = channels * pcm_convert->get_sample_bytes(param.out_format);
+    convert_frames = pcm_convert->get_out_frames(converter,
+            pcm_container.chunk_size);
+
+    convert_buf = malloc(convert_frames * out_frame_bytes);
+    if (convert_buf == NULL) {
+        LOGE("Failed to allocate convert buffer\n");
+        close_converter();
+        return -1;
+    }
+
+    converter_param = param;
+
+    return 0;
+}
+
+/*
+ * Read one period, returns bytes in the caller's format. Converted
+ * output goes to @out, or the shared convert buffer when NULL.
+ */
+static int read_chunk(struct snd_pcm_container* pcm_container, uint8_t* out,
+        uint8_t** buffer) {
+    uint32_t frames = pcm_container->chunk_size;
+    int ret;
+
+    if (pcm_read(pcm_container, frames) != frames)
+        return -1;
+
+    if (converter == NULL) {
+        *buffer = pcm_container->data_buf;
+        return pcm_container->chunk_bytes;
+    }
+
+    *buffer = out ? out : convert_buf;
+    ret = pcm_convert->process(converter, pcm_container->data_buf, &frames,
+            *buffer, convert_frames);
+
+    return ret * out_frame_bytes;
+}
+
+static uint32_t capture_block_bytes(void) {
+    if (converter)
+        return convert_frames * out_frame_bytes;
+
+    return pcm_container.chunk_bytes;
+}
+
+static void set_realtime(void) {
+    struct sched_param param;
+    int error;
+
+    param.sched_priority = sched_get_priority_max(SCHED_FIFO);
+
+    error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (error)
+        LOGW("Capture thread runs without SCHED_FIFO: %s\n", strerror(error));
+}
+
+static void notify_consumer(void) {
+    uint64_t one = 1;
+
+    if (capture.event_fd < 0)
+        return;
+
+    if (write(capture.event_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        LOGE("Failed to signal capture event: %s\n", strerror(errno));
+}
+
+static void publish_meter(const struct wave_meter* meter) {
+    __atomic_add_fetch(&capture.meter_seq, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    capture.meter = *meter;
+
+    __atomic_add_fetch(&capture.meter_seq, 1, __ATOMIC_RELEASE);
+}
+
+static void queue_block(uint32_t tail, uint32_t size, uint32_t segment) {
+    capture.sizes[tail % capture.block_count] = size;
+    capture.segments[tail % capture.block_count] = segment;
+}
+
+/*
+ * Slot for the next block while the gate is closed, the oldest one
+ * is given up when the preroll is full
+ */
+static uint8_t* preroll_slot(void) {
+    if (capture.preroll_fill == capture.preroll_count) {
+        capture.preroll_head = (capture.preroll_head + 1)
+                % capture.preroll_count;
+        capture.preroll_fill--;
+        capture.stat.gated++;
+    }
+
+    return capture.preroll + ((capture.preroll_head + capture.preroll_fill)
+            % capture.preroll_count) * capture.block_bytes;
+}
+
+/*
+ * A segment opened: queue what was read before the onset, oldest
+ * first, ending with the block that opened it
+ */
+static void flush_preroll(uint32_t segment) {
+    uint32_t tail = capture.tail;
+    uint32_t head = __atomic_load_n(&capture.head, __ATOMIC_ACQUIRE);
+    uint32_t index;
+
+    while (capture.preroll_fill) {
+        index = capture.preroll_head;
+
+        if (tail - head < capture.block_count) {
+            memcpy(capture.blocks + (tail % capture.block_count)
+                    * capture.block_bytes, capture.preroll
+                    + index * capture.block_bytes,
+                    capture.preroll_sizes[index]);
+            queue_block(tail, capture.preroll_sizes[index], segment);
+            tail++;
+        } else {
+            capture.stat.dropped++;
+        }
+
+        capture.preroll_head = (index + 1) % capture.preroll_count;
+        capture.preroll_fill--;
+    }
+
+    if (tail - head > capture.stat.max_fill)
+        capture.stat.max_fill = tail - head;
+
+    __atomic_store_n(&capture.tail, tail, __ATOMIC_RELEASE);
+
+    notify_consumer();
+}
+
+/*
+ * Capture thread: never blocks on anything but ALSA. With the ring
+ * full the period is still read, so the device never overruns, and
+ * dropped instead.
+ */
+static void capture_loop(struct pthread_wrapper* thread, void* param) {
+    enum wave_vad_state state = WAVE_VAD_SILENCE;
+    struct wave_meter meter;
+    uint32_t segment = 0;
+    uint32_t head;
+    uint32_t tail;
+    uint32_t fill;
+    uint8_t* slot;
+    uint8_t* buffer;
+    int closed;
+    int size;
+
+    set_realtime();
+
+    while (!__atomic_load_n(&capture.quit, __ATOMIC_RELAXED)) {
+        tail = capture.tail;
+        head = __atomic_load_n(&capture.head, __ATOMIC_ACQUIRE);
+        fill = tail - head;
+
+        closed = capture.gate && (state == WAVE_VAD_SILENCE
+                || state == WAVE_VAD_ONSET);
+
+        slot = NULL;
+        if (closed)
+            slot = preroll_slot();
+        else if (fill < capture.block_count)
+            slot = capture.blocks
+                    + (tail % capture.block_count) * capture.block_bytes;
+
+        if (converter == NULL)
+            capture.container.data_buf = slot ? slot : pcm_container.data_buf;
+
+        size = read_chunk(&capture.container, slot, &buffer);
+        if (size < 0) {
+            LOGE("Failed to read capture period\n");
+            break;
+        }
+
+        capture.stat.periods++;
+        capture.stat.xruns = capture.container.xruns - capture.xruns_base;
+
+        if (capture.vad) {
+            state = wave_vad->process(capture.vad, buffer,
+                    size / capture.frame_bytes, &meter);
+            publish_meter(&meter);
+
+            segment = state == WAVE_VAD_SPEECH || state == WAVE_VAD_HANGOVER
+                    ? meter.segment : 0;
+            capture.stat.segments = meter.segment;
+        }
+
+        if (closed) {
+            capture.preroll_sizes[(capture.preroll_head
+                    + capture.preroll_fill) % capture.preroll_count] = size;
+            capture.preroll_fill++;
+
+            if (state == WAVE_VAD_SPEECH)
+                flush_preroll(segment);
+            continue;
+        }
+
+        if (slot == NULL) {
+            capture.stat.dropped++;
+            continue;
+        }
+
+        if (fill + 1 > capture.stat.max_fill)
+            capture.stat.max_fill = fill + 1;
+
+        queue_block(tail, size, segment);
+        __atomic_store_n(&capture.tail, tail + 1, __ATOMIC_RELEASE);
+
+        notify_consumer();
+    }
+
+    /*
+     * Let a blocked consumer see the end of the stream
+     */
+    __atomic_store_n(&capture.running, 0, __ATOMIC_RELEASE);
+    notify_consumer();
+}
+
+static int dequeue_capture(uint8_t** buffer, int timeout_ms) {
+    assert_die_if(buffer == NULL, "buffer is NULL\n");
+
+    struct pollfd pfd;
+    uint64_t value;
+    uint32_t head;
+    uint32_t tail;
+    int ret;
+
+    if (capture.blocks == NULL)
+        return -1;
+
+    for (;;) {
+        head = capture.head;
+        tail = __atomic_load_n(&capture.tail, __ATOMIC_ACQUIRE);
+
+        if (tail != head) {
+            *buffer = capture.blocks
+                    + (head % capture.block_count) * capture.block_bytes;
+            return capture.sizes[head % capture.block_count];
+        }
+
+        if (!__atomic_load_n(&capture.running, __ATOMIC_ACQUIRE))
+            return -1;
+
+        pfd.fd = capture.event_fd;
+        pfd.events = POLLIN;
+
+        ret = poll(&pfd, 1, timeout_ms);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            LOGE("Failed to poll capture event: %s\n", strerror(errno));
+            return -1;
+        }
+
+        if (ret == 0)
+            return 0;
+
+        read(capture.event_fd, &value, sizeof(value));
+    }
+}
+
+static int release_capture(void) {
+    uint32_t head = capture.head;
+
+    if (head == __atomic_load_n(&capture.tail, __ATOMIC_ACQUIRE))
+        return -1;
+
+    __atomic_store_n(&capture.head, head + 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+static void deliver_loop(struct pthread_wrapper* thread, void* param) {
+    uint8_t* buffer;
+    int size;
+
+    for (;;) {
+        size = dequeue_capture(&buffer, -1);
+        if (size < 0 || __atomic_load_n(&capture.quit, __ATOMIC_RELAXED))
+            break;
+
+        if (size == 0)
+            continue;
+
+        capture.receive(buffer, size);
+        release_capture();
+    }
+}
+
+static void free_capture(void) {
+    free(capture.blocks);
+    capture.blocks = NULL;
+    free(capture.sizes);
+    capture.sizes = NULL;
+    free(capture.segments);
+    capture.segments = NULL;
+
+    free(capture.preroll);
+    capture.preroll = NULL;
+    free(capture.preroll_sizes);
+    capture.preroll_sizes = NULL;
+
+    if (capture.vad) {
+        wave_vad->close(capture.vad);
+        capture.vad = NULL;
+    }
+
+    if (capture.event_fd >= 0) {
+        close(capture.event_fd);
+        capture.event_fd = -1;
+    }
+}
+
+/*
+ * Stop the device side, the consumer can still drain what is queued
+ */
+static void halt_capture(void) {
+    __atomic_store_n(&capture.quit, 1, __ATOMIC_RELEASE);
+
+    /*
+     * The reader may sit in snd_pcm_wait(), pcm_read() tests for
+     * cancellation each round and the reader holds no lock
+     */
+    if (capture.reader) {
+        capture.reader->stop(capture.reader);
+        _delete(capture.reader);
+        capture.reader = NULL;
+
+        snd_pcm_drop(pcm_container.pcm_handle);
+        pcm_container.xruns = capture.container.xruns;
+    }
+
+    __atomic_store_n(&capture.running, 0, __ATOMIC_RELEASE);
+    notify_consumer();
+}
+
+static int stop_capture(void) {
+    if (capture.event_fd < 0)
+        return 0;
+
+    halt_capture();
+
+    if (capture.deliver) {
+        capture.deliver->wait(capture.deliver);
+        _delete(capture.deliver);
+        capture.deliver = NULL;
+    }
+
+    free_capture();
+
+    return 0;
+}
+
+static int open_vad(int channels, int sample_rate, int sample_length) {
+    struct wave_vad_param param = vad_param;
+    uint64_t preroll_frames;
+    uint32_t preroll_ms = param.preroll_ms ? param.preroll_ms
+            : DEFAULT_PREROLL_MS;
+
+    param.format = pcm_sample_format_from_bits(sample_length);
+    param.channels = channels;
+    param.sample_rate = sample_rate;
+
+    capture.frame_bytes = channels * pcm_convert->get_sample_bytes(param.format);
+    capture.gate = vad_gate;
+
+    capture.vad = wave_vad->open(&param);
+    if (capture.vad == NULL)
+        return -1;
+
+    if (!capture.gate)
+        return 0;
+
+    /*
+     * Room for the preroll and the block that opens the segment
+     */
+    preroll_frames = (uint64_t) hw_rate * preroll_ms / 1000;
+    capture.preroll_count = (preroll_frames + pcm_container.chunk_size - 1)
+            / pcm_container.chunk_size + 1;
+    capture.preroll_head = 0;
+    capture.preroll_fill = 0;
+
+    capture.preroll = malloc(capture.preroll_count * capture.block_bytes);
+    capture.preroll_sizes = calloc(capture.preroll_count, sizeof(uint32_t));
+    if (capture.preroll == NULL || capture.preroll_sizes == NULL) {
+        LOGE("Failed to allocate capture preroll\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int open_capture(int channels, int sample_rate, int sample_length,
+        int ring_ms, wave_capture_receive receive, int detect) {
+    uint64_t ring_frames;
+
+    if (capture.event_fd >= 0) {
+        LOGE("Capture already running\n");
+        return -1;
+    }
+
+    if (setup_input(channels, sample_rate, sample_length) < 0)
+        return -1;
+
+    if (converter)
+        pcm_convert->reset(converter);
+
+    if (ring_ms <= 0)
+        ring_ms = DEFAULT_RING_MS;
+
+    ring_frames = (uint64_t) hw_rate * ring_ms / 1000;
+
+    memset(&capture.stat, 0, sizeof(capture.stat));
+    capture.block_bytes = capture_block_bytes();
+    capture.block_count = MAX(2, (ring_frames + pcm_container.chunk_size - 1)
+            / pcm_container.chunk_size);
+    capture.head = 0;
+    capture.tail = 0;
+    capture.quit = 0;
+    capture.running = 1;
+    capture.receive = receive;
+    capture.container = pcm_container;
+    capture.xruns_base = pcm_container.xruns;
+
+    capture.event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (capture.event_fd < 0) {
+        LOGE("Failed to create capture eventfd: %s\n", strerror(errno));
+        goto error;
+    }
+
+    capture.blocks = malloc(capture.block_count * capture.block_bytes);
+    capture.sizes = calloc(capture.block_count, sizeof(uint32_t));
+    capture.segments = calloc(capture.block_count, sizeof(uint32_t));
+    if (capture.blocks == NULL || capture.sizes == NULL
+            || capture.segments == NULL) {
+        LOGE("Failed to allocate capture ring\n");
+        goto error;
+    }
+
+    capture.stat.block_bytes = capture.block_bytes;
+    capture.stat.block_count = capture.block_count;
+
+    capture.gate = 0;
+    capture.meter_seq = 0;
+    memset(&capture.meter, 0, sizeof(capture.meter));
+    if (detect && vad_enabled && open_vad(channels, sample_rate,
+            sample_length) < 0)
+        goto error;
+
+    if (receive) {
+        capture.deliver = _new(struct thread, thread);
+        capture.deliver->runnable.run = deliver_loop;
+        if (capture.deliver->start(capture.deliver, NULL) < 0) {
+            LOGE("Failed to start capture delivery thread\n");
+            _delete(capture.deliver);
+            capture.deliver = NULL;
+            goto error;
+        }
+    }
+
+    capture.reader = _new(struct thread, thread);
+    capture.reader->runnable.run = capture_loop;
+    if (capture.reader->start(capture.reader, NULL) < 0) {
+        LOGE("Failed to start capture thread\n");
+        _delete(capture.reader);
+        capture.reader = NULL;
+        goto error;
+    }
+
+    return 0;
+
+error:
+    stop_capture();
+
+    return -1;
+}
+
+static int start_capture(int channels, int sample_rate, int sample_length,
+        int ring_ms, wave_capture_receive receive) {
+    assert_die_if(channels <= 0, "Invaild channels\n");
+    assert_die_if(sample_rate <= 0, "Invaild sample rate\n");
+    assert_die_if(sample_length <= 0, "Invaild sample_length\n");
+
+    return open_capture(channels, sample_rate, sample_length, ring_ms,
+            receive, 1);
+}
+
+static int set_capture_vad(const struct wave_vad_param* param, int gate) {
+    if (capture.event_fd >= 0) {
+        LOGE("Can't change vad while capturing\n");
+        return -1;
+    }
+
+    vad_enabled = param != NULL;
+    vad_gate = vad_enabled && gate;
+    if (param)
+        vad_param = *param;
+
+    return 0;
+}
+
+static int get_capture_level(struct wave_meter* meter) {
+    assert_die_if(meter == NULL, "meter is NULL\n");
+
+    uint32_t seq;
+
+    if (capture.vad == NULL)
+        return -1;
+
+    do {
+        seq = __atomic_load_n(&capture.meter_seq, __ATOMIC_ACQUIRE);
+        *meter = capture.meter;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n(&capture.meter_seq,
+            __ATOMIC_RELAXED));
+
+    return 0;
+}
+
+static int get_capture_segment(void) {
+    uint32_t head = capture.head;
+
+    if (capture.segments == NULL
+            || head == __atomic_load_n(&capture.tail, __ATOMIC_ACQUIRE))
+        return -1;
+
+    return capture.segments[head % capture.block_count];
+}
+
+static int get_capture_fd(void) {
+    return capture.event_fd;
+}
+
+static int get_capture_stat(struct wave_capture_stat* stat) {
+    assert_die_if(stat == NULL, "stat is NULL\n");
+
+    *stat = capture.stat;
+    stat->fill = __atomic_load_n(&capture.tail, __ATOMIC_ACQUIRE)
+            - __atomic_load_n(&capture.head, __ATOMIC_ACQUIRE);
+
+    return 0;
+}
+
 static int prepare_wave_params(WaveContainer *wav, int channels, int sample_rate,
         int sample_length, int duration_time) {
 
@@ -53,12 +785,87 @@ static int prepare_wave_params(WaveContainer *wav, int channels, int sample_rate
     return 0;
 }
 
+static void record_cleanup(void* arg) {
+    stop_capture();
+}
+
+static int write_encoded(int fd, uint8_t* buffer, uint32_t size,
+        uint64_t* coded) {
+    uint8_t out[ENCODE_BUF_BYTES];
+    uint32_t frame_bytes = LE_SHORT(wave_container.format.channels) * 2;
+    uint32_t frames = size / frame_bytes;
+    uint32_t consumed;
+    int ret;
+
+    do {
+        consumed = frames;
+        if (buffer)
+            ret = wave_codec->encode(encoder, buffer, &consumed, out,
+                    sizeof(out));
+        else
+            ret = wave_codec->flush(encoder, out, sizeof(out));
+
+        if (ret > 0 && write(fd, out, ret) != ret) {
+            LOGE("Failed to write wave file\n");
+            return -1;
+        }
+
+        *coded += ret;
+        frames -= consumed;
+        if (buffer)
+            buffer += consumed * frame_bytes;
+    } while (frames || ret == sizeof(out) || (buffer == NULL && ret > 0));
+
+    return 0;
+}
+
+/*
+ * The data length of a compressed file is only known at the end, fill
+ * it and the fact chunk in once everything is written
+ */
+static int finish_encoded(int fd, WaveContainer* wave_container,
+        uint64_t coded) {
+    uint32_t header_bytes = sizeof(wave_container->header)
+            + sizeof(wave_container->format) + sizeof(wave_container->codec)
+            + sizeof(wave_container->fact) + sizeof(wave_container->chunk_header);
+    uint8_t pad = 0;
+
+    /*
+     * RIFF chunks are word aligned
+     */
+    if ((coded & 1) && write(fd, &pad, 1) != 1)
+        return -1;
+
+    wave_codec->fill_header(encoder, wave_container);
+    wave_container->chunk_header.length = LE_INT(coded);
+    wave_container->header.length = LE_INT(header_bytes - 8
+            + ((coded + 1) & ~1ull));
+
+    if (lseek(fd, 0, SEEK_SET) < 0) {
+        LOGW("Output not seekable, wave header left without lengths\n");
+        return 0;
+    }
+
+    if (wave_write_header(fd, wave_container) < 0) {
+        LOGE("Failed to update wave header\n");
+        return -1;
+    }
+
+    lseek(fd, 0, SEEK_END);
+
+    return 0;
+}
+
+/*
+ * Capture runs on its own thread into a deep ring, so a stall in
+ * write() only fills the ring instead of overrunning the device
+ */
 static int do_record_wave(struct snd_pcm_container* pcm_container,
-        WaveContainer* wave_container, int fd) {
+        WaveContainer* wave_container, int fd, uint64_t count) {
+    uint64_t coded = 0;
+    uint8_t* buffer;
     int error = 0;
-    uint64_t count;
-    uint32_t writed;
-    uint32_t frame_count;
+    int size;
 
     error = wave_write_header(fd, wave_container);
     if (error < 0) {
@@ -66,23 +873,50 @@ static int do_record_wave(struct snd_pcm_container* pcm_container,
         return -1;
     }
 
-    count = wave_container->chunk_header.length;
-    while (count) {
-        writed = (count <= pcm_container->chunk_bytes) ? count : pcm_container->chunk_bytes;
-        frame_count = writed * 8 / pcm_container->bits_per_frame;
+    error = open_capture(LE_SHORT(wave_container->format.channels),
+            LE_INT(wave_container->format.sample_fq),
+            encoder ? 16 : LE_SHORT(wave_container->format.bit_p_spl),
+            RECORD_RING_MS, NULL, 0);
+    if (error < 0)
+        return -1;
+
+    pthread_cleanup_push(record_cleanup, NULL);
 
-        if (pcm_read(pcm_container, frame_count) != frame_count)
+    while (count) {
+        size = dequeue_capture(&buffer, -1);
+        if (size < 0)
             break;
 
-        if (write(fd, pcm_container->data_buf, writed) != writed) {
+        if (size == 0)
+            continue;
+
+        size = MIN(count, size);
+        if (encoder)
+            error = write_encoded(fd, buffer, size, &coded);
+        else if (write(fd, buffer, size) != size)
+            error = -1;
+
+        if (error < 0) {
             LOGE("Failed to write wave file\n");
-            return -1;
+            break;
         }
 
-        count -= writed;
+        release_capture();
+        count -= size;
     }
 
-    return 0;
+    if (capture.stat.dropped)
+        LOGW("Dropped %u periods, storage too slow\n", capture.stat.dropped);
+
+    pthread_cleanup_pop(1);
+
+    if (encoder && error == 0)
+        error = write_encoded(fd, NULL, 0, &coded);
+
+    if (encoder && error == 0)
+        error = finish_encoded(fd, wave_container, coded);
+
+    return error;
 }
 
 int record_wave(int fd, int channles, int sample_rate, int sample_length,
@@ -93,8 +927,19 @@ int record_wave(int fd, int channles, int sample_rate, int sample_length,
     assert_die_if(sample_length < 0, "Invaild sample_length\n");
     assert_die_if(duration_time < 0, "Invaild time\n");
 
+    uint64_t count;
     int error = 0;
 
+    if (capture.event_fd >= 0) {
+        LOGE("Capture running\n");
+        return -1;
+    }
+
+    if (record_codec != WAVE_CODEC_PCM && sample_length != 16) {
+        LOGE("Compressed recording takes 16 bit samples\n");
+        return -1;
+    }
+
     error = prepare_wave_params(&wave_container, channles, sample_rate,
             sample_length, duration_time);
     if (error < 0) {
@@ -102,28 +947,41 @@ int record_wave(int fd, int channles, int sample_rate, int sample_length,
         goto error;
     }
 
-    if (!hw_inited) {
-        error = pcm_set_params(&pcm_container, LE_SHORT(sample_length), channles,
+    count = LE_INT(wave_container.chunk_header.length);
+
+    if (encoder) {
+        wave_codec->close(encoder);
+        encoder = NULL;
+    }
+
+    if (record_codec != WAVE_CODEC_PCM) {
+        encoder = wave_codec->open_encoder(record_codec, channles,
                 sample_rate);
-        if (error < 0) {
-            LOGE("Failed to set hw params\n");
+        if (encoder == NULL)
             goto error;
-        }
 
-        hw_inited = 1;
+        wave_codec->fill_header(encoder, &wave_container);
+        wave_container.chunk_header.length = 0;
     }
 
+    error = setup_input(channles, sample_rate, sample_length);
+    if (error < 0)
+        goto error;
+
 #ifdef LOCAL_DEBUG
     snd_pcm_dump(pcm_container.pcm_handle, pcm_container.out_log);
 #endif
 
-    error = do_record_wave(&pcm_container, &wave_container, fd);
+    error = do_record_wave(&pcm_container, &wave_container, fd, count);
     if (error < 0) {
         LOGE("Failed to record\n");
         goto error;
     }
 
-    snd_pcm_drain(pcm_container.pcm_handle);
+    if (encoder) {
+        wave_codec->close(encoder);
+        encoder = NULL;
+    }
 
     if (pcm_container.data_buf) {
         free(pcm_container.data_buf);
@@ -133,6 +991,11 @@ int record_wave(int fd, int channles, int sample_rate, int sample_length,
     return 0;
 
 error:
+    if (encoder) {
+        wave_codec->close(encoder);
+        encoder = NULL;
+    }
+
     if (pcm_container.data_buf) {
         free(pcm_container.data_buf);
         pcm_container.data_buf = NULL;
@@ -147,32 +1010,113 @@ static int record_stream(int channels, int sample_rate, int sample_length,
     assert_die_if(sample_rate < 0, "Invaild sample rate\n");
     assert_die_if(sample_length < 0, "Invaild sample_length\n");
 
-    int error = 0;
+    int size;
 
-    if (!hw_inited) {
-        error = pcm_set_params(&pcm_container, LE_SHORT(sample_length), channels,
-                sample_rate);
-        if (error < 0) {
-            LOGE("Failed to set hw params\n");
-            return -1;
-        }
+    if (capture.event_fd >= 0) {
+        LOGE("Capture running, use dequeue_capture\n");
+        return -1;
+    }
 
-        hw_inited = 1;
+    if (setup_input(channels, sample_rate, sample_length) < 0)
+        return -1;
+
+    size = read_chunk(&pcm_container, NULL, buffer);
+    if (size < 0) {
+        LOGE("Failed to pcm read\n");
+        return -1;
+    }
+
+    return size;
+}
+
+static int set_hw_format(int channels, int sample_rate, int sample_length,
+        enum pcm_convert_quality quality) {
+    if (channels && (sample_rate <= 0 || (sample_length != 16
+            && sample_length != 24 && sample_length != 32))) {
+        LOGE("Invalid hw format %dch %dHz %dbit\n", channels, sample_rate,
+                sample_length);
+        return -1;
     }
 
-    error = pcm_read(&pcm_container, pcm_container.chunk_size);
-    if (error != pcm_container.chunk_size) {
-        LOGE("Failed to pcm write\n");
+    pthread_mutex_lock(&init_lock);
+
+    close_converter();
+
+    if (pcm_container.data_buf) {
+        free(pcm_container.data_buf);
+        pcm_container.data_buf = NULL;
+    }
+
+    hw_format.channels = channels;
+    hw_format.sample_rate = sample_rate;
+    hw_format.sample_length = sample_length;
+    hw_format.quality = quality;
+
+    hw_inited = 0;
+
+    pthread_mutex_unlock(&init_lock);
+
+    return 0;
+}
+
+static int set_buffer_size(uint32_t period_frames, uint32_t periods) {
+    if (capture.event_fd >= 0) {
+        LOGE("Can't resize the buffer while capturing\n");
         return -1;
     }
 
-    *buffer = pcm_container.data_buf;
+    pthread_mutex_lock(&init_lock);
 
-    return pcm_container.chunk_bytes;
+    close_converter();
+
+    if (pcm_container.data_buf) {
+        free(pcm_container.data_buf);
+        pcm_container.data_buf = NULL;
+    }
+
+    pcm_container.period_frames = period_frames;
+    pcm_container.periods = periods;
+
+    hw_inited = 0;
+
+    pthread_mutex_unlock(&init_lock);
+
+    return 0;
+}
+
+static int get_buffer_size(uint32_t* period_frames, uint32_t* buffer_frames) {
+    assert_die_if(period_frames == NULL, "period_frames is NULL\n");
+    assert_die_if(buffer_frames == NULL, "buffer_frames is NULL\n");
+
+    if (!hw_inited)
+        return -1;
+
+    *period_frames = pcm_container.chunk_size;
+    *buffer_frames = pcm_container.buffer_size;
+
+    return 0;
+}
+
+static int set_codec(enum wave_codec_type codec) {
+    if (codec < WAVE_CODEC_PCM || codec > WAVE_CODEC_LOSSLESS) {
+        LOGE("Invalid codec %d\n", codec);
+        return -1;
+    }
+
+    record_codec = codec;
+
+    return 0;
 }
 
 static int cancel_record(void) {
-    int error = pcm_cancel(&pcm_container);
+    int error;
+
+    halt_capture();
+
+    error = pcm_cancel(&pcm_container);
+
+    if (converter)
+        pcm_convert->reset(converter);
 
     if (pcm_container.data_buf) {
         free(pcm_container.data_buf);
@@ -191,6 +1135,9 @@ static int init(const char* snd_device) {
 
     if (init_count++ == 0) {
         snd_output_stdio_attach(&pcm_container.out_log, stderr, 0);
+        pcm_convert = get_pcm_convert();
+        wave_codec = get_wave_codec();
+        wave_vad = get_wave_vad();
 
         error = snd_pcm_open(&pcm_container.pcm_handle, snd_device,
                 SND_PCM_STREAM_CAPTURE, 0);
@@ -220,7 +1167,15 @@ static int deinit(void) {
     pthread_mutex_lock(&init_lock);
 
     if (--init_count == 0) {
+        stop_capture();
+
+        if (encoder) {
+            wave_codec->close(encoder);
+            encoder = NULL;
+        }
+
         hw_inited = 0;
+        close_converter();
 
         if (pcm_container.data_buf) {
             free(pcm_container.data_buf);
@@ -242,6 +1197,19 @@ static struct wave_recorder this = {
         .record_wave = record_wave,
         .record_stream = record_stream,
         .cancel_record = cancel_record,
+        .set_hw_format = set_hw_format,
+        .set_buffer_size = set_buffer_size,
+        .get_buffer_size = get_buffer_size,
+        .set_codec = set_codec,
+        .start_capture = start_capture,
+        .stop_capture = stop_capture,
+        .dequeue_capture = dequeue_capture,
+        .release_capture = release_capture,
+        .get_capture_fd = get_capture_fd,
+        .get_capture_stat = get_capture_stat,
+        .set_capture_vad = set_capture_vad,
+        .get_capture_level = get_capture_level,
+        .get_capture_segment = get_capture_segment,
 };
 
 struct wave_recorder* get_wave_recorder(void) {
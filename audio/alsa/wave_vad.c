@@ -0,0 +1,340 @@
+/*
+ *  Copyright (C) 2017, Zhang YanMing <yanmin.zhang@ingenic.com, jamincheung@126.com>
+ *
+ *  Ingenic Linux plarform SDK project
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <utils/log.h>
+#include <utils/assert.h>
+#include <utils/common.h>
+#include <audio/alsa/wave_vad.h>
+
+#define LOG_TAG "wave_vad"
+
+#define DEFAULT_THRESHOLD_DB    12
+#define DEFAULT_ATTACK_MS       40
+#define DEFAULT_HANGOVER_MS     300
+
+/*
+ * Mean square of full scale 16 bit samples is 2^30; nothing quieter
+ * than -60dBFS counts as speech however low the floor gets
+ */
+#define FULL_SCALE_LOG2         30
+#define SPEECH_MIN_ENERGY       1074
+#define SILENCE_CDB             (-9600)
+
+/*
+ * The floor can rise to the quietest block of the last second, kept
+ * as the minimum of each quarter, pauses between words keep it down
+ */
+#define FLOOR_WINDOWS           4
+#define FLOOR_WINDOW_DIV        4
+
+/*
+ * 10^(dB/10) in Q8 for 0, 1 and 2dB
+ */
+static const uint16_t remainder_q8[3] = {256, 322, 406};
+
+struct wave_vad_handle {
+    uint32_t channels;
+    uint32_t sample_bytes;
+    uint32_t sample_offset;     /* of the top 16 bits in a sample */
+
+    uint32_t threshold_q8;      /* energy ratio over the floor */
+    uint32_t attack_frames;
+    uint32_t hangover_frames;
+    uint32_t window_frames;
+
+    enum wave_vad_state state;
+    uint32_t noise;
+    uint32_t window_min[FLOOR_WINDOWS];
+    uint32_t window_index;
+    uint32_t window_fill;       /* frames in the current window */
+    uint32_t run_frames;        /* in ONSET or HANGOVER so far */
+    uint32_t segment;
+};
+
+/*
+ * log2(x) with 10 fractional bits: integer part from the top bit, each
+ * fraction bit from squaring the mantissa
+ */
+static int32_t log2_q10(uint64_t x) {
+    int msb = 63 - __builtin_clzll(x);
+    int32_t result = msb << 10;
+    uint64_t m;
+
+    m = msb > 30 ? x >> (msb - 30) : x << (30 - msb);
+
+    for (int bit = 9; bit >= 0; bit--) {
+        m = (m * m) >> 30;
+        if (m >= (2ULL << 30)) {
+            m >>= 1;
+            result |= 1 << bit;
+        }
+    }
+
+    return result;
+}
+
+static int32_t energy_to_cdb(uint32_t energy) {
+    if (energy == 0)
+        return SILENCE_CDB;
+
+    return MAX(SILENCE_CDB, (log2_q10(energy) - (FULL_SCALE_LOG2 << 10))
+            * 301 / 1024);
+}
+
+static int32_t peak_to_cdb(uint32_t peak) {
+    if (peak == 0)
+        return SILENCE_CDB;
+
+    return MAX(SILENCE_CDB, (log2_q10(peak) - (15 << 10)) * 602 / 1024);
+}
+
+/*
+ * Every format is metered on the top 16 bits of each sample
+ */
+static void measure(struct wave_vad_handle* handle, const uint8_t* buffer,
+        uint32_t frames, uint32_t* energy, uint32_t* peak) {
+    const uint8_t* p = buffer + handle->sample_offset;
+    uint32_t samples = frames * handle->channels;
+    uint32_t stride = handle->sample_bytes;
+    uint64_t sum = 0;
+    uint32_t max = 0;
+    uint32_t magnitude;
+    int32_t sample;
+
+    for (uint32_t i = 0; i < samples; i++, p += stride) {
+        sample = (int16_t) (p[0] | (p[1] << 8));
+        magnitude = sample < 0 ? -sample : sample;
+
+        sum += (uint32_t) (sample * sample);
+        if (magnitude > max)
+            max = magnitude;
+    }
+
+    *energy = samples ? sum / samples : 0;
+    *peak = max;
+}
+
+/*
+ * The floor follows a drop at once and rises towards the minimum of
+ * the last second, a steady new noise is learned in about a second
+ * whatever the blocks in between were
+ */
+static void track_noise(struct wave_vad_handle* handle, uint32_t energy,
+        uint32_t frames) {
+    uint32_t floor = UINT32_MAX;
+    uint32_t i;
+
+    if (energy < handle->window_min[handle->window_index])
+        handle->window_min[handle->window_index] = energy;
+
+    for (i = 0; i < FLOOR_WINDOWS; i++)
+        floor = MIN(floor, handle->window_min[i]);
+
+    if (energy < handle->noise)
+        handle->noise -= (handle->noise - energy) >> 2;
+    else if (floor > handle->noise)
+        handle->noise += (floor - handle->noise) >> 3;
+
+    if (handle->noise == 0)
+        handle->noise = 1;
+
+    handle->window_fill += frames;
+    if (handle->window_fill >= handle->window_frames) {
+        handle->window_fill = 0;
+        handle->window_index = (handle->window_index + 1) % FLOOR_WINDOWS;
+        handle->window_min[handle->window_index] = UINT32_MAX;
+    }
+}
+
+static enum wave_vad_state process(struct wave_vad_handle* handle,
+        const uint8_t* buffer, uint32_t frames, struct wave_meter* meter) {
+    assert_die_if(handle == NULL, "handle is NULL\n");
+    assert_die_if(buffer == NULL && frames, "buffer is NULL\n");
+
+    uint32_t energy;
+    uint32_t peak;
+    int loud;
+
+    measure(handle, buffer, frames, &energy, &peak);
+
+    if (handle->noise == 0)
+        handle->noise = MAX(energy, 1);
+
+    loud = energy >= SPEECH_MIN_ENERGY && energy
+            > ((uint64_t) handle->noise * handle->threshold_q8 >> 8);
+
+    track_noise(handle, energy, frames);
+
+    switch (handle->state) {
+    case WAVE_VAD_SILENCE:
+        if (!loud)
+            break;
+
+        handle->state = WAVE_VAD_ONSET;
+        handle->run_frames = 0;
+
+        /* fall through */
+    case WAVE_VAD_ONSET:
+        if (!loud) {
+            handle->state = WAVE_VAD_SILENCE;
+            break;
+        }
+
+        handle->run_frames += frames;
+        if (handle->run_frames >= handle->attack_frames) {
+            handle->state = WAVE_VAD_SPEECH;
+            handle->segment++;
+        }
+        break;
+
+    case WAVE_VAD_SPEECH:
+        if (loud)
+            break;
+
+        handle->state = WAVE_VAD_HANGOVER;
+        handle->run_frames = 0;
+
+        /* fall through */
+    case WAVE_VAD_HANGOVER:
+        if (loud) {
+            handle->state = WAVE_VAD_SPEECH;
+            break;
+        }
+
+        handle->run_frames += frames;
+        if (handle->run_frames >= handle->hangover_frames)
+            handle->state = WAVE_VAD_SILENCE;
+        break;
+    }
+
+    if (meter) {
+        meter->rms = energy_to_cdb(energy);
+        meter->peak = peak_to_cdb(peak);
+        meter->noise = energy_to_cdb(handle->noise);
+        meter->state = handle->state;
+        meter->segment = handle->segment;
+    }
+
+    return handle->state;
+}
+
+static int reset(struct wave_vad_handle* handle) {
+    assert_die_if(handle == NULL, "handle is NULL\n");
+
+    handle->state = WAVE_VAD_SILENCE;
+    handle->noise = 0;
+    handle->run_frames = 0;
+    handle->segment = 0;
+
+    for (int i = 0; i < FLOOR_WINDOWS; i++)
+        handle->window_min[i] = UINT32_MAX;
+    handle->window_index = 0;
+    handle->window_fill = 0;
+
+    return 0;
+}
+
+static struct wave_vad_handle* vad_open(const struct wave_vad_param* param) {
+    assert_die_if(param == NULL, "param is NULL\n");
+
+    struct wave_vad_handle* handle;
+    uint32_t threshold_db = param->threshold_db ? param->threshold_db
+            : DEFAULT_THRESHOLD_DB;
+    uint32_t attack_ms = param->attack_ms ? param->attack_ms
+            : DEFAULT_ATTACK_MS;
+    uint32_t hangover_ms = param->hangover_ms ? param->hangover_ms
+            : DEFAULT_HANGOVER_MS;
+    uint64_t ratio = 256;
+
+    if (param->channels <= 0 || param->sample_rate <= 0) {
+        LOGE("Invalid vad format %dch %dHz\n", param->channels,
+                param->sample_rate);
+        return NULL;
+    }
+
+    if (threshold_db > 40) {
+        LOGE("Invalid vad threshold %udB\n", threshold_db);
+        return NULL;
+    }
+
+    handle = calloc(1, sizeof(*handle));
+    if (handle == NULL) {
+        LOGE("Failed to allocate vad\n");
+        return NULL;
+    }
+
+    switch (param->format) {
+    case PCM_SAMPLE_S16:
+        handle->sample_bytes = 2;
+        handle->sample_offset = 0;
+        break;
+    case PCM_SAMPLE_S24:
+        handle->sample_bytes = 4;
+        handle->sample_offset = 1;
+        break;
+    case PCM_SAMPLE_S24_3:
+        handle->sample_bytes = 3;
+        handle->sample_offset = 1;
+        break;
+    case PCM_SAMPLE_S32:
+        handle->sample_bytes = 4;
+        handle->sample_offset = 2;
+        break;
+    default:
+        LOGE("Unsupported vad sample format %d\n", param->format);
+        free(handle);
+        return NULL;
+    }
+
+    /*
+     * 10^(dB/10) in Q8, doubling per 3dB then the remainder
+     */
+    for (uint32_t db = threshold_db; db >= 3; db -= 3)
+        ratio *= 2;
+    ratio = ratio * remainder_q8[threshold_db % 3] / 256;
+
+    handle->channels = param->channels;
+    handle->threshold_q8 = ratio;
+    handle->attack_frames = (uint64_t) param->sample_rate * attack_ms / 1000;
+    handle->hangover_frames = (uint64_t) param->sample_rate * hangover_ms
+            / 1000;
+    handle->window_frames = MAX(1, param->sample_rate / FLOOR_WINDOW_DIV);
+
+    reset(handle);
+
+    return handle;
+}
+
+static int vad_close(struct wave_vad_handle* handle) {
+    free(handle);
+
+    return 0;
+}
+
+static struct wave_vad this = {
+        .open = vad_open,
+        .close = vad_close,
+        .reset = reset,
+        .process = process,
+};
+
+struct wave_vad* get_wave_vad(void) {
+    return &this;
+}
@@ -16,16 +16,41 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
 
 #include <utils/log.h>
 #include <utils/list.h>
 #include <utils/assert.h>
+#include <utils/common.h>
+#include <thread/thread.h>
 #include <netlink/netlink_handler.h>
 #include <netlink/netlink_event.h>
 #include <battery/battery_manager.h>
 
 #define LOG_TAG "battery_manager"
 
+/*
+ * Status, technology and health strings are looked up through a
+ * perfect hash: a seed is searched once for which every string of a
+ * table lands in its own slot, a lookup is then one hash and one compare
+ */
+#define STRING_HASH_SIZE    16
+#define STRING_HASH_INIT    2166136261u
+#define STRING_HASH_STEP(hash, c)  (((hash) ^ (uint8_t) (c)) * 16777619u)
+#define MAX_SEED            4096
+
+#define DEFAULT_HYSTERESIS_CAPACITY     1
+#define DEFAULT_HYSTERESIS_VOLTAGE      20000
+#define DEFAULT_HYSTERESIS_INTERVAL_MS  1000
+
+struct string_table {
+    char** strs;
+    int count;
+    uint32_t seed;
+    uint8_t slots[STRING_HASH_SIZE];
+};
+
 static struct list_head listeners;
 static pthread_mutex_t listener_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t init_lock = PTHREAD_MUTEX_INITIALIZER;
@@ -33,6 +58,35 @@ static struct netlink_handler* nh;
 static uint32_t init_count;
 static struct battery_manager this;
 
+/*
+ * Last state decoded and last state delivered to listeners, both
+ * only touched from the netlink listener thread and get_state()
+ */
+static struct battery_event decoded;
+static struct battery_event notified;
+static int has_notified;
+static uint64_t notified_ms;
+static pthread_mutex_t state_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * A capacity or voltage change held back by the interval is delivered
+ * by the flush thread once the interval is over, the gauge may not
+ * send another uevent for minutes. notify_lock keeps deliveries from
+ * both threads in order, it is taken before state_lock.
+ */
+static struct thread* flush_thread;
+static pthread_cond_t flush_cond;
+static pthread_mutex_t notify_lock = PTHREAD_MUTEX_INITIALIZER;
+static int flush_started;
+static int flush_pending;
+static int flush_quit;
+
+static struct battery_hysteresis hysteresis = {
+        .capacity = DEFAULT_HYSTERESIS_CAPACITY,
+        .voltage = DEFAULT_HYSTERESIS_VOLTAGE,
+        .interval_ms = DEFAULT_HYSTERESIS_INTERVAL_MS,
+};
+
 struct listener {
     battery_event_listener_t cb;
     struct list_head head;
@@ -52,90 +106,309 @@ static char *status_strs[] = {
         "Unknown", "Charging", "Discharging", "Not charging", "Full"
 };
 
-static void handle_power_supply_event(struct netlink_handler* nh,
-        struct netlink_event* event) {
-    const int action = event->get_action(event);
-    const char* name = event->find_param(event, "POWER_SUPPLY_NAME");
+static struct string_table health_table = {
+        .strs = health_strs,
+        .count = ARRAY_SIZE(health_strs),
+};
 
-    if (strcmp(name, "battery"))
-        return;
+static struct string_table technology_table = {
+        .strs = technology_strs,
+        .count = ARRAY_SIZE(technology_strs),
+};
+
+static struct string_table status_table = {
+        .strs = status_strs,
+        .count = ARRAY_SIZE(status_strs),
+};
+
+static pthread_once_t string_table_once = PTHREAD_ONCE_INIT;
+
+static uint32_t hash_string(const char* str, uint32_t seed) {
+    uint32_t hash = STRING_HASH_INIT ^ seed;
+
+    while (*str)
+        hash = STRING_HASH_STEP(hash, *str++);
+
+    /*
+     * The low bits of FNV only see the low bits of the seed
+     */
+    return (hash ^ (hash >> 16)) % STRING_HASH_SIZE;
+}
+
+static void build_string_table(struct string_table* table) {
+    uint32_t slot;
+    int i;
+
+    for (table->seed = 0; table->seed < MAX_SEED; table->seed++) {
+        memset(table->slots, 0, sizeof(table->slots));
+
+        for (i = 0; i < table->count; i++) {
+            slot = hash_string(table->strs[i], table->seed);
+            if (table->slots[slot])
+                break;
+
+            table->slots[slot] = i + 1;
+        }
 
-    const char* state = event->find_param(event, "POWER_SUPPLY_STATUS");
-    const char* cap = event->find_param(event, "POWER_SUPPLY_CAPACITY");
-    const char* vol_now = event->find_param(event, "POWER_SUPPLY_VOLTAGE_NOW");
-    const char* vol_max = event->find_param(event, "POWER_SUPPLY_VOLTAGE_MAX_DESIGN");
-    const char* vol_min = event->find_param(event, "POWER_SUPPLY_VOLTAGE_MIN_DESIGN");
-    const char* tech = event->find_param(event, "POWER_SUPPLY_TECHNOLOGY");
-    const char* health = event->find_param(event, "POWER_SUPPLY_HEALTH");
-    const char* present = event->find_param(event, "POWER_SUPPLY_PRESENT");
-
-    struct battery_event *battery_event = calloc(1,
-            sizeof(struct battery_event));
-
-    if (action == NLACTION_CHANGE || action == NLACTION_ADD) {
-        if (!strcmp(state, "Charging"))
-            battery_event->state = POWER_SUPPLY_STATUS_CHARGING;
-        else if (!strcmp(state, "Not charging"))
-            battery_event->state = POWER_SUPPLY_STATUS_NOT_CHARGING;
-        else if (!strcmp(state, "Discharging"))
-            battery_event->state = POWER_SUPPLY_STATUS_DISCHARGING;
-        else if (!strcmp(state, "Full"))
-            battery_event->state = POWER_SUPPLY_STATUS_FULL;
-        else if (!strcmp(state, "Unknown"))
-            battery_event->state = POWER_SUPPLY_STATUS_UNKNOWN;
+        if (i == table->count)
+            return;
     }
 
-    if (!strcmp(tech, "NiMH"))
-        battery_event->technology = POWER_SUPPLY_TECHNOLOGY_NiMH;
-    else if (!strcmp(tech, "Li-ion"))
-        battery_event->technology = POWER_SUPPLY_TECHNOLOGY_LION;
-    else if (!strcmp(tech, "Li-poly"))
-        battery_event->technology = POWER_SUPPLY_TECHNOLOGY_LIPO;
-    else if (!strcmp(tech, "LiFe"))
-        battery_event->technology = POWER_SUPPLY_TECHNOLOGY_LiFe;
-    else if (!strcmp(tech, "NiCd"))
-        battery_event->technology = POWER_SUPPLY_TECHNOLOGY_NiCd;
-    else if (!strcmp(tech, "LiMn"))
-        battery_event->technology = POWER_SUPPLY_TECHNOLOGY_LiMn;
-    else if (!strcmp(tech, "Unknown"))
-        battery_event->technology = POWER_SUPPLY_TECHNOLOGY_UNKNOWN;
-
-    if (!strcmp(health, "Good"))
-        battery_event->health = POWER_SUPPLY_HEALTH_GOOD;
-    else if (!strcmp(health, "Overheat"))
-        battery_event->health = POWER_SUPPLY_HEALTH_OVERHEAT;
-    else if (!strcmp(health, "Dead"))
-        battery_event->health = POWER_SUPPLY_HEALTH_DEAD;
-    else if (!strcmp(health, "Over voltage"))
-        battery_event->health = POWER_SUPPLY_HEALTH_OVERVOLTAGE;
-    else if (!strcmp(health, "Unspecified failure"))
-        battery_event->health = POWER_SUPPLY_HEALTH_UNSPEC_FAILURE;
-    else if (!strcmp(health, "Cold"))
-        battery_event->health = POWER_SUPPLY_HEALTH_COLD;
-    else if (!strcmp(health, "Watchdog timer expire"))
-        battery_event->health = POWER_SUPPLY_HEALTH_WATCHDOG_TIMER_EXPIRE;
-    else if (!strcmp(health, "Safety timer expire"))
-        battery_event->health = POWER_SUPPLY_HEALTH_SAFETY_TIMER_EXPIRE;
-    else if (!strcmp(health, "Unknown"))
-        battery_event->health = POWER_SUPPLY_HEALTH_UNKNOWN;
-
-    battery_event->capacity = strtol(cap, NULL, 0);
-    battery_event->voltage_now = strtol(vol_now, NULL, 0);
-    battery_event->voltage_max = strtol(vol_max, NULL, 0);
-    battery_event->voltage_min = strtol(vol_min, NULL, 0);
-    battery_event->present = strtol(present, NULL, 0);
+    assert_die_if(1, "No perfect hash for %s table\n", table->strs[1]);
+}
 
-    pthread_mutex_lock(&listener_lock);
+static void build_string_tables(void) {
+    build_string_table(&health_table);
+    build_string_table(&technology_table);
+    build_string_table(&status_table);
+}
+
+/*
+ * Index of @str in @table, @fallback for NULL or unknown strings
+ */
+static uint32_t lookup_string(struct string_table* table, const char* str,
+        uint32_t fallback) {
+    int index;
+
+    if (str == NULL)
+        return fallback;
+
+    index = table->slots[hash_string(str, table->seed)];
+    if (index && !strcmp(table->strs[index - 1], str))
+        return index - 1;
+
+    return fallback;
+}
+
+static uint32_t parse_number(const char* str, uint32_t fallback) {
+    return str ? strtol(str, NULL, 0) : fallback;
+}
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
 
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint32_t distance(uint32_t a, uint32_t b) {
+    return a > b ? a - b : b - a;
+}
+
+/*
+ * What changed since the last delivery, leaving out capacity and
+ * voltage moves inside the hysteresis
+ */
+static uint32_t diff_state(const struct battery_event* now,
+        const struct battery_event* last) {
+    uint32_t changed = 0;
+
+    if (now->state != last->state)
+        changed |= BATTERY_CHANGED_STATE;
+    if (now->present != last->present)
+        changed |= BATTERY_CHANGED_PRESENT;
+    if (now->technology != last->technology)
+        changed |= BATTERY_CHANGED_TECHNOLOGY;
+    if (now->health != last->health)
+        changed |= BATTERY_CHANGED_HEALTH;
+
+    if (distance(now->capacity, last->capacity) >= hysteresis.capacity
+            && now->capacity != last->capacity)
+        changed |= BATTERY_CHANGED_CAPACITY;
+
+    /*
+     * Empty goes out whatever the hysteresis
+     */
+    if (now->capacity == 0 && last->capacity != 0)
+        changed |= BATTERY_CHANGED_CAPACITY;
+
+    if (distance(now->voltage_now, last->voltage_now) >= hysteresis.voltage
+            && now->voltage_now != last->voltage_now)
+        changed |= BATTERY_CHANGED_VOLTAGE;
+
+    if (now->voltage_max != last->voltage_max
+            || now->voltage_min != last->voltage_min)
+        changed |= BATTERY_CHANGED_VOLTAGE_RANGE;
+
+    return changed;
+}
+
+static void notify_listeners(struct battery_event* event) {
     struct list_head* pos;
+
+    pthread_mutex_lock(&listener_lock);
+
     list_for_each(pos, &listeners) {
         struct listener* l = list_entry(pos, struct listener, head);
-        l->cb(battery_event);
+        l->cb(event);
     }
 
     pthread_mutex_unlock(&listener_lock);
+}
 
-    free(battery_event);
+/*
+ * With state_lock held: true when @event can't go out before
+ * notified_ms + interval_ms
+ */
+static int hold_back(const struct battery_event* event, uint64_t now) {
+    return !(event->changed & ~(BATTERY_CHANGED_CAPACITY
+            | BATTERY_CHANGED_VOLTAGE)) && event->capacity != 0
+            && now - notified_ms < hysteresis.interval_ms;
+}
+
+static void flush_loop(struct pthread_wrapper* pthread, void* param) {
+    struct battery_event battery_event;
+    struct timespec ts;
+    uint64_t deadline;
+
+    pthread_mutex_lock(&state_lock);
+
+    for (;;) {
+        while (!flush_pending && !flush_quit)
+            pthread_cond_wait(&flush_cond, &state_lock);
+
+        if (flush_quit)
+            break;
+
+        deadline = notified_ms + hysteresis.interval_ms;
+        if (now_ms() < deadline) {
+            ts.tv_sec = deadline / 1000;
+            ts.tv_nsec = (deadline % 1000) * 1000000;
+            pthread_cond_timedwait(&flush_cond, &state_lock, &ts);
+            continue;
+        }
+
+        pthread_mutex_unlock(&state_lock);
+        pthread_mutex_lock(&notify_lock);
+        pthread_mutex_lock(&state_lock);
+
+        /*
+         * A uevent may have delivered it meanwhile
+         */
+        battery_event = decoded;
+        battery_event.changed = diff_state(&battery_event, &notified);
+
+        if (battery_event.changed == 0)
+            flush_pending = 0;
+
+        if (!flush_pending || hold_back(&battery_event, now_ms())) {
+            pthread_mutex_unlock(&notify_lock);
+            continue;
+        }
+
+        flush_pending = 0;
+        notified = battery_event;
+        notified_ms = now_ms();
+
+        pthread_mutex_unlock(&state_lock);
+
+        notify_listeners(&battery_event);
+
+        pthread_mutex_unlock(&notify_lock);
+        pthread_mutex_lock(&state_lock);
+    }
+
+    pthread_mutex_unlock(&state_lock);
+}
+
+static void handle_power_supply_event(struct netlink_handler* nh,
+        struct netlink_event* event) {
+    const int action = event->get_action(event);
+    const char* name = event->find_key(event, NL_KEY_POWER_SUPPLY_NAME);
+    struct battery_event battery_event;
+    uint64_t now;
+
+    if (name == NULL || strcmp(name, "battery"))
+        return;
+
+    pthread_once(&string_table_once, build_string_tables);
+
+    pthread_mutex_lock(&notify_lock);
+    pthread_mutex_lock(&state_lock);
+
+    /*
+     * Keys missing from an event keep their last value
+     */
+    battery_event = decoded;
+
+    if (action == NLACTION_CHANGE || action == NLACTION_ADD)
+        battery_event.state = lookup_string(&status_table,
+                event->find_key(event, NL_KEY_POWER_SUPPLY_STATUS),
+                battery_event.state);
+    else
+        battery_event.state = POWER_SUPPLY_STATUS_UNKNOWN;
+
+    battery_event.technology = lookup_string(&technology_table,
+            event->find_key(event, NL_KEY_POWER_SUPPLY_TECHNOLOGY),
+            battery_event.technology);
+    battery_event.health = lookup_string(&health_table,
+            event->find_key(event, NL_KEY_POWER_SUPPLY_HEALTH),
+            battery_event.health);
+
+    battery_event.capacity = parse_number(
+            event->find_key(event, NL_KEY_POWER_SUPPLY_CAPACITY),
+            battery_event.capacity);
+    battery_event.voltage_now = parse_number(
+            event->find_key(event, NL_KEY_POWER_SUPPLY_VOLTAGE_NOW),
+            battery_event.voltage_now);
+    battery_event.voltage_max = parse_number(
+            event->find_key(event, NL_KEY_POWER_SUPPLY_VOLTAGE_MAX_DESIGN),
+            battery_event.voltage_max);
+    battery_event.voltage_min = parse_number(
+            event->find_key(event, NL_KEY_POWER_SUPPLY_VOLTAGE_MIN_DESIGN),
+            battery_event.voltage_min);
+    battery_event.present = parse_number(
+            event->find_key(event, NL_KEY_POWER_SUPPLY_PRESENT),
+            battery_event.present);
+
+    if (action == NLACTION_REMOVE)
+        battery_event.present = 0;
+
+    decoded = battery_event;
+
+    if (has_notified) {
+        battery_event.changed = diff_state(&battery_event, &notified);
+
+        if (battery_event.changed == 0) {
+            flush_pending = 0;
+            goto out;
+        }
+
+        /*
+         * Capacity and voltage alone wait out the interval, the flush
+         * thread delivers them after it unless a uevent does first
+         */
+        now = now_ms();
+        if (hold_back(&battery_event, now)) {
+            if (!flush_started)
+                flush_started = flush_thread->start(flush_thread, NULL) >= 0;
+            flush_pending = 1;
+            pthread_cond_signal(&flush_cond);
+            goto out;
+        }
+
+        notified_ms = now;
+    } else {
+        battery_event.changed = BATTERY_CHANGED_ALL;
+        has_notified = 1;
+        notified_ms = now_ms();
+    }
+
+    notified = battery_event;
+    flush_pending = 0;
+
+    pthread_mutex_unlock(&state_lock);
+
+    notify_listeners(&battery_event);
+
+    pthread_mutex_unlock(&notify_lock);
+
+    return;
+
+out:
+    pthread_mutex_unlock(&state_lock);
+    pthread_mutex_unlock(&notify_lock);
 }
 
 static void handle_event(struct netlink_handler* nh,
@@ -222,23 +495,60 @@ static void dump_event(struct battery_event* event) {
     LOGI("Voltage Min: %u\n", event->voltage_min);
     LOGI("Voltage Now: %u\n", event->voltage_now);
     LOGI("Capacity:    %u\n", event->capacity);
+    LOGI("Changed:     0x%02x\n", event->changed);
     LOGI("========================================\n");
 }
 
+static void set_hysteresis(const struct battery_hysteresis* param) {
+    assert_die_if(param == NULL, "param is NULL\n");
+
+    pthread_mutex_lock(&state_lock);
+    hysteresis = *param;
+    pthread_mutex_unlock(&state_lock);
+}
+
+static int get_state(struct battery_event* event) {
+    assert_die_if(event == NULL, "event is NULL\n");
+
+    pthread_mutex_lock(&state_lock);
+
+    if (!has_notified) {
+        pthread_mutex_unlock(&state_lock);
+        return -1;
+    }
+
+    *event = decoded;
+    event->changed = 0;
+
+    pthread_mutex_unlock(&state_lock);
+
+    return 0;
+}
+
 static struct netlink_handler* get_netlink_handler(void) {
     return nh;
 }
 
 static int init(void) {
+    pthread_condattr_t attr;
+
     pthread_mutex_lock(&init_lock);
 
     if (init_count++ == 0) {
         nh = (struct netlink_handler *) calloc(1, sizeof(struct netlink_handler));
         nh->construct = construct_netlink_handler;
         nh->deconstruct = destruct_netlink_handler;
-        nh->construct(nh, "all sub-system", 0, handle_event, &this);
+        nh->construct(nh, "power_supply", 0, handle_event, &this);
 
         INIT_LIST_HEAD(&listeners);
+
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&flush_cond, &attr);
+        pthread_condattr_destroy(&attr);
+
+        flush_thread = _new(struct thread, thread);
+        flush_thread->runnable.run = flush_loop;
     }
 
     pthread_mutex_unlock(&init_lock);
@@ -254,7 +564,26 @@ static int deinit(void) {
         free(nh);
         nh = NULL;
 
+        pthread_mutex_lock(&state_lock);
+        flush_quit = 1;
+        pthread_cond_signal(&flush_cond);
+        pthread_mutex_unlock(&state_lock);
+
+        if (flush_started)
+            flush_thread->wait(flush_thread);
+        _delete(flush_thread);
+        flush_thread = NULL;
+        pthread_cond_destroy(&flush_cond);
+
         unregister_all_listener();
+
+        pthread_mutex_lock(&state_lock);
+        memset(&decoded, 0, sizeof(decoded));
+        has_notified = 0;
+        flush_started = 0;
+        flush_pending = 0;
+        flush_quit = 0;
+        pthread_mutex_unlock(&state_lock);
     }
 
     pthread_mutex_unlock(&init_lock);
@@ -269,6 +598,8 @@ static struct battery_manager this = {
         .unregister_event_listener = unregister_event_listener,
         .get_netlink_handler = get_netlink_handler,
         .dump_event = dump_event,
+        .set_hysteresis = set_hysteresis,
+        .get_state = get_state,
 };
 
 struct battery_manager* get_battery_manager(void) {
@@ -165,6 +165,16 @@ CONFIG_CHAR_CAMERA_MANAGER=y
 #
 CONFIG_V4L2_CAMERA_MANAGER=y
 
+#
+# Physical memory manager
+#
+CONFIG_PMEM_MANAGER=y
+
+#
+# Snapshot manager
+#
+CONFIG_SNAPSHOT_MANAGER=y
+
 #
 # PWM Manager
 #
@@ -264,6 +274,12 @@ ifeq ($(CONFIG_ALSA_AUDIO), y)
 
 	#Mixer
 	CONFIG_ALSA_AUDIO_MIXER=y
+
+	#Low latency mmap engine
+	CONFIG_ALSA_AUDIO_MMAP=y
+
+	#Software mixer for concurrent streams
+	CONFIG_ALSA_AUDIO_STREAM_MIXER=y
 endif
 
 #
@@ -307,10 +323,22 @@ ifeq ($(CONFIG_ALSA_AUDIO), y)
 CONFIG_LIB_ALSA=y
 endif
 
+ifeq ($(CONFIG_ALSA_AUDIO_STREAM_MIXER), y)
+CONFIG_ALSA_AUDIO_MMAP=y
+endif
+
 ifeq ($(CONFIG_MTD_FLASH_MANAGER), y)
 CONFIG_LIB_MTD=y
 endif
 
+ifeq ($(CONFIG_V4L2_CAMERA_MANAGER), y)
+CONFIG_PMEM_MANAGER=y
+endif
+
+ifeq ($(CONFIG_SNAPSHOT_MANAGER), y)
+CONFIG_LIB_PNG=y
+endif
+
 ifeq ($(CONFIG_LIB_PNG), y)
 CONFIG_LIB_ZLIB=y
 endif
@@ -19,16 +19,22 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
 
 #include <stdbool.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
 
 #include <types.h>
 #include <utils/log.h>
 #include <utils/assert.h>
+#include <utils/common.h>
+#include <thread/thread.h>
 #include <camera/camera_manager.h>
 
 /*
@@ -65,12 +71,48 @@ struct reg_msg {
 
 #define LOG_TAG  "camera"
 
+#define RING_ERROR_DELAY_US 10000
+
+/*
+ * Stream ring slot state
+ */
+enum {
+    SLOT_FREE = 0,
+    SLOT_FILLING,
+    SLOT_READY,
+    SLOT_DEQUEUED,
+};
+
+struct frame_ring {
+    uint8_t *base;
+    uint32_t map_size;
+    uint32_t frame_size;
+    uint32_t nbuf;
+    uint8_t *state;
+    uint32_t *sequence;
+
+    /*
+     * FIFO of READY slots, oldest first
+     */
+    uint32_t *ready;
+    uint32_t ready_head;
+    uint32_t ready_count;
+};
+
 /*
  * Variables
  */
 static int cim_fd    = -1;
 static int sensor_fd = -1;
 
+static struct camera_img_param img_param;
+static struct frame_ring ring;
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static camera_frame_receive frame_receive_cb;
+static struct thread *stream_thread;
+static int event_fd = -1;
+static uint32_t next_sequence;
+
 /*
  * Functions
  */
@@ -82,6 +124,8 @@ static int32_t set_img_param(struct camera_img_param *img) {
         return -1;
     }
 
+    img_param = *img;
+
     return 0;
 }
 
@@ -177,9 +221,287 @@ static int32_t sensor_setup_regs(const struct camera_regval_list *vals) {
 static int32_t camera_read(uint8_t *yuvbuf, uint32_t size) {
 
     assert_die_if(!yuvbuf, "Error: framebuf pointer cannot to 'NULL'\n");
+
+    if (stream_thread) {
+        LOGE("camera_read is not available in stream mode\n");
+        return -1;
+    }
+
     return read(cim_fd, yuvbuf, size);
 }
 
+static inline uint8_t *slot_addr(uint32_t index) {
+    return ring.base + index * ring.frame_size;
+}
+
+static void ready_push(uint32_t index) {
+    ring.ready[(ring.ready_head + ring.ready_count) % ring.nbuf] = index;
+    ring.ready_count++;
+}
+
+static int ready_pop(void) {
+    uint32_t index;
+
+    if (ring.ready_count == 0)
+        return -1;
+
+    index = ring.ready[ring.ready_head];
+    ring.ready_head = (ring.ready_head + 1) % ring.nbuf;
+    ring.ready_count--;
+
+    return index;
+}
+
+/*
+ * Pick a slot to capture into. When the consumer holds no free slot,
+ * the oldest ready frame is recycled so the ring always carries the
+ * newest frames
+ */
+static int ring_get_fill_slot(void) {
+    uint64_t count;
+    int index = -1;
+
+    pthread_mutex_lock(&ring_lock);
+
+    for (uint32_t i = 0; i < ring.nbuf; i++) {
+        if (ring.state[i] == SLOT_FREE) {
+            index = i;
+            break;
+        }
+    }
+
+    if (index < 0) {
+        index = ready_pop();
+        if (index >= 0) {
+            LOGD("Drop frame %u\n", ring.sequence[index]);
+            read(event_fd, &count, sizeof(count));
+        }
+    }
+
+    if (index >= 0)
+        ring.state[index] = SLOT_FILLING;
+
+    pthread_mutex_unlock(&ring_lock);
+
+    return index;
+}
+
+/*
+ * Cancellation is only allowed while blocked outside ring_lock
+ */
+static void cancel_point_sleep(uint32_t us) {
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+    usleep(us);
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+}
+
+static void stream_loop(struct pthread_wrapper *pthread, void *param) {
+    uint64_t count = 1;
+    int index;
+    int ret;
+
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+    for (;;) {
+        index = ring_get_fill_slot();
+        if (index < 0) {
+            /*
+             * Every slot is dequeued by the application
+             */
+            cancel_point_sleep(RING_ERROR_DELAY_US);
+            continue;
+        }
+
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+        ret = read(cim_fd, slot_addr(index), ring.frame_size);
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+        if (ret != ring.frame_size) {
+            LOGE("Failed to read frame: %d %s\n", ret, strerror(errno));
+            pthread_mutex_lock(&ring_lock);
+            ring.state[index] = SLOT_FREE;
+            pthread_mutex_unlock(&ring_lock);
+            cancel_point_sleep(RING_ERROR_DELAY_US);
+            continue;
+        }
+
+        ring.sequence[index] = next_sequence++;
+
+        if (frame_receive_cb) {
+            frame_receive_cb((char *)slot_addr(index), img_param.width,
+                    img_param.height, ring.sequence[index]);
+
+            pthread_mutex_lock(&ring_lock);
+            ring.state[index] = SLOT_FREE;
+            pthread_mutex_unlock(&ring_lock);
+            continue;
+        }
+
+        pthread_mutex_lock(&ring_lock);
+        ring.state[index] = SLOT_READY;
+        ready_push(index);
+        pthread_mutex_unlock(&ring_lock);
+
+        write(event_fd, &count, sizeof(count));
+    }
+}
+
+static void ring_free(void) {
+    if (ring.base)
+        munmap(ring.base, ring.map_size);
+
+    free(ring.state);
+    free(ring.sequence);
+    free(ring.ready);
+    memset(&ring, 0, sizeof(ring));
+}
+
+static int ring_alloc(uint32_t nbuf, uint32_t frame_size) {
+    uint32_t page_size = getpagesize();
+
+    ring.nbuf = nbuf;
+    ring.frame_size = frame_size;
+    ring.map_size = (nbuf * frame_size + page_size - 1) & ~(page_size - 1);
+
+    /*
+     * One contiguous, prefaulted mapping for all frames
+     */
+    ring.base = mmap(NULL, ring.map_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (ring.base == MAP_FAILED) {
+        LOGE("Failed to mmap frame ring: %s\n", strerror(errno));
+        ring.base = NULL;
+        goto error;
+    }
+
+    ring.state = calloc(nbuf, sizeof(*ring.state));
+    ring.sequence = calloc(nbuf, sizeof(*ring.sequence));
+    ring.ready = calloc(nbuf, sizeof(*ring.ready));
+    if (!ring.state || !ring.sequence || !ring.ready) {
+        LOGE("Failed to allocate memory\n");
+        goto error;
+    }
+
+    return 0;
+
+error:
+    ring_free();
+    return -1;
+}
+
+static int32_t camera_stream_start(uint32_t nbuf,
+                                   camera_frame_receive fr_cb) {
+    assert_die_if(cim_fd < 0, "Error: camera not init\n");
+
+    if (stream_thread) {
+        LOGE("Stream already started\n");
+        return -1;
+    }
+
+    if (img_param.size == 0) {
+        LOGE("Image param not set\n");
+        return -1;
+    }
+
+    if (nbuf == 0)
+        nbuf = CAMERA_DEFAULT_NBUF;
+
+    event_fd = eventfd(0, EFD_NONBLOCK | EFD_SEMAPHORE | EFD_CLOEXEC);
+    if (event_fd < 0) {
+        LOGE("Failed to create eventfd: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if (ring_alloc(nbuf, img_param.size) < 0)
+        goto error;
+
+    frame_receive_cb = fr_cb;
+    next_sequence = 0;
+
+    stream_thread = _new(struct thread, thread);
+    stream_thread->runnable.run = stream_loop;
+    if (stream_thread->start(stream_thread, NULL) < 0) {
+        LOGE("Failed to start stream thread\n");
+        _delete(stream_thread);
+        stream_thread = NULL;
+        ring_free();
+        goto error;
+    }
+
+    return 0;
+
+error:
+    close(event_fd);
+    event_fd = -1;
+    return -1;
+}
+
+static void camera_stream_stop(void) {
+    if (!stream_thread)
+        return;
+
+    stream_thread->stop(stream_thread);
+    _delete(stream_thread);
+    stream_thread = NULL;
+
+    pthread_mutex_lock(&ring_lock);
+    ring_free();
+    pthread_mutex_unlock(&ring_lock);
+
+    close(event_fd);
+    event_fd = -1;
+    frame_receive_cb = NULL;
+}
+
+static int32_t camera_get_fd(void) {
+    return event_fd;
+}
+
+static int32_t camera_dequeue_frame(uint8_t **frame, uint32_t *seq) {
+    uint64_t count;
+    int index;
+
+    assert_die_if(!frame, "Error: frame pointer cannot to 'NULL'\n");
+
+    pthread_mutex_lock(&ring_lock);
+
+    index = ring.nbuf ? ready_pop() : -1;
+    if (index < 0) {
+        pthread_mutex_unlock(&ring_lock);
+        errno = EAGAIN;
+        return -1;
+    }
+
+    read(event_fd, &count, sizeof(count));
+    ring.state[index] = SLOT_DEQUEUED;
+
+    *frame = slot_addr(index);
+    if (seq)
+        *seq = ring.sequence[index];
+
+    pthread_mutex_unlock(&ring_lock);
+
+    return index;
+}
+
+static int32_t camera_queue_frame(int32_t index) {
+    int ret = -1;
+
+    pthread_mutex_lock(&ring_lock);
+
+    if (index >= 0 && index < ring.nbuf
+            && ring.state[index] == SLOT_DEQUEUED) {
+        ring.state[index] = SLOT_FREE;
+        ret = 0;
+    } else {
+        LOGE("Invalid frame index %d\n", index);
+    }
+
+    pthread_mutex_unlock(&ring_lock);
+
+    return ret;
+}
+
 static int32_t camera_init(void) {
     struct camera_timing_param timing;
 
@@ -202,6 +524,8 @@ static int32_t camera_init(void) {
 }
 
 static void camera_deinit(void) {
+    camera_stream_stop();
+
     close(cim_fd);
     close(sensor_fd);
     cim_fd    = -1;
@@ -218,6 +542,11 @@ struct camera_manager camera_manager = {
     .sensor_setup_regs = sensor_setup_regs,
     .sensor_write_reg  = sensor_write_reg,
     .sensor_read_reg   = sensor_read_reg,
+    .camera_stream_start  = camera_stream_start,
+    .camera_stream_stop   = camera_stream_stop,
+    .camera_get_fd        = camera_get_fd,
+    .camera_dequeue_frame = camera_dequeue_frame,
+    .camera_queue_frame   = camera_queue_frame,
 };
 
 struct camera_manager *get_camera_manager(void) {
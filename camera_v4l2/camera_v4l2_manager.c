@@ -57,6 +57,7 @@ static pthread_mutex_t start_lock = PTHREAD_MUTEX_INITIALIZER;
 static struct thread* thread;
 static int init_count;
 static int start_count;
+static uint32_t stat_log_interval = CAMERA_V4L2_STAT_LOG_INTERVAL;
 
 static inline uint32_t  make_pixel(uint32_t r, uint32_t g,
                         uint32_t b, struct rgb_pixel_fmt fmt)
@@ -108,6 +109,8 @@ static int camera_v4l2_init(struct capt_param_t *capt_p)
             goto error;
         }
 
+        v4l2_set_stat_log_interval(&camera_v4l2_op.capt, stat_log_interval);
+
         ret = v4l2_init_device(&camera_v4l2_op.capt,
                                 (frame_process)frame_process_cb);
         if (ret < 0) {
@@ -279,6 +282,50 @@ error:
     return -1;
 }
 
+static int camera_v4l2_get_stat(struct camera_v4l2_stat* stat)
+{
+    assert_die_if(stat == NULL, "stat is NULL\n");
+
+    pthread_mutex_lock(&init_lock);
+
+    if (init_count == 0) {
+        LOGE("Camera not init\n");
+        pthread_mutex_unlock(&init_lock);
+        return -1;
+    }
+
+    v4l2_get_stat(&camera_v4l2_op.capt, stat);
+
+    pthread_mutex_unlock(&init_lock);
+
+    return 0;
+}
+
+static int camera_v4l2_reset_stat(void)
+{
+    pthread_mutex_lock(&init_lock);
+
+    if (init_count)
+        v4l2_reset_stat(&camera_v4l2_op.capt);
+
+    pthread_mutex_unlock(&init_lock);
+
+    return 0;
+}
+
+static int camera_v4l2_set_stat_log_interval(uint32_t seconds)
+{
+    pthread_mutex_lock(&init_lock);
+
+    stat_log_interval = seconds;
+    if (init_count)
+        v4l2_set_stat_log_interval(&camera_v4l2_op.capt, seconds);
+
+    pthread_mutex_unlock(&init_lock);
+
+    return 0;
+}
+
 static struct camera_v4l2_manager camera_v4l2_manager = {
     .init      = camera_v4l2_init,
     .start     = camera_v4l2_start,
@@ -287,7 +334,10 @@ static struct camera_v4l2_manager camera_v4l2_manager = {
     .yuv2rgb   = camera_v4l2_yuv2rgb,
     .rgb2pixel = camera_v4l2_rgb2pixel,
     .build_bmp = camera_v4l2_build_bmp,
-    .deinit    = camera_v4l2_deinit
+    .deinit    = camera_v4l2_deinit,
+    .get_stat  = camera_v4l2_get_stat,
+    .reset_stat = camera_v4l2_reset_stat,
+    .set_stat_log_interval = camera_v4l2_set_stat_log_interval,
 };
 
 struct camera_v4l2_manager* get_camera_v4l2_manager(void){
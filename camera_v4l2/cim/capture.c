@@ -29,10 +29,10 @@
 #include <sys/ioctl.h>
 #include <asm/types.h>
 #include <linux/videodev2.h>
-#include "jz_mem.h"
+#include <pmem/pmem_manager.h>
 #include <utils/yuv2bmp.h>
 #include "capture.h"
-#include <sys/time.h>
+#include <time.h>
 #include <utils/log.h>
 #include <types.h>
 
@@ -180,9 +180,14 @@ static int init_userp(struct capture_t *capt)
     /* Update the value of nbuf */
     capt->nbuf = req.count;
 
+    if (get_pmem_manager()->init(PMEM_BACKEND_IMEM, 0) < 0) {
+        LOGE("%s Failed to init pmem manager\n", capt->dev_name);
+        goto err_pmem_init;
+    }
+
     for (i = 0; i < capt->nbuf; i++) {
         capt->pbuf[i].length = buffer_size;
-        capt->pbuf[i].start  = jz_mem_alloc(128, buffer_size);
+        capt->pbuf[i].start  = get_pmem_manager()->alloc(buffer_size, 128);
 
         if (!capt->pbuf[i].start) {
             LOGE("%s %s Out of memory start.\n",capt->dev_name,__FUNCTION__);
@@ -192,6 +197,10 @@ static int init_userp(struct capture_t *capt)
     return 0;
 
 err_calloc_start:
+    while (i--)
+        get_pmem_manager()->free(capt->pbuf[i].start);
+    get_pmem_manager()->deinit();
+err_pmem_init:
     free(capt->pbuf);
 err_calloc_pbuf:
 err_buff_insufficient:
@@ -207,11 +216,175 @@ static void process_image(uint8_t* buf, uint32_t width, uint32_t height, uint32_
     }
 }
 
+static uint64_t monotonic_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int latency_bucket(uint32_t us)
+{
+    uint32_t ms = us / 1000;
+    int bucket = 0;
+
+    while (ms && bucket < CAMERA_V4L2_LATENCY_BUCKETS - 1) {
+        ms >>= 1;
+        bucket++;
+    }
+
+    return bucket;
+}
+
+static void log_stat(struct capture_t *capt)
+{
+    struct camera_v4l2_stat stat;
+
+    v4l2_get_stat(capt, &stat);
+
+    LOGD("%s: %u frames, %.1f fps, dropped %u(%u gaps), delayed %u, "
+         "max dequeued %u/%u, latency %u/%u/%u us, process %u/%u us\n",
+            capt->dev_name, stat.frames, stat.fps, stat.dropped,
+            stat.sequence_gaps, stat.delayed, stat.max_dequeued, capt->nbuf,
+            stat.latency_min_us, stat.latency_avg_us, stat.latency_max_us,
+            stat.process_avg_us, stat.process_max_us);
+}
+
+/*
+ * Deliver one dequeued frame and account it, @buf is NULL for
+ * IO_METHOD_READ which has no sequence or timestamp
+ */
+static void deliver_frame(struct capture_t *capt, uint8_t* start,
+                          struct v4l2_buffer *buf)
+{
+    struct camera_v4l2_stat *stat = &capt->stat;
+    uint64_t timestamp_us = 0;
+    uint64_t begin, end;
+    uint32_t latency = 0;
+    int log = 0;
+
+    begin = monotonic_us();
+    process_image(start, capt->width, capt->height, buf ? buf->sequence : 0);
+    end = monotonic_us();
+
+    pthread_mutex_lock(&capt->stat_lock);
+
+    if (buf) {
+        if (stat->frames && buf->sequence > capt->next_sequence) {
+            stat->dropped += buf->sequence - capt->next_sequence;
+            stat->sequence_gaps++;
+        }
+        capt->next_sequence = buf->sequence + 1;
+
+#ifdef V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC
+        if ((buf->flags & V4L2_BUF_FLAG_TIMESTAMP_MASK)
+                == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+            timestamp_us = (uint64_t)buf->timestamp.tv_sec * 1000000
+                    + buf->timestamp.tv_usec;
+#endif
+    }
+
+    if (timestamp_us && timestamp_us <= begin) {
+        latency = begin - timestamp_us;
+
+        if (latency < stat->latency_min_us || !capt->latency_frames)
+            stat->latency_min_us = latency;
+        if (latency > stat->latency_max_us)
+            stat->latency_max_us = latency;
+        capt->latency_total_us += latency;
+        capt->latency_frames++;
+        stat->latency_hist[latency_bucket(latency)]++;
+
+        if (capt->last_timestamp_us && timestamp_us > capt->last_timestamp_us
+                && latency > timestamp_us - capt->last_timestamp_us)
+            stat->delayed++;
+        capt->last_timestamp_us = timestamp_us;
+    }
+
+    if (end - begin > stat->process_max_us)
+        stat->process_max_us = end - begin;
+    capt->process_total_us += end - begin;
+    stat->frames++;
+
+    if (!capt->window_start_us)
+        capt->window_start_us = end;
+    capt->window_frames++;
+    if (end - capt->window_start_us >= 1000000) {
+        stat->fps = capt->window_frames * 1000000.0f
+                / (end - capt->window_start_us);
+        capt->window_start_us = end;
+        capt->window_frames = 0;
+    }
+
+    if (!capt->last_log_us)
+        capt->last_log_us = end;
+    if (capt->log_interval
+            && end - capt->last_log_us >= capt->log_interval * 1000000ULL) {
+        capt->last_log_us = end;
+        log = 1;
+    }
+
+    pthread_mutex_unlock(&capt->stat_lock);
+
+    if (log)
+        log_stat(capt);
+}
+
+static void account_dequeued(struct capture_t *capt, uint32_t count)
+{
+    pthread_mutex_lock(&capt->stat_lock);
+    if (count > capt->stat.max_dequeued)
+        capt->stat.max_dequeued = count;
+    pthread_mutex_unlock(&capt->stat_lock);
+}
+
+void v4l2_get_stat(struct capture_t *capt, struct camera_v4l2_stat *stat)
+{
+    pthread_mutex_lock(&capt->stat_lock);
+
+    *stat = capt->stat;
+
+    if (capt->latency_frames)
+        stat->latency_avg_us = capt->latency_total_us / capt->latency_frames;
+    if (stat->frames)
+        stat->process_avg_us = capt->process_total_us / stat->frames;
+
+    pthread_mutex_unlock(&capt->stat_lock);
+}
+
+void v4l2_reset_stat(struct capture_t *capt)
+{
+    pthread_mutex_lock(&capt->stat_lock);
+
+    memset(&capt->stat, 0, sizeof(capt->stat));
+    capt->next_sequence = 0;
+    capt->last_timestamp_us = 0;
+    capt->latency_total_us = 0;
+    capt->latency_frames = 0;
+    capt->process_total_us = 0;
+    capt->window_start_us = 0;
+    capt->window_frames = 0;
+    capt->last_log_us = 0;
+
+    pthread_mutex_unlock(&capt->stat_lock);
+}
+
+void v4l2_set_stat_log_interval(struct capture_t *capt, uint32_t seconds)
+{
+    pthread_mutex_lock(&capt->stat_lock);
+    capt->log_interval = seconds;
+    capt->last_log_us = 0;
+    pthread_mutex_unlock(&capt->stat_lock);
+}
+
 
 static int read_frame(struct capture_t *capt)
 {
     struct v4l2_buffer buf;
     uint32_t i, ret;
+    uint32_t dequeued = 0;
 
     switch (capt->io) {
     case IO_METHOD_READ:
@@ -222,7 +395,8 @@ static int read_frame(struct capture_t *capt)
             return -1;
         }
 
-        process_image(capt->pbuf[0].start, capt->width, capt->height, 0);
+        deliver_frame(capt, capt->pbuf[0].start, NULL);
+        account_dequeued(capt, 1);
         break;
 
     case IO_METHOD_MMAP:
@@ -232,14 +406,15 @@ static int read_frame(struct capture_t *capt)
 
         while (-1 != ioctl(capt->fd, VIDIOC_DQBUF, &buf)) {
             assert(buf.index < capt->nbuf);
-            process_image(capt->pbuf[buf.index].start, capt->width,
-                                        capt->height, buf.sequence);
+            dequeued++;
+            deliver_frame(capt, capt->pbuf[buf.index].start, &buf);
             if (-1 == ioctl(capt->fd, VIDIOC_QBUF, &buf)) {
                 LOGE("%s Failed to ioctl: VIDIOC_QBUF %d %s\n",
                                     capt->dev_name, errno, strerror(errno));
                 return -1;
             }
         }
+        account_dequeued(capt, dequeued);
         break;
 
     case IO_METHOD_USERPTR:
@@ -261,8 +436,8 @@ static int read_frame(struct capture_t *capt)
                 }
 
                 assert(i < capt->nbuf);
-                process_image(capt->pbuf[i].start, capt->width,
-                                    capt->height, buf.sequence);
+                dequeued++;
+                deliver_frame(capt, capt->pbuf[i].start, &buf);
 
                 if (-1 == ioctl(capt->fd, VIDIOC_QBUF, &buf)) {
                     LOGE("%s Failed to ioctl: VIDIOC_QBUF %d %s\n",
@@ -270,6 +445,7 @@ static int read_frame(struct capture_t *capt)
                     return -1;
                 }
             }
+            account_dequeued(capt, dequeued);
             break;
         }
     }
@@ -283,6 +459,8 @@ int v4l2_start_capturing(struct capture_t *capt)
     enum v4l2_buf_type type;
     struct v4l2_buffer buf;
 
+    v4l2_reset_stat(capt);
+
     switch (capt->io) {
     case IO_METHOD_READ:
         /* Nothing to do */
@@ -378,6 +556,8 @@ int v4l2_open_device(struct capture_t *capt)
         return -1;
     }
 
+    pthread_mutex_init(&capt->stat_lock, NULL);
+
     capt->fd = open(capt->dev_name, O_RDWR | O_NONBLOCK, 0);
 
     if (capt->fd < 0) {
@@ -537,7 +717,9 @@ int v4l2_free_device(struct capture_t *capt)
         break;
 
     case IO_METHOD_USERPTR:
-        jz_free_alloc_mem();
+        for (i = 0; i < capt->nbuf; i++)
+            get_pmem_manager()->free(capt->pbuf[i].start);
+        get_pmem_manager()->deinit();
         break;
     }
 
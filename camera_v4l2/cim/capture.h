@@ -16,6 +16,8 @@
 #ifndef _CAPTURE_H
 #define _CAPTURE_H
 #include <types.h>
+#include <pthread.h>
+#include <camera_v4l2/camera_v4l2_manager.h>
 
 /*
  * Struct
@@ -44,6 +46,21 @@ struct capture_t {
 
     io_method io;
     struct buffer *pbuf;
+
+    /*
+     * Frame accounting, updated by the capture thread
+     */
+    pthread_mutex_t stat_lock;
+    struct camera_v4l2_stat stat;
+    uint32_t next_sequence;
+    uint64_t last_timestamp_us;
+    uint64_t latency_total_us;
+    uint32_t latency_frames;    /* frames with a usable timestamp */
+    uint64_t process_total_us;
+    uint64_t window_start_us;
+    uint32_t window_frames;
+    uint64_t last_log_us;
+    uint32_t log_interval;
 };
 
 typedef void (*frame_process)(uint8_t* buf, uint32_t width, uint32_t height, uint8_t seq);
@@ -60,5 +77,8 @@ int v4l2_close_device(struct capture_t *capt);
 int v4l2_init_device(struct capture_t *capt, frame_process fp_cb);
 int v4l2_free_device(struct capture_t *capt);
 int v4l2_loop(struct capture_t *capt);
+void v4l2_get_stat(struct capture_t *capt, struct camera_v4l2_stat *stat);
+void v4l2_reset_stat(struct capture_t *capt);
+void v4l2_set_stat_log_interval(struct capture_t *capt, uint32_t seconds);
 
 #endif
@@ -0,0 +1,339 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include <types.h>
+#include <utils/log.h>
+#include <utils/common.h>
+#include <thread/thread.h>
+#include <audio/alsa/wave_player.h>
+#include <audio/alsa/wave_recorder.h>
+
+#define LOG_TAG "test_audio_latency"
+
+/*
+ * snd-aloop: what is played to substream 0 of device 0 comes back on
+ * substream 0 of device 1, "modprobe snd-aloop" on any Linux box
+ */
+#define DEFAULT_PLAY_DEVICE      "hw:Loopback,0,0"
+#define DEFAULT_CAPTURE_DEVICE   "hw:Loopback,1,0"
+#define DEFAULT_SECONDS          (5)
+
+#define CHANNELS                 (2)
+#define SAMPLE_RATE              (48000)
+#define SAMPLE_LENGTH            (16)
+#define FRAME_BYTES              (CHANNELS * SAMPLE_LENGTH / 8)
+#define MAX_PERIOD_FRAMES        (4096)
+
+/*
+ * A 2ms chirp every 250ms, latencies beyond the interval can't be
+ * told apart
+ */
+#define MARKER_FRAMES            (96)
+#define MARKER_INTERVAL_MS       (250)
+#define MARKER_THRESHOLD         (16384)
+#define MAX_MARKERS              (1024)
+#define CAPTURE_RING_MS          (200)
+
+static const struct {
+    uint32_t period_frames;
+    uint32_t periods;
+} configs[] = {
+    {64, 2},
+    {128, 2},
+    {256, 2},
+    {256, 4},
+    {512, 4},
+    {1024, 4},
+};
+
+static struct wave_player* player;
+static struct wave_recorder* recorder;
+
+static int16_t marker[MARKER_FRAMES];
+
+static struct {
+    uint32_t period_frames;
+    uint64_t sent_us[MAX_MARKERS];
+    uint32_t sent;
+    int quit;
+} play_state;
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t cpu_us(void) {
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+
+    return (uint64_t) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000
+            + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static void make_marker(void) {
+    for (int i = 0; i < MARKER_FRAMES; i++) {
+        double t = (double) i / SAMPLE_RATE;
+        double sweep = 1000 + 7000.0 * i / MARKER_FRAMES;
+
+        marker[i] = 30000 * sin(2 * M_PI * sweep * t + M_PI / 2);
+    }
+}
+
+/*
+ * Silence with a marker at the start of a period every interval, the
+ * send time is taken once the period is queued to the device
+ */
+static void play_loop(struct pthread_wrapper* thread, void* param) {
+    int16_t buffer[MAX_PERIOD_FRAMES * CHANNELS];
+    uint32_t interval = SAMPLE_RATE * MARKER_INTERVAL_MS / 1000;
+    uint32_t period = play_state.period_frames;
+    uint32_t buffer_frames;
+    uint64_t written = 0;
+    uint64_t next_marker = interval;
+    int has_marker;
+
+    while (!__atomic_load_n(&play_state.quit, __ATOMIC_ACQUIRE)) {
+        memset(buffer, 0, period * FRAME_BYTES);
+
+        has_marker = written >= next_marker
+                && play_state.sent < MAX_MARKERS;
+        if (has_marker) {
+            for (int i = 0; i < MIN(MARKER_FRAMES, period); i++)
+                for (int c = 0; c < CHANNELS; c++)
+                    buffer[i * CHANNELS + c] = marker[i];
+
+            next_marker += interval;
+        }
+
+        if (player->play_stream(CHANNELS, SAMPLE_RATE, SAMPLE_LENGTH,
+                (uint8_t*) buffer, period * FRAME_BYTES) < 0) {
+            LOGE("Failed to play stream\n");
+            break;
+        }
+
+        if (has_marker) {
+            play_state.sent_us[play_state.sent] = now_us();
+            __atomic_store_n(&play_state.sent, play_state.sent + 1,
+                    __ATOMIC_RELEASE);
+        }
+
+        /*
+         * Write whole device periods from here on, a short write
+         * would be padded with silence
+         */
+        if (written == 0 && player->get_buffer_size(&period,
+                &buffer_frames) == 0)
+            period = MIN(period, MAX_PERIOD_FRAMES);
+
+        written += period;
+    }
+}
+
+/*
+ * Latency of a marker seen at @seen_us: the newest marker sent
+ * before it, anything slower than the interval is a miss
+ */
+static int match_marker(uint64_t seen_us, uint32_t* latency_us) {
+    uint32_t sent = __atomic_load_n(&play_state.sent, __ATOMIC_ACQUIRE);
+
+    for (int i = sent - 1; i >= 0; i--) {
+        if (play_state.sent_us[i] > seen_us)
+            continue;
+
+        if (seen_us - play_state.sent_us[i] >= MARKER_INTERVAL_MS * 1000)
+            return -1;
+
+        *latency_us = seen_us - play_state.sent_us[i];
+        return 0;
+    }
+
+    return -1;
+}
+
+static int run_config(uint32_t period_frames, uint32_t periods, int seconds) {
+    struct wave_player_stat play_stat;
+    struct wave_capture_stat capture_stat;
+    static uint32_t latencies[MAX_MARKERS];
+    struct thread* play_thread;
+    uint32_t play_period = 0;
+    uint32_t play_buffer = 0;
+    uint32_t capture_period = 0;
+    uint32_t capture_buffer = 0;
+    uint32_t found = 0;
+    uint32_t holdoff = 0;
+    uint32_t latency;
+    uint32_t min_us = UINT32_MAX;
+    uint32_t max_us = 0;
+    uint64_t start;
+    uint64_t end;
+    uint64_t cpu_start;
+    uint64_t seen_us;
+    double mean = 0;
+    double jitter = 0;
+    uint8_t* block;
+    int16_t* samples;
+    int size;
+    int frames;
+
+    player->set_buffer_size(period_frames, periods);
+    recorder->set_buffer_size(period_frames, periods);
+    player->reset_stat();
+
+    memset(&play_state, 0, sizeof(play_state));
+    play_state.period_frames = MIN(period_frames, MAX_PERIOD_FRAMES);
+
+    if (recorder->start_capture(CHANNELS, SAMPLE_RATE, SAMPLE_LENGTH,
+            CAPTURE_RING_MS, NULL) < 0) {
+        LOGE("Failed to start capture\n");
+        return -1;
+    }
+
+    recorder->get_buffer_size(&capture_period, &capture_buffer);
+
+    play_thread = _new(struct thread, thread);
+    play_thread->runnable.run = play_loop;
+
+    start = now_us();
+    cpu_start = cpu_us();
+    end = start + (uint64_t) seconds * 1000000;
+
+    if (play_thread->start(play_thread, NULL) < 0) {
+        LOGE("Failed to start play thread\n");
+        _delete(play_thread);
+        recorder->stop_capture();
+        return -1;
+    }
+
+    while (now_us() < end) {
+        size = recorder->dequeue_capture(&block, 100);
+        if (size < 0)
+            break;
+
+        if (size == 0)
+            continue;
+
+        seen_us = now_us();
+        samples = (int16_t*) block;
+        frames = size / FRAME_BYTES;
+
+        for (int i = 0; i < frames; i++) {
+            if (holdoff) {
+                holdoff--;
+                continue;
+            }
+
+            if (abs(samples[i * CHANNELS]) < MARKER_THRESHOLD)
+                continue;
+
+            holdoff = MARKER_FRAMES * 2;
+
+            if (match_marker(seen_us, &latency) < 0 || found == MAX_MARKERS)
+                continue;
+
+            latencies[found++] = latency;
+        }
+
+        recorder->release_capture();
+    }
+
+    __atomic_store_n(&play_state.quit, 1, __ATOMIC_RELEASE);
+    play_thread->wait(play_thread);
+    _delete(play_thread);
+
+    end = now_us();
+
+    player->get_buffer_size(&play_period, &play_buffer);
+    player->get_stat(&play_stat);
+    recorder->get_capture_stat(&capture_stat);
+
+    player->cancel_play();
+    recorder->stop_capture();
+
+    for (uint32_t i = 0; i < found; i++) {
+        mean += latencies[i];
+        min_us = MIN(min_us, latencies[i]);
+        max_us = MAX(max_us, latencies[i]);
+    }
+
+    if (found)
+        mean /= found;
+
+    for (uint32_t i = 0; i < found; i++)
+        jitter += (latencies[i] - mean) * (latencies[i] - mean);
+
+    if (found)
+        jitter = sqrt(jitter / found);
+
+    LOGI("%4u x %u | play %4u/%5u cap %4u/%5u | %3u/%3u markers | "
+            "latency %6.2f/%6.2f/%6.2f ms jitter %5.2f ms | xruns play %u "
+            "cap %u dropped %u | cpu %4.1f%%\n",
+            period_frames, periods, play_period, play_buffer, capture_period,
+            capture_buffer, found, play_state.sent,
+            found ? min_us / 1000.0 : 0, mean / 1000, max_us / 1000.0,
+            jitter / 1000, play_stat.underruns, capture_stat.xruns,
+            capture_stat.dropped,
+            100.0 * (cpu_us() - cpu_start) / (end - start));
+
+    return found ? 0 : -1;
+}
+
+int main(int argc, char *argv[]) {
+    const char* play_device = DEFAULT_PLAY_DEVICE;
+    const char* capture_device = DEFAULT_CAPTURE_DEVICE;
+    int seconds = DEFAULT_SECONDS;
+    int error = 0;
+
+    if (argc > 1)
+        play_device = argv[1];
+    if (argc > 2)
+        capture_device = argv[2];
+    if (argc > 3)
+        seconds = atoi(argv[3]);
+
+    if (seconds <= 0) {
+        LOGE("Usage: %s [PLAY-DEVICE] [CAPTURE-DEVICE] [SECONDS]\n", argv[0]);
+        return -1;
+    }
+
+    make_marker();
+
+    player = get_wave_player();
+    if (player->init(play_device) < 0) {
+        LOGE("Failed to init player on %s\n", play_device);
+        return -1;
+    }
+
+    recorder = get_wave_recorder();
+    if (recorder->init(capture_device) < 0) {
+        LOGE("Failed to init recorder on %s\n", capture_device);
+        player->deinit();
+        return -1;
+    }
+
+    LOGI("%dch %dHz, %s -> %s, %ds per config\n", CHANNELS, SAMPLE_RATE,
+            play_device, capture_device, seconds);
+    LOGI("period x count | granted period/buffer frames | markers found/sent "
+            "| latency min/avg/max\n");
+
+    for (int i = 0; i < ARRAY_SIZE(configs); i++)
+        if (run_config(configs[i].period_frames, configs[i].periods,
+                seconds) < 0)
+            error = -1;
+
+    recorder->deinit();
+    player->deinit();
+
+    return error;
+}
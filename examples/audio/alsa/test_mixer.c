@@ -1,5 +1,7 @@
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <poll.h>
 
 #include <types.h>
 #include <utils/log.h>
@@ -10,7 +12,12 @@
 static struct mixer_controller* mixer;
 
 static void print_help(void) {
-    LOGE("Usage: %s volume/mute VOLUME/MUTE\n", LOG_TAG);
+    LOGE("Usage: %s volume/ramp/mute/monitor VOLUME/MUTE/SECONDS\n", LOG_TAG);
+}
+
+static void on_mixer_event(const char* name) {
+    LOGI("'%s' changed, playback volume: %d\n", name,
+            mixer->get_volume(name, PLAYBACK));
 }
 
 int main(int argc, char *argv[]) {
@@ -49,6 +56,34 @@ int main(int argc, char *argv[]) {
         LOGI("playback volume: %d, record volume: %d\n", playback_vol,
                 record_vol);
 
+    } else if (!strcmp(argv[1], "ramp")) {
+        error = mixer->ramp_volume("MERCURY", PLAYBACK,
+                strtol(argv[2], NULL, 10), 500);
+        if (error < 0) {
+            LOGE("Failed to ramp playback volume\n");
+            return -1;
+        }
+
+        usleep(600 * 1000);
+
+        LOGI("playback volume: %d\n", mixer->get_volume("MERCURY", PLAYBACK));
+
+    } else if (!strcmp(argv[1], "monitor")) {
+        struct pollfd pfd;
+        int timeout = strtol(argv[2], NULL, 10) * 1000;
+
+        pfd.fd = mixer->get_event_fd();
+        pfd.events = POLLIN;
+        if (pfd.fd < 0) {
+            LOGE("Failed to get mixer event fd\n");
+            return -1;
+        }
+
+        mixer->set_event_listener(on_mixer_event);
+
+        while (poll(&pfd, 1, timeout) > 0)
+            mixer->handle_events();
+
     } else if (!strcmp(argv[1], "mute")) {
         error = mixer->mute("Digital Playback mute", strtol(argv[2], NULL, 10));
         if (error < 0) {
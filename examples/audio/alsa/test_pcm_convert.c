@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <math.h>
+
+#include <types.h>
+#include <utils/log.h>
+#include <utils/common.h>
+#include <audio/alsa/pcm_convert.h>
+
+#define LOG_TAG "test_pcm_convert"
+
+#define DEFAULT_SECONDS          (10)
+#define TONE_HZ                  (1000)
+#define CHUNK_FRAMES             (480)
+
+static struct pcm_convert* convert;
+
+static const char* quality_names[] = {
+    [PCM_CONVERT_FAST] = "fast",
+    [PCM_CONVERT_MEDIUM] = "medium",
+    [PCM_CONVERT_HIGH] = "high",
+};
+
+static const int rate_pairs[][2] = {
+    {8000, 48000},
+    {16000, 48000},
+    {44100, 16000},
+    {48000, 16000},
+    {44100, 48000},
+    {22050, 16000},
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Mono S16 tone in, stereo S16 out, in chunks like a player would
+ */
+static int bench_rate(int in_rate, int out_rate,
+        enum pcm_convert_quality quality, int seconds) {
+    struct pcm_convert_param param;
+    struct pcm_convert_handle* handle;
+    uint32_t in_total = in_rate * seconds;
+    uint32_t out_expected = (uint64_t) in_total * out_rate / in_rate;
+    uint32_t out_capacity;
+    uint32_t out_done = 0;
+    uint32_t in_done = 0;
+    uint32_t frames;
+    uint64_t start;
+    uint64_t used;
+    double signal = 0;
+    double noise = 0;
+    int16_t* in;
+    int16_t* out;
+    int ret;
+
+    param.in_format = PCM_SAMPLE_S16;
+    param.in_channels = 1;
+    param.in_rate = in_rate;
+    param.out_format = PCM_SAMPLE_S16;
+    param.out_channels = 2;
+    param.out_rate = out_rate;
+    param.quality = quality;
+
+    handle = convert->open(&param);
+    if (handle == NULL)
+        return -1;
+
+    out_capacity = out_expected + convert->get_out_frames(handle, 0) + 16;
+
+    in = malloc(in_total * sizeof(int16_t));
+    out = malloc(out_capacity * 2 * sizeof(int16_t));
+    if (in == NULL || out == NULL) {
+        LOGE("Failed to allocate buffers\n");
+        free(in);
+        free(out);
+        convert->close(handle);
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < in_total; i++)
+        in[i] = 16000 * sin(2 * M_PI * TONE_HZ * i / in_rate);
+
+    start = now_ns();
+
+    while (in_done < in_total) {
+        frames = MIN(in_total - in_done, CHUNK_FRAMES);
+
+        ret = convert->process(handle, (uint8_t*) (in + in_done), &frames,
+                (uint8_t*) (out + out_done * 2), out_capacity - out_done);
+        if (ret < 0)
+            break;
+
+        in_done += frames;
+        out_done += ret;
+    }
+
+    while ((ret = convert->flush(handle, (uint8_t*) (out + out_done * 2),
+            out_capacity - out_done)) > 0)
+        out_done += ret;
+
+    used = now_ns() - start;
+
+    /*
+     * The filters are linear phase and centred, so the output lines
+     * up with the ideal tone; skip the edges where the window is
+     * half empty
+     */
+    for (uint32_t i = out_rate / 10; i + out_rate / 10 < out_done; i++) {
+        double ideal = 16000 * sin(2 * M_PI * TONE_HZ * (double) i / out_rate);
+        double error = out[i * 2] - ideal;
+
+        signal += ideal * ideal;
+        noise += error * error;
+    }
+
+    LOGI("%5d -> %5d %-6s: %u frames (expect %u), %6.1fx realtime, "
+            "%5.1f ns/frame, SNR %.1f dB\n", in_rate, out_rate,
+            quality_names[quality], out_done, out_expected,
+            (double) seconds * 1000000000 / used, (double) used / out_done,
+            10 * log10(signal / (noise + 1e-9)));
+
+    ret = out_done >= out_expected && out_done <= out_expected + 1 ? 0 : -1;
+    if (ret < 0)
+        LOGE("Output length mismatch\n");
+
+    free(in);
+    free(out);
+    convert->close(handle);
+
+    return ret;
+}
+
+/*
+ * S16 -> format -> S16 must come back bit exact
+ */
+static int test_format(enum pcm_sample_format format) {
+    struct pcm_convert_param param;
+    struct pcm_convert_handle* to;
+    struct pcm_convert_handle* back;
+    int16_t in[1024];
+    int16_t out[1024];
+    uint8_t middle[1024 * 4];
+    uint32_t frames;
+    int error = 0;
+
+    for (int i = 0; i < 1024; i++)
+        in[i] = i == 0 ? INT16_MIN : i == 1 ? INT16_MAX : rand();
+
+    memset(&param, 0, sizeof(param));
+    param.in_format = PCM_SAMPLE_S16;
+    param.in_channels = 2;
+    param.in_rate = 16000;
+    param.out_format = format;
+    param.out_channels = 2;
+    param.out_rate = 16000;
+
+    to = convert->open(&param);
+
+    param.in_format = format;
+    param.out_format = PCM_SAMPLE_S16;
+    back = convert->open(&param);
+
+    if (to == NULL || back == NULL)
+        return -1;
+
+    frames = 512;
+    convert->process(to, (uint8_t*) in, &frames, middle, 512);
+    frames = 512;
+    convert->process(back, middle, &frames, (uint8_t*) out, 512);
+
+    if (memcmp(in, out, sizeof(in))) {
+        LOGE("Format %d round trip mismatch\n", format);
+        error = -1;
+    }
+
+    convert->close(to);
+    convert->close(back);
+
+    return error;
+}
+
+int main(int argc, char *argv[]) {
+    int seconds = DEFAULT_SECONDS;
+    int error = 0;
+
+    if (argc > 1)
+        seconds = atoi(argv[1]);
+
+    if (seconds <= 0) {
+        LOGE("Usage: test_pcm_convert [SECONDS]\n");
+        return -1;
+    }
+
+    convert = get_pcm_convert();
+
+    for (int format = PCM_SAMPLE_S16; format <= PCM_SAMPLE_FLOAT; format++)
+        if (test_format(format) < 0)
+            error = -1;
+
+    for (int i = 0; i < ARRAY_SIZE(rate_pairs); i++)
+        for (int quality = PCM_CONVERT_FAST; quality <= PCM_CONVERT_HIGH;
+                quality++)
+            if (bench_rate(rate_pairs[i][0], rate_pairs[i][1], quality,
+                    seconds) < 0)
+                error = -1;
+
+    LOGI("%s\n", error ? "FAILED" : "PASSED");
+
+    return error;
+}
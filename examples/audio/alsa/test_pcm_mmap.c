@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <types.h>
+#include <utils/log.h>
+#include <utils/common.h>
+#include <audio/alsa/pcm_mmap.h>
+
+#define LOG_TAG "test_pcm_mmap"
+
+#define DEFAULT_DEVICE           "null"
+#define DEFAULT_CHANNELS         (2)
+#define DEFAULT_SAMPLE_RATE      (16000)
+#define DEFAULT_SAMPLE_LENGTH    (16)
+#define DEFAULT_PERIOD_US        (5000)
+#define DEFAULT_PERIODS          (2)
+#define DEFAULT_SECONDS          (3)
+#define TONE_HZ                  (1000)
+
+static struct pcm_mmap* pcm_mmap;
+
+static void print_latency(struct pcm_mmap_handle* handle) {
+    struct pcm_mmap_latency latency;
+
+    pcm_mmap->get_latency(handle, &latency);
+
+    LOGI("period %u frames(%uus), buffer %u frames(%uus), "
+            "delay %d frames(%dus), xruns %u\n",
+            latency.period_frames, latency.period_us, latency.buffer_frames,
+            latency.buffer_us, latency.delay_frames, latency.delay_us,
+            latency.xruns);
+}
+
+static int run_playback(struct pcm_mmap_handle* handle, int seconds) {
+    uint32_t total = DEFAULT_SAMPLE_RATE * seconds;
+    uint32_t done = 0;
+    uint32_t frames;
+    uint32_t phase = 0;
+    int16_t* area;
+
+    while (done < total) {
+        frames = total - done;
+        if (pcm_mmap->begin(handle, (uint8_t**) &area, &frames, 1000) < 0)
+            return -1;
+
+        /*
+         * Render the tone straight into the DMA area
+         */
+        for (uint32_t i = 0; i < frames; i++, phase++) {
+            int16_t sample = 8000 * sin(2 * M_PI * TONE_HZ * phase
+                    / DEFAULT_SAMPLE_RATE);
+
+            for (int ch = 0; ch < DEFAULT_CHANNELS; ch++)
+                *area++ = sample;
+        }
+
+        if (pcm_mmap->commit(handle, frames) < 0)
+            return -1;
+
+        done += frames;
+        if (done / DEFAULT_SAMPLE_RATE != (done - frames) / DEFAULT_SAMPLE_RATE)
+            print_latency(handle);
+    }
+
+    pcm_mmap->drain(handle);
+
+    return 0;
+}
+
+static int run_capture(struct pcm_mmap_handle* handle, int seconds) {
+    uint32_t total = DEFAULT_SAMPLE_RATE * seconds;
+    uint32_t done = 0;
+    uint32_t frames;
+    int16_t* area;
+    int peak = 0;
+
+    while (done < total) {
+        frames = 0;
+        if (pcm_mmap->begin(handle, (uint8_t**) &area, &frames, 1000) < 0)
+            return -1;
+
+        for (uint32_t i = 0; i < frames * DEFAULT_CHANNELS; i++)
+            peak = MAX(peak, abs(area[i]));
+
+        if (pcm_mmap->commit(handle, frames) < 0)
+            return -1;
+
+        done += frames;
+        if (done / DEFAULT_SAMPLE_RATE != (done - frames) / DEFAULT_SAMPLE_RATE) {
+            print_latency(handle);
+            LOGI("peak %d\n", peak);
+            peak = 0;
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char* device = DEFAULT_DEVICE;
+    enum pcm_mmap_stream stream = PCM_MMAP_PLAYBACK;
+    struct pcm_mmap_param param;
+    struct pcm_mmap_handle* handle;
+    int period_us = DEFAULT_PERIOD_US;
+    int seconds = DEFAULT_SECONDS;
+    int error;
+
+    if (argc > 1 && !strcmp(argv[1], "-c")) {
+        stream = PCM_MMAP_CAPTURE;
+        argc--;
+        argv++;
+    }
+
+    if (argc > 1)
+        device = argv[1];
+    if (argc > 2)
+        period_us = atoi(argv[2]);
+    if (argc > 3)
+        seconds = atoi(argv[3]);
+
+    if (period_us <= 0 || seconds <= 0) {
+        LOGE("Usage: test_pcm_mmap [-c] [DEVICE] [PERIOD-US] [SECONDS]\n");
+        return -1;
+    }
+
+    param.channels = DEFAULT_CHANNELS;
+    param.sample_rate = DEFAULT_SAMPLE_RATE;
+    param.sample_length = DEFAULT_SAMPLE_LENGTH;
+    param.period_frames = (uint64_t) DEFAULT_SAMPLE_RATE * period_us / 1000000;
+    param.periods = DEFAULT_PERIODS;
+
+    pcm_mmap = get_pcm_mmap();
+
+    handle = pcm_mmap->open(device, stream, &param);
+    if (handle == NULL) {
+        LOGE("Failed to open %s\n", device);
+        return -1;
+    }
+
+    print_latency(handle);
+
+    if (stream == PCM_MMAP_PLAYBACK)
+        error = run_playback(handle, seconds);
+    else
+        error = run_capture(handle, seconds);
+
+    print_latency(handle);
+
+    pcm_mmap->close(handle);
+
+    return error;
+}
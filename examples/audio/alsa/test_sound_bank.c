@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <types.h>
+#include <utils/log.h>
+#include <utils/common.h>
+#include <audio/alsa/sound_bank.h>
+#include <audio/alsa/wave_player.h>
+
+#define LOG_TAG "test_sound_bank"
+
+#define DEFAULT_REPEAT           (3)
+
+static const char* snd_device = "hw:0,0";
+static struct sound_bank* bank;
+static struct wave_player* player;
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int is_pack(const char* path) {
+    const char* ext = strrchr(path, '.');
+
+    return ext && !strcmp(ext, ".pack");
+}
+
+static void print_help(void) {
+    LOGE("Usage: %s REPEAT FILE.wav/FILE.pack...\n", LOG_TAG);
+}
+
+int main(int argc, char *argv[]) {
+    int ids[SOUND_BANK_MAX_SOUNDS];
+    const struct wave_sound* sound;
+    struct wave_player_stat stat;
+    uint64_t start;
+    int repeat;
+    int count = 0;
+    int ret;
+    int error = 0;
+
+    if (argc < 3) {
+        print_help();
+        return -1;
+    }
+
+    repeat = strtol(argv[1], NULL, 10);
+    if (repeat <= 0)
+        repeat = DEFAULT_REPEAT;
+
+    bank = get_sound_bank();
+    bank->init();
+
+    for (int i = 2; i < argc && count < SOUND_BANK_MAX_SOUNDS; i++) {
+        start = now_us();
+
+        if (is_pack(argv[i])) {
+            ret = bank->load_pack(argv[i], ids + count,
+                    SOUND_BANK_MAX_SOUNDS - count);
+        } else {
+            ret = bank->load_wave(argv[i]);
+            if (ret >= 0) {
+                ids[count] = ret;
+                ret = 1;
+            }
+        }
+
+        if (ret < 0) {
+            LOGE("Failed to load %s\n", argv[i]);
+            error = -1;
+            goto out;
+        }
+
+        LOGI("%s: %d sound(s) loaded in %llu us\n", argv[i], ret,
+                (unsigned long long) (now_us() - start));
+        count += ret;
+    }
+
+    player = get_wave_player();
+    if (player->init(snd_device) < 0) {
+        LOGE("Failed to init player\n");
+        error = -1;
+        goto out;
+    }
+
+    for (int i = 0; i < count; i++) {
+        sound = bank->get_sound(ids[i]);
+
+        LOGI("sound %d: %dch %dHz %dbit, %u bytes\n", ids[i], sound->channels,
+                sound->sample_rate, sound->sample_length, sound->size);
+
+        for (int j = 0; j < repeat; j++) {
+            start = now_us();
+
+            if (player->play_sound(sound) < 0) {
+                LOGE("Failed to play sound %d\n", ids[i]);
+                error = -1;
+                break;
+            }
+
+            LOGI("  play %d: %llu us\n", j, (unsigned long long) (now_us()
+                    - start));
+        }
+    }
+
+    player->get_stat(&stat);
+    LOGI("sound plays: %u, underruns: %u\n", stat.sound_plays,
+            stat.underruns);
+
+    player->deinit();
+
+out:
+    bank->deinit();
+
+    return error;
+}
@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <math.h>
+
+#include <types.h>
+#include <utils/log.h>
+#include <utils/common.h>
+#include <audio/alsa/stream_mixer.h>
+
+#define LOG_TAG "test_stream_mix"
+
+#define DEFAULT_DEVICE           "null"
+#define DEFAULT_CHANNELS         (2)
+#define DEFAULT_SAMPLE_RATE      (16000)
+#define TONE_HZ                  (440)
+#define TONE_SECONDS             (3)
+#define TONE_CHUNK_FRAMES        (320)
+
+static struct stream_mixer* mixer;
+
+static void print_stat(void) {
+    struct stream_mixer_stat stat;
+
+    mixer->get_stat(&stat);
+
+    LOGI("periods %u, active %u, underruns %u, starved %u, clipped %u, "
+            "max mix %uus\n", stat.periods, stat.active_sources,
+            stat.underruns, stat.starved, stat.clipped_samples,
+            stat.max_mix_us);
+}
+
+/*
+ * Push a mono tone as a stream source, pausing it and lowering its
+ * gain half way through while the wave files keep playing
+ */
+static int play_tone(void) {
+    int16_t chunk[TONE_CHUNK_FRAMES];
+    uint32_t total = DEFAULT_SAMPLE_RATE * TONE_SECONDS;
+    uint32_t phase = 0;
+    int id;
+
+    id = mixer->open_stream(1, DEFAULT_SAMPLE_RATE, STREAM_MIXER_GAIN_UNITY);
+    if (id < 0)
+        return -1;
+
+    while (phase < total) {
+        for (int i = 0; i < TONE_CHUNK_FRAMES; i++, phase++)
+            chunk[i] = 8000 * sin(2 * M_PI * TONE_HZ * phase
+                    / DEFAULT_SAMPLE_RATE);
+
+        if (mixer->write_stream(id, (uint8_t*) chunk, sizeof(chunk)) < 0) {
+            LOGE("Failed to write tone\n");
+            mixer->cancel(id);
+            return -1;
+        }
+
+        if (phase == total / 2) {
+            mixer->pause(id);
+            print_stat();
+            usleep(500000);
+            mixer->set_gain(id, STREAM_MIXER_GAIN_UNITY / 4);
+            mixer->resume(id);
+        }
+    }
+
+    mixer->close_stream(id);
+    mixer->wait(id);
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    struct stream_mixer_param param;
+    const char* device = DEFAULT_DEVICE;
+    int ids[STREAM_MIXER_MAX_SOURCES];
+    int fds[STREAM_MIXER_MAX_SOURCES];
+    int count = 0;
+    int error;
+
+    if (argc > 1)
+        device = argv[1];
+
+    param.channels = DEFAULT_CHANNELS;
+    param.sample_rate = DEFAULT_SAMPLE_RATE;
+    param.period_frames = 0;
+    param.periods = 0;
+
+    mixer = get_stream_mixer();
+    if (mixer->init(device, &param) < 0) {
+        LOGE("Usage: test_stream_mix [DEVICE] [WAVE-FILE]...\n");
+        return -1;
+    }
+
+    for (int i = 2; i < argc && count < STREAM_MIXER_MAX_SOURCES - 1; i++) {
+        fds[count] = open(argv[i], O_RDONLY);
+        if (fds[count] < 0) {
+            LOGE("Failed to open %s: %s\n", argv[i], strerror(errno));
+            continue;
+        }
+
+        ids[count] = mixer->play_wave(fds[count], STREAM_MIXER_GAIN_UNITY);
+        if (ids[count] < 0) {
+            close(fds[count]);
+            continue;
+        }
+
+        count++;
+    }
+
+    error = play_tone();
+
+    for (int i = 0; i < count; i++) {
+        mixer->wait(ids[i]);
+        close(fds[i]);
+    }
+
+    print_stat();
+
+    mixer->deinit();
+
+    return error;
+}
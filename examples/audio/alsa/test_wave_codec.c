@@ -0,0 +1,279 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+
+#include <types.h>
+#include <utils/log.h>
+#include <utils/common.h>
+#include <utils/wave_parser.h>
+#include <audio/alsa/wave_codec.h>
+
+#define LOG_TAG "test_wave_codec"
+
+#define DEFAULT_SECONDS          (10)
+#define DEFAULT_CHANNELS         (2)
+#define DEFAULT_SAMPLE_RATE      (16000)
+#define MAX_CHUNK_FRAMES         (700)
+#define OUT_CHUNK_BYTES          (1000)
+
+static struct wave_codec* codec;
+
+static const char* codec_names[] = {
+    [WAVE_CODEC_PCM] = "pcm",
+    [WAVE_CODEC_IMA_ADPCM] = "ima-adpcm",
+    [WAVE_CODEC_LOSSLESS] = "lossless",
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Two tones, a slow sweep and a little noise, somewhere between
+ * speech and music for the predictors
+ */
+static void make_signal(int16_t* pcm, uint32_t frames, int channels,
+        int sample_rate) {
+    for (uint32_t i = 0; i < frames; i++) {
+        double t = (double) i / sample_rate;
+        double sweep = 200 + 1800 * (0.5 + 0.5 * sin(2 * M_PI * 0.2 * t));
+
+        for (int c = 0; c < channels; c++) {
+            double v = 6000 * sin(2 * M_PI * 440 * t + c)
+                    + 3000 * sin(2 * M_PI * sweep * t)
+                    + (rand() % 401 - 200);
+
+            pcm[i * channels + c] = v;
+        }
+    }
+}
+
+static int load_wave(const char* path, int16_t** pcm, uint32_t* frames,
+        int* channels, int* sample_rate) {
+    WaveContainer container;
+    uint32_t length;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        LOGE("Failed to open %s\n", path);
+        return -1;
+    }
+
+    if (wave_read_header(fd, &container) < 0
+            || LE_SHORT(container.format.format) != WAV_FMT_PCM
+            || LE_SHORT(container.format.bit_p_spl) != 16) {
+        LOGE("%s is not a 16 bit pcm wave file\n", path);
+        close(fd);
+        return -1;
+    }
+
+    *channels = LE_SHORT(container.format.channels);
+    *sample_rate = LE_INT(container.format.sample_fq);
+    length = LE_INT(container.chunk_header.length);
+
+    *pcm = malloc(length);
+    if (*pcm == NULL || read(fd, *pcm, length) != length) {
+        LOGE("Failed to read %s\n", path);
+        free(*pcm);
+        close(fd);
+        return -1;
+    }
+
+    *frames = length / (*channels * 2);
+    close(fd);
+
+    return 0;
+}
+
+/*
+ * Encode and decode the whole signal in odd sized pieces, the way a
+ * recorder and player feed it
+ */
+static int bench_codec(enum wave_codec_type type, const int16_t* pcm,
+        uint32_t frames, int channels, int sample_rate) {
+    struct wave_codec_handle* handle;
+    WaveContainer container;
+    uint32_t frame_bytes = channels * 2;
+    uint32_t capacity = frames * frame_bytes + 65536;
+    uint32_t coded = 0;
+    uint32_t done = 0;
+    uint32_t size;
+    uint32_t piece;
+    uint64_t encode_ns;
+    uint64_t decode_ns;
+    uint64_t start;
+    double seconds = (double) frames / sample_rate;
+    double signal = 0;
+    double noise = 0;
+    uint8_t* data;
+    int16_t* out;
+    int error = 0;
+    int ret;
+
+    data = malloc(capacity);
+    out = malloc((frames + 8) * frame_bytes);
+    if (data == NULL || out == NULL) {
+        LOGE("Failed to allocate buffers\n");
+        free(data);
+        free(out);
+        return -1;
+    }
+
+    handle = codec->open_encoder(type, channels, sample_rate);
+    if (handle == NULL) {
+        free(data);
+        free(out);
+        return -1;
+    }
+
+    start = now_ns();
+
+    while (done < frames) {
+        piece = 1 + rand() % MAX_CHUNK_FRAMES;
+        size = MIN(frames - done, piece);
+
+        do {
+            uint32_t taken = size;
+
+            ret = codec->encode(handle, (const uint8_t*) (pcm
+                    + done * channels), &taken, data + coded,
+                    MIN(OUT_CHUNK_BYTES, capacity - coded));
+            coded += ret;
+            done += taken;
+            size -= taken;
+        } while (size || ret == OUT_CHUNK_BYTES);
+    }
+
+    while ((ret = codec->flush(handle, data + coded,
+            MIN(OUT_CHUNK_BYTES, capacity - coded))) > 0)
+        coded += ret;
+
+    encode_ns = now_ns() - start;
+
+    memset(&container, 0, sizeof(container));
+    codec->fill_header(handle, &container);
+    container.chunk_header.length = LE_INT(coded);
+    codec->close(handle);
+
+    handle = codec->open_decoder(&container);
+    if (handle == NULL) {
+        free(data);
+        free(out);
+        return -1;
+    }
+
+    start = now_ns();
+
+    done = 0;
+    for (uint32_t pos = 0; pos < coded;) {
+        uint32_t taken;
+
+        piece = 1 + rand() % OUT_CHUNK_BYTES;
+        taken = MIN(coded - pos, piece);
+
+        ret = codec->decode(handle, data + pos, &taken,
+                (uint8_t*) (out + done * channels),
+                MIN(MAX_CHUNK_FRAMES, frames + 8 - done));
+        if (ret < 0) {
+            error = -1;
+            break;
+        }
+
+        done += ret;
+        pos += taken;
+    }
+
+    size = 0;
+    while (!error && (ret = codec->decode(handle, NULL, &size,
+            (uint8_t*) (out + done * channels), frames + 8 - done)) > 0)
+        done += ret;
+
+    decode_ns = now_ns() - start;
+    codec->close(handle);
+
+    /*
+     * The fact chunk trims the padding of the last block
+     */
+    if (done != frames) {
+        LOGE("%s: decoded %u frames of %u\n", codec_names[type], done, frames);
+        error = -1;
+    }
+
+    if (type == WAVE_CODEC_LOSSLESS && memcmp(pcm, out, frames * frame_bytes)) {
+        LOGE("%s: round trip is not bit exact\n", codec_names[type]);
+        error = -1;
+    }
+
+    for (uint32_t i = 0; i < frames * channels; i++) {
+        double e = out[i] - pcm[i];
+
+        signal += (double) pcm[i] * pcm[i];
+        noise += e * e;
+    }
+
+    LOGI("%-9s: %5.1f%% of pcm, encode %7.1fx realtime (%6.2f ms CPU/s), "
+            "decode %7.1fx realtime (%6.2f ms CPU/s), SNR %.1f dB\n",
+            codec_names[type], 100.0 * coded / (frames * frame_bytes),
+            seconds * 1e9 / encode_ns, encode_ns / 1e6 / seconds,
+            seconds * 1e9 / decode_ns, decode_ns / 1e6 / seconds,
+            noise ? 10 * log10(signal / noise) : INFINITY);
+
+    free(data);
+    free(out);
+
+    return error;
+}
+
+int main(int argc, char *argv[]) {
+    int channels = DEFAULT_CHANNELS;
+    int sample_rate = DEFAULT_SAMPLE_RATE;
+    int seconds = DEFAULT_SECONDS;
+    uint32_t frames;
+    int16_t* pcm;
+    int error = 0;
+
+    if (argc > 1)
+        seconds = atoi(argv[1]);
+
+    if (seconds <= 0) {
+        LOGE("Usage: test_wave_codec [SECONDS] [FILE.wav]\n");
+        return -1;
+    }
+
+    codec = get_wave_codec();
+
+    if (argc > 2) {
+        if (load_wave(argv[2], &pcm, &frames, &channels, &sample_rate) < 0)
+            return -1;
+    } else {
+        frames = sample_rate * seconds;
+        pcm = malloc(frames * channels * 2);
+        if (pcm == NULL) {
+            LOGE("Failed to allocate signal\n");
+            return -1;
+        }
+
+        make_signal(pcm, frames, channels, sample_rate);
+    }
+
+    LOGI("%u frames, %dch %dHz\n", frames, channels, sample_rate);
+
+    for (int type = WAVE_CODEC_IMA_ADPCM; type <= WAVE_CODEC_LOSSLESS; type++)
+        if (bench_codec(type, pcm, frames, channels, sample_rate) < 0)
+            error = -1;
+
+    free(pcm);
+
+    LOGI("%s\n", error ? "FAILED" : "PASSED");
+
+    return error;
+}
@@ -103,11 +103,16 @@ static void input_event_listener(const char* name, struct input_event* event) {
 
 static void play_thread(struct pthread_wrapper* thread, void* param) {
     int error = 0;
+    struct wave_player_stat stat;
 
     error = player->play_wave(fd);
     if (error < 0)
         LOGE("Failed to play wave\n");
 
+    player->get_stat(&stat);
+    LOGI("chunks: %u, underruns: %u, reader stalls: %u, max read: %uus\n",
+            stat.chunks, stat.underruns, stat.reader_stalls, stat.max_read_us);
+
     if (fd > 0)
         close(fd);
 
@@ -93,6 +93,7 @@ static void input_event_listener(const char* name, struct input_event* event) {
 }
 
 static void record_thread(struct pthread_wrapper* thread, void* param) {
+    struct wave_capture_stat stat;
     int error = 0;
 
     error = recorder->record_wave(fd, DEFAULT_CHANNELS,
@@ -100,6 +101,11 @@ static void record_thread(struct pthread_wrapper* thread, void* param) {
     if (error < 0)
         LOGE("Failed to record wave file\n");
 
+    recorder->get_capture_stat(&stat);
+    LOGI("periods %u, dropped %u, xruns %u, ring %u/%u blocks\n",
+            stat.periods, stat.dropped, stat.xruns, stat.max_fill,
+            stat.block_count);
+
     pthread_exit(NULL);
 }
 
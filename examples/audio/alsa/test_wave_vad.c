@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+
+#include <types.h>
+#include <utils/log.h>
+#include <utils/common.h>
+#include <utils/wave_parser.h>
+#include <audio/alsa/wave_vad.h>
+
+#define LOG_TAG "test_wave_vad"
+
+#define DEFAULT_CHANNELS         (1)
+#define DEFAULT_SAMPLE_RATE      (16000)
+#define BLOCK_MS                 (10)
+
+static struct wave_vad* wave_vad;
+
+static const char* state_names[] = {
+    [WAVE_VAD_SILENCE] = "silence",
+    [WAVE_VAD_ONSET] = "onset",
+    [WAVE_VAD_SPEECH] = "speech",
+    [WAVE_VAD_HANGOVER] = "hangover",
+};
+
+/*
+ * Bursts over a noise floor that rises 20dB from 4s to 6s: two words,
+ * a click too short to count, then a word on the louder floor and a
+ * long one with a gap shorter than the hangover inside it
+ */
+static const struct {
+    uint32_t start_ms;
+    uint32_t length_ms;
+    int amplitude;
+} bursts[] = {
+    {1000, 600, 8000},
+    {2500, 400, 3000},
+    {3800, 20, 20000},
+    {6500, 500, 8000},
+    {7500, 500, 6000},
+    {8100, 700, 6000},
+};
+
+#define SYNTHETIC_MS             (10000)
+#define NOISE_RISE_MS            (4000)
+#define NOISE_RISE_LENGTH_MS     (2000)
+#define SYNTHETIC_SEGMENTS       (4)
+
+static int make_signal(int16_t** pcm, uint32_t* frames, int channels,
+        int sample_rate) {
+    *frames = (uint64_t) sample_rate * SYNTHETIC_MS / 1000;
+    *pcm = malloc(*frames * channels * 2);
+    if (*pcm == NULL) {
+        LOGE("Failed to allocate signal\n");
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < *frames; i++) {
+        double t = (double) i / sample_rate;
+        uint32_t ms = i * 1000ULL / sample_rate;
+        int noise = 30;
+        double v;
+
+        if (ms >= NOISE_RISE_MS + NOISE_RISE_LENGTH_MS)
+            noise = 300;
+        else if (ms >= NOISE_RISE_MS)
+            noise = 30 * pow(10, (double) (ms - NOISE_RISE_MS)
+                    / NOISE_RISE_LENGTH_MS);
+
+        v = rand() % (2 * noise + 1) - noise;
+
+        for (int b = 0; b < ARRAY_SIZE(bursts); b++)
+            if (ms >= bursts[b].start_ms
+                    && ms < bursts[b].start_ms + bursts[b].length_ms)
+                v += bursts[b].amplitude * sin(2 * M_PI * (300 + 50 * b) * t);
+
+        for (int c = 0; c < channels; c++)
+            (*pcm)[i * channels + c] = v;
+    }
+
+    return 0;
+}
+
+static int load_wave(const char* path, int16_t** pcm, uint32_t* frames,
+        int* channels, int* sample_rate) {
+    WaveContainer container;
+    uint32_t length;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        LOGE("Failed to open %s\n", path);
+        return -1;
+    }
+
+    if (wave_read_header(fd, &container) < 0
+            || LE_SHORT(container.format.format) != WAV_FMT_PCM
+            || LE_SHORT(container.format.bit_p_spl) != 16) {
+        LOGE("%s is not a 16 bit pcm wave file\n", path);
+        close(fd);
+        return -1;
+    }
+
+    *channels = LE_SHORT(container.format.channels);
+    *sample_rate = LE_INT(container.format.sample_fq);
+    length = LE_INT(container.chunk_header.length);
+
+    *pcm = malloc(length);
+    if (*pcm == NULL || read(fd, *pcm, length) != length) {
+        LOGE("Failed to read %s\n", path);
+        free(*pcm);
+        close(fd);
+        return -1;
+    }
+
+    *frames = length / (*channels * 2);
+    close(fd);
+
+    return 0;
+}
+
+/*
+ * Feed the signal in capture sized blocks, print every state change
+ * with the levels at that point and the time spent metering
+ */
+static int run_vad(const int16_t* pcm, uint32_t frames, int channels,
+        int sample_rate, uint32_t* segments) {
+    struct wave_vad_param param;
+    struct wave_vad_handle* handle;
+    struct wave_meter meter;
+    enum wave_vad_state last = WAVE_VAD_SILENCE;
+    enum wave_vad_state state;
+    uint32_t block = sample_rate * BLOCK_MS / 1000;
+    uint32_t size;
+    uint64_t elapsed = 0;
+    struct timespec start;
+    struct timespec end;
+
+    memset(&param, 0, sizeof(param));
+    param.format = PCM_SAMPLE_S16;
+    param.channels = channels;
+    param.sample_rate = sample_rate;
+
+    handle = wave_vad->open(&param);
+    if (handle == NULL)
+        return -1;
+
+    memset(&meter, 0, sizeof(meter));
+
+    for (uint32_t pos = 0; pos < frames; pos += size) {
+        size = MIN(block, frames - pos);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        state = wave_vad->process(handle, (const uint8_t*) (pcm
+                + pos * channels), size, &meter);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        elapsed += (end.tv_sec - start.tv_sec) * 1000000000LL
+                + end.tv_nsec - start.tv_nsec;
+
+        if (state == last)
+            continue;
+
+        LOGI("%7.3fs %-8s -> %-8s segment %u rms %6.2f peak %6.2f "
+                "noise %6.2f dBFS\n", (double) pos / sample_rate,
+                state_names[last], state_names[state], meter.segment,
+                meter.rms / 100.0, meter.peak / 100.0, meter.noise / 100.0);
+        last = state;
+    }
+
+    wave_vad->close(handle);
+
+    LOGI("%u segments, %.2f ms CPU per second of audio\n", meter.segment,
+            elapsed / 1e6 / ((double) frames / sample_rate));
+
+    *segments = meter.segment;
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int channels = DEFAULT_CHANNELS;
+    int sample_rate = DEFAULT_SAMPLE_RATE;
+    int expected = SYNTHETIC_SEGMENTS;
+    uint32_t segments;
+    uint32_t frames;
+    int16_t* pcm;
+    int error;
+
+    wave_vad = get_wave_vad();
+
+    if (argc > 1) {
+        if (load_wave(argv[1], &pcm, &frames, &channels, &sample_rate) < 0)
+            return -1;
+
+        expected = argc > 2 ? atoi(argv[2]) : -1;
+    } else if (make_signal(&pcm, &frames, channels, sample_rate) < 0) {
+        return -1;
+    }
+
+    LOGI("%u frames, %dch %dHz\n", frames, channels, sample_rate);
+
+    error = run_vad(pcm, frames, channels, sample_rate, &segments);
+    if (!error && expected >= 0 && segments != expected) {
+        LOGE("Expected %d segments\n", expected);
+        error = -1;
+    }
+
+    free(pcm);
+
+    if (expected >= 0)
+        LOGI("%s\n", error ? "FAILED" : "PASSED");
+
+    return error;
+}
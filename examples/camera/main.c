@@ -12,6 +12,7 @@
 #include <fcntl.h>
 #include <stdbool.h>
 #include <getopt.h>
+#include <poll.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
@@ -43,12 +44,13 @@ static struct sensor_info sensor_info[] = {
     {OV2640, "ov2640"},
 };
 
-static const char short_options[] = "hx:y:s:";
+static const char short_options[] = "hx:y:s:p";
 static const struct option long_options[] = {
 	{ "help",       0,      NULL,           'h' },
 	{ "width",      1,      NULL,           'x' },
 	{ "height",     1,      NULL,           'y' },
 	{ "sensor",     1,      NULL,           's' },
+	{ "poll",       0,      NULL,           'p' },
 	{ 0, 0, 0, 0 }
 };
 
@@ -65,6 +67,7 @@ static void usage(FILE *fp, int argc, char *argv[])
 			 "-x | --width         Set image width\n"
 			 "-y | --height        Set image height\n"
              "-s | --sensor        Select sensor\n"
+             "-p | --poll          Capture through stream mode and poll\n"
 			 "\n", argv[0]);
 
     fprintf(fp, "Support sensor:\n");
@@ -93,10 +96,53 @@ static void print_data(unsigned char *pbuf, unsigned int image_size)
 }
 #endif
 
+/*
+ * 流模式: 采集线程读入帧环, 主线程 poll 就绪帧
+ */
+static void capture_poll(struct camera_manager *cm,
+                         struct camera_img_param *img, uint8_t *rgbbuf)
+{
+    char filename[64];
+    struct pollfd pfd;
+    uint8_t *frame;
+    uint32_t seq;
+    int index;
+    int cnt = 0;
+
+    if (cm->camera_stream_start(CAMERA_DEFAULT_NBUF, NULL) < 0) {
+        LOGE("Failed to start stream\n");
+        return;
+    }
+
+    pfd.fd = cm->camera_get_fd();
+    pfd.events = POLLIN;
+
+    while (cnt <= 5) {
+        if (poll(&pfd, 1, 2000) <= 0) {
+            LOGE("Wait frame timeout\n");
+            continue;
+        }
+
+        while ((index = cm->camera_dequeue_frame(&frame, &seq)) >= 0) {
+            sprintf(filename, "test_%d.bmp", cnt);
+            LOGI("filename = %s, seq = %u\n", filename, seq);
+
+            yuv2rgb(frame, rgbbuf, img->width, img->height);
+            cm->camera_queue_frame(index);
+
+            rgb2bmp(filename, img->width, img->height, 24, rgbbuf);
+            cnt++;
+        }
+    }
+
+    cm->camera_stream_stop();
+}
+
 int main(int argc, char *argv[])
 {
     int ret;
     int cnt = 0;
+    int use_poll = 0;
     char filename[64] = "";
     uint8_t *yuvbuf = NULL;
     uint8_t *rgbbuf = NULL;
@@ -138,6 +184,9 @@ int main(int argc, char *argv[])
         case 's':
             sensor = atoi(optarg);
             break;
+        case 'p':
+            use_poll = 1;
+            break;
         default:
             usage(stderr, argc, argv);
             exit(EXIT_FAILURE);
@@ -170,6 +219,11 @@ int main(int argc, char *argv[])
         exit(-1);
     }
 
+    if (use_poll) {
+        capture_poll(cm, &img, rgbbuf);
+        goto out;
+    }
+
     while(1) {
         /* 开始获取图像 */
         ret = cm->camera_read(yuvbuf, img.size);
@@ -196,6 +250,7 @@ int main(int argc, char *argv[])
             break;
     }
 
+out:
     /* 释放内存和摄像头 */
     free(yuvbuf);
     free(rgbbuf);
@@ -30,6 +30,7 @@
 #include <sys/ioctl.h>
 #include <fb/fb_manager.h>
 #include <camera_v4l2/camera_v4l2_manager.h>
+#include <snapshot/snapshot_manager.h>
 
 /*
  * Macro
@@ -69,6 +70,7 @@ typedef enum {
 
 struct camera_v4l2_manager* cimm;
 struct fb_manager* fbm;
+struct snapshot_manager* snapm;
 
 struct _capt_op{
     action_m action;            // action capture or preview
@@ -76,9 +78,11 @@ struct _capt_op{
     char double_ch;             // channel num
     uint8_t* filename;             // picture save name when action is capture picture
     uint16_t *ppbuf;               // map lcd piexl buf
+    int captured;                  // picture already queued to snapshot
+    struct snapshot_param snap;    // picture encode format
 }capt_op;
 
-static const char short_options[] = "c:phmn:rux:y:ds:";
+static const char short_options[] = "c:phmn:rux:y:ds:f:l:";
 
 static const struct option long_options[] = {
     { "help",       0,      NULL,           'h' },
@@ -92,6 +96,8 @@ static const struct option long_options[] = {
     { "preview",    0,      NULL,           'p' },
     { "double",     0,      NULL,           'd' },
     { "select",     1,      NULL,           's' },
+    { "format",     1,      NULL,           'f' },
+    { "level",      1,      NULL,           'l' },
     { 0, 0, 0, 0 }
 };
 
@@ -114,6 +120,8 @@ static void usage(FILE *fp, int argc, char *argv[])
              "-p | --preview       Preview picture to LCD\n"
              "-d | --double        Used double camera sensor\n"
              "-s | --select        Select operate channel, 0(color) or 1(black&white)\n"
+             "-f | --format        Picture format, bmp(default) or png\n"
+             "-l | --level         PNG compression level 0 - 9\n"
              "\n", argv[0]);
 }
 
@@ -124,6 +132,31 @@ static void frame_receive_cb(uint8_t* buf, uint32_t width, uint32_t height, uint
     uint8_t *yuvbuf = buf;
     uint8_t *rgbbuf = NULL;
     struct rgb_pixel_fmt pixel_fmt;
+    char name[256];
+
+    if (capt_op.double_ch != 1) {
+        seq = capt_op.channel;
+    }
+
+    /*
+     * Snapshot copies the YUYV frame and encodes it off this thread
+     */
+    if (capt_op.action == CAPTURE_PICTURE) {
+        if (seq != capt_op.channel || capt_op.captured)
+            return;
+
+        snprintf(name, sizeof(name), "%s.%s", (char*)capt_op.filename,
+                capt_op.snap.format == SNAPSHOT_FORMAT_PNG ? "png" : "bmp");
+
+        ret = snapm->take(name, yuvbuf, width, height, SNAPSHOT_PIXEL_YUYV,
+                &capt_op.snap, NULL, NULL);
+        if (ret < 0)
+            LOGE("make picutre fail, errno: %d\n", ret);
+        else
+            capt_op.captured = 1;
+
+        return;
+    }
 
     rgbbuf = (uint8_t *)malloc(width * height * 3);
     if (!rgbbuf) {
@@ -131,11 +164,6 @@ static void frame_receive_cb(uint8_t* buf, uint32_t width, uint32_t height, uint
         return;
     }
 
-
-    if (capt_op.double_ch != 1) {
-        seq = capt_op.channel;
-    }
-
     if (seq == capt_op.channel) {
         ret = cimm->yuv2rgb(yuvbuf, rgbbuf, width, height);
         if (ret < 0){
@@ -144,12 +172,7 @@ static void frame_receive_cb(uint8_t* buf, uint32_t width, uint32_t height, uint
             return;
         }
 
-        if (capt_op.action == CAPTURE_PICTURE){
-            ret = cimm->build_bmp(rgbbuf, width, height, (uint8_t*)capt_op.filename);
-            if (ret < 0){
-                LOGE("make bmp picutre fail, errno: %d\n",ret);
-            }
-        } else if (capt_op.action == PREVIEW_PICTURE) {
+        if (capt_op.action == PREVIEW_PICTURE) {
             MK_PIXEL_FMT(pixel_fmt);
             cimm->rgb2pixel(rgbbuf, capt_op.ppbuf, width, height, pixel_fmt);
             fbm->display();
@@ -160,6 +183,27 @@ static void frame_receive_cb(uint8_t* buf, uint32_t width, uint32_t height, uint
     return;
 }
 
+static void dump_camera_stat(void) {
+    struct camera_v4l2_stat stat;
+
+    if (cimm->get_stat(&stat) < 0)
+        return;
+
+    LOGI("Frames: %u, fps: %.1f\n", stat.frames, stat.fps);
+    LOGI("Dropped: %u in %u gaps, delayed: %u\n", stat.dropped,
+            stat.sequence_gaps, stat.delayed);
+    LOGI("Max dequeued per wakeup: %u\n", stat.max_dequeued);
+    LOGI("Latency(us): min %u, avg %u, max %u\n", stat.latency_min_us,
+            stat.latency_avg_us, stat.latency_max_us);
+    LOGI("Process(us): avg %u, max %u\n", stat.process_avg_us,
+            stat.process_max_us);
+
+    for (int i = 0; i < CAMERA_V4L2_LATENCY_BUCKETS; i++)
+        LOGI("  %s%3d ms: %u\n", i == CAMERA_V4L2_LATENCY_BUCKETS - 1 ? ">=" : " <",
+                i == CAMERA_V4L2_LATENCY_BUCKETS - 1 ? 1 << (i - 1) : 1 << i,
+                stat.latency_hist[i]);
+}
+
 int main(int argc, char *argv[])
 {
     struct capt_param_t capt_param;
@@ -175,6 +219,10 @@ int main(int argc, char *argv[])
     capt_op.double_ch = DEFAULT_DOUBLE_CHANNEL;
     capt_op.channel   = DEFAULT_CHANNEL;
     capt_op.action    = DEFAULT_ACTION;
+    capt_op.snap.format = SNAPSHOT_FORMAT_BMP;
+    capt_op.snap.compress_level = -1;
+    capt_op.snap.filter = SNAPSHOT_FILTER_DEFAULT;
+    capt_op.snap.strategy = SNAPSHOT_STRATEGY_DEFAULT;
 
     while(1) {
         int oc;
@@ -233,6 +281,17 @@ int main(int argc, char *argv[])
         case 's':
             capt_op.channel = atoi(optarg);
             break;
+
+        case 'f':
+            if (!strcmp(optarg, "png"))
+                capt_op.snap.format = SNAPSHOT_FORMAT_PNG;
+            else
+                capt_op.snap.format = SNAPSHOT_FORMAT_BMP;
+            break;
+
+        case 'l':
+            capt_op.snap.compress_level = atoi(optarg);
+            break;
         default:
             usage(stderr, argc, argv);
             LOGE("Invalid parameter %c.\n",oc);
@@ -253,6 +312,13 @@ int main(int argc, char *argv[])
         return -1;
     }
 
+    snapm = get_snapshot_manager();
+
+    if (snapm->init(SNAPSHOT_DEFAULT_QUEUE_DEPTH) < 0) {
+        LOGE("Failed to init snapshot manager\n");
+        return -1;
+    }
+
     cimm = get_camera_v4l2_manager();
 
     ret = cimm->init(&capt_param);
@@ -274,7 +340,12 @@ int main(int argc, char *argv[])
         sleep(1);
     }
 
+    dump_camera_stat();
+
     cimm->stop();
     cimm->deinit();
+
+    snapm->wait_idle();
+    snapm->deinit();
     return 0;
 }
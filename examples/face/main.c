@@ -35,6 +35,7 @@
 
 #include <fb/fb_manager.h>
 #include <utils/png_decode.h>
+#include <utils/image_process.h>
 #include <graphics/gr_drawer.h>
 #include <input/input_manager.h>
 #include <lib/face/NmIrFaceSdk.h>
@@ -258,21 +259,13 @@ __attribute__((unused)) static int save_image(uint8_t* data, char type)
 static void yuyv_extract_y(uint8_t* yuyvbuf, uint8_t* ybuf, uint32_t width,
                                                    uint32_t height, uint8_t pix_type)
 {
-    int i, j, k;
     if (pix_type == RECOGNIZE_PIXELS_320X240) {
         // y image: 320 x240
-        for (i = 0, j = 0; i < width * height * 2; i += 2, j++) {
-            ybuf[j] = yuyvbuf[i];
-        }
+        image_yuyv_extract_y(yuyvbuf, width, height, width * 2, ybuf);
     } else if (pix_type == RECOGNIZE_PIXELS_240X320) {
         // y image: 240 x320
-        for (i = width*2-1, k = 0; i >= 0; --i) {
-            if (!(i%2)) {
-                for (j = 0; j < height; ++j) {
-                    ybuf[k++] = yuyvbuf[j*width*2+i];
-                }
-            }
-        }
+        image_yuyv_extract_y_rotate(yuyvbuf, width, height, width * 2, ybuf,
+                                    IMAGE_ROTATE_CCW90);
     }
 }
 
@@ -0,0 +1,164 @@
+/*
+ *  Copyright (C) 2017, Zhang YanMing <yanmin.zhang@ingenic.com, jamincheung@126.com>
+ *
+ *  Ingenic Linux plarform SDK project
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <types.h>
+#include <utils/log.h>
+#include <utils/common.h>
+#include <utils/image_process.h>
+
+#define LOG_TAG "test_image_process"
+
+#define DEFAULT_WIDTH       640
+#define DEFAULT_HEIGHT      480
+#define DEFAULT_LOOPS       50
+
+static uint32_t width = DEFAULT_WIDTH;
+static uint32_t height = DEFAULT_HEIGHT;
+
+static uint8_t* yuyv;
+static uint8_t* luma;
+static uint8_t* out;
+static uint32_t* integral;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void run_extract_y(void) {
+    image_yuyv_extract_y(yuyv, width, height, width * 2, luma);
+}
+
+static void run_extract_y_rotate(void) {
+    image_yuyv_extract_y_rotate(yuyv, width, height, width * 2, out,
+            IMAGE_ROTATE_CCW90);
+}
+
+static void run_nv12_extract_y(void) {
+    image_nv12_extract_y(yuyv, width, height, width, out);
+}
+
+static void run_crop(void) {
+    image_yuyv_crop_y(yuyv, width, height, width * 2, width / 4, height / 4,
+            width / 2, height / 2, out, width / 2);
+}
+
+static void run_resize_box(void) {
+    image_resize_box(luma, width, height, width, out, width / 3, height / 3,
+            width / 3);
+}
+
+static void run_resize_bilinear(void) {
+    image_resize_bilinear(luma, width, height, width, out, width * 3 / 4,
+            height * 3 / 4, width * 3 / 4);
+}
+
+static void run_equalize_hist(void) {
+    image_equalize_hist(luma, width, height, width, out, width);
+}
+
+static void run_integral(void) {
+    image_integral(luma, width, height, width, integral);
+}
+
+static struct {
+    const char* name;
+    void (*run)(void);
+} kernels[] = {
+    {"yuyv_extract_y",          run_extract_y},
+    {"yuyv_extract_y_rotate",   run_extract_y_rotate},
+    {"nv12_extract_y",          run_nv12_extract_y},
+    {"yuyv_crop_y(1/4 area)",   run_crop},
+    {"resize_box(1/3)",         run_resize_box},
+    {"resize_bilinear(3/4)",    run_resize_bilinear},
+    {"equalize_hist",           run_equalize_hist},
+    {"integral",                run_integral},
+};
+
+static void print_usage(const char* name) {
+    fprintf(stderr, "Usage: %s [width] [height] [loops]\n", name);
+}
+
+int main(int argc, char *argv[]) {
+    int loops = DEFAULT_LOOPS;
+
+    if (argc > 1 && (!strcmp(argv[1], "-h") || !strcmp(argv[1], "--help"))) {
+        print_usage(argv[0]);
+        return 0;
+    }
+
+    if (argc > 2) {
+        width = strtoul(argv[1], NULL, 0) & ~1;
+        height = strtoul(argv[2], NULL, 0);
+    }
+
+    if (argc > 3)
+        loops = atoi(argv[3]);
+
+    if (width < 8 || height < 8 || loops <= 0) {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    yuyv = malloc(width * height * 2);
+    luma = malloc(width * height);
+    out = malloc(width * height * 2);
+    integral = malloc((width + 1) * (height + 1) * sizeof(uint32_t));
+    if (!yuyv || !luma || !out || !integral) {
+        LOGE("Failed to allocate memory\n");
+        return -1;
+    }
+
+    srand(time(NULL));
+    for (uint32_t i = 0; i < width * height * 2; i++)
+        yuyv[i] = rand();
+
+    image_yuyv_extract_y(yuyv, width, height, width * 2, luma);
+
+    LOGI("Frame %ux%u, %d loops\n", width, height, loops);
+
+    for (int i = 0; i < ARRAY_SIZE(kernels); i++) {
+        /*
+         * Warm up caches first
+         */
+        kernels[i].run();
+
+        uint64_t start = now_ns();
+        for (int j = 0; j < loops; j++)
+            kernels[i].run();
+        uint64_t used = now_ns() - start;
+
+        double mps = (double) width * height * loops * 1000.0 / used;
+
+        LOGI("%-24s %8.3f ms/frame %9.2f MP/s\n", kernels[i].name,
+                used / 1000000.0 / loops, mps);
+    }
+
+    free(yuyv);
+    free(luma);
+    free(out);
+    free(integral);
+
+    return 0;
+}
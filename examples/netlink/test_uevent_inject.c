@@ -0,0 +1,281 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <types.h>
+#include <utils/log.h>
+#include <utils/common.h>
+#include <netlink/netlink_handler.h>
+#include <netlink/netlink_manager.h>
+#include <netlink/uevent_injector.h>
+
+#define LOG_TAG "test_uevent_inject"
+
+#define DEFAULT_EVENTS           (5000)
+#define DRAIN_TIMEOUT_MS         (2000)
+
+/*
+ * One event in UNHANDLED_EVERY goes to a subsystem nobody handles, the
+ * socket filter should drop those before the listener sees them
+ */
+#define UNHANDLED_EVERY          (8)
+
+static const int rates[] = {1000, 5000, 20000, 0};
+
+static struct netlink_manager* netlink_manager;
+static struct uevent_injector* injector;
+
+static struct {
+    int first_seqnum;
+    uint32_t count;
+    uint64_t* sent_ns;
+    uint32_t* latency_us;
+    uint32_t handled;
+    uint32_t bad;
+    uint64_t last_ns;
+} bench;
+
+static uint32_t fixture_counts[2];
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void handle_bench_event(struct netlink_handler* nh,
+        struct netlink_event* event) {
+    uint64_t now = now_ns();
+    const char* value = event->find_key(event, NL_KEY_SEQNUM);
+    uint32_t index;
+
+    if (value == NULL) {
+        bench.bad++;
+        return;
+    }
+
+    index = strtol(value, NULL, 10) - bench.first_seqnum;
+    if (index >= bench.count || bench.latency_us[index]) {
+        bench.bad++;
+        return;
+    }
+
+    bench.latency_us[index] = (now - bench.sent_ns[index]) / 1000 + 1;
+    bench.last_ns = now;
+    __atomic_add_fetch(&bench.handled, 1, __ATOMIC_RELEASE);
+}
+
+static void handle_fixture_event(struct netlink_handler* nh,
+        struct netlink_event* event) {
+    int battery = !strcmp(event->get_subsystem(event), "power_supply");
+
+    __atomic_add_fetch(&fixture_counts[battery], 1, __ATOMIC_RELEASE);
+}
+
+static int compare_latency(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*) a;
+    uint32_t y = *(const uint32_t*) b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * SEQNUMs the benchmark sets itself, one range per rate so a late
+ * event of the last rate can't pass for one of this
+ */
+#define BENCH_SEQNUM_BASE        (1000000)
+
+static int run_rate(int rate, uint32_t count) {
+    static int next_seqnum = BENCH_SEQNUM_BASE;
+    char seqnum_param[32];
+    const char* params[] = {
+        "POWER_SUPPLY_NAME=battery",
+        "POWER_SUPPLY_STATUS=Discharging",
+        "POWER_SUPPLY_CAPACITY=50",
+        seqnum_param,
+        NULL,
+    };
+    const char* unhandled_params[] = {
+        seqnum_param,
+        NULL,
+    };
+    struct netlink_stat before;
+    struct netlink_stat after;
+    struct timespec due;
+    uint32_t expected = 0;
+    uint32_t handled;
+    uint64_t start;
+    uint64_t sent_end;
+    uint64_t deadline;
+    int seqnum;
+
+    memset(bench.latency_us, 0, count * sizeof(uint32_t));
+    bench.count = count;
+    bench.handled = 0;
+    bench.bad = 0;
+    bench.first_seqnum = next_seqnum;
+    next_seqnum += count;
+
+    netlink_manager->get_stat(&before);
+
+    start = now_ns();
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (rate) {
+            uint64_t at = start + (uint64_t) i * 1000000000 / rate;
+
+            due.tv_sec = at / 1000000000;
+            due.tv_nsec = at % 1000000000;
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL);
+        }
+
+        snprintf(seqnum_param, sizeof(seqnum_param), "SEQNUM=%d",
+                bench.first_seqnum + i);
+
+        bench.sent_ns[i] = now_ns();
+
+        if (i % UNHANDLED_EVERY == UNHANDLED_EVERY - 1) {
+            seqnum = injector->inject_event("change", "/devices/virtual/input0",
+                    "input", unhandled_params);
+        } else {
+            seqnum = injector->inject_event("change",
+                    "/devices/platform/battery/power_supply/battery",
+                    "power_supply", params);
+            expected++;
+        }
+
+        if (seqnum < 0)
+            return -1;
+    }
+
+    sent_end = now_ns();
+    deadline = sent_end + DRAIN_TIMEOUT_MS * 1000000ULL;
+
+    while ((handled = __atomic_load_n(&bench.handled, __ATOMIC_ACQUIRE))
+            < expected && now_ns() < deadline)
+        usleep(1000);
+
+    netlink_manager->get_stat(&after);
+
+    /*
+     * Unhandled subsystem slots stay 0 and sort first, skip them
+     */
+    qsort(bench.latency_us, count, sizeof(uint32_t), compare_latency);
+
+    uint32_t* latency = bench.latency_us + (count - handled);
+
+    LOGI("%6d/s | sent %7.0f/s | handled %5u/%5u %7.0f/s | latency "
+            "p50 %5u p99 %5u max %6u us | %u datagrams in %u reads\n",
+            rate, count * 1e9 / (sent_end - start), handled, expected,
+            handled ? handled * 1e9 / (bench.last_ns - start) : 0,
+            handled ? latency[handled / 2] - 1 : 0,
+            handled ? latency[handled * 99 / 100] - 1 : 0,
+            handled ? latency[handled - 1] - 1 : 0,
+            after.received - before.received, after.batches - before.batches);
+
+    if (handled != expected || bench.bad) {
+        LOGE("%u events lost, %u unexpected\n", expected - handled, bench.bad);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int run_benchmark(uint32_t count) {
+    struct netlink_handler handler;
+    int error = 0;
+
+    bench.sent_ns = calloc(count, sizeof(uint64_t));
+    bench.latency_us = calloc(count, sizeof(uint32_t));
+    if (bench.sent_ns == NULL || bench.latency_us == NULL) {
+        LOGE("Failed to allocate %u samples\n", count);
+        free(bench.sent_ns);
+        free(bench.latency_us);
+        return -1;
+    }
+
+    construct_netlink_handler(&handler, "power_supply", 0,
+            handle_bench_event, NULL);
+    netlink_manager->register_handler(&handler);
+
+    LOGI("%u events per rate, 1 in %d unhandled\n", count, UNHANDLED_EVERY);
+
+    for (int i = 0; i < ARRAY_SIZE(rates); i++)
+        if (run_rate(rates[i], count) < 0)
+            error = -1;
+
+    netlink_manager->unregister_handler(&handler);
+    destruct_netlink_handler(&handler);
+
+    free(bench.sent_ns);
+    free(bench.latency_us);
+
+    return error;
+}
+
+static int run_fixture(const char* path, int rate) {
+    struct netlink_handler handler;
+    int count;
+
+    construct_netlink_handler(&handler, NETLINK_SUBSYSTEM_ALL, 0,
+            handle_fixture_event, NULL);
+    netlink_manager->register_handler(&handler);
+
+    count = injector->inject_fixture(path, rate);
+
+    usleep(DRAIN_TIMEOUT_MS * 1000);
+
+    netlink_manager->unregister_handler(&handler);
+    destruct_netlink_handler(&handler);
+
+    if (count < 0)
+        return -1;
+
+    LOGI("%d injected, %u handled of which %u power_supply\n", count,
+            fixture_counts[0] + fixture_counts[1], fixture_counts[1]);
+
+    return fixture_counts[0] + fixture_counts[1] == count ? 0 : -1;
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t count = DEFAULT_EVENTS;
+    const char* fixture = NULL;
+    int rate = 0;
+    int error;
+
+    if (argc > 1 && atoi(argv[1]) > 0) {
+        count = atoi(argv[1]);
+    } else if (argc > 1) {
+        fixture = argv[1];
+        rate = argc > 2 ? atoi(argv[2]) : 0;
+    }
+
+    netlink_manager = get_netlink_manager();
+    injector = get_uevent_injector();
+
+    if (injector->init() < 0) {
+        LOGE("Failed to init uevent injector\n");
+        return -1;
+    }
+
+    if (netlink_manager->start() < 0) {
+        LOGE("Failed to start netlink manager\n");
+        injector->deinit();
+        return -1;
+    }
+
+    if (fixture)
+        error = run_fixture(fixture, rate);
+    else
+        error = run_benchmark(count);
+
+    injector->deinit();
+
+    LOGI("%s\n", error ? "FAILED" : "PASSED");
+
+    return error;
+}
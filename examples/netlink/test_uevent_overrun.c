@@ -0,0 +1,271 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <time.h>
+
+#include <types.h>
+#include <utils/log.h>
+#include <utils/common.h>
+#include <thread/reactor.h>
+#include <netlink/netlink_handler.h>
+#include <netlink/netlink_manager.h>
+
+#define LOG_TAG "test_uevent_overrun"
+
+/*
+ * Needs root and the kernel uevent socket: a handler that is slow
+ * while the devices of a subsystem are flooded with "change" overruns
+ * the socket, the listener must resync and then settle. "all" takes a
+ * handler for every subsystem, so the resync replays all of sysfs.
+ * With a loop count the listener runs on the reactor.
+ */
+#define DEFAULT_SUBSYSTEM        "mem"
+#define DEFAULT_FLOOD            (3000)
+#define MAX_DEVICES              (64)
+#define SLOW_HANDLER_US          (1000)
+#define SETTLE_MS                (5000)
+#define SETTLE_TIMEOUT_MS        (120 * 1000)
+#define PROBE_TIMEOUT_MS         (2000)
+
+static struct netlink_manager* netlink_manager;
+
+static int flooding;
+static uint32_t handled;
+static char probe_devpath[PATH_MAX];
+static int probe_seen;
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void handle_event(struct netlink_handler* nh,
+        struct netlink_event* event) {
+    const char* path = event->find_key(event, NL_KEY_DEVPATH);
+
+    __atomic_add_fetch(&handled, 1, __ATOMIC_RELAXED);
+
+    if (__atomic_load_n(&flooding, __ATOMIC_ACQUIRE)) {
+        usleep(SLOW_HANDLER_US);
+        return;
+    }
+
+    if (path && !strcmp(path, probe_devpath))
+        __atomic_store_n(&probe_seen, 1, __ATOMIC_RELEASE);
+}
+
+static int list_devices(const char* subsystem, char paths[][PATH_MAX]) {
+    char dir_path[PATH_MAX];
+    struct dirent* entry;
+    DIR* dir;
+    int count = 0;
+
+    snprintf(dir_path, sizeof(dir_path), "/sys/class/%s", subsystem);
+
+    dir = opendir(dir_path);
+    if (dir == NULL) {
+        LOGE("No /sys/class/%s\n", subsystem);
+        return -1;
+    }
+
+    while ((entry = readdir(dir)) && count < MAX_DEVICES) {
+        if (entry->d_name[0] == '.')
+            continue;
+
+        snprintf(paths[count], PATH_MAX, "%s/%s/uevent", dir_path,
+                entry->d_name);
+        if (access(paths[count], W_OK) == 0)
+            count++;
+    }
+
+    closedir(dir);
+
+    return count;
+}
+
+static int trigger(const char* path) {
+    int fd;
+    int ret;
+
+    fd = open(path, O_WRONLY);
+    if (fd < 0)
+        return -1;
+
+    ret = write(fd, "change", 6);
+    close(fd);
+
+    return ret == 6 ? 0 : -1;
+}
+
+/*
+ * The devpath the kernel reports for a /sys/class/.../uevent file
+ */
+static int resolve_devpath(const char* uevent, char* devpath) {
+    char path[PATH_MAX];
+    char real[PATH_MAX];
+
+    snprintf(path, sizeof(path), "%s", uevent);
+    *strrchr(path, '/') = '\0';
+
+    if (realpath(path, real) == NULL || strncmp(real, "/sys", 4))
+        return -1;
+
+    snprintf(devpath, PATH_MAX, "%s", real + 4);
+
+    return 0;
+}
+
+/*
+ * Settled: nothing overran for SETTLE_MS after the last resync
+ */
+static int wait_settle(void) {
+    struct netlink_stat stat;
+    uint32_t overruns = 0;
+    uint32_t resyncs = 0;
+    uint64_t start = now_ms();
+    uint64_t quiet = start;
+
+    for (;;) {
+        netlink_manager->get_stat(&stat);
+
+        if (stat.overruns != overruns || stat.resyncs != resyncs) {
+            overruns = stat.overruns;
+            resyncs = stat.resyncs;
+            quiet = now_ms();
+        }
+
+        if (now_ms() - quiet >= SETTLE_MS)
+            break;
+
+        if (now_ms() - start >= SETTLE_TIMEOUT_MS) {
+            LOGE("Still overrunning after %d s: %u overruns, %u resyncs\n",
+                    SETTLE_TIMEOUT_MS / 1000, overruns, resyncs);
+            return -1;
+        }
+
+        usleep(100000);
+    }
+
+    LOGI("Settled after %llu ms: %u overruns, %u resyncs, %u events\n",
+            (unsigned long long) (quiet - start), overruns, resyncs,
+            __atomic_load_n(&handled, __ATOMIC_RELAXED));
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    static char devices[MAX_DEVICES][PATH_MAX];
+    char* subsystem = DEFAULT_SUBSYSTEM;
+    int flood = DEFAULT_FLOOD;
+    int loops = 0;
+    struct netlink_handler handler;
+    struct netlink_stat stat;
+    uint64_t deadline;
+    int count;
+    int error = 0;
+
+    if (argc > 1)
+        subsystem = argv[1];
+    if (argc > 2)
+        flood = atoi(argv[2]);
+    if (argc > 3)
+        loops = atoi(argv[3]);
+
+    count = list_devices(strcmp(subsystem, "all") ? subsystem : "mem",
+            devices);
+    if (count <= 0 || resolve_devpath(devices[0], probe_devpath) < 0) {
+        LOGE("No device to trigger uevents on\n");
+        return -1;
+    }
+
+    if (loops > 0 && get_reactor()->init(loops) < 0) {
+        LOGE("Failed to init reactor\n");
+        return -1;
+    }
+
+    netlink_manager = get_netlink_manager();
+
+    if (netlink_manager->init() < 0) {
+        LOGE("Failed to init netlink manager\n");
+        if (loops > 0)
+            get_reactor()->deinit();
+        return -1;
+    }
+
+    construct_netlink_handler(&handler, strcmp(subsystem, "all")
+            ? subsystem : NETLINK_SUBSYSTEM_ALL, 0, handle_event, NULL);
+    netlink_manager->register_handler(&handler);
+
+    if (netlink_manager->start() < 0) {
+        LOGE("Failed to start netlink manager\n");
+        error = -1;
+        goto out;
+    }
+
+    LOGI("Flooding %d devices of %s with %d uevents\n", count, subsystem,
+            flood);
+
+    __atomic_store_n(&flooding, 1, __ATOMIC_RELEASE);
+
+    for (int i = 0; i < flood; i++)
+        trigger(devices[i % count]);
+
+    /*
+     * The slow handler may still be working through the backlog when
+     * the socket gives ENOBUFS
+     */
+    deadline = now_ms() + PROBE_TIMEOUT_MS;
+
+    netlink_manager->get_stat(&stat);
+    while (stat.overruns == 0 && now_ms() < deadline) {
+        usleep(10000);
+        netlink_manager->get_stat(&stat);
+    }
+
+    __atomic_store_n(&flooding, 0, __ATOMIC_RELEASE);
+
+    if (stat.overruns == 0) {
+        LOGE("Socket did not overrun, try more uevents\n");
+        error = -1;
+        goto out;
+    }
+
+    if (wait_settle() < 0) {
+        error = -1;
+        goto out;
+    }
+
+    /*
+     * And it still listens
+     */
+    trigger(devices[0]);
+
+    deadline = now_ms() + PROBE_TIMEOUT_MS;
+    while (!__atomic_load_n(&probe_seen, __ATOMIC_ACQUIRE)
+            && now_ms() < deadline)
+        usleep(1000);
+
+    if (!probe_seen) {
+        LOGE("No uevent for %s after settling\n", probe_devpath);
+        error = -1;
+    }
+
+out:
+    netlink_manager->unregister_handler(&handler);
+    destruct_netlink_handler(&handler);
+    netlink_manager->deinit();
+
+    if (loops > 0)
+        get_reactor()->deinit();
+
+    LOGI("%s\n", error ? "FAILED" : "PASSED");
+
+    return error;
+}
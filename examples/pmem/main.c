@@ -0,0 +1,209 @@
+/*
+ *  Copyright (C) 2017, Zhang YanMing <yanmin.zhang@ingenic.com, jamincheung@126.com>
+ *
+ *  Ingenic Linux plarform SDK project
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <types.h>
+#include <utils/log.h>
+#include <utils/common.h>
+#include <pmem/pmem_manager.h>
+
+#define LOG_TAG "test_pmem"
+
+#define MAX_BLOCKS          128
+#define DEFAULT_LOOPS       100000
+
+struct block {
+    uint8_t* addr;
+    uint32_t size;
+    uint8_t pattern;
+};
+
+static struct pmem_manager* pmem;
+static struct block blocks[MAX_BLOCKS];
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint32_t random_size(void) {
+    switch (rand() % 4) {
+    case 0:
+        return 1 + rand() % 256;
+    case 1:
+        return 1 + rand() % 2048;
+    case 2:
+        return 1 + rand() % (64 * 1024);
+    default:
+        return 1 + rand() % (128 * 1024);
+    }
+}
+
+static int check_block(struct block* block) {
+    for (uint32_t i = 0; i < block->size; i++) {
+        if (block->addr[i] != block->pattern) {
+            LOGE("Block %p(%u) corrupted at %u\n", block->addr, block->size, i);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int test_random(int loops) {
+    uint32_t align;
+    uint64_t start;
+    uint64_t used = 0;
+    uint32_t ops = 0;
+
+    for (int i = 0; i < loops; i++) {
+        struct block* block = &blocks[rand() % MAX_BLOCKS];
+
+        if (block->addr) {
+            if (check_block(block) < 0)
+                return -1;
+
+            start = now_ns();
+            pmem->free(block->addr);
+            used += now_ns() - start;
+            ops++;
+
+            block->addr = NULL;
+            continue;
+        }
+
+        block->size = random_size();
+        align = 1 << (rand() % 13);
+
+        start = now_ns();
+        block->addr = pmem->alloc(block->size, align);
+        used += now_ns() - start;
+        ops++;
+
+        if (block->addr == NULL)
+            continue;
+
+        if ((uintptr_t) block->addr & (align - 1)) {
+            LOGE("Block %p not aligned to %u\n", block->addr, align);
+            return -1;
+        }
+
+        if (block->size <= PMEM_BOUNDARY_SIZE
+                && ((uintptr_t) block->addr ^ ((uintptr_t) block->addr
+                        + block->size - 1)) & ~(PMEM_BOUNDARY_SIZE - 1)) {
+            LOGE("Block %p crosses a 4MB boundary\n", block->addr);
+            return -1;
+        }
+
+        if (pmem->phys_to_virt(pmem->virt_to_phys(block->addr))
+                != block->addr) {
+            LOGE("Block %p address translation mismatch\n", block->addr);
+            return -1;
+        }
+
+        block->pattern = rand();
+        memset(block->addr, block->pattern, block->size);
+    }
+
+    for (int i = 0; i < MAX_BLOCKS; i++) {
+        if (blocks[i].addr) {
+            if (check_block(&blocks[i]) < 0)
+                return -1;
+            pmem->free(blocks[i].addr);
+            blocks[i].addr = NULL;
+        }
+    }
+
+    LOGI("%u alloc/free, %.1f ns/op\n", ops, (double) used / ops);
+
+    return 0;
+}
+
+static int check_empty(void) {
+    struct pmem_stat stat;
+
+    pmem->get_stat(&stat);
+
+    if (stat.used_size || stat.slab_pages
+            || stat.largest_free_size != stat.total_size) {
+        LOGE("Pool not empty after free all: used=%u slab=%u largest=%u\n",
+                stat.used_size, stat.slab_pages, stat.largest_free_size);
+        return -1;
+    }
+
+    if (stat.alloc_count != stat.free_count) {
+        LOGE("alloc_count %u != free_count %u\n", stat.alloc_count,
+                stat.free_count);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void print_usage(const char* name) {
+    fprintf(stderr, "Usage: %s [plain|imem] [loops]\n", name);
+}
+
+int main(int argc, char *argv[]) {
+    enum pmem_backend backend = PMEM_BACKEND_PLAIN;
+    int loops = DEFAULT_LOOPS;
+    int error;
+
+    if (argc > 1) {
+        if (!strcmp(argv[1], "imem")) {
+            backend = PMEM_BACKEND_IMEM;
+        } else if (strcmp(argv[1], "plain")) {
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (argc > 2)
+        loops = atoi(argv[2]);
+
+    if (loops <= 0) {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    pmem = get_pmem_manager();
+    if (pmem->init(backend, 0) < 0) {
+        LOGE("Failed to init pmem manager\n");
+        return -1;
+    }
+
+    srand(time(NULL));
+
+    error = test_random(loops);
+    pmem->dump();
+
+    if (!error)
+        error = check_empty();
+
+    pmem->deinit();
+
+    LOGI("%s\n", error ? "FAILED" : "PASSED");
+
+    return error;
+}
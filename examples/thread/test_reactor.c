@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <semaphore.h>
+#include <time.h>
+
+#include <types.h>
+#include <utils/log.h>
+#include <utils/common.h>
+#include <thread/reactor.h>
+#include <timer/timer_manager.h>
+#include <netlink/netlink_handler.h>
+#include <netlink/netlink_manager.h>
+#include <netlink/uevent_injector.h>
+
+#define LOG_TAG "test_reactor"
+
+#define DEFAULT_LOOPS            (1)
+#define RUN_MS                   (600)
+#define MANAGER_TIMER_MS         (50)
+#define ONESHOT_TIMER_MS         (120)
+#define REACTOR_TIMER_US         (10000)
+#define UEVENTS                  (1000)
+#define PING_PONGS               (10000)
+#define SIGNALS                  (3)
+
+static struct reactor* reactor;
+static struct timer_manager* timer_manager;
+static struct netlink_manager* netlink_manager;
+static struct uevent_injector* injector;
+
+static struct {
+    uint32_t manager_timer;
+    uint32_t oneshot_timer;
+    uint32_t reactor_timer;
+    uint32_t uevents;
+    uint32_t signals;
+    uint32_t pongs;
+} counts;
+
+static int oneshot_id;
+static sem_t pong;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int thread_count(void) {
+    char line[128];
+    int threads = -1;
+    FILE* fp;
+
+    fp = fopen("/proc/self/status", "r");
+    if (fp == NULL)
+        return -1;
+
+    while (fgets(line, sizeof(line), fp))
+        if (sscanf(line, "Threads: %d", &threads) == 1)
+            break;
+
+    fclose(fp);
+
+    return threads;
+}
+
+static void handle_manager_timer(int timer_id, int exp_num) {
+    if (timer_id == oneshot_id)
+        __atomic_add_fetch(&counts.oneshot_timer, exp_num, __ATOMIC_RELAXED);
+    else
+        __atomic_add_fetch(&counts.manager_timer, exp_num, __ATOMIC_RELAXED);
+}
+
+static void handle_reactor_timer(int id, uint64_t expirations, void* arg) {
+    __atomic_add_fetch(&counts.reactor_timer, expirations, __ATOMIC_RELAXED);
+}
+
+static void handle_signal(int id, const struct signalfd_siginfo* info,
+        void* arg) {
+    __atomic_add_fetch(&counts.signals, 1, __ATOMIC_RELAXED);
+}
+
+static void handle_ping(int id, uint64_t count, void* arg) {
+    __atomic_add_fetch(&counts.pongs, count, __ATOMIC_RELAXED);
+    sem_post(&pong);
+}
+
+static void handle_uevent(struct netlink_handler* nh,
+        struct netlink_event* event) {
+    __atomic_add_fetch(&counts.uevents, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Round trips main thread -> loop -> main thread through an eventfd
+ */
+static int run_ping_pong(void) {
+    uint64_t max_ns = 0;
+    uint64_t total_ns = 0;
+    uint64_t start;
+    uint64_t elapsed;
+    int id;
+
+    sem_init(&pong, 0, 0);
+
+    id = reactor->add_event(handle_ping, NULL);
+    if (id < 0) {
+        sem_destroy(&pong);
+        return -1;
+    }
+
+    for (int i = 0; i < PING_PONGS; i++) {
+        start = now_ns();
+
+        reactor->notify_event(id);
+        sem_wait(&pong);
+
+        elapsed = now_ns() - start;
+        total_ns += elapsed;
+        max_ns = MAX(max_ns, elapsed);
+    }
+
+    reactor->remove(id);
+    sem_destroy(&pong);
+
+    LOGI("%d event round trips, avg %.1f us max %.1f us\n", PING_PONGS,
+            total_ns / 1000.0 / PING_PONGS, max_ns / 1000.0);
+
+    return counts.pongs == PING_PONGS ? 0 : -1;
+}
+
+int main(int argc, char *argv[]) {
+    struct netlink_handler handler;
+    struct reactor_stat stat;
+    int loops = DEFAULT_LOOPS;
+    int timer_ids[2];
+    int signal_id;
+    int timer_id;
+    int error = 0;
+
+    if (argc > 1)
+        loops = atoi(argv[1]);
+
+    reactor = get_reactor();
+    timer_manager = get_timer_manager();
+    netlink_manager = get_netlink_manager();
+    injector = get_uevent_injector();
+
+    LOGI("%d threads before the reactor\n", thread_count());
+
+    if (reactor->init(loops) < 0) {
+        LOGE("Failed to init reactor\n");
+        return -1;
+    }
+
+    signal_id = reactor->add_signal(SIGUSR1, handle_signal, NULL);
+    if (signal_id < 0) {
+        error = -1;
+        goto out;
+    }
+
+    /*
+     * Both managers find the reactor up and run on it
+     */
+    if (timer_manager->init() < 0) {
+        LOGE("Failed to init timer manager\n");
+        error = -1;
+        goto out;
+    }
+
+    for (int i = 0; i < ARRAY_SIZE(timer_ids); i++) {
+        timer_ids[i] = timer_manager->alloc_timer(MANAGER_TIMER_MS,
+                MANAGER_TIMER_MS, 0, handle_manager_timer);
+        timer_manager->start(timer_ids[i]);
+    }
+
+    oneshot_id = timer_manager->alloc_timer(ONESHOT_TIMER_MS, 0, 1,
+            handle_manager_timer);
+    timer_manager->start(oneshot_id);
+
+    if (injector->init() < 0 || netlink_manager->start() < 0) {
+        LOGE("Failed to start netlink manager\n");
+        error = -1;
+        goto out_timer;
+    }
+
+    construct_netlink_handler(&handler, "power_supply", 0, handle_uevent,
+            NULL);
+    netlink_manager->register_handler(&handler);
+
+    timer_id = reactor->add_timer(REACTOR_TIMER_US, REACTOR_TIMER_US,
+            handle_reactor_timer, NULL);
+
+    LOGI("%d threads with timer and netlink manager on %d loops\n",
+            thread_count(), loops);
+
+    for (int i = 0; i < UEVENTS; i++)
+        injector->inject_event("change", "/devices/virtual/power_supply/bat",
+                "power_supply", NULL);
+
+    for (int i = 0; i < SIGNALS; i++) {
+        kill(getpid(), SIGUSR1);
+        usleep(10000);
+    }
+
+    if (run_ping_pong() < 0)
+        error = -1;
+
+    usleep(RUN_MS * 1000);
+
+    reactor->remove(timer_id);
+    netlink_manager->unregister_handler(&handler);
+    destruct_netlink_handler(&handler);
+    injector->deinit();
+
+    reactor->get_stat(&stat);
+
+    LOGI("manager timers %u oneshot %u reactor timer %u uevents %u/%d "
+            "signals %u/%d\n", counts.manager_timer, counts.oneshot_timer,
+            counts.reactor_timer, counts.uevents, UEVENTS, counts.signals,
+            SIGNALS);
+    LOGI("%u loops, %u sources, %u wakeups, %u dispatched, slowest "
+            "handler %u us\n", stat.loops, stat.sources, stat.wakeups,
+            stat.dispatched, stat.max_dispatch_us);
+
+    if (counts.manager_timer == 0 || counts.oneshot_timer != 1
+            || counts.reactor_timer == 0 || counts.uevents != UEVENTS
+            || counts.signals != SIGNALS)
+        error = -1;
+
+out_timer:
+    timer_manager->deinit();
+
+out:
+    if (signal_id > 0)
+        reactor->remove(signal_id);
+
+    reactor->deinit();
+
+    LOGI("%s\n", error ? "FAILED" : "PASSED");
+
+    return error;
+}
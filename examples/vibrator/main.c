@@ -10,15 +10,32 @@
 #include <sys/types.h>
 #include <types.h>
 #include <utils/log.h>
+#include <utils/common.h>
 #include <vibrator/vibrator_manager.h>
 #include <netlink/netlink_manager.h>
 
 #define LOG_TAG "test_vibrator"
 
+/*
+ * Two short pulses and a long fading one
+ */
+static const struct vibrator_step notify_steps[] = {
+    {80, 8}, {80, 0}, {80, 8}, {160, 0},
+    {200, 10}, {150, 6}, {100, 3}, {400, 0},
+};
+
 static void motor_event_callback(uint32_t motor_id, motor_status status) {
     LOGI("motor%d event callback status: %d\n", motor_id, status);
 }
 
+static void pattern_callback(uint32_t motor_id, int32_t pattern_id,
+        int cancelled, const struct vibrator_pattern_stat* stat) {
+    LOGI("motor%d pattern %d %s: %u steps, %u repeats, late max %u us "
+            "avg %u us\n", motor_id, pattern_id,
+            cancelled ? "cancelled" : "done", stat->steps, stat->repeats,
+            stat->late_max_us, stat->late_avg_us);
+}
+
 int main(int argc, char *argv[]) {
     int id;
     struct vibrator_manager* vibrator_manager = get_vibrator_manager();
@@ -74,6 +91,17 @@ int main(int argc, char *argv[]) {
     }
 
     sleep(1);
+
+    struct vibrator_pattern pattern = {
+        .steps = notify_steps,
+        .count = ARRAY_SIZE(notify_steps),
+        .repeat = 3,
+    };
+
+    if (vibrator_manager->play_pattern(id, &pattern, 0, pattern_callback) < 0)
+        LOGE("motor%d play_pattern error\n", id);
+
+    sleep(5);
     vibrator_manager->close(id);
     vibrator_manager->deinit();
     netlink_manager->stop();
@@ -17,17 +17,38 @@
 #ifndef MIXER_CONTROLLER_H
 #define MIXER_CONTROLLER_H
 
+#include <types.h>
+
 enum {
     PLAYBACK,
     CAPTURE
 };
 
+typedef void (*mixer_event_listener_t)(const char* name);
+
 struct mixer_controller {
     int (*init)(void);
     int (*deinit)(void);
     int (*set_volume)(const char* name, int dir, int volume);
     int (*get_volume)(const char* name, int dir);
     int (*mute)(const char* name, int mute);
+
+    /*
+     * Fade to @volume over @duration_ms from a background thread, one
+     * control write per 5ms at most. set_volume() on the same control
+     * and direction cancels it.
+     */
+    int (*ramp_volume)(const char* name, int dir, int volume,
+            uint32_t duration_ms);
+
+    /*
+     * Mixer change events: poll the fd for POLLIN and call
+     * handle_events(), which calls the listener with the name of each
+     * control whose value changed, by this process or any other
+     */
+    int (*get_event_fd)(void);
+    int (*handle_events)(void);
+    void (*set_event_listener)(mixer_event_listener_t listener);
 };
 
 struct mixer_controller* get_mixer_controller(void);
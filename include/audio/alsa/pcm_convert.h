@@ -0,0 +1,86 @@
+/*
+ *  Copyright (C) 2017, Zhang YanMing <yanmin.zhang@ingenic.com, jamincheung@126.com>
+ *
+ *  Ingenic Linux plarform SDK project
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef PCM_CONVERT_H
+#define PCM_CONVERT_H
+
+#include <types.h>
+
+#define PCM_CONVERT_MAX_CHANNELS    8
+
+enum pcm_sample_format {
+    PCM_SAMPLE_S16 = 0,
+    PCM_SAMPLE_S24,         /* S24_LE, low 24 bits of a 32 bit word */
+    PCM_SAMPLE_S24_3,       /* S24_3LE, packed, as stored in wave files */
+    PCM_SAMPLE_S32,
+    PCM_SAMPLE_FLOAT,       /* FLOAT_LE, -1.0 ~ 1.0 */
+};
+
+/*
+ * Resampler quality/CPU tradeoff
+ */
+enum pcm_convert_quality {
+    PCM_CONVERT_FAST = 0,   /* linear interpolation, no anti-alias filter */
+    PCM_CONVERT_MEDIUM,     /* 16 taps per phase */
+    PCM_CONVERT_HIGH,       /* 48 taps per phase */
+};
+
+struct pcm_convert_param {
+    enum pcm_sample_format in_format;
+    int in_channels;
+    int in_rate;
+
+    enum pcm_sample_format out_format;
+    int out_channels;
+    int out_rate;
+
+    enum pcm_convert_quality quality;
+};
+
+struct pcm_convert_handle;
+
+struct pcm_convert {
+    struct pcm_convert_handle* (*open)(const struct pcm_convert_param* param);
+    int (*close)(struct pcm_convert_handle* handle);
+
+    /*
+     * Convert interleaved frames. *in_frames is the input available
+     * on entry and how much was consumed on return, input is only
+     * left over when @out_frames is full. Returns output frames.
+     */
+    int (*process)(struct pcm_convert_handle* handle, const uint8_t* in,
+            uint32_t* in_frames, uint8_t* out, uint32_t out_frames);
+
+    /*
+     * End of stream: emit what is still held back by the filter,
+     * call until it returns 0
+     */
+    int (*flush)(struct pcm_convert_handle* handle, uint8_t* out,
+            uint32_t out_frames);
+    int (*reset)(struct pcm_convert_handle* handle);
+
+    /*
+     * Upper bound of the output produced by @in_frames more input
+     */
+    uint32_t (*get_out_frames)(struct pcm_convert_handle* handle,
+            uint32_t in_frames);
+
+    uint32_t (*get_sample_bytes)(enum pcm_sample_format format);
+};
+
+struct pcm_convert* get_pcm_convert(void);
+
+#endif /* PCM_CONVERT_H */
@@ -0,0 +1,95 @@
+/*
+ *  Copyright (C) 2017, Zhang YanMing <yanmin.zhang@ingenic.com, jamincheung@126.com>
+ *
+ *  Ingenic Linux plarform SDK project
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef PCM_MMAP_H
+#define PCM_MMAP_H
+
+#include <types.h>
+
+enum pcm_mmap_stream {
+    PCM_MMAP_PLAYBACK = 0,
+    PCM_MMAP_CAPTURE,
+};
+
+struct pcm_mmap_param {
+    int channels;
+    int sample_rate;
+    int sample_length;
+
+    /*
+     * Requested period and buffer in frames, the device may round
+     * them, check get_latency() for what was granted
+     */
+    uint32_t period_frames;
+    uint32_t periods;
+};
+
+struct pcm_mmap_latency {
+    int sample_rate;
+    uint32_t period_frames;
+    uint32_t buffer_frames;
+    uint32_t period_us;
+    uint32_t buffer_us;
+
+    /*
+     * Frames between the application pointer and the DAC/ADC right now
+     */
+    int32_t delay_frames;
+    int32_t delay_us;
+
+    uint32_t xruns;
+};
+
+struct pcm_mmap_handle;
+
+struct pcm_mmap {
+    struct pcm_mmap_handle* (*open)(const char* snd_device,
+            enum pcm_mmap_stream stream, const struct pcm_mmap_param* param);
+    int (*close)(struct pcm_mmap_handle* handle);
+
+    /*
+     * Zero copy access: begin() returns a contiguous, interleaved
+     * region of the DMA area, waiting at most timeout_ms (-1 forever)
+     * for space (playback) or data (capture). *frames is the most
+     * the caller wants (0 for no limit) on entry and the region size
+     * on return, 0 means timeout. commit() hands back how many of
+     * those frames were used. A handle must not be shared between
+     * threads.
+     */
+    int (*begin)(struct pcm_mmap_handle* handle, uint8_t** area,
+            uint32_t* frames, int timeout_ms);
+    int (*commit)(struct pcm_mmap_handle* handle, uint32_t frames);
+
+    /*
+     * Copy helpers on top of begin()/commit(), block until every
+     * frame is transferred. Return frames transferred or -1.
+     */
+    int (*write)(struct pcm_mmap_handle* handle, const uint8_t* buffer,
+            uint32_t frames);
+    int (*read)(struct pcm_mmap_handle* handle, uint8_t* buffer,
+            uint32_t frames);
+
+    int (*drain)(struct pcm_mmap_handle* handle);
+    int (*drop)(struct pcm_mmap_handle* handle);
+
+    int (*get_latency)(struct pcm_mmap_handle* handle,
+            struct pcm_mmap_latency* latency);
+    uint32_t (*get_frame_bytes)(struct pcm_mmap_handle* handle);
+};
+
+struct pcm_mmap* get_pcm_mmap(void);
+
+#endif /* PCM_MMAP_H */
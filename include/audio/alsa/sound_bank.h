@@ -0,0 +1,66 @@
+/*
+ *  Copyright (C) 2017, Zhang YanMing <yanmin.zhang@ingenic.com, jamincheung@126.com>
+ *
+ *  Ingenic Linux plarform SDK project
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef SOUND_BANK_H
+#define SOUND_BANK_H
+
+#include <types.h>
+
+#define SOUND_BANK_MAX_SOUNDS   64
+
+/*
+ * Interleaved pcm ready for the device, sample aligned and never
+ * written by the player
+ */
+struct wave_sound {
+    int channels;
+    int sample_rate;
+    int sample_length;
+    const uint8_t* data;
+    uint32_t size;
+};
+
+/*
+ * Short sounds parsed and decoded once, then played from memory with
+ * wave_player play_sound() as often as needed
+ */
+struct sound_bank {
+    int (*init)(void);
+    int (*deinit)(void);
+
+    /*
+     * Any wave file wave_player plays, compressed ones are decoded to
+     * 16 bit pcm here. Returns the sound id.
+     */
+    int (*load_wave)(const char* path);
+
+    /*
+     * A pack is wave files back to back ("cat *.wav > ui.pack"). It is
+     * mapped and pcm sounds are played from the mapping. Fills up to
+     * @max_ids ids in pack order, returns how many.
+     */
+    int (*load_pack)(const char* path, int* ids, int max_ids);
+    int (*unload)(int id);
+
+    /*
+     * Valid until the sound is unloaded
+     */
+    const struct wave_sound* (*get_sound)(int id);
+};
+
+struct sound_bank* get_sound_bank(void);
+
+#endif /* SOUND_BANK_H */
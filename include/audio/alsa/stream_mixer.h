@@ -0,0 +1,94 @@
+/*
+ *  Copyright (C) 2017, Zhang YanMing <yanmin.zhang@ingenic.com, jamincheung@126.com>
+ *
+ *  Ingenic Linux plarform SDK project
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef STREAM_MIXER_H
+#define STREAM_MIXER_H
+
+#include <types.h>
+
+#define STREAM_MIXER_MAX_SOURCES    8
+
+/*
+ * Source gain is Q8 fixed point, 256 is unity, at most 4x
+ */
+#define STREAM_MIXER_GAIN_UNITY     256
+#define STREAM_MIXER_GAIN_MAX       (4 * STREAM_MIXER_GAIN_UNITY)
+
+struct stream_mixer_param {
+    int channels;
+    int sample_rate;
+
+    /*
+     * Device period in frames and period count, 0 for defaults
+     */
+    uint32_t period_frames;
+    uint32_t periods;
+};
+
+struct stream_mixer_stat {
+    uint32_t periods;
+    uint32_t underruns;
+    uint32_t clipped_samples;
+
+    /*
+     * Periods in which an active source had less data than needed
+     */
+    uint32_t starved;
+    uint32_t max_mix_us;
+    uint32_t active_sources;
+};
+
+struct stream_mixer {
+    /*
+     * Open @snd_device once, every source is mixed into it as
+     * interleaved S16_LE. Sources must use the mixer's sample rate,
+     * mono sources are spread over every output channel.
+     */
+    int (*init)(const char* snd_device, const struct stream_mixer_param* param);
+    int (*deinit)(void);
+
+    /*
+     * Start playing a wave file in the background, returns a source
+     * id. @fd stays owned by the caller and must stay open until the
+     * source finished (see wait) or was cancelled.
+     */
+    int (*play_wave)(int fd, int gain);
+
+    /*
+     * Push mode source: open, write any number of buffers (blocks
+     * while the source queue is full), close lets queued data play
+     * out and releases the source.
+     */
+    int (*open_stream)(int channels, int sample_rate, int gain);
+    int (*write_stream)(int id, uint8_t* buffer, int size);
+    int (*close_stream)(int id);
+
+    int (*set_gain)(int id, int gain);
+    int (*pause)(int id);
+    int (*resume)(int id);
+    int (*cancel)(int id);
+
+    /*
+     * Block until the source finished or was cancelled
+     */
+    int (*wait)(int id);
+
+    int (*get_stat)(struct stream_mixer_stat* stat);
+};
+
+struct stream_mixer* get_stream_mixer(void);
+
+#endif /* STREAM_MIXER_H */
@@ -0,0 +1,76 @@
+/*
+ *  Copyright (C) 2017, Zhang YanMing <yanmin.zhang@ingenic.com, jamincheung@126.com>
+ *
+ *  Ingenic Linux plarform SDK project
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef WAVE_CODEC_H
+#define WAVE_CODEC_H
+
+#include <types.h>
+#include <utils/wave_parser.h>
+
+/*
+ * Compressed sample data inside a RIFF WAVE file, both codecs take
+ * and give interleaved 16 bit pcm of one or two channels
+ */
+enum wave_codec_type {
+    WAVE_CODEC_PCM = 0,
+    WAVE_CODEC_IMA_ADPCM,       /* WAV_FMT_IMA_ADPCM, 4 bits per sample */
+    WAVE_CODEC_LOSSLESS,        /* WAV_FMT_LOSSLESS, fixed prediction + rice */
+};
+
+struct wave_codec_handle;
+
+struct wave_codec {
+    struct wave_codec_handle* (*open_encoder)(enum wave_codec_type type,
+            int channels, int sample_rate);
+
+    /*
+     * @container as filled by wave_read_header()
+     */
+    struct wave_codec_handle* (*open_decoder)(const WaveContainer* container);
+    int (*close)(struct wave_codec_handle* handle);
+
+    /*
+     * Both work like pcm_convert process: *in_frames or *in_bytes is
+     * the input available on entry and how much was consumed on return,
+     * input is only left over when the output is full. Blocks are
+     * buffered inside, so any split of the stream works. Returns
+     * output bytes/frames.
+     */
+    int (*encode)(struct wave_codec_handle* handle, const uint8_t* in,
+            uint32_t* in_frames, uint8_t* out, uint32_t out_bytes);
+    int (*decode)(struct wave_codec_handle* handle, const uint8_t* in,
+            uint32_t* in_bytes, uint8_t* out, uint32_t out_frames);
+
+    /*
+     * End of encoding: emit the last partial block, call until it
+     * returns 0
+     */
+    int (*flush)(struct wave_codec_handle* handle, uint8_t* out,
+            uint32_t out_bytes);
+
+    /*
+     * Fill the fmt fields and fact chunk of a file the encoder writes,
+     * the caller sets the RIFF and data lengths
+     */
+    int (*fill_header)(struct wave_codec_handle* handle,
+            WaveContainer* container);
+
+    enum wave_codec_type (*get_type)(const WaveContainer* container);
+};
+
+struct wave_codec* get_wave_codec(void);
+
+#endif /* WAVE_CODEC_H */
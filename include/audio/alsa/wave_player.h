@@ -17,15 +17,71 @@
 #ifndef WAVE_PLAYER_H
 #define WAVE_PLAYER_H
 
+#include <types.h>
+#include <audio/alsa/pcm_convert.h>
+#include <audio/alsa/sound_bank.h>
+
+struct wave_player_stat {
+    uint32_t underruns;
+
+    /*
+     * Chunks handed to ALSA, and how many times the PCM side had to
+     * wait because the prefetch ring was empty
+     */
+    uint32_t chunks;
+    uint32_t reader_stalls;
+    uint32_t max_read_us;
+
+    uint32_t buffered_plays;
+    uint32_t mmap_plays;
+    uint32_t sound_plays;
+};
+
 struct wave_player {
     int (*init)(const char* snd_device);
     int (*deinit)(void);
+
+    /*
+     * PCM, IMA-ADPCM or wave_codec lossless files
+     */
     int (*play_wave)(int fd);
     int (*play_stream)(int channels, int sample_rate, int sample_length,
             uint8_t* buffer, int size);
+
+    /*
+     * End of a play_stream() stream: a converted stream is played in
+     * whole periods, this plays the short last one and the resampler
+     * tail, padded with silence
+     */
+    int (*flush_stream)(void);
+
+    /*
+     * A sound_bank sound, played from memory without reading or
+     * parsing anything
+     */
+    int (*play_sound)(const struct wave_sound* sound);
     int (*pause_play)(void);
     int (*resume_play)(void);
     int (*cancel_play)(void);
+
+    /*
+     * Pin the device to one format, sources in any other rate,
+     * channel count or 16/24/32 bit sample size are converted in the
+     * library instead of going through the ALSA plug layer. channels
+     * 0 lets the device follow each source again.
+     */
+    int (*set_hw_format)(int channels, int sample_rate, int sample_length,
+            enum pcm_convert_quality quality);
+
+    /*
+     * Period size and count for the device from the next play on, 0
+     * frames for the default 500ms buffer. get_buffer_size() reports
+     * what the device granted once it is set up.
+     */
+    int (*set_buffer_size)(uint32_t period_frames, uint32_t periods);
+    int (*get_buffer_size)(uint32_t* period_frames, uint32_t* buffer_frames);
+    int (*get_stat)(struct wave_player_stat* stat);
+    int (*reset_stat)(void);
 };
 
 struct wave_player* get_wave_player(void);
@@ -17,6 +17,24 @@
 #ifndef WAVE_RECODER_H
 #define WAVE_RECODER_H
 
+#include <audio/alsa/pcm_convert.h>
+#include <audio/alsa/wave_codec.h>
+#include <audio/alsa/wave_vad.h>
+
+typedef void (*wave_capture_receive)(uint8_t* buffer, int size);
+
+struct wave_capture_stat {
+    uint32_t block_bytes;
+    uint32_t block_count;
+    uint32_t fill;          /* blocks queued now */
+    uint32_t max_fill;
+    uint32_t periods;       /* read from the device */
+    uint32_t dropped;       /* read but lost to a full ring */
+    uint32_t xruns;         /* device overruns */
+    uint32_t segments;      /* speech segments detected */
+    uint32_t gated;         /* silent blocks the vad gate kept back */
+};
+
 struct wave_recorder {
     int (*init)(const char* snd_device);
     int (*deinit)(void);
@@ -25,6 +43,75 @@ struct wave_recorder {
     int (*record_stream)(int channels, int sample_rate, int sample_length,
             uint8_t** buffer);
     int (*cancel_record)(void);
+
+    /*
+     * Pin the capture device to one format, recordings in any other
+     * rate, channel count or 16/24/32 bit sample size are converted
+     * in the library. channels 0 lets the device follow each request.
+     */
+    int (*set_hw_format)(int channels, int sample_rate, int sample_length,
+            enum pcm_convert_quality quality);
+
+    /*
+     * Period size and count for the device from the next recording on, 0
+     * frames for the default 500ms buffer. get_buffer_size() reports
+     * what the device granted once it is set up.
+     */
+    int (*set_buffer_size)(uint32_t period_frames, uint32_t periods);
+    int (*get_buffer_size)(uint32_t* period_frames, uint32_t* buffer_frames);
+
+    /*
+     * File format of the following record_wave() calls, compressed
+     * files take 16 bit samples and need a seekable fd to fill in the
+     * lengths at the end
+     */
+    int (*set_codec)(enum wave_codec_type codec);
+
+    /*
+     * Continuous capture: a realtime thread reads every period into a
+     * ring of @ring_ms (0 for the default), a full ring drops blocks
+     * rather than stalling the device. With @receive set each block is
+     * handed to it on a delivery thread, otherwise pull them with
+     * dequeue_capture()/release_capture() from one thread.
+     * cancel_record() halts the device, stop_capture() frees the ring.
+     */
+    int (*start_capture)(int channels, int sample_rate, int sample_length,
+            int ring_ms, wave_capture_receive receive);
+    int (*stop_capture)(void);
+
+    /*
+     * Returns bytes of the oldest block, valid until release_capture(),
+     * 0 on timeout, -1 once capture stopped and the ring is empty
+     */
+    int (*dequeue_capture)(uint8_t** buffer, int timeout_ms);
+    int (*release_capture)(void);
+
+    /*
+     * eventfd readable when blocks are queued, for the caller's poll loop
+     */
+    int (*get_capture_fd)(void);
+    int (*get_capture_stat)(struct wave_capture_stat* stat);
+
+    /*
+     * Meter every block of the next start_capture() and run voice
+     * activity detection on it, NULL turns it off. format, channels
+     * and rate of @param come from start_capture(). With @gate only
+     * speech segments and their preroll are queued, so consumers are
+     * not woken through silence.
+     */
+    int (*set_capture_vad)(const struct wave_vad_param* param, int gate);
+
+    /*
+     * Levels and vad state of the latest block
+     */
+    int (*get_capture_level)(struct wave_meter* meter);
+
+    /*
+     * Segment of the block dequeue_capture() returned, 0 outside
+     * speech, so a consumer sees where one segment ends and the
+     * next begins
+     */
+    int (*get_capture_segment)(void);
 };
 
 struct wave_recorder* get_wave_recorder(void);
@@ -0,0 +1,78 @@
+/*
+ *  Copyright (C) 2017, Zhang YanMing <yanmin.zhang@ingenic.com, jamincheung@126.com>
+ *
+ *  Ingenic Linux plarform SDK project
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef WAVE_VAD_H
+#define WAVE_VAD_H
+
+#include <types.h>
+#include <audio/alsa/pcm_convert.h>
+
+enum wave_vad_state {
+    WAVE_VAD_SILENCE = 0,
+    WAVE_VAD_ONSET,             /* loud, not for long enough yet */
+    WAVE_VAD_SPEECH,
+    WAVE_VAD_HANGOVER,          /* quiet inside a segment */
+};
+
+struct wave_vad_param {
+    enum pcm_sample_format format;      /* S16, S24, S24_3 or S32 */
+    int channels;
+    int sample_rate;
+
+    /*
+     * 0 for the defaults: 12dB over the noise floor, loud for 40ms
+     * opens a segment, quiet for 300ms closes it, 200ms kept before
+     * the onset where the caller gates on it
+     */
+    uint32_t threshold_db;
+    uint32_t attack_ms;
+    uint32_t hangover_ms;
+    uint32_t preroll_ms;
+};
+
+/*
+ * Levels are in 1/100 dB relative to full scale, -9600 for silence
+ */
+struct wave_meter {
+    int32_t rms;
+    int32_t peak;
+    int32_t noise;              /* tracked noise floor */
+    enum wave_vad_state state;
+    uint32_t segment;           /* segments opened so far */
+};
+
+struct wave_vad_handle;
+
+/*
+ * Energy detector against an adaptive noise floor, all integer math
+ * so it can run in the capture thread and on a wave file alike
+ */
+struct wave_vad {
+    struct wave_vad_handle* (*open)(const struct wave_vad_param* param);
+    int (*close)(struct wave_vad_handle* handle);
+    int (*reset)(struct wave_vad_handle* handle);
+
+    /*
+     * Meter one block of interleaved samples and step the state
+     * machine, returns the state after the block
+     */
+    enum wave_vad_state (*process)(struct wave_vad_handle* handle,
+            const uint8_t* buffer, uint32_t frames, struct wave_meter* meter);
+};
+
+struct wave_vad* get_wave_vad(void);
+
+#endif /* WAVE_VAD_H */
@@ -49,6 +49,19 @@ enum {
     POWER_SUPPLY_HEALTH_SAFETY_TIMER_EXPIRE,
 };
 
+#define BATTERY_CHANGED_STATE           (1 << 0)
+#define BATTERY_CHANGED_CAPACITY        (1 << 1)
+#define BATTERY_CHANGED_VOLTAGE         (1 << 2)
+#define BATTERY_CHANGED_VOLTAGE_RANGE   (1 << 3)
+#define BATTERY_CHANGED_PRESENT         (1 << 4)
+#define BATTERY_CHANGED_TECHNOLOGY      (1 << 5)
+#define BATTERY_CHANGED_HEALTH          (1 << 6)
+#define BATTERY_CHANGED_ALL             (0x7f)
+
+/*
+ * Listeners get the whole state, @changed tells what differs from
+ * the last one they were given, all of it on the first
+ */
 struct battery_event {
     uint8_t state;
     uint32_t capacity;
@@ -58,6 +71,19 @@ struct battery_event {
     uint32_t present;
     uint32_t technology;
     uint32_t health;
+    uint32_t changed;
+};
+
+/*
+ * Capacity (percent) and voltage_now (uV) moves smaller than these
+ * are not a change. Events that change nothing else are delivered at
+ * most once per @interval_ms, except a drop to empty, and one held
+ * back goes out when the interval ends.
+ */
+struct battery_hysteresis {
+    uint32_t capacity;
+    uint32_t voltage;
+    uint32_t interval_ms;
 };
 
 typedef void (*battery_event_listener_t)(struct battery_event *event);
@@ -69,6 +95,12 @@ struct battery_manager {
     void (*unregister_event_listener)(battery_event_listener_t listener);
     struct netlink_handler* (*get_netlink_handler)(void);
     void (*dump_event)(struct battery_event* event);
+    void (*set_hysteresis)(const struct battery_hysteresis* param);
+
+    /*
+     * Latest state decoded, hysteresis aside. -1 before any event
+     */
+    int (*get_state)(struct battery_event* event);
 };
 
 struct battery_manager* get_battery_manager(void);
@@ -85,6 +85,19 @@ struct camera_timing_param {
     uint8_t vsync_active_level;
 };
 
+/*
+ * 流模式下的帧回调, 与 camera_v4l2 的 frame_receive 原型一致:
+ *     buf: 帧数据, 只在回调期间有效
+ *     seq: 帧序号, 从 0 开始递增
+ */
+typedef void (*camera_frame_receive)(char* buf, uint32_t width,
+                                     uint32_t height, uint32_t seq);
+
+/*
+ * 流模式默认的帧缓存个数
+ */
+#define CAMERA_DEFAULT_NBUF  3
+
 struct camera_manager {
     /**
      *    Function: camera_init
@@ -172,6 +185,55 @@ struct camera_manager {
      *      Return: -1 --> 失败, 其他 --> 寄存器的值
      */
     uint8_t (*sensor_read_reg)(uint32_t regaddr);
+
+    /**
+     *    Function: camera_stream_start
+     * Description: 开启流模式, 内部线程将图像直接读入 nbuf 个 mmap 帧缓存组成的环
+     *       Input:
+     *            nbuf: 帧缓存个数, 为0时使用 CAMERA_DEFAULT_NBUF
+     *           fr_cb: 帧回调, 在采集线程中调用; 为 NULL 时帧放入就绪队列,
+     *                  通过 camera_get_fd/camera_dequeue_frame 获取
+     *      Others: 必须先调用 set_img_param 设置图像大小;
+     *              采集线程总占用一个缓存, 就绪队列最多 nbuf - 1 帧,
+     *              满时丢弃最旧的一帧; 流模式下 camera_read 不可用
+     *      Return: 0 --> 成功, -1 --> 失败
+     */
+    int32_t (*camera_stream_start)(uint32_t nbuf, camera_frame_receive fr_cb);
+
+    /**
+     *    Function: camera_stream_stop
+     * Description: 关闭流模式, 释放帧缓存, 已出队的帧不再有效
+     *      Return: 无
+     */
+    void (*camera_stream_stop)(void);
+
+    /**
+     *    Function: camera_get_fd
+     * Description: 获取可 poll/epoll 的 fd, 有就绪帧时可读(POLLIN)
+     *      Others: 不要直接 read 此 fd, 使用 camera_dequeue_frame
+     *      Return: fd, 未开启流模式时返回 -1
+     */
+    int32_t (*camera_get_fd)(void);
+
+    /**
+     *    Function: camera_dequeue_frame
+     * Description: 非阻塞地取出最旧的就绪帧
+     *       Input:
+     *           frame: 返回帧数据指针
+     *             seq: 返回帧序号, 可为 NULL
+     *      Others: 用完后必须调用 camera_queue_frame 归还
+     *      Return: 帧缓存索引, 无就绪帧返回 -1 且 errno 为 EAGAIN
+     */
+    int32_t (*camera_dequeue_frame)(uint8_t **frame, uint32_t *seq);
+
+    /**
+     *    Function: camera_queue_frame
+     * Description: 归还 camera_dequeue_frame 取出的帧缓存
+     *       Input:
+     *           index: camera_dequeue_frame 返回的索引
+     *      Return: 0 --> 成功, -1 --> 失败
+     */
+    int32_t (*camera_queue_frame)(int32_t index);
 };
 
 /**
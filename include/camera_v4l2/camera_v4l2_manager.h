@@ -46,6 +46,28 @@ struct rgb_pixel_fmt {
 };
 
 
+/*
+ * Capture-to-callback latency buckets: <1ms, <2ms, <4ms ... >=64ms
+ */
+#define CAMERA_V4L2_LATENCY_BUCKETS     8
+#define CAMERA_V4L2_STAT_LOG_INTERVAL   10
+
+struct camera_v4l2_stat {
+    uint32_t frames;            // frames handed to the callback
+    uint32_t dropped;           // frames missing from buf.sequence
+    uint32_t sequence_gaps;     // number of sequence discontinuities
+    uint32_t delayed;           // frames waiting longer than one frame interval
+    uint32_t max_dequeued;      // most frames dequeued in one wakeup
+    float fps;
+
+    uint32_t latency_min_us;    // driver timestamp to callback
+    uint32_t latency_max_us;
+    uint32_t latency_avg_us;
+    uint32_t process_max_us;    // time spent in the callback
+    uint32_t process_avg_us;
+    uint32_t latency_hist[CAMERA_V4L2_LATENCY_BUCKETS];
+};
+
 struct camera_v4l2_manager {
     /**
      *  @brief   初始化camera devide
@@ -78,6 +100,22 @@ struct camera_v4l2_manager {
     int (*build_bmp)(uint8_t* rgb, uint32_t width, uint32_t height, uint8_t* filename);
 
     int (*deinit)(void);
+
+    /**
+     *  @brief   获取帧统计: 帧率, 丢帧, 序号跳变, 延迟直方图
+     *
+     *  @param   stat - 返回统计数据
+     *
+     */
+    int (*get_stat)(struct camera_v4l2_stat* stat);
+
+    int (*reset_stat)(void);
+
+    /**
+     *  @brief   设置统计打印周期(秒), 0 关闭打印
+     *
+     */
+    int (*set_stat_log_interval)(uint32_t seconds);
 };
 
 struct camera_v4l2_manager* get_camera_v4l2_manager(void);
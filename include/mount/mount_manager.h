@@ -14,6 +14,7 @@
  *
  */
 
+#include <types.h>
 #include <utils/list.h>
 
 struct mounted_volume {
@@ -24,12 +25,74 @@ struct mounted_volume {
     struct list_head head;
 };
 
+enum {
+    MOUNT_EVENT_MOUNTED = 0,
+    MOUNT_EVENT_UNMOUNTED,
+    MOUNT_EVENT_CHANGED,        /* remounted, flags differ */
+};
+
+/*
+ * @volume is a copy, only valid during the call. Listeners may call
+ * back into mount_manager.
+ */
+typedef void (*mount_event_listener_t)(int event,
+        const struct mounted_volume* volume);
+
+/*
+ * Outcome of an asynchronous mount or umount, strings only valid
+ * during the callback. Times are spent waiting for a pool thread,
+ * probing the superblock and in mount(2) or umount(2).
+ */
+struct mount_result {
+    const char* device;
+    const char* mount_point;
+    const char* filesystem;     /* probed, NULL if none was recognized */
+    int umount;
+    int error;                  /* 0 or -errno */
+    uint32_t wait_us;
+    uint32_t probe_us;
+    uint32_t mount_us;
+};
+
+typedef void (*mount_callback_t)(const struct mount_result* result,
+        void* arg);
+
+/*
+ * The mount table is kept in memory and indexed, lookups only re-read
+ * /proc/self/mountinfo after the kernel flags a change. init() starts
+ * a thread that refreshes it and tells listeners as changes happen,
+ * without it the table is refreshed on the next lookup.
+ */
 struct mount_manager {
+    int (*init)(void);
+    int (*deinit)(void);
+    void (*register_event_listener)(mount_event_listener_t listener);
+    void (*unregister_event_listener)(mount_event_listener_t listener);
     void (*dump_mounted_volumes)(void);
     struct mounted_volume* (*find_mounted_volume_by_device)(const char* device);
     struct mounted_volume* (*find_mounted_volume_by_mount_point)(const char* mount_point);
     int (*umount_volume)(struct mounted_volume* volume);
+
+    /*
+     * The filesystem is probed from the superblock, the list of
+     * supported ones is tried only when the probe finds nothing
+     */
     int (*mount_volume)(const char* device, const char* mount_point);
+
+    /*
+     * Automount: block uevents from get_netlink_handler() mount sd and
+     * mmc volumes under @mount_prefix/<name> and umount them on removal,
+     * on @threads pool threads in parallel, @cb is told of each. The
+     * *_async calls queue on the same pool and need it started.
+     */
+    int (*start_automount)(const char* mount_prefix, int threads,
+            mount_callback_t cb, void* arg);
+    void (*stop_automount)(void);
+    struct netlink_handler* (*get_netlink_handler)(void);
+    int (*mount_volume_async)(const char* device, const char* mount_point,
+            mount_callback_t cb, void* arg);
+    int (*umount_volume_async)(const char* device, mount_callback_t cb,
+            void* arg);
 };
 
 struct mount_manager* get_mount_manager(void);
@@ -17,6 +17,11 @@
 #ifndef NETLINK_EVENT_H
 #define NETLINK_EVENT_H
 
+#include <stddef.h>
+
+#include <types.h>
+#include <utils/list.h>
+
 #define NL_PARAMS_MAX       128
 
 #define NLACTION_UNKNOWN    0
@@ -26,6 +31,49 @@
 #define NLACTION_LINKUP     4
 #define NLACTION_LINKDOWN   5
 
+/*
+ * Keys interned at decode time, find_key() gets their value without
+ * any string compare
+ */
+enum netlink_key {
+    NL_KEY_UNKNOWN = -1,
+    NL_KEY_ACTION = 0,
+    NL_KEY_DEVPATH,
+    NL_KEY_SUBSYSTEM,
+    NL_KEY_SEQNUM,
+    NL_KEY_DEVTYPE,
+    NL_KEY_DEVNAME,
+    NL_KEY_MAJOR,
+    NL_KEY_MINOR,
+    NL_KEY_NPARTS,
+    NL_KEY_PARTN,
+    NL_KEY_DRIVER,
+    NL_KEY_MODALIAS,
+    NL_KEY_PRODUCT,
+    NL_KEY_TYPE,
+    NL_KEY_INTERFACE,
+    NL_KEY_SWITCH_NAME,
+    NL_KEY_SWITCH_STATE,
+    NL_KEY_POWER_SUPPLY_NAME,
+    NL_KEY_POWER_SUPPLY_TYPE,
+    NL_KEY_POWER_SUPPLY_STATUS,
+    NL_KEY_POWER_SUPPLY_HEALTH,
+    NL_KEY_POWER_SUPPLY_PRESENT,
+    NL_KEY_POWER_SUPPLY_ONLINE,
+    NL_KEY_POWER_SUPPLY_TECHNOLOGY,
+    NL_KEY_POWER_SUPPLY_CAPACITY,
+    NL_KEY_POWER_SUPPLY_VOLTAGE_NOW,
+    NL_KEY_POWER_SUPPLY_VOLTAGE_MAX_DESIGN,
+    NL_KEY_POWER_SUPPLY_VOLTAGE_MIN_DESIGN,
+    NL_KEY_POWER_SUPPLY_CURRENT_NOW,
+    NL_KEY_POWER_SUPPLY_TEMP,
+    NL_KEY_MAX,
+};
+
+/*
+ * decode() parses in place: path, subsystem, params and values point
+ * into the decoded buffer, which must outlive the event
+ */
 struct netlink_event {
     void (*construct)(struct netlink_event *this);
     void (*destruct)(struct netlink_event *this);
@@ -33,6 +81,8 @@ struct netlink_event {
             int format);
     const char *(*find_param)(struct netlink_event *this,
             const char *param_name);
+    const char *(*find_key)(struct netlink_event *this,
+            enum netlink_key key);
     const char *(*get_subsystem)(struct netlink_event* this);
     const int (*get_action)(struct netlink_event *this);
     void (*dump)(struct netlink_event* this);
@@ -41,9 +91,23 @@ struct netlink_event {
     int action;
     char *subsystem;
     char *params[NL_PARAMS_MAX];
+    int param_count;
+    const char *values[NL_KEY_MAX];
+    struct list_head node;
 };
 
 void construct_netlink_event(struct netlink_event* this);
 void destruct_netlink_event(struct netlink_event* this);
 
+/*
+ * Events recycled between messages instead of _new/_delete each
+ */
+struct netlink_event* obtain_netlink_event(void);
+void recycle_netlink_event(struct netlink_event* event);
+
+/*
+ * NL_KEY_UNKNOWN for keys not in the table
+ */
+enum netlink_key netlink_intern_key(const char* name, int length);
+
 #endif /* NETLINK_EVENT_H */
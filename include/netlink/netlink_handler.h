@@ -19,6 +19,12 @@
 
 #include <netlink/netlink_event.h>
 
+/*
+ * Subsystem of a handler that wants every uevent, the listener then
+ * can't filter any out
+ */
+#define NETLINK_SUBSYSTEM_ALL   "all sub-system"
+
 struct netlink_handler {
     void (*construct)(struct netlink_handler *this, char* subsystem,
             int priority,
@@ -17,16 +17,40 @@
 #ifndef NETLINK_MANAGER_H
 #define NETLINK_MANAGER_H
 
+#include <types.h>
 #include <netlink/netlink_handler.h>
 
+struct netlink_stat {
+    uint32_t received;      /* datagrams read */
+    uint32_t batches;       /* reads, each up to a batch of datagrams */
+    uint32_t truncated;     /* larger than a receive slot */
+    uint32_t undecoded;     /* not a kernel uevent */
+    uint32_t overruns;      /* socket overflowed, events were lost */
+    uint32_t resyncs;       /* sysfs replays after an overrun */
+};
+
 struct netlink_manager {
     int (*init)(void);
+
+    /*
+     * Test backend, call instead of and before any init(): the listener
+     * reads a socketpair rather than the kernel, and uevents written in
+     * kernel format to *peer reach the handlers as if the kernel had
+     * sent them. The caller closes *peer after deinit()
+     */
+    int (*init_local)(int* peer);
     int (*deinit)(void);
+
+    /*
+     * Listens on the reactor when get_reactor() is init before this,
+     * on a thread of its own otherwise
+     */
     int (*start)(void);
     int (*is_start)(void);
     int (*stop)(void);
     void (*register_handler)(struct netlink_handler* handler);
     void (*unregister_handler)(struct netlink_handler* handler);
+    int (*get_stat)(struct netlink_stat* stat);
 };
 
 struct netlink_manager* get_netlink_manager(void);
@@ -0,0 +1,55 @@
+/*
+ *  Copyright (C) 2017, Zhang YanMing <yanmin.zhang@ingenic.com, jamincheung@126.com>
+ *
+ *  Ingenic Linux plarform SDK project
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef UEVENT_INJECTOR_H
+#define UEVENT_INJECTOR_H
+
+#include <types.h>
+
+/*
+ * Feeds uevents to netlink_manager without a kernel: init() sets the
+ * manager up on its socketpair backend, so it must come before anything
+ * else calls netlink_manager init(). Handlers register and the manager
+ * starts as usual.
+ */
+struct uevent_injector {
+    int (*init)(void);
+    int (*deinit)(void);
+
+    /*
+     * One uevent as the kernel sends it: "action@devpath\0KEY=VALUE\0..."
+     */
+    int (*inject)(const char* uevent, int size);
+
+    /*
+     * Build and inject an event, @params are "KEY=VALUE" strings ending
+     * with NULL. SEQNUM is added when missing, returns the one used.
+     */
+    int (*inject_event)(const char* action, const char* devpath,
+            const char* subsystem, const char** params);
+
+    /*
+     * Replay a recording of "udevadm monitor --kernel --property":
+     * events are blocks of KEY=VALUE lines split by empty lines, other
+     * lines are ignored. @rate is events per second, 0 as fast as the
+     * listener takes them. Returns the count injected.
+     */
+    int (*inject_fixture)(const char* path, int rate);
+};
+
+struct uevent_injector* get_uevent_injector(void);
+
+#endif /* UEVENT_INJECTOR_H */
@@ -0,0 +1,94 @@
+/*
+ *  Copyright (C) 2017, Zhang YanMing <yanmin.zhang@ingenic.com, jamincheung@126.com>
+ *
+ *  Ingenic Linux plarform SDK project
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef PMEM_MANAGER_H
+#define PMEM_MANAGER_H
+
+#include <types.h>
+
+#define PMEM_PAGE_SHIFT         12
+#define PMEM_PAGE_SIZE          (1 << PMEM_PAGE_SHIFT)
+
+/*
+ * Largest pool is 2^12 pages(16MB), same as /proc/jz/mem/imem
+ */
+#define PMEM_MAX_ORDER          12
+#define PMEM_MIN_ORDER          8
+
+/*
+ * Hardware DMA can't cross a 4MB virtual boundary (jz_mem skipped to
+ * the next one). Blocks up to this size never cross one, larger ones
+ * can't avoid it
+ */
+#define PMEM_BOUNDARY_SIZE      (4 << 20)
+
+enum pmem_backend {
+    /*
+     * Reserved memory from /proc/jz/mem/imem, mapped through /dev/mem
+     */
+    PMEM_BACKEND_IMEM = 0,
+
+    /*
+     * Ordinary process memory with synthetic physical addresses,
+     * for hosts without the imem driver
+     */
+    PMEM_BACKEND_PLAIN,
+};
+
+struct pmem_stat {
+    uint32_t total_size;
+    uint32_t used_size;
+    uint32_t peak_used_size;
+    uint32_t largest_free_size;
+    uint32_t alloc_count;
+    uint32_t free_count;
+    uint32_t failed_count;
+    uint32_t slab_pages;
+
+    /*
+     * Free buddy blocks per order
+     */
+    uint32_t free_blocks[PMEM_MAX_ORDER + 1];
+};
+
+struct pmem_manager {
+    /*
+     * @size: pool size in bytes, rounded up to 2^n pages,
+     *        0 means the largest the backend can offer
+     */
+    int (*init)(enum pmem_backend backend, uint32_t size);
+    int (*deinit)(void);
+
+    /*
+     * Requests up to PMEM_PAGE_SIZE / 2 come from slab caches, larger
+     * ones are buddy blocks aligned to their size, virtual and physical,
+     * up to the alignment of the pool base. That is the pool size, less
+     * when the imem region is less aligned physically (init logs it),
+     * and never under PMEM_PAGE_SIZE. A larger @align fails.
+     */
+    void* (*alloc)(uint32_t size, uint32_t align);
+    void (*free)(void* addr);
+
+    uint32_t (*virt_to_phys)(void* addr);
+    void* (*phys_to_virt)(uint32_t paddr);
+
+    void (*get_stat)(struct pmem_stat* stat);
+    void (*dump)(void);
+};
+
+struct pmem_manager* get_pmem_manager(void);
+
+#endif /* PMEM_MANAGER_H */
@@ -0,0 +1,98 @@
+/*
+ *  Copyright (C) 2017, Zhang YanMing <yanmin.zhang@ingenic.com, jamincheung@126.com>
+ *
+ *  Ingenic Linux plarform SDK project
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef SNAPSHOT_MANAGER_H
+#define SNAPSHOT_MANAGER_H
+
+#include <types.h>
+
+#define SNAPSHOT_DEFAULT_QUEUE_DEPTH    2
+
+enum snapshot_format {
+    SNAPSHOT_FORMAT_BMP = 0,
+    SNAPSHOT_FORMAT_PNG,
+};
+
+/*
+ * SNAPSHOT_PIXEL_RGB24 is B-G-R byte order, as produced by yuv2rgb()
+ */
+enum snapshot_pixel_format {
+    SNAPSHOT_PIXEL_YUYV = 0,
+    SNAPSHOT_PIXEL_RGB24,
+};
+
+/*
+ * PNG row filters, may be or'ed together
+ */
+#define SNAPSHOT_FILTER_DEFAULT         0x00
+#define SNAPSHOT_FILTER_NONE            0x08
+#define SNAPSHOT_FILTER_SUB             0x10
+#define SNAPSHOT_FILTER_UP              0x20
+#define SNAPSHOT_FILTER_AVG             0x40
+#define SNAPSHOT_FILTER_PAETH           0x80
+#define SNAPSHOT_FILTER_ALL             0xf8
+
+enum snapshot_strategy {
+    SNAPSHOT_STRATEGY_DEFAULT = 0,
+    SNAPSHOT_STRATEGY_FILTERED,
+    SNAPSHOT_STRATEGY_HUFFMAN_ONLY,
+    SNAPSHOT_STRATEGY_RLE,
+};
+
+struct snapshot_param {
+    enum snapshot_format format;
+
+    /*
+     * PNG only: zlib level 0 - 9, -1 means zlib default
+     */
+    int compress_level;
+    int filter;
+    enum snapshot_strategy strategy;
+};
+
+typedef void (*snapshot_complete_t)(const char* path, int error, void* param);
+
+struct snapshot_stat {
+    uint32_t taken;
+    uint32_t encoded;
+    uint32_t failed;
+    uint32_t rejected;
+    uint64_t max_encode_us;
+    uint64_t total_encode_us;
+};
+
+struct snapshot_manager {
+    int (*init)(int queue_depth);
+    int (*deinit)(void);
+
+    /*
+     * Copy @frame into a free queue slot and return immediately,
+     * encoding happens on the snapshot thread. Returns -1 when
+     * every slot is busy so the caller's capture loop never blocks.
+     */
+    int (*take)(const char* path, const uint8_t* frame, uint32_t width,
+            uint32_t height, enum snapshot_pixel_format pixel_format,
+            const struct snapshot_param* param, snapshot_complete_t callback,
+            void* callback_param);
+
+    int (*wait_idle)(void);
+    int (*get_pending)(void);
+    void (*get_stat)(struct snapshot_stat* stat);
+};
+
+struct snapshot_manager* get_snapshot_manager(void);
+
+#endif /* SNAPSHOT_MANAGER_H */
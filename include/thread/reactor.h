@@ -0,0 +1,102 @@
+/*
+ *  Copyright (C) 2017, Zhang YanMing <yanmin.zhang@ingenic.com, jamincheung@126.com>
+ *
+ *  Ingenic Linux plarform SDK project
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+
+#define REACTOR_MAX_LOOPS   4
+
+/*
+ * Handlers of one source always run on the same loop thread, one at
+ * a time, and must not block: everything else on that loop waits
+ */
+typedef void (*reactor_fd_handler_t)(int id, int fd, uint32_t events,
+        void* arg);
+typedef void (*reactor_timer_handler_t)(int id, uint64_t expirations,
+        void* arg);
+typedef void (*reactor_signal_handler_t)(int id,
+        const struct signalfd_siginfo* info, void* arg);
+typedef void (*reactor_event_handler_t)(int id, uint64_t count, void* arg);
+
+struct reactor_stat {
+    uint32_t loops;
+    uint32_t sources;
+    uint32_t wakeups;
+    uint32_t dispatched;
+    uint32_t max_dispatch_us;
+};
+
+/*
+ * epoll loops shared by the SDK: timer_manager and netlink_manager
+ * find it init when they start and register their fds here rather
+ * than running threads of their own
+ */
+struct reactor {
+    /*
+     * @loops: epoll threads, sources are spread over them and each is
+     * bound to a cpu. 0 takes one per online cpu up to
+     * REACTOR_MAX_LOOPS. Counted, the first init decides.
+     */
+    int (*init)(int loops);
+    int (*deinit)(void);
+    int (*is_init)(void);
+
+    /*
+     * Every add returns a source id > 0 or -1. @events as epoll
+     * (EPOLLIN, EPOLLOUT, EPOLLET...), the fd stays the caller's.
+     */
+    int (*add_fd)(int fd, uint32_t events, reactor_fd_handler_t handler,
+            void* arg);
+    int (*modify_fd)(int id, uint32_t events);
+
+    /*
+     * Monotonic timerfd, @initial_us 0 leaves it disarmed and
+     * @interval_us 0 makes it oneshot
+     */
+    int (*add_timer)(uint32_t initial_us, uint32_t interval_us,
+            reactor_timer_handler_t handler, void* arg);
+    int (*set_timer)(int id, uint32_t initial_us, uint32_t interval_us);
+
+    /*
+     * The signal is blocked in the caller and every loop thread, add it
+     * before other threads are created or block it in them as well
+     */
+    int (*add_signal)(int signo, reactor_signal_handler_t handler,
+            void* arg);
+
+    /*
+     * Eventfd, notify_event from any thread wakes the handler with the
+     * number of notifications since the last call
+     */
+    int (*add_event)(reactor_event_handler_t handler, void* arg);
+    int (*notify_event)(int id);
+
+    /*
+     * Once it returns the handler is not running and won't be called
+     * again, except when called from that handler itself
+     */
+    int (*remove)(int id);
+
+    int (*get_stat)(struct reactor_stat* stat);
+};
+
+struct reactor* get_reactor(void);
+
+#endif /* REACTOR_H */
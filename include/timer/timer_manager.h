@@ -22,6 +22,10 @@
 typedef void (*timer_event_listener_t)(int timer_id, int exp_num);
 
 struct timer_manager {
+    /*
+     * Timers fire on the reactor instead of a thread of their own
+     * when get_reactor() is init before this
+     */
     int (*init)(void);
     int (*deinit)(void);
     int (*is_init)(void);
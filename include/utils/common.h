@@ -53,6 +53,21 @@ char* get_current_process_name(void);
 char* get_user_system_dir(uid_t uid);
 void msleep(uint64_t msec);
 void cold_boot(const char *path);
+
+struct cold_boot_stat {
+    uint32_t uevents;       /* "add" written */
+    uint32_t failed;        /* uevent files that refused it */
+    uint32_t elapsed_ms;
+};
+
+/*
+ * cold_boot() with the subtrees below @path walked on @threads pool
+ * threads, 0 for one per CPU. With @subsystems only devices whose
+ * subsystem is listed get "add". @stat may be NULL, the time taken is
+ * logged either way.
+ */
+int cold_boot_parallel(const char *path, const char **subsystems, int count,
+        int threads, struct cold_boot_stat *stat);
 enum system_platform_t get_system_platform(void);
 
 #endif /* COMMON_H */
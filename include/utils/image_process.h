@@ -0,0 +1,79 @@
+/*
+ *  Copyright (C) 2017, Zhang YanMing <yanmin.zhang@ingenic.com, jamincheung@126.com>
+ *
+ *  Ingenic Linux plarform SDK project
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef IMAGE_PROCESS_H
+#define IMAGE_PROCESS_H
+
+#include <types.h>
+
+/*
+ * Kernels work on 8bit planes described by width, height and stride
+ * (bytes per line). YUYV strides are in bytes too, so a packed
+ * YUYV frame has stride = width * 2.
+ */
+
+enum image_rotate {
+    IMAGE_ROTATE_NONE = 0,
+    IMAGE_ROTATE_CW90,
+    IMAGE_ROTATE_CCW90,
+};
+
+/*
+ * Luma extraction, output is a packed width x height plane, or
+ * height x width for 90 degree rotations
+ */
+void image_yuyv_extract_y(const uint8_t* yuyv, uint32_t width, uint32_t height,
+        uint32_t stride, uint8_t* y);
+void image_yuyv_extract_y_rotate(const uint8_t* yuyv, uint32_t width,
+        uint32_t height, uint32_t stride, uint8_t* y, enum image_rotate rotate);
+void image_nv12_extract_y(const uint8_t* nv12, uint32_t width, uint32_t height,
+        uint32_t stride, uint8_t* y);
+
+/*
+ * ROI crop, x of YUYV crop is rounded down to an even pixel
+ */
+int image_crop(const uint8_t* src, uint32_t src_width, uint32_t src_height,
+        uint32_t src_stride, uint32_t x, uint32_t y, uint32_t width,
+        uint32_t height, uint8_t* dst, uint32_t dst_stride);
+int image_yuyv_crop_y(const uint8_t* yuyv, uint32_t src_width,
+        uint32_t src_height, uint32_t src_stride, uint32_t x, uint32_t y,
+        uint32_t width, uint32_t height, uint8_t* dst, uint32_t dst_stride);
+
+/*
+ * Box resize averages every source pixel covered by a destination
+ * pixel, use it to shrink. Bilinear is for small ratios and upscale.
+ */
+int image_resize_box(const uint8_t* src, uint32_t src_width,
+        uint32_t src_height, uint32_t src_stride, uint8_t* dst,
+        uint32_t dst_width, uint32_t dst_height, uint32_t dst_stride);
+int image_resize_bilinear(const uint8_t* src, uint32_t src_width,
+        uint32_t src_height, uint32_t src_stride, uint8_t* dst,
+        uint32_t dst_width, uint32_t dst_height, uint32_t dst_stride);
+
+void image_histogram(const uint8_t* src, uint32_t width, uint32_t height,
+        uint32_t stride, uint32_t hist[256]);
+void image_equalize_hist(const uint8_t* src, uint32_t width, uint32_t height,
+        uint32_t src_stride, uint8_t* dst, uint32_t dst_stride);
+
+/*
+ * Integral image has (width + 1) x (height + 1) entries, first row
+ * and column are zero, sum(x0, y0, x1, y1) =
+ *     I[y1][x1] - I[y0][x1] - I[y1][x0] + I[y0][x0]
+ */
+void image_integral(const uint8_t* src, uint32_t width, uint32_t height,
+        uint32_t stride, uint32_t* integral);
+
+#endif /* IMAGE_PROCESS_H */
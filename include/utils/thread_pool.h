@@ -18,6 +18,9 @@
 #define THREAD_POOL_H
 
 #include <limits.h>
+#include <pthread.h>
+#include <types.h>
+#include <utils/list.h>
 
 typedef void (*func_thread_async) (void *arg);
 typedef void (*func_thread_handle) (void *arg);
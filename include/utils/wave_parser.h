@@ -15,7 +15,7 @@
  */
 
 #ifndef WAVE_PARSER_H
-#define WAVE_PAESER_H
+#define WAVE_PARSER_H
 
 #include <types.h>
 #include <endian.h>
@@ -41,13 +41,18 @@
 #define WAV_WAVE        COMPOSE_ID('W','A','V','E')
 #define WAV_FMT         COMPOSE_ID('f','m','t',' ')
 #define WAV_DATA        COMPOSE_ID('d','a','t','a')
+#define WAV_FACT        COMPOSE_ID('f','a','c','t')
 
 /* WAVE fmt block constants from Microsoft mmreg.h header */
 #define WAV_FMT_PCM             0x0001
 #define WAV_FMT_IEEE_FLOAT      0x0003
+#define WAV_FMT_IMA_ADPCM       0x0011
 #define WAV_FMT_DOLBY_AC3_SPDIF 0x0092
 #define WAV_FMT_EXTENSIBLE      0xfffe
 
+/* Private tag of the wave_codec lossless format, not read by other tools */
+#define WAV_FMT_LOSSLESS        0x4c53
+
 /* Used with WAV_FMT_EXTENSIBLE format */
 #define WAV_GUID_TAG        "/x00/x00/x00/x00/x10/x00/x80/x00/x00/xAA/x00/x38/x9B/x71"
 
@@ -86,12 +91,38 @@ typedef struct {
     uint32_t length;       /* samplecount */
 } WaveChunkHeader;
 
+/* fmt extension of compressed formats, format_size 20 */
+typedef struct {
+    uint16_t ext_size;          /* 2 */
+    uint16_t samples_per_block;
+} WaveFmtCodecExt;
+
+typedef struct {
+    uint32_t type;         /* 'fact' */
+    uint32_t length;       /* 4 */
+    uint32_t samples;      /* frames in the file */
+} WaveFactChunk;
+
 typedef struct {
     WaveHeader header;
     WaveFmtBody format;
     WaveChunkHeader chunk_header;
+
+    /*
+     * Only used when format is not WAV_FMT_PCM, written between the
+     * fmt and data chunks
+     */
+    WaveFmtCodecExt codec;
+    WaveFactChunk fact;
 } WaveContainer;
 
+/*
+ * Parse a header held in memory, *data_offset is where the sample data
+ * starts in @buffer. Returns -EAGAIN when @buffer ends before the data
+ * chunk, so a stream can be parsed as it arrives.
+ */
+int wave_parse_header(const uint8_t* buffer, uint32_t size,
+        WaveContainer* container, uint32_t* data_offset);
 int wave_read_header(int fd, WaveContainer* container);
 int wave_write_header(int fd, WaveContainer* container);
 
@@ -35,6 +35,51 @@ typedef enum _motor_status {
 
 typedef void (*motor_event_callback_t)(uint32_t motor_id, motor_status status);
 
+/*
+ * 振动波形的一步
+ *           duration_ms    持续时间, 单位: ms
+ *           speed          强度 0-10, 0: 停止(MOTOR_COAST)
+ */
+struct vibrator_step {
+    uint32_t duration_ms;
+    uint32_t speed;
+};
+
+/*
+ * 振动波形
+ *           steps          波形步骤
+ *           count          步骤数
+ *           repeat         播放次数, 0: 一直播放直到取消
+ */
+struct vibrator_pattern {
+    const struct vibrator_step* steps;
+    uint32_t count;
+    uint32_t repeat;
+};
+
+/*
+ * 波形定时精度统计
+ *           steps          已执行的步骤数
+ *           repeats        已播放完的次数
+ *           late_max_us    步骤实际执行比计划晚的最大值, 单位: us
+ *           late_avg_us    平均值, 单位: us
+ */
+struct vibrator_pattern_stat {
+    uint32_t steps;
+    uint32_t repeats;
+    uint32_t late_max_us;
+    uint32_t late_avg_us;
+};
+
+/*
+ * 波形结束回调, cancelled: 1 被取消或被替换, 0 播放完成
+ * 在定时线程中调用, 可以play_pattern/cancel_pattern, 不能调用deinit:
+ * deinit要等定时线程退出, 在回调中调用会死锁
+ */
+typedef void (*vibrator_pattern_callback_t)(uint32_t motor_id,
+        int32_t pattern_id, int cancelled,
+        const struct vibrator_pattern_stat* stat);
+
 struct vibrator_manager {
     /**
      * Function: manager_init
@@ -46,6 +91,7 @@ struct vibrator_manager {
     /**
      * Function: manager_deinit
      * Description: 释放库使用的资源
+     *  注意：不能在波形结束回调中调用, 否则死锁
      */
     void (*deinit)(void);
 
@@ -163,6 +209,31 @@ struct vibrator_manager {
        *  Return: NULL: 失败， 成功返回netlink_handler结构指针
        */
       struct netlink_handler* (*get_netlink_handler)(void);
+
+      /**
+       * Function: play_pattern
+       * Description: 在motor上播放振动波形, 所有motor共用一个定时线程
+       * Input:
+       *   motor_id:  需要操作的motor编号
+       *   pattern:  波形, 调用返回后可释放
+       *   queue:  0: 取消当前及排队的波形后立即播放
+       *              1: 排在已有波形之后播放
+       *   callback:  波形结束回调, 可为NULL, 在定时线程中调用
+       *  Return: >0: 波形编号， -1: 失败
+       */
+      int32_t (*play_pattern)(uint32_t motor_id,
+              const struct vibrator_pattern* pattern, int queue,
+              vibrator_pattern_callback_t callback);
+
+      /**
+       * Function: cancel_pattern
+       * Description: 取消motor上的波形, motor停止
+       * Input:
+       *   motor_id:  需要操作的motor编号
+       *   pattern_id:  play_pattern返回的编号, 0: 取消全部
+       *  Return: 0: 成功， -1: 没有对应的波形
+       */
+      int32_t (*cancel_pattern)(uint32_t motor_id, int32_t pattern_id);
 };
 
 /**
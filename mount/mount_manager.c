@@ -18,21 +18,109 @@
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <limits.h>
 #include <sys/mount.h>
 
 #include <utils/log.h>
 #include <utils/list.h>
 #include <utils/assert.h>
+#include <utils/common.h>
 #include <utils/file_ops.h>
+#include <utils/thread_pool.h>
+#include <utils/compare_string.h>
+#include <thread/thread.h>
+#include <netlink/netlink_event.h>
+#include <netlink/netlink_handler.h>
 #include <mount/mount_manager.h>
 
 #define LOG_TAG "mount_manager"
 
-#define PROC_MOUNTS_FILENAME "/proc/mounts"
+/*
+ * The kernel flags POLLPRI on an open mountinfo whenever the mount
+ * table of the namespace changes, so the table is only re-read then
+ */
+#define PROC_MOUNTINFO_FILENAME "/proc/self/mountinfo"
+
+#define MOUNT_HASH_SIZE     64
+#define MOUNTINFO_CHUNK     4096
+
+/*
+ * Enough of the start of a volume for every superblock probed
+ */
+#define PROBE_SIZE          4096
+#define DEFAULT_AUTOMOUNT_THREADS   4
+
+/*
+ * A mounted_volume handed out stays valid until its mount goes away
+ */
+struct mount_entry {
+    struct mounted_volume volume;
+    int id;
+    uint32_t generation;
+    struct mount_entry* next_id;
+    struct mount_entry* next_device;
+    struct mount_entry* next_mount_point;
+};
+
+struct mount_change {
+    int event;
+    struct mounted_volume volume;
+};
+
+struct listener {
+    mount_event_listener_t cb;
+    struct list_head head;
+};
 
 static pthread_mutex_t list_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t listener_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t init_lock = PTHREAD_MUTEX_INITIALIZER;
 
 LIST_HEAD(mounted_list);
+static LIST_HEAD(listeners);
+
+static struct mount_entry* id_table[MOUNT_HASH_SIZE];
+static struct mount_entry* device_table[MOUNT_HASH_SIZE];
+static struct mount_entry* mount_point_table[MOUNT_HASH_SIZE];
+
+static int mountinfo_fd = -1;
+static char* mountinfo;
+static uint32_t mountinfo_size;
+static uint32_t generation;
+static int scanned;
+
+static struct thread* thread;
+static uint32_t init_count;
+
+/*
+ * Mounts and umounts of the automount pool in queue order. Only the
+ * first of a device is on the pool, the others wait for it to finish.
+ */
+struct mount_request {
+    char device[64];
+    char mount_point[PATH_MAX];
+    int umount;
+    int waiting;
+    mount_callback_t cb;
+    void* arg;
+    uint64_t queued_ns;
+    struct list_head head;
+};
+
+static pthread_mutex_t automount_lock = PTHREAD_MUTEX_INITIALIZER;
+static LIST_HEAD(pending_requests);
+static struct thread_pool_manager* automount_pool;
+static uint32_t automount_threads;
+static char automount_prefix[PATH_MAX - NAME_MAX - 1];
+static mount_callback_t automount_cb;
+static void* automount_arg;
+static struct netlink_handler* nh;
+static struct mount_manager this;
 
 const char* supported_filesystem_list[] = {
         "vfat",
@@ -64,75 +152,427 @@ static void dump_mounted_volumes(void) {
     pthread_mutex_unlock(&list_lock);
 }
 
-static void scan_mounted_volumes(void) {
-    char line[2048] = {0};
-    FILE* fp = NULL;
+static uint32_t hash_string(const char* str) {
+    uint32_t hash = 5381;
 
-    fp = fopen(PROC_MOUNTS_FILENAME, "r");
+    while (*str)
+        hash = hash * 33 + (uint8_t) *str++;
 
-    assert_die_if(fp == NULL, "Failed to open %s: %s\n",
-            PROC_MOUNTS_FILENAME, strerror(errno));
+    return hash % MOUNT_HASH_SIZE;
+}
 
-    /*
-     * Clear list first
-     */
-    pthread_mutex_lock(&list_lock);
+/*
+ * Chains keep mountinfo order, so the first match is the oldest mount
+ * as with a walk of the whole table
+ */
+static void index_entry(struct mount_entry* entry) {
+    struct mount_entry** link;
+
+    link = &device_table[hash_string(entry->volume.device)];
+    while (*link)
+        link = &(*link)->next_device;
+    *link = entry;
+
+    link = &mount_point_table[hash_string(entry->volume.mount_point)];
+    while (*link)
+        link = &(*link)->next_mount_point;
+    *link = entry;
+}
+
+static void unindex_entry(struct mount_entry* entry) {
+    struct mount_entry** link;
+
+    link = &device_table[hash_string(entry->volume.device)];
+    while (*link != entry)
+        link = &(*link)->next_device;
+    *link = entry->next_device;
+
+    link = &mount_point_table[hash_string(entry->volume.mount_point)];
+    while (*link != entry)
+        link = &(*link)->next_mount_point;
+    *link = entry->next_mount_point;
+}
 
-    if (!list_empty(&mounted_list)) {
-        struct list_head* pos;
-        struct list_head* next_pos;
+static struct mount_entry* find_entry_by_id(int id) {
+    struct mount_entry* entry;
 
-        list_for_each_safe(pos, next_pos, &mounted_list) {
-            struct mounted_volume* volume =
-                    list_entry(pos, struct mounted_volume, head);
+    for (entry = id_table[id % MOUNT_HASH_SIZE]; entry; entry = entry->next_id)
+        if (entry->id == id)
+            return entry;
 
-            list_del(&volume->head);
-            free(volume);
+    return NULL;
+}
+
+/*
+ * Next space separated field of a mountinfo line, terminated in place
+ * with its octal escapes (\040 for a space and so on) undone
+ */
+static char* next_field(char** cursor) {
+    char* field;
+    char* in;
+    char* out;
+
+    while (**cursor == ' ')
+        (*cursor)++;
+
+    if (**cursor == '\0')
+        return NULL;
+
+    field = in = out = *cursor;
+
+    while (*in && *in != ' ') {
+        if (in[0] == '\\' && in[1] >= '0' && in[1] <= '3'
+                && in[2] >= '0' && in[2] <= '7' && in[3] >= '0' && in[3] <= '7') {
+            *out++ = (in[1] - '0') << 6 | (in[2] - '0') << 3 | (in[3] - '0');
+            in += 4;
+        } else {
+            *out++ = *in++;
         }
     }
 
+    *cursor = *in ? in + 1 : in;
+    *out = '\0';
+
+    return field;
+}
+
+static void copy_field(char* to, const char* from, size_t size) {
+    size_t length = strlen(from);
+
+    if (length >= size)
+        length = size - 1;
+
+    memcpy(to, from, length);
+    to[length] = '\0';
+}
+
+/*
+ * "36 35 98:0 /mnt1 /mnt/parent rw,noatime master:1 - ext3 /dev/root rw"
+ * into @volume, flags as /proc/mounts shows them: mount options then
+ * superblock options
+ */
+static int parse_mountinfo_line(char* line, int* id,
+        struct mounted_volume* volume) {
+    char* mount_point;
+    char* mount_options;
+    char* filesystem;
+    char* device;
+    char* super_options;
+    char* field;
+    char* cursor = line;
+    int i;
+
+    field = next_field(&cursor);
+    if (field == NULL)
+        return -1;
+
+    *id = strtol(field, NULL, 10);
+
     /*
-     * Scan /proc/mounts
+     * parent id, major:minor and root
      */
-    while (fgets(line, sizeof(line), fp)) {
-        int matches;
+    for (i = 0; i < 3; i++)
+        if (next_field(&cursor) == NULL)
+            return -1;
 
-        struct mounted_volume* volume = calloc(1,
-                sizeof(struct mounted_volume));
+    mount_point = next_field(&cursor);
+    mount_options = next_field(&cursor);
+    if (mount_options == NULL)
+        return -1;
+
+    /*
+     * Optional fields up to the "-" separator
+     */
+    while ((field = next_field(&cursor)) && strcmp(field, "-"))
+        continue;
+
+    if (field == NULL)
+        return -1;
+
+    filesystem = next_field(&cursor);
+    device = next_field(&cursor);
+    super_options = next_field(&cursor);
+    if (super_options == NULL)
+        return -1;
+
+    /*
+     * Both option lists open with ro/rw, /proc/mounts shows it once
+     */
+    if ((!strncmp(super_options, "rw", 2) || !strncmp(super_options, "ro", 2))
+            && (super_options[2] == ',' || super_options[2] == '\0'))
+        super_options += super_options[2] ? 3 : 2;
+
+    copy_field(volume->device, device, sizeof(volume->device));
+    copy_field(volume->mount_point, mount_point, sizeof(volume->mount_point));
+    copy_field(volume->filesystem, filesystem, sizeof(volume->filesystem));
+    snprintf(volume->flags, sizeof(volume->flags), "%s%s%s", mount_options,
+            *super_options ? "," : "", super_options);
+
+    return 0;
+}
 
-        matches = sscanf(line, "%63s %63s %63s %127s",
-                volume->device, volume->mount_point,
-                volume->filesystem, volume->flags);
+static int read_mountinfo(void) {
+    ssize_t count;
+    uint32_t length = 0;
+    char* buffer;
 
-        if (matches != 4) {
-            LOGW("Failed to parse line %s\n", line);
-            free(volume);
+    if (lseek(mountinfo_fd, 0, SEEK_SET) < 0) {
+        LOGE("Failed to rewind %s: %s\n", PROC_MOUNTINFO_FILENAME,
+                strerror(errno));
+        return -1;
+    }
+
+    for (;;) {
+        if (mountinfo_size - length < MOUNTINFO_CHUNK) {
+            buffer = realloc(mountinfo, mountinfo_size + MOUNTINFO_CHUNK);
+            if (buffer == NULL) {
+                LOGE("Failed to grow mountinfo buffer\n");
+                return -1;
+            }
+
+            mountinfo = buffer;
+            mountinfo_size += MOUNTINFO_CHUNK;
+        }
+
+        count = read(mountinfo_fd, mountinfo + length,
+                mountinfo_size - length - 1);
+        if (count < 0 && errno == EINTR)
             continue;
+
+        if (count < 0) {
+            LOGE("Failed to read %s: %s\n", PROC_MOUNTINFO_FILENAME,
+                    strerror(errno));
+            return -1;
         }
 
-        list_add_tail(&volume->head, &mounted_list);
+        if (count == 0)
+            break;
+
+        length += count;
     }
 
+    mountinfo[length] = '\0';
+
+    return length;
+}
+
+static int add_change(struct mount_change** changes, int* count, int event,
+        const struct mounted_volume* volume) {
+    struct mount_change* grown;
+
+    if ((*count & (*count - 1)) == 0) {
+        grown = realloc(*changes, (*count ? *count * 2 : 1) * sizeof(**changes));
+        if (grown == NULL)
+            return -1;
+
+        *changes = grown;
+    }
+
+    (*changes)[*count].event = event;
+    (*changes)[*count].volume = *volume;
+    (*count)++;
+
+    return 0;
+}
+
+/*
+ * Bring the table in line with mountinfo: entries whose mount id is
+ * still there are kept as they are, new ids are added and missing
+ * ones dropped. Called with list_lock held, the changes are returned
+ * for the listeners to be told once it is released.
+ */
+static int refresh_mounted_volumes(struct mount_change** changes, int* count) {
+    struct mounted_volume volume;
+    struct mount_entry* entry;
+    struct mount_entry** link;
+    char* line;
+    char* eol;
+    int id;
+    int i;
+
+    if (read_mountinfo() < 0)
+        return -1;
+
+    generation++;
+
+    for (line = mountinfo; *line; line = eol) {
+        eol = strchr(line, '\n');
+        if (eol)
+            *eol++ = '\0';
+        else
+            eol = line + strlen(line);
+
+        if (parse_mountinfo_line(line, &id, &volume) < 0) {
+            if (*line)
+                LOGW("Failed to parse line %s\n", line);
+            continue;
+        }
+
+        entry = find_entry_by_id(id);
+        if (entry) {
+            entry->generation = generation;
+
+            /*
+             * Remounts keep the id, only the flags move
+             */
+            if (strcmp(entry->volume.flags, volume.flags)) {
+                memcpy(entry->volume.flags, volume.flags, sizeof(volume.flags));
+                if (scanned)
+                    add_change(changes, count, MOUNT_EVENT_CHANGED,
+                            &entry->volume);
+            }
+
+            continue;
+        }
+
+        entry = calloc(1, sizeof(*entry));
+        if (entry == NULL) {
+            LOGE("Failed to allocate mount entry\n");
+            continue;
+        }
+
+        entry->volume = volume;
+        entry->id = id;
+        entry->generation = generation;
+
+        entry->next_id = id_table[id % MOUNT_HASH_SIZE];
+        id_table[id % MOUNT_HASH_SIZE] = entry;
+        index_entry(entry);
+        list_add_tail(&entry->volume.head, &mounted_list);
+
+        if (scanned)
+            add_change(changes, count, MOUNT_EVENT_MOUNTED, &entry->volume);
+    }
+
+    for (i = 0; i < MOUNT_HASH_SIZE; i++) {
+        link = &id_table[i];
+
+        while ((entry = *link)) {
+            if (entry->generation == generation) {
+                link = &entry->next_id;
+                continue;
+            }
+
+            *link = entry->next_id;
+            unindex_entry(entry);
+            list_del(&entry->volume.head);
+
+            add_change(changes, count, MOUNT_EVENT_UNMOUNTED, &entry->volume);
+            free(entry);
+        }
+    }
+
+    scanned = 1;
+
+    return 0;
+}
+
+static void notify_listeners(struct mount_change* changes, int count) {
+    struct list_head* pos;
+    int i;
+
+    pthread_mutex_lock(&listener_lock);
+
+    for (i = 0; i < count; i++) {
+        list_for_each(pos, &listeners) {
+            struct listener* l = list_entry(pos, struct listener, head);
+            l->cb(changes[i].event, &changes[i].volume);
+        }
+    }
+
+    pthread_mutex_unlock(&listener_lock);
+}
+
+static int open_mountinfo(void) {
+    if (mountinfo_fd >= 0)
+        return 0;
+
+    mountinfo_fd = open(PROC_MOUNTINFO_FILENAME, O_RDONLY | O_CLOEXEC);
+    if (mountinfo_fd < 0) {
+        LOGE("Failed to open %s: %s\n", PROC_MOUNTINFO_FILENAME,
+                strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Re-read the table when @force or the kernel flagged a change since
+ * the last look, without blocking
+ */
+static void update_mounted_volumes(int force) {
+    struct mount_change* changes = NULL;
+    struct pollfd fds;
+    int count = 0;
+
+    pthread_mutex_lock(&list_lock);
+
+    assert_die_if(open_mountinfo() < 0, "Mount table unavailable\n");
+
+    fds.fd = mountinfo_fd;
+    fds.events = POLLPRI;
+    fds.revents = 0;
+
+    if (poll(&fds, 1, 0) > 0 && (fds.revents & (POLLPRI | POLLERR)))
+        force = 1;
+
+    if (force || !scanned)
+        refresh_mounted_volumes(&changes, &count);
+
     pthread_mutex_unlock(&list_lock);
 
-    fclose(fp);
+    if (count)
+        notify_listeners(changes, count);
+
+    free(changes);
+}
+
+static void scan_mounted_volumes(void) {
+    update_mounted_volumes(1);
+}
+
+static void monitor_loop(struct pthread_wrapper* pthread, void* param) {
+    struct pollfd fds;
+    int old_state;
+
+    fds.fd = mountinfo_fd;
+    fds.events = POLLPRI;
+
+    for (;;) {
+        fds.revents = 0;
+
+        if (poll(&fds, 1, -1) < 0) {
+            if (errno != EINTR)
+                LOGE("Failed to poll %s: %s\n", PROC_MOUNTINFO_FILENAME,
+                        strerror(errno));
+            continue;
+        }
+
+        /*
+         * Not cancelled with the table lock held or a listener
+         * half way through
+         */
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &old_state);
+        update_mounted_volumes(1);
+        pthread_setcancelstate(old_state, NULL);
+    }
 }
 
 static struct mounted_volume* find_mounted_volume_by_device(const char* device) {
     assert_die_if(device == NULL, "device is NULL\n");
 
-    struct list_head* pos;
+    struct mount_entry* entry;
+
+    update_mounted_volumes(0);
 
     pthread_mutex_lock(&list_lock);
 
-    list_for_each(pos, &mounted_list) {
-        struct mounted_volume* volume = list_entry(pos,
-                struct mounted_volume, head);
-        if (volume->device != NULL) {
-            if (!strcmp(volume->device, device)) {
-                pthread_mutex_unlock(&list_lock);
-                return volume;
-            }
+    for (entry = device_table[hash_string(device)]; entry;
+            entry = entry->next_device) {
+        if (!strcmp(entry->volume.device, device)) {
+            pthread_mutex_unlock(&list_lock);
+            return &entry->volume;
         }
     }
 
@@ -141,22 +581,47 @@ static struct mounted_volume* find_mounted_volume_by_device(const char* device)
     return NULL;
 }
 
+/*
+ * Copy of the volume mounted from @device taken under list_lock, for
+ * use after the entry may have gone with a table refresh
+ */
+static int copy_mounted_volume_by_device(const char* device,
+        struct mounted_volume* copy) {
+    struct mount_entry* entry;
+    int error = -1;
+
+    update_mounted_volumes(0);
+
+    pthread_mutex_lock(&list_lock);
+
+    for (entry = device_table[hash_string(device)]; entry;
+            entry = entry->next_device) {
+        if (!strcmp(entry->volume.device, device)) {
+            *copy = entry->volume;
+            error = 0;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&list_lock);
+
+    return error;
+}
+
 static struct mounted_volume* find_mounted_volume_by_mount_point(const char* mount_point) {
     assert_die_if(mount_point == NULL, "mount_point is NULL\n");
 
-    struct list_head* pos;
+    struct mount_entry* entry;
 
-    pthread_mutex_lock(&list_lock);
+    update_mounted_volumes(0);
 
-    list_for_each(pos, &mounted_list) {
+    pthread_mutex_lock(&list_lock);
 
-        struct mounted_volume* volume = list_entry(pos,
-                struct mounted_volume, head);
-        if (volume->mount_point != NULL) {
-            if (!strcmp(volume->mount_point, mount_point)) {
-                pthread_mutex_unlock(&list_lock);
-                return volume;
-            }
+    for (entry = mount_point_table[hash_string(mount_point)]; entry;
+            entry = entry->next_mount_point) {
+        if (!strcmp(entry->volume.mount_point, mount_point)) {
+            pthread_mutex_unlock(&list_lock);
+            return &entry->volume;
         }
     }
 
@@ -165,25 +630,111 @@ static struct mounted_volume* find_mounted_volume_by_mount_point(const char* mou
     return NULL;
 }
 
-static int do_umount(struct mounted_volume* volume) {
-    assert_die_if(volume == NULL, "volume is NULL\n");
+static void register_event_listener(mount_event_listener_t listener) {
+    assert_die_if(listener == NULL, "listener is NULL\n");
+
+    struct list_head* pos;
+    struct listener* l;
+
+    pthread_mutex_lock(&listener_lock);
 
+    list_for_each(pos, &listeners) {
+        l = list_entry(pos, struct listener, head);
+        if (l->cb == listener) {
+            pthread_mutex_unlock(&listener_lock);
+            return;
+        }
+    }
+
+    l = malloc(sizeof(struct listener));
+    l->cb = listener;
+    list_add_tail(&l->head, &listeners);
+
+    pthread_mutex_unlock(&listener_lock);
+}
+
+static void unregister_event_listener(mount_event_listener_t listener) {
+    assert_die_if(listener == NULL, "listener is NULL\n");
+
+    struct list_head* pos;
+    struct list_head* next_pos;
+
+    pthread_mutex_lock(&listener_lock);
+
+    list_for_each_safe(pos, next_pos, &listeners) {
+        struct listener* l = list_entry(pos, struct listener, head);
+
+        if (l->cb == listener) {
+            list_del(&l->head);
+            free(l);
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&listener_lock);
+}
+
+static int init(void) {
+    int error = 0;
+
+    pthread_mutex_lock(&init_lock);
+
+    if (init_count == 0) {
+        update_mounted_volumes(0);
+
+        thread = _new(struct thread, thread);
+        thread->runnable.run = monitor_loop;
+
+        error = thread->start(thread, NULL);
+        if (error < 0) {
+            LOGE("Failed to start mount table monitor\n");
+            _delete(thread);
+            thread = NULL;
+            goto out;
+        }
+    }
+
+    init_count++;
+
+out:
+    pthread_mutex_unlock(&init_lock);
+
+    return error;
+}
+
+static int deinit(void) {
+    pthread_mutex_lock(&init_lock);
+
+    if (init_count && --init_count == 0) {
+        thread->stop(thread);
+        _delete(thread);
+        thread = NULL;
+    }
+
+    pthread_mutex_unlock(&init_lock);
+
+    return 0;
+}
+
+/*
+ * Takes private copies only, a table entry may be freed by a refresh
+ * as soon as list_lock is dropped
+ */
+static int do_umount(const char* device, const char* mount_point,
+        const char* filesystem) {
     int error = 0;
 
-    if (!strcmp(volume->filesystem, "ramdisk"))
+    if (!strcmp(filesystem, "ramdisk"))
         return 0;
 
-    error = umount(volume->mount_point);
+    error = umount(mount_point);
     if (error < 0) {
-        LOGE("Failed to umount \"%s\" from \"%s\": %s\n", volume->device,
-                volume->mount_point, strerror(errno));
+        LOGE("Failed to umount \"%s\" from \"%s\": %s\n", device,
+                mount_point, strerror(errno));
         return -1;
     }
 
-    dir_delete(volume->mount_point);
-
-    list_del(&volume->head);
-    free(volume);
+    dir_delete(mount_point);
 
     return 0;
 }
@@ -239,19 +790,436 @@ static int do_mount(const char* device, const char* mount_point,
     return 0;
 
 error:
+    error = errno;
     dir_delete(mount_point);
+    errno = error;
+
+    return -1;
+}
+
+static int umount_volume(struct mounted_volume* volume) {
+    struct mounted_volume copy;
+    int error = 0;
+
+    assert_die_if(volume == NULL, "volume is NULL\n");
+
+    pthread_mutex_lock(&list_lock);
+    copy = *volume;
+    pthread_mutex_unlock(&list_lock);
+
+    error = do_umount(copy.device, copy.mount_point, copy.filesystem);
+
+    scan_mounted_volumes();
+
+    return error;
+}
+
+static int is_fat(const uint8_t* sector) {
+    uint16_t sector_size = sector[11] | sector[12] << 8;
+
+    if (sector[510] != 0x55 || sector[511] != 0xaa)
+        return 0;
+
+    if (!memcmp(sector + 54, "FAT1", 4) || !memcmp(sector + 82, "FAT32", 5))
+        return 1;
+
+    /*
+     * Some formatters leave the type label empty, fall back on a sane
+     * BPB: power of two sector size and a jump instruction
+     */
+    return (sector[0] == 0xeb || sector[0] == 0xe9)
+            && sector_size >= 512 && sector_size <= 4096
+            && !(sector_size & (sector_size - 1)) && sector[13] != 0
+            && sector[16] != 0;
+}
+
+/*
+ * Filesystem of @device from its superblock magic, NULL when it is
+ * none that can be mounted
+ */
+static const char* probe_filesystem(const char* device) {
+    uint8_t buffer[PROBE_SIZE];
+    ssize_t size;
+    int fd;
+
+    fd = open(device, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOGE("Failed to open %s: %s\n", device, strerror(errno));
+        return NULL;
+    }
+
+    size = pread(fd, buffer, sizeof(buffer), 0);
+    close(fd);
+
+    if (size != sizeof(buffer)) {
+        LOGE("Failed to read superblock of %s\n", device);
+        return NULL;
+    }
+
+    if (!memcmp(buffer + 3, "EXFAT   ", 8))
+        return "exfat";
+
+    if (!memcmp(buffer + 3, "NTFS    ", 8))
+        return "ntfs";
+
+    /*
+     * ext2/3/4 all have 0xef53 at 1024 + 56, ext4 mounts them all
+     */
+    if (buffer[1080] == 0x53 && buffer[1081] == 0xef)
+        return "ext4";
+
+    if (is_fat(buffer))
+        return "vfat";
+
+    return NULL;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void submit_next_locked(const char* device);
+
+static void run_request(void* arg) {
+    struct mount_request* request = arg;
+    struct mount_result result;
+    struct mounted_volume volume;
+    uint64_t start = now_ns();
+    uint64_t probed;
+
+    memset(&result, 0, sizeof(result));
+    result.device = request->device;
+    result.mount_point = request->mount_point;
+    result.umount = request->umount;
+    result.wait_us = (start - request->queued_ns) / 1000;
+
+    if (request->umount) {
+        if (copy_mounted_volume_by_device(request->device, &volume) < 0) {
+            result.error = -ENOENT;
+        } else {
+            snprintf(request->mount_point, sizeof(request->mount_point), "%s",
+                    volume.mount_point);
+            result.filesystem = volume.filesystem;
+
+            if (do_umount(volume.device, volume.mount_point,
+                    volume.filesystem) < 0)
+                result.error = -errno;
+
+            scan_mounted_volumes();
+        }
+
+        result.mount_us = (now_ns() - start) / 1000;
+
+    } else {
+        result.filesystem = probe_filesystem(request->device);
+        probed = now_ns();
+        result.probe_us = (probed - start) / 1000;
+
+        if (result.filesystem == NULL) {
+            LOGE("No known filesystem on \"%s\"\n", request->device);
+            result.error = -ENODEV;
+        } else if (do_mount(request->device, request->mount_point,
+                result.filesystem) < 0) {
+            result.error = errno ? -errno : -EIO;
+        } else {
+            scan_mounted_volumes();
+        }
+
+        result.mount_us = (now_ns() - probed) / 1000;
+    }
+
+    LOGI("%s \"%s\" %s: %s, queued %u us, probe %u us, %s %u us\n",
+            request->umount ? "Umount" : "Mount", request->device,
+            request->mount_point, result.error ? strerror(-result.error) : "ok",
+            result.wait_us, result.probe_us,
+            request->umount ? "umount" : "mount", result.mount_us);
+
+    if (request->cb)
+        request->cb(&result, request->arg);
+
+    pthread_mutex_lock(&automount_lock);
+    list_del(&request->head);
+    submit_next_locked(request->device);
+    pthread_mutex_unlock(&automount_lock);
+
+    free(request);
+}
+
+/*
+ * Put the next waiting request of @device on the pool, called with
+ * automount_lock held. While stopping the pool is gone and those left
+ * are dropped.
+ */
+static void submit_next_locked(const char* device) {
+    struct mount_request* request;
+    struct list_head* pos;
+
+    if (automount_pool == NULL)
+        return;
+
+    list_for_each(pos, &pending_requests) {
+        request = list_entry(pos, struct mount_request, head);
+        if (strcmp(request->device, device))
+            continue;
+
+        if (!request->waiting)
+            return;
+
+        request->waiting = 0;
+
+        if (automount_pool->add_work(automount_pool, run_request, request,
+                NULL, NULL) == 0)
+            return;
+
+        LOGE("Failed to queue %s of \"%s\"\n",
+                request->umount ? "umount" : "mount", device);
+
+        list_del(&request->head);
+        free(request);
+
+        submit_next_locked(device);
+        return;
+    }
+}
 
+/*
+ * Queue a mount or umount, one per device at a time: a request for a
+ * device busy with another waits behind it, one the same as the last
+ * queued for the device is dropped
+ */
+static int queue_request(const char* device, const char* mount_point,
+        int umount, mount_callback_t cb, void* arg) {
+    struct mount_request* request;
+    struct mount_request* last = NULL;
+    struct list_head* pos;
+
+    pthread_mutex_lock(&automount_lock);
+
+    if (automount_pool == NULL) {
+        LOGE("Automount is not started\n");
+        goto error;
+    }
+
+    if (strlen(device) >= sizeof(request->device) || (mount_point
+            && strlen(mount_point) >= sizeof(request->mount_point))) {
+        LOGE("Device or mount point of \"%s\" too long\n", device);
+        goto error;
+    }
+
+    list_for_each(pos, &pending_requests) {
+        request = list_entry(pos, struct mount_request, head);
+        if (!strcmp(request->device, device))
+            last = request;
+    }
+
+    if (last && last->umount == umount) {
+        LOGW("%s of \"%s\" already queued\n",
+                umount ? "Umount" : "Mount", device);
+        goto error;
+    }
+
+    request = calloc(1, sizeof(*request));
+    if (request == NULL) {
+        LOGE("Failed to allocate mount request\n");
+        goto error;
+    }
+
+    snprintf(request->device, sizeof(request->device), "%s", device);
+    snprintf(request->mount_point, sizeof(request->mount_point), "%s",
+            mount_point ? mount_point : "");
+    request->umount = umount;
+    request->cb = cb;
+    request->arg = arg;
+    request->queued_ns = now_ns();
+    request->waiting = last != NULL;
+
+    list_add_tail(&request->head, &pending_requests);
+
+    if (!request->waiting && automount_pool->add_work(automount_pool,
+            run_request, request, NULL, NULL) < 0) {
+        list_del(&request->head);
+        free(request);
+        goto error;
+    }
+
+    pthread_mutex_unlock(&automount_lock);
+
+    return 0;
+
+error:
+    pthread_mutex_unlock(&automount_lock);
+    return -1;
+}
+
+static int mount_volume_async(const char* device, const char* mount_point,
+        mount_callback_t cb, void* arg) {
+    assert_die_if(device == NULL, "device is NULL\n");
+    assert_die_if(mount_point == NULL, "mount_point is NULL\n");
+
+    return queue_request(device, mount_point, 0, cb, arg);
+}
+
+static int umount_volume_async(const char* device, mount_callback_t cb,
+        void* arg) {
+    assert_die_if(device == NULL, "device is NULL\n");
+
+    return queue_request(device, NULL, 1, cb, arg);
+}
+
+/*
+ * Whole disks without a partition table and partitions of sd and mmc
+ * devices, as they come and go
+ */
+static void handle_block_event(struct netlink_handler* nh,
+        struct netlink_event* event) {
+    const char* type = event->find_key(event, NL_KEY_DEVTYPE);
+    const char* name = event->find_key(event, NL_KEY_DEVNAME);
+    const char* nparts = event->find_key(event, NL_KEY_NPARTS);
+    const int action = event->get_action(event);
+    char device[64];
+    char mount_point[sizeof(automount_prefix) + NAME_MAX + 1];
+
+    if (type == NULL || name == NULL)
+        return;
+
+    if (!is_prefixed_with(name, "sd") && !is_prefixed_with(name, "mmcblk"))
+        return;
+
+    if (strcmp(type, "partition")
+            && (strcmp(type, "disk") || nparts == NULL || atoi(nparts)))
+        return;
+
+    snprintf(device, sizeof(device), "/dev/%s", name);
+
+    if (action == NLACTION_ADD) {
+        if (snprintf(mount_point, sizeof(mount_point), "%s/%s",
+                automount_prefix, name) >= sizeof(mount_point)) {
+            LOGE("Mount point for \"%s\" too long\n", name);
+            return;
+        }
+
+        queue_request(device, mount_point, 0, automount_cb, automount_arg);
+
+    } else if (action == NLACTION_REMOVE) {
+        queue_request(device, NULL, 1, automount_cb, automount_arg);
+    }
+}
+
+static int start_automount(const char* mount_prefix, int threads,
+        mount_callback_t cb, void* arg) {
+    assert_die_if(mount_prefix == NULL, "mount_prefix is NULL\n");
+
+    pthread_mutex_lock(&automount_lock);
+
+    if (automount_pool) {
+        pthread_mutex_unlock(&automount_lock);
+        return 0;
+    }
+
+    if (strlen(mount_prefix) >= sizeof(automount_prefix)) {
+        LOGE("Mount prefix \"%s\" too long\n", mount_prefix);
+        goto error;
+    }
+
+    nh = calloc(1, sizeof(struct netlink_handler));
+    if (nh == NULL) {
+        LOGE("Failed to allocate netlink handler\n");
+        goto error;
+    }
+
+    automount_threads = threads > 0 ? threads : DEFAULT_AUTOMOUNT_THREADS;
+
+    automount_pool = construct_thread_pool_manager();
+    if (automount_pool == NULL)
+        goto error;
+
+    if (automount_pool->init(automount_pool, automount_threads, 0, 0) < 0) {
+        deconstruct_thread_pool_manager(&automount_pool);
+        goto error;
+    }
+
+    automount_pool->start(automount_pool);
+
+    snprintf(automount_prefix, sizeof(automount_prefix), "%s", mount_prefix);
+    automount_cb = cb;
+    automount_arg = arg;
+
+    nh->construct = construct_netlink_handler;
+    nh->deconstruct = destruct_netlink_handler;
+    nh->construct(nh, "block", 0, handle_block_event, &this);
+
+    pthread_mutex_unlock(&automount_lock);
+
+    return 0;
+
+error:
+    LOGE("Failed to start automount\n");
+    free(nh);
+    nh = NULL;
+    pthread_mutex_unlock(&automount_lock);
     return -1;
 }
 
+/*
+ * The caller unregisters the netlink handler first
+ */
+static void stop_automount(void) {
+    struct thread_pool_manager* pool;
+    struct list_head* pos;
+    struct list_head* next_pos;
+
+    pthread_mutex_lock(&automount_lock);
+    pool = automount_pool;
+    automount_pool = NULL;
+    pthread_mutex_unlock(&automount_lock);
+
+    if (pool == NULL)
+        return;
+
+    /*
+     * Requests running finish, those still queued are dropped
+     */
+    pool->destroy(pool, automount_threads);
+    deconstruct_thread_pool_manager(&pool);
+
+    pthread_mutex_lock(&automount_lock);
+
+    list_for_each_safe(pos, next_pos, &pending_requests) {
+        struct mount_request* request = list_entry(pos, struct mount_request,
+                head);
+
+        list_del(&request->head);
+        free(request);
+    }
+
+    pthread_mutex_unlock(&automount_lock);
+
+    nh->deconstruct(nh);
+    free(nh);
+    nh = NULL;
+}
+
+static struct netlink_handler* get_netlink_handler(void) {
+    return nh;
+}
+
 static int mount_volume(const char* device, const char* mount_point) {
     assert_die_if(device == NULL, "device is NULL\n");
     assert_die_if(mount_point == NULL, "mount_point is NULL\n");
 
+    const char* probed;
     int i = 0;
     int error = 0;
 
-    scan_mounted_volumes();
+    probed = probe_filesystem(device);
+    if (probed && do_mount(device, mount_point, probed) == 0) {
+        scan_mounted_volumes();
+        return 0;
+    }
 
     for (i = 0; supported_filesystem_list[i]; i++) {
         const char* filesystem = supported_filesystem_list[i];
@@ -266,29 +1234,29 @@ static int mount_volume(const char* device, const char* mount_point) {
         return -1;
     }
 
+    /*
+     * Listeners hear of the new mount before this returns
+     */
     scan_mounted_volumes();
 
     return 0;
 }
 
-static int umount_volume(struct mounted_volume* volume) {
-    int error = 0;
-
-    assert_die_if(volume == NULL, "volume is NULL\n");
-
-    error = do_umount(volume);
-
-    scan_mounted_volumes();
-
-    return error;
-}
-
 static struct mount_manager this = {
+        .init = init,
+        .deinit = deinit,
+        .register_event_listener = register_event_listener,
+        .unregister_event_listener = unregister_event_listener,
         .dump_mounted_volumes = dump_mounted_volumes,
         .find_mounted_volume_by_device = find_mounted_volume_by_device,
         .find_mounted_volume_by_mount_point = find_mounted_volume_by_mount_point,
         .umount_volume = umount_volume,
         .mount_volume = mount_volume,
+        .mount_volume_async = mount_volume_async,
+        .umount_volume_async = umount_volume_async,
+        .start_automount = start_automount,
+        .stop_automount = stop_automount,
+        .get_netlink_handler = get_netlink_handler,
 };
 
 struct mount_manager* get_mount_manager(void) {
@@ -18,22 +18,111 @@
 #include <stddef.h>
 #include <string.h>
 #include <stdbool.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <utils/log.h>
 #include <utils/assert.h>
+#include <utils/common.h>
+#include <utils/list.h>
 #include <netlink/netlink_event.h>
 
 #include "netlink_listener.h"
 
 #define LOG_TAG "netlink_event"
 
-static const char*
-has_prefix(const char* str, const char* end, const char* prefix,
-        size_t prefixlen) {
-    if ((end - str) >= (ptrdiff_t) prefixlen && !memcmp(str, prefix, prefixlen))
-        return str + prefixlen;
-    else
-        return NULL;
+/*
+ * Free events kept for reuse, a storm needs as many as are in flight
+ */
+#define EVENT_POOL_MAX      16
+
+#define KEY_HASH_SIZE       64
+#define KEY_HASH_INIT       2166136261u
+#define KEY_HASH_STEP(hash, c)  (((hash) ^ (uint8_t) (c)) * 16777619u)
+
+static const char* key_names[NL_KEY_MAX] = {
+    [NL_KEY_ACTION] = "ACTION",
+    [NL_KEY_DEVPATH] = "DEVPATH",
+    [NL_KEY_SUBSYSTEM] = "SUBSYSTEM",
+    [NL_KEY_SEQNUM] = "SEQNUM",
+    [NL_KEY_DEVTYPE] = "DEVTYPE",
+    [NL_KEY_DEVNAME] = "DEVNAME",
+    [NL_KEY_MAJOR] = "MAJOR",
+    [NL_KEY_MINOR] = "MINOR",
+    [NL_KEY_NPARTS] = "NPARTS",
+    [NL_KEY_PARTN] = "PARTN",
+    [NL_KEY_DRIVER] = "DRIVER",
+    [NL_KEY_MODALIAS] = "MODALIAS",
+    [NL_KEY_PRODUCT] = "PRODUCT",
+    [NL_KEY_TYPE] = "TYPE",
+    [NL_KEY_INTERFACE] = "INTERFACE",
+    [NL_KEY_SWITCH_NAME] = "SWITCH_NAME",
+    [NL_KEY_SWITCH_STATE] = "SWITCH_STATE",
+    [NL_KEY_POWER_SUPPLY_NAME] = "POWER_SUPPLY_NAME",
+    [NL_KEY_POWER_SUPPLY_TYPE] = "POWER_SUPPLY_TYPE",
+    [NL_KEY_POWER_SUPPLY_STATUS] = "POWER_SUPPLY_STATUS",
+    [NL_KEY_POWER_SUPPLY_HEALTH] = "POWER_SUPPLY_HEALTH",
+    [NL_KEY_POWER_SUPPLY_PRESENT] = "POWER_SUPPLY_PRESENT",
+    [NL_KEY_POWER_SUPPLY_ONLINE] = "POWER_SUPPLY_ONLINE",
+    [NL_KEY_POWER_SUPPLY_TECHNOLOGY] = "POWER_SUPPLY_TECHNOLOGY",
+    [NL_KEY_POWER_SUPPLY_CAPACITY] = "POWER_SUPPLY_CAPACITY",
+    [NL_KEY_POWER_SUPPLY_VOLTAGE_NOW] = "POWER_SUPPLY_VOLTAGE_NOW",
+    [NL_KEY_POWER_SUPPLY_VOLTAGE_MAX_DESIGN] = "POWER_SUPPLY_VOLTAGE_MAX_DESIGN",
+    [NL_KEY_POWER_SUPPLY_VOLTAGE_MIN_DESIGN] = "POWER_SUPPLY_VOLTAGE_MIN_DESIGN",
+    [NL_KEY_POWER_SUPPLY_CURRENT_NOW] = "POWER_SUPPLY_CURRENT_NOW",
+    [NL_KEY_POWER_SUPPLY_TEMP] = "POWER_SUPPLY_TEMP",
+};
+
+/*
+ * Open addressing over key_names, slots hold key + 1
+ */
+static uint8_t key_hash[KEY_HASH_SIZE];
+static pthread_once_t key_hash_once = PTHREAD_ONCE_INIT;
+
+static LIST_HEAD(free_events);
+static uint32_t free_count;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t hash_key(const char* name, int length) {
+    uint32_t hash = KEY_HASH_INIT;
+
+    for (int i = 0; i < length; i++)
+        hash = KEY_HASH_STEP(hash, name[i]);
+
+    return hash;
+}
+
+static void build_key_hash(void) {
+    uint32_t slot;
+
+    for (int key = 0; key < NL_KEY_MAX; key++) {
+        slot = hash_key(key_names[key], strlen(key_names[key]));
+
+        while (key_hash[slot % KEY_HASH_SIZE])
+            slot++;
+
+        key_hash[slot % KEY_HASH_SIZE] = key + 1;
+    }
+}
+
+static enum netlink_key lookup_key(const char* name, int length,
+        uint32_t slot) {
+    int key;
+
+    while ((key = key_hash[slot % KEY_HASH_SIZE])) {
+        key--;
+        if (!strncmp(key_names[key], name, length)
+                && key_names[key][length] == '\0')
+            return key;
+        slot++;
+    }
+
+    return NL_KEY_UNKNOWN;
+}
+
+enum netlink_key netlink_intern_key(const char* name, int length) {
+    pthread_once(&key_hash_once, build_key_hash);
+
+    return lookup_key(name, length, hash_key(name, length));
 }
 
 static int parseBinaryNetlinkMessage(struct netlink_event* this, char *buffer,
@@ -41,50 +130,89 @@ static int parseBinaryNetlinkMessage(struct netlink_event* this, char *buffer,
     return -1;
 }
 
-#define CONST_STRLEN(x)  (sizeof(x)-1)
+static int parse_action(const char* action) {
+    if (!strcmp(action, "add"))
+        return NLACTION_ADD;
+    else if (!strcmp(action, "remove"))
+        return NLACTION_REMOVE;
+    else if (!strcmp(action, "change"))
+        return NLACTION_CHANGE;
 
-#define HAS_CONST_PREFIX(str,end,prefix)  has_prefix((str),(end),prefix,CONST_STRLEN(prefix))
+    return NLACTION_UNKNOWN;
+}
 
+static void clear_event(struct netlink_event* this) {
+    this->path = NULL;
+    this->action = NLACTION_UNKNOWN;
+    this->subsystem = NULL;
+    this->seq = 0;
+
+    memset(this->params, 0, this->param_count * sizeof(this->params[0]));
+    this->param_count = 0;
+    memset(this->values, 0, sizeof(this->values));
+}
+
+/*
+ * "action@devpath" then "KEY=value" strings, all NUL terminated. Nothing
+ * is copied, the strings stay in @buffer.
+ */
 static int parseAsciiNetlinkMessage(struct netlink_event* this, char *buffer,
         int size) {
-    const char *s = buffer;
-    const char *end;
-    int param_idx = 0;
-    int first = 1;
+    char *s = buffer;
+    char *end;
+    char *at;
+    char *p;
+    uint32_t hash;
+    size_t length;
+    enum netlink_key key;
 
     if (size == 0)
         return -1;
 
     buffer[size - 1] = '\0';
-
     end = s + size;
-    while (s < end) {
-        if (first) {
-            // parse event path
-            const char *p = s;
-            for (; *p != '@'; p++)
-                continue;
-            p++;
-            this->path = strdup(p + 1);
-            first = 0;
-        } else {
-            const char* a;
-            if ((a = HAS_CONST_PREFIX(s, end, "ACTION=")) != NULL) {
-                if (!strcmp(a, "add"))
-                    this->action = NLACTION_ADD;
-                else if (!strcmp(a, "remove"))
-                    this->action = NLACTION_REMOVE;
-                else if (!strcmp(a, "change"))
-                    this->action = NLACTION_CHANGE;
-            } else if ((a = HAS_CONST_PREFIX(s, end, "SEQNUM=")) != NULL) {
-                this->seq = atoi(a);
-            } else if ((a = HAS_CONST_PREFIX(s, end, "SUBSYSTEM=")) != NULL) {
-                this->subsystem = strdup(a);
-            } else if (param_idx < NL_PARAMS_MAX) {
-                this->params[param_idx++] = strdup(s);
-            }
+
+    length = strlen(s);
+    at = memchr(s, '@', length);
+    if (at == NULL || at + 1 == s + length)
+        return -1;
+
+    this->path = at + 2;
+
+    pthread_once(&key_hash_once, build_key_hash);
+
+    /*
+     * One pass over each key, hashing on the way to '='
+     */
+    for (s += length + 1; s < end; s = p + strlen(p) + 1) {
+        hash = KEY_HASH_INIT;
+        for (p = s; *p != '=' && *p != '\0'; p++)
+            hash = KEY_HASH_STEP(hash, *p);
+
+        if (*p == '\0')
+            continue;
+
+        key = lookup_key(s, p - s, hash);
+        p++;
+
+        if (key != NL_KEY_UNKNOWN && this->values[key] == NULL)
+            this->values[key] = p;
+
+        switch (key) {
+        case NL_KEY_ACTION:
+            this->action = parse_action(p);
+            break;
+        case NL_KEY_SEQNUM:
+            this->seq = atoi(p);
+            break;
+        case NL_KEY_SUBSYSTEM:
+            this->subsystem = p;
+            break;
+        default:
+            if (this->param_count < NL_PARAMS_MAX)
+                this->params[this->param_count++] = s;
+            break;
         }
-        s += strlen(s) + 1;
     }
 
     return 0;
@@ -92,6 +220,8 @@ static int parseAsciiNetlinkMessage(struct netlink_event* this, char *buffer,
 
 static int decode(struct netlink_event *this, char *buffer, int size,
         int format) {
+    clear_event(this);
+
     if (format == NETLINK_FORMAT_BINARY) {
         return parseBinaryNetlinkMessage(this, buffer, size);
     } else {
@@ -99,11 +229,28 @@ static int decode(struct netlink_event *this, char *buffer, int size,
     }
 }
 
+static const char *find_key(struct netlink_event* this,
+        enum netlink_key key) {
+    if (key < 0 || key >= NL_KEY_MAX)
+        return NULL;
+
+    return this->values[key];
+}
+
 static const char *find_param(struct netlink_event* this,
         const char* param_name) {
     int i;
     size_t len = strlen(param_name);
-    for (i = 0; i < NL_PARAMS_MAX && this->params[i] != NULL; ++i) {
+    enum netlink_key key = netlink_intern_key(param_name, len);
+
+    if (key != NL_KEY_UNKNOWN) {
+        if (this->values[key] == NULL)
+            LOGD("Parameter '%s' not found\n", param_name);
+
+        return this->values[key];
+    }
+
+    for (i = 0; i < this->param_count; ++i) {
         const char *ptr = this->params[i] + len;
         if (!strncmp(this->params[i], param_name, len) && *ptr == '=')
             return ++ptr;
@@ -132,39 +279,65 @@ static void dump(struct netlink_event* this) {
     LOGD("NL subsytem \'%s\'\n", this->subsystem);
     LOGD("NL devpath \'%s\'\n", this->path);
     LOGD("NL action \'%s\'\n", action[this->action]);
-    for (i = 0; i < NL_PARAMS_MAX; i++) {
-        if (!this->params[i])
-            break;
+    for (i = 0; i < this->param_count; i++)
         LOGD("NL param \'%s\'\n", this->params[i]);
-    }
     LOGD("========================================\n");
 }
 
 void construct_netlink_event(struct netlink_event* this) {
-    this->path = NULL;
-    this->action = NLACTION_UNKNOWN;
-    this->subsystem = NULL;
-    this->seq = 0;
-    memset(this->params, 0, sizeof(this->params));
+    this->param_count = 0;
+    clear_event(this);
+    INIT_LIST_HEAD(&this->node);
 
     this->decode = decode;
     this->find_param = find_param;
+    this->find_key = find_key;
     this->get_subsystem = get_subsystem;
     this->get_action = get_action;
     this->dump = dump;
 }
 
 void destruct_netlink_event(struct netlink_event* this) {
+    /*
+     * Nothing owned, the strings belong to the decoded buffer
+     */
+    clear_event(this);
+}
 
-    if (this->path)
-        free(this->path);
+struct netlink_event* obtain_netlink_event(void) {
+    struct netlink_event* event;
 
-    if (this->subsystem)
-        free(this->subsystem);
+    pthread_mutex_lock(&pool_lock);
 
-    int i;
-    for (i = 0; i < NL_PARAMS_MAX; i++) {
-        if (!this->params[i])
-            free(this->params[i]);
+    event = list_first_entry_or_null(&free_events, struct netlink_event, node);
+    if (event) {
+        list_del_init(&event->node);
+        free_count--;
     }
+
+    pthread_mutex_unlock(&pool_lock);
+
+    if (event == NULL)
+        event = _new(struct netlink_event, netlink_event);
+
+    return event;
+}
+
+void recycle_netlink_event(struct netlink_event* event) {
+    assert_die_if(event == NULL, "event is NULL\n");
+
+    clear_event(event);
+
+    pthread_mutex_lock(&pool_lock);
+
+    if (free_count < EVENT_POOL_MAX) {
+        list_add(&event->node, &free_events);
+        free_count++;
+        event = NULL;
+    }
+
+    pthread_mutex_unlock(&pool_lock);
+
+    if (event)
+        _delete(event);
 }
@@ -21,101 +21,541 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <errno.h>
 #include <poll.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <pthread.h>
 
 #include <utils/log.h>
 #include <utils/assert.h>
 #include <utils/common.h>
 #include <thread/thread.h>
+#include <thread/reactor.h>
 #include <netlink/netlink_handler.h>
 #include <netlink/netlink_event.h>
 
+#include "uevent_filter.h"
+
 #define LOG_TAG "netlink_listener"
 
-static int local_socket;
-static char buffer[64 * 1024];
-static struct netlink_handler* head;
+#define HANDLER_HASH_SIZE   32
+
+/*
+ * Datagrams taken per wakeup, the kernel's uevents are at most 2KB
+ */
+#define RECV_BATCH          16
+#define RECV_SIZE           (8 * 1024)
+
+/*
+ * After an overrun resync at most this often, resync events can
+ * themselves overrun the socket. Each resync that overran again
+ * doubles the interval up to the max.
+ */
+#define RESYNC_INTERVAL_MS      1000
+#define RESYNC_MAX_INTERVAL_MS  (32 * 1000)
+
+/*
+ * Receive buffer while a resync replays, the replay is as fast as
+ * sysfs can be written
+ */
+#define RESYNC_BUFFER_SIZE      (1024 * 1024)
+
+static int local_socket = -1;
+static char buffers[RECV_BATCH][RECV_SIZE];
 static struct thread* thread;
-static pthread_mutex_t handler_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Resyncs run on their own thread, the one draining the socket must
+ * keep at it while the kernel replays
+ */
+static struct thread* resync_thread;
+
+static struct netlink_stat listener_stat;
+static int resync_pending;
+static int resync_running;
+static uint32_t resync_interval_ms = RESYNC_INTERVAL_MS;
+static uint64_t last_resync_ms;
+static pthread_mutex_t resync_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Socket, resync timer and resync done event when running on the
+ * reactor. Resyncs never run on a loop, they stall all its sources.
+ */
+static int reactor_id = -1;
+static int resync_timer_id = -1;
+static int resync_done_id = -1;
+static struct netlink_event* reactor_event;
+
+/*
+ * Handlers chained through ->next by subsystem hash, highest
+ * priority first. Those for every subsystem are kept apart and merged
+ * in at dispatch.
+ */
+static struct netlink_handler* handler_table[HANDLER_HASH_SIZE];
+static struct netlink_handler* wildcard_head;
+static pthread_rwlock_t handler_lock = PTHREAD_RWLOCK_INITIALIZER;
 static pthread_mutex_t init_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t start_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static uint32_t init_count;
 static uint32_t start_count;
 
+static int is_wildcard(struct netlink_handler* handler) {
+    const char* subsystem = handler->get_subsystem(handler);
+
+    return subsystem == NULL || !strcmp(subsystem, NETLINK_SUBSYSTEM_ALL);
+}
+
+static uint32_t hash_subsystem(const char* subsystem) {
+    uint32_t hash = 5381;
+
+    while (*subsystem)
+        hash = hash * 33 + (uint8_t) *subsystem++;
+
+    return hash % HANDLER_HASH_SIZE;
+}
+
+static struct netlink_handler** handler_chain(struct netlink_handler* handler) {
+    if (is_wildcard(handler))
+        return &wildcard_head;
+
+    return &handler_table[hash_subsystem(handler->get_subsystem(handler))];
+}
+
+static struct netlink_handler* next_match(struct netlink_handler* nh,
+        const char* subsystem) {
+    while (nh && strcmp(nh->subsystem, subsystem))
+        nh = nh->next;
+
+    return nh;
+}
+
 static void dispatch_event(struct netlink_event *event) {
-    struct netlink_handler *nh, *next_nh;
+    const char* subsystem = event->get_subsystem(event);
+    struct netlink_handler *nh = NULL;
+    struct netlink_handler *all;
+    struct netlink_handler *next;
+
+    pthread_rwlock_rdlock(&handler_lock);
+
+    all = wildcard_head;
+
+    if (subsystem)
+        nh = next_match(handler_table[hash_subsystem(subsystem)], subsystem);
+
+    while (nh || all) {
+        if (nh && (all == NULL || nh->priority >= all->priority)) {
+            next = next_match(nh->next, subsystem);
+            nh->handle_event(nh, event);
+            nh = next;
+        } else {
+            next = all->next;
+            all->handle_event(all, event);
+            all = next;
+        }
+    }
+
+    pthread_rwlock_unlock(&handler_lock);
+}
+
+/*
+ * Let the kernel drop uevents no handler wants, no filter while any
+ * handler takes every subsystem. Called with handler_lock held.
+ */
+static void update_filter(void) {
+    const char* subsystems[UEVENT_FILTER_MAX_SUBSYSTEMS];
+    struct netlink_handler* nh;
+    int count = 0;
+    int i;
+    int j;
+
+    if (local_socket < 0)
+        return;
+
+    if (wildcard_head)
+        goto no_filter;
+
+    for (i = 0; i < HANDLER_HASH_SIZE; i++) {
+        for (nh = handler_table[i]; nh; nh = nh->next) {
+            for (j = 0; j < count; j++)
+                if (!strcmp(subsystems[j], nh->subsystem))
+                    break;
 
-    nh = head;
+            if (j < count)
+                continue;
 
-    while (nh) {
-        next_nh = nh->next;
+            if (count == UEVENT_FILTER_MAX_SUBSYSTEMS)
+                goto no_filter;
 
-        nh->handle_event(nh, event);
+            subsystems[count++] = nh->subsystem;
+        }
+    }
+
+    if (uevent_filter_attach(local_socket, subsystems, count) == 0)
+        return;
+
+no_filter:
+    uevent_filter_detach(local_socket);
+}
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void cold_boot_subsystem(const char* subsystem) {
+    char path[PATH_MAX];
+    struct stat st;
+
+    snprintf(path, sizeof(path), "/sys/class/%s", subsystem);
+    if (stat(path, &st) == 0) {
+        cold_boot(path);
+        return;
+    }
+
+    snprintf(path, sizeof(path), "/sys/bus/%s/devices", subsystem);
+    if (stat(path, &st) == 0)
+        cold_boot(path);
+}
+
+/*
+ * Events were lost: have the kernel replay "add" for the devices of
+ * every subsystem handled, so handlers rebuild their state
+ */
+static void resync(void) {
+    char subsystems[UEVENT_FILTER_MAX_SUBSYSTEMS][UEVENT_FILTER_MAX_NAME + 1];
+    struct netlink_handler* nh;
+    int count = 0;
+    int all;
+    int i;
+    int j;
+
+    pthread_rwlock_rdlock(&handler_lock);
+
+    all = wildcard_head != NULL;
+
+    for (i = 0; i < HANDLER_HASH_SIZE && !all; i++) {
+        for (nh = handler_table[i]; nh; nh = nh->next) {
+            for (j = 0; j < count; j++)
+                if (!strcmp(subsystems[j], nh->subsystem))
+                    break;
+
+            if (j < count)
+                continue;
+
+            if (count == UEVENT_FILTER_MAX_SUBSYSTEMS
+                    || strlen(nh->subsystem) > UEVENT_FILTER_MAX_NAME) {
+                all = 1;
+                break;
+            }
+
+            strcpy(subsystems[count++], nh->subsystem);
+        }
+    }
+
+    pthread_rwlock_unlock(&handler_lock);
 
-        nh = next_nh;
+    LOGW("Resync uevents of %s\n", all ? "all devices" : "handled subsystems");
+
+    if (all) {
+        cold_boot_parallel("/sys/devices", NULL, 0, 0, NULL);
+    } else {
+        for (i = 0; i < count; i++)
+            cold_boot_subsystem(subsystems[i]);
     }
+
+    __atomic_add_fetch(&listener_stat.resyncs, 1, __ATOMIC_RELAXED);
+}
+
+static void handle_overrun(void) {
+    __atomic_add_fetch(&listener_stat.overruns, 1, __ATOMIC_RELAXED);
+
+    LOGW("uevent socket overrun, events lost\n");
+
+    pthread_mutex_lock(&resync_lock);
+    resync_pending = 1;
+    pthread_mutex_unlock(&resync_lock);
+}
+
+static void resync_loop(struct pthread_wrapper* pthread, void* param) {
+    int socket = (int) (long) param;
+    int size = RESYNC_BUFFER_SIZE;
+    int saved = 0;
+    socklen_t len = sizeof(saved);
+
+    /*
+     * The kernel reports twice what was set
+     */
+    if (getsockopt(socket, SOL_SOCKET, SO_RCVBUF, &saved, &len) == 0
+            && setsockopt(socket, SOL_SOCKET, SO_RCVBUFFORCE, &size,
+                    sizeof(size)) < 0)
+        setsockopt(socket, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+    resync();
+
+    if (saved) {
+        saved /= 2;
+        if (setsockopt(socket, SOL_SOCKET, SO_RCVBUFFORCE, &saved,
+                sizeof(saved)) < 0)
+            setsockopt(socket, SOL_SOCKET, SO_RCVBUF, &saved, sizeof(saved));
+    }
+
+    pthread_mutex_lock(&resync_lock);
+
+    resync_running = 0;
+
+    if (resync_pending)
+        resync_interval_ms = MIN(resync_interval_ms * 2,
+                RESYNC_MAX_INTERVAL_MS);
+    else
+        resync_interval_ms = RESYNC_INTERVAL_MS;
+
+    pthread_mutex_unlock(&resync_lock);
+
+    if (__atomic_load_n(&resync_done_id, __ATOMIC_ACQUIRE) > 0)
+        get_reactor()->notify_event(resync_done_id);
+}
+
+/*
+ * Hand a pending resync to the resync thread once the last one is
+ * done and long enough ago, returns the ms until it should be checked
+ * again or -1
+ */
+static int run_resync(void) {
+    int timeout = -1;
+    int due = 0;
+    uint64_t now;
+
+    pthread_mutex_lock(&resync_lock);
+
+    if (resync_pending && resync_running) {
+        /*
+         * On the reactor the done event comes back here
+         */
+        if (resync_done_id < 0)
+            timeout = resync_interval_ms;
+    } else if (resync_pending) {
+        now = now_ms();
+
+        if (now - last_resync_ms >= resync_interval_ms) {
+            resync_pending = 0;
+            resync_running = 1;
+            last_resync_ms = now;
+            due = 1;
+        } else {
+            timeout = resync_interval_ms - (now - last_resync_ms);
+        }
+    }
+
+    pthread_mutex_unlock(&resync_lock);
+
+    if (due) {
+        /*
+         * Reap the last one, it has finished
+         */
+        resync_thread->wait(resync_thread);
+
+        if (resync_thread->start(resync_thread,
+                (void*) (long) local_socket) < 0) {
+            LOGE("Failed to start resync\n");
+
+            pthread_mutex_lock(&resync_lock);
+            resync_running = 0;
+            resync_pending = 1;
+            pthread_mutex_unlock(&resync_lock);
+
+            timeout = resync_interval_ms;
+        }
+    }
+
+    return timeout;
+}
+
+/*
+ * Drain the socket in batches, returns 0 once it is empty
+ */
+static int receive_batch(struct netlink_event* event) {
+    struct mmsghdr msgs[RECV_BATCH];
+    struct iovec iovs[RECV_BATCH];
+    int count;
+    int i;
+
+    memset(msgs, 0, sizeof(msgs));
+    for (i = 0; i < RECV_BATCH; i++) {
+        iovs[i].iov_base = buffers[i];
+        iovs[i].iov_len = RECV_SIZE;
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    count = recvmmsg(local_socket, msgs, RECV_BATCH, MSG_DONTWAIT, NULL);
+    if (count < 0) {
+        if (errno == ENOBUFS) {
+            handle_overrun();
+            return 1;
+        }
+
+        if (errno != EAGAIN && errno != EINTR)
+            LOGE("netlink event recv failed: %s\n", strerror(errno));
+
+        return 0;
+    }
+
+    __atomic_add_fetch(&listener_stat.batches, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&listener_stat.received, count, __ATOMIC_RELAXED);
+
+    for (i = 0; i < count; i++) {
+        if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+            LOGE("Truncated uevent of %u bytes\n", msgs[i].msg_len);
+            __atomic_add_fetch(&listener_stat.truncated, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        if (event->decode(event, buffers[i], msgs[i].msg_len,
+                NETLINK_FORMAT_ASCII) < 0) {
+            LOGE("Error decoding netlink_event\n");
+            __atomic_add_fetch(&listener_stat.undecoded, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        dispatch_event(event);
+    }
+
+    return count == RECV_BATCH;
 }
 
 static void thread_loop(struct pthread_wrapper* pthread, void *param) {
+    struct netlink_event* event = obtain_netlink_event();
     struct pollfd fds;
+    int timeout;
+    int count;
 
     fds.fd = local_socket;
     fds.events = POLLIN;
     fds.revents = 0;
 
-    int count;
-
     for (;;) {
-restart:
+        timeout = run_resync();
+
         do {
-            count = poll(&fds, 1, -1);
+            count = poll(&fds, 1, timeout);
         } while (count < 0 && errno == EINTR);
 
-        if (fds.revents & POLLIN) {
-            count = recv(local_socket, buffer, sizeof(buffer), 0);
-            if (count < 0) {
-                LOGE("netlink event recv failed: %s\n", strerror(errno));
-                goto restart;
-            }
+        if (fds.revents & POLLIN)
+            while (receive_batch(event))
+                continue;
+    }
 
-            struct netlink_event* event = _new(struct netlink_event,
-                    netlink_event);
+    recycle_netlink_event(event);
 
-            if (event->decode(event, buffer, count, NETLINK_FORMAT_ASCII) < 0) {
-                LOGE("Error decoding netlink_event\n");
-                _delete(event);
-                goto restart;
-            }
+    pthread_exit(NULL);
+}
 
-            dispatch_event(event);
+static void schedule_resync(void) {
+    int timeout = run_resync();
 
-            _delete(event);
-        }
-    }
+    if (timeout >= 0)
+        get_reactor()->set_timer(resync_timer_id, timeout * 1000, 0);
+}
 
-    pthread_exit(NULL);
+static void socket_handler(int id, int fd, uint32_t events, void* arg) {
+    while (receive_batch(reactor_event))
+        continue;
+
+    schedule_resync();
+}
+
+static void resync_handler(int id, uint64_t expirations, void* arg) {
+    schedule_resync();
+}
+
+static void resync_done_handler(int id, uint64_t count, void* arg) {
+    schedule_resync();
+}
+
+static void stop_on_reactor(void) {
+    struct reactor* reactor = get_reactor();
+
+    if (reactor_id > 0)
+        reactor->remove(reactor_id);
+
+    if (resync_timer_id > 0)
+        reactor->remove(resync_timer_id);
+
+    /*
+     * Nothing starts a resync now, let a running one finish before
+     * its done event goes
+     */
+    resync_thread->wait(resync_thread);
+
+    if (resync_done_id > 0)
+        reactor->remove(resync_done_id);
+
+    if (reactor_event)
+        recycle_netlink_event(reactor_event);
+
+    reactor_id = -1;
+    resync_timer_id = -1;
+    __atomic_store_n(&resync_done_id, -1, __ATOMIC_RELEASE);
+    reactor_event = NULL;
+}
+
+static int start_on_reactor(void) {
+    struct reactor* reactor = get_reactor();
+
+    reactor_event = obtain_netlink_event();
+
+    resync_timer_id = reactor->add_timer(0, 0, resync_handler, NULL);
+    if (resync_timer_id < 0)
+        goto error;
+
+    resync_done_id = reactor->add_event(resync_done_handler, NULL);
+    if (resync_done_id < 0)
+        goto error;
+
+    reactor_id = reactor->add_fd(local_socket, EPOLLIN, socket_handler, NULL);
+    if (reactor_id < 0)
+        goto error;
+
+    return 0;
+
+error:
+    stop_on_reactor();
+
+    return -1;
 }
 
 static int start(void) {
+    int error = 0;
+
     pthread_mutex_lock(&start_lock);
 
-    if (start_count++ == 0)
-        thread->start(thread, NULL);
+    if (start_count++ == 0) {
+        if (get_reactor()->is_init())
+            error = start_on_reactor();
+        else
+            error = thread->start(thread, NULL) < 0 ? -1 : 0;
+
+        if (error < 0)
+            start_count = 0;
+    }
 
     pthread_mutex_unlock(&start_lock);
 
-    return 0;
+    return error;
 }
 
 static int is_start(void) {
     pthread_mutex_lock(&start_lock);
-    int started = thread->is_running(thread);
+    int started = reactor_id > 0 || thread->is_running(thread);
     pthread_mutex_unlock(&start_lock);
 
     return started;
@@ -124,21 +564,43 @@ static int is_start(void) {
 static int stop(void) {
     pthread_mutex_lock(&start_lock);
 
-    if (--start_count == 0)
-        thread->stop(thread);
+    if (start_count && --start_count == 0) {
+        if (reactor_id > 0)
+            stop_on_reactor();
+        else
+            thread->stop(thread);
+    }
 
     pthread_mutex_unlock(&start_lock);
 
     return 0;
 }
 
+static int get_stat(struct netlink_stat* stat) {
+    assert_die_if(stat == NULL, "stat is NULL\n");
+
+    /*
+     * Counters are single words, a copy is torn at worst between them
+     */
+    *stat = listener_stat;
+
+    return 0;
+}
+
 static int init(int socket) {
     pthread_mutex_lock(&init_lock);
 
     if (init_count++ == 0) {
+        pthread_rwlock_wrlock(&handler_lock);
         local_socket = socket;
+        update_filter();
+        pthread_rwlock_unlock(&handler_lock);
+
         thread = _new(struct thread, thread);
         thread->runnable.run = thread_loop;
+
+        resync_thread = _new(struct thread, thread);
+        resync_thread->runnable.run = resync_loop;
     }
 
     pthread_mutex_unlock(&init_lock);
@@ -150,11 +612,16 @@ static int deinit(void) {
     pthread_mutex_lock(&init_lock);
 
     if (--init_count == 0) {
-        local_socket = -1;
-
         if (is_start())
             stop();
         _delete(thread);
+
+        resync_thread->wait(resync_thread);
+        _delete(resync_thread);
+
+        pthread_rwlock_wrlock(&handler_lock);
+        local_socket = -1;
+        pthread_rwlock_unlock(&handler_lock);
     }
 
     pthread_mutex_unlock(&init_lock);
@@ -162,36 +629,45 @@ static int deinit(void) {
     return 0;
 }
 
+/*
+ * Handlers must not register or unregister from their handle_event
+ */
 static void register_handler(struct netlink_handler* handler) {
     assert_die_if(handler == NULL, "Handler is NULL\n");
 
-    pthread_mutex_lock(&handler_lock);
+    struct netlink_handler** nh;
 
-    while (head != NULL) {
-        if (handler->get_priority(handler) > head->get_priority(handler))
-            break;
-        head = (head->next);
-    }
-    handler->next = head;
-    head = handler;
+    pthread_rwlock_wrlock(&handler_lock);
 
-    pthread_mutex_unlock(&handler_lock);
+    nh = handler_chain(handler);
+    while (*nh && (*nh)->get_priority(*nh) >= handler->get_priority(handler))
+        nh = &(*nh)->next;
+
+    handler->next = *nh;
+    *nh = handler;
+
+    update_filter();
+
+    pthread_rwlock_unlock(&handler_lock);
 }
 
 static void unregister_handler(struct netlink_handler* handler) {
     assert_die_if(handler == NULL, "Handler is NULL\n");
 
-    pthread_mutex_lock(&handler_lock);
+    struct netlink_handler** nh;
 
-    while (head != NULL) {
-        if (head == handler) {
-            head = handler->next;
-            return;
+    pthread_rwlock_wrlock(&handler_lock);
+
+    for (nh = handler_chain(handler); *nh; nh = &(*nh)->next) {
+        if (*nh == handler) {
+            *nh = handler->next;
+            handler->next = NULL;
+            update_filter();
+            break;
         }
-        head = (head->next);
     }
 
-    pthread_mutex_unlock(&handler_lock);
+    pthread_rwlock_unlock(&handler_lock);
 }
 
 static struct netlink_listener this = {
@@ -202,6 +678,7 @@ static struct netlink_listener this = {
         .is_start = is_start,
         .register_handler = register_handler,
         .unregister_handler = unregister_handler,
+        .get_stat = get_stat,
 };
 
 struct netlink_listener* get_netlink_listener(void) {
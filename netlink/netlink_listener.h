@@ -21,6 +21,7 @@
 #define NETLINK_FORMAT_BINARY 1
 
 #include <netlink/netlink_handler.h>
+#include <netlink/netlink_manager.h>
 
 struct netlink_listener {
     int (*init)(int socket);
@@ -30,6 +31,7 @@ struct netlink_listener {
     int (*stop)(void);
     void (*register_handler)(struct netlink_handler *handler);
     void (*unregister_handler)(struct netlink_handler *handler);
+    int (*get_stat)(struct netlink_stat* stat);
 };
 
 struct netlink_listener* get_netlink_listener(void);
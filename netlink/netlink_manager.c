@@ -35,8 +35,10 @@
 
 #define LOG_TAG "netlink_manager"
 
+#define UEVENT_BUFFER_SIZE  (64 * 1024)
+
 static struct netlink_listener *nl;
-static int local_socket;
+static int local_socket = -1;
 
 static pthread_mutex_t init_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t start_lock = PTHREAD_MUTEX_INITIALIZER;
@@ -77,10 +79,6 @@ static int stop(void) {
             LOGE("Failed to stop netlink_listener: %s\n", strerror(errno));
             goto error;
         }
-
-        close(local_socket);
-        local_socket = -1;
-        nl = NULL;
     }
 
     pthread_mutex_unlock(&start_lock);
@@ -102,58 +100,118 @@ static int is_start(void) {
 
 }
 
-static int init(void) {
+static int open_kernel_socket(void) {
     struct sockaddr_nl nladdr;
-    int size = 64 * 1024;
+    int size = UEVENT_BUFFER_SIZE;
 
-    pthread_mutex_lock(&init_lock);
+    memset(&nladdr, 0, sizeof(nladdr));
+    nladdr.nl_family = AF_NETLINK;
+    nladdr.nl_pid = (pthread_self() << 16) | getpid();
+    nladdr.nl_groups = 0xffffffff;
 
-    if (init_count++ == 0) {
-        memset(&nladdr, 0, sizeof(nladdr));
-        nladdr.nl_family = AF_NETLINK;
-        nladdr.nl_pid = (pthread_self() << 16) | getpid();
-        nladdr.nl_groups = 0xffffffff;
+    local_socket = socket(PF_NETLINK, SOCK_DGRAM, NETLINK_KOBJECT_UEVENT);
+    if (local_socket < 0) {
+        LOGE("Unable to create uevent local_socket: %s\n", strerror(errno));
+        return -1;
+    }
 
-        local_socket = socket(PF_NETLINK, SOCK_DGRAM, NETLINK_KOBJECT_UEVENT);
-        if (local_socket < 0) {
-            LOGE("Unable to create uevent local_socket: %s\n", strerror(errno));
-            goto error;
-        }
+    if (setsockopt(local_socket, SOL_SOCKET, SO_RCVBUFFORCE, &size,
+            sizeof(size)) < 0) {
+        LOGE("Unable to set uevent local_socket options: %s\n", strerror(errno));
+        goto error;
+    }
 
-        if (setsockopt(local_socket, SOL_SOCKET, SO_RCVBUFFORCE, &size,
-                sizeof(size)) < 0) {
-            LOGE("Unable to set uevent local_socket options: %s\n", strerror(errno));
-            goto error;
-        }
+    if (bind(local_socket, (struct sockaddr *)&nladdr, sizeof(nladdr)) < 0) {
+        LOGE("Unable to bind uevent local_socket: %s\n", strerror(errno));
+        goto error;
+    }
+
+    return 0;
+
+error:
+    close(local_socket);
+    local_socket = -1;
+    return -1;
+}
+
+/*
+ * Datagrams keep one uevent per message like the netlink socket, and
+ * a full queue blocks the writer instead of dropping
+ */
+static int open_local_socket(int* peer) {
+    int size = UEVENT_BUFFER_SIZE;
+    int fds[2];
+
+    if (socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, fds) < 0) {
+        LOGE("Unable to create uevent socketpair: %s\n", strerror(errno));
+        return -1;
+    }
 
-        if (bind(local_socket, (struct sockaddr *)&nladdr, sizeof(nladdr)) < 0) {
-            LOGE("Unable to bind uevent local_socket: %s\n", strerror(errno));
+    setsockopt(fds[0], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+    local_socket = fds[0];
+    *peer = fds[1];
+
+    return 0;
+}
+
+static int do_init(int* peer) {
+    pthread_mutex_lock(&init_lock);
+
+    if (init_count == 0) {
+        if (peer ? open_local_socket(peer) : open_kernel_socket())
             goto error;
-        }
 
         nl = get_netlink_listener();
         if (nl->init(local_socket)) {
             LOGE("Failed to init netlink listener\n");
+            close(local_socket);
+            local_socket = -1;
             goto error;
         }
+
+    } else if (peer) {
+        LOGE("init_local must come before any init\n");
+        goto error;
     }
 
+    init_count++;
+
     pthread_mutex_unlock(&init_lock);
 
     return 0;
 
 error:
-    init_count = 0;
     pthread_mutex_unlock(&init_lock);
     return -1;
 }
 
+static int init(void) {
+    return do_init(NULL);
+}
+
+static int init_local(int* peer) {
+    assert_die_if(peer == NULL, "peer is NULL\n");
+
+    return do_init(peer);
+}
+
 static int deinit(void) {
     pthread_mutex_lock(&init_lock);
 
-    if (init_count-- == 0) {
-        if (is_start())
-            stop();
+    if (init_count && --init_count == 0) {
+        pthread_mutex_lock(&start_lock);
+        if (start_count) {
+            start_count = 0;
+            nl->stop();
+        }
+        pthread_mutex_unlock(&start_lock);
+
+        nl->deinit();
+        nl = NULL;
+
+        close(local_socket);
+        local_socket = -1;
     }
 
     pthread_mutex_unlock(&init_lock);
@@ -173,14 +231,22 @@ static void unregister_handler(struct netlink_handler* handler) {
     nl->unregister_handler(handler);
 }
 
+static int get_stat(struct netlink_stat* stat) {
+    assert_die_if(stat == NULL, "stat is NULL\n");
+
+    return nl->get_stat(stat);
+}
+
 static struct netlink_manager this = {
         .init = init,
+        .init_local = init_local,
         .deinit = deinit,
         .start = start,
         .is_start = is_start,
         .stop = stop,
         .register_handler = register_handler,
         .unregister_handler = unregister_handler,
+        .get_stat = get_stat,
 };
 
 struct netlink_manager* get_netlink_manager(void) {
@@ -0,0 +1,239 @@
+/*
+ *  Copyright (C) 2017, Zhang YanMing <yanmin.zhang@ingenic.com, jamincheung@126.com>
+ *
+ *  Ingenic Linux plarform SDK project
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+
+#include <types.h>
+#include <utils/log.h>
+#include <utils/assert.h>
+#include <utils/common.h>
+
+#include "uevent_filter.h"
+
+#define LOG_TAG "uevent_filter"
+
+/*
+ * Kernel uevents start "action@devpath\0ACTION=action\0DEVPATH=devpath\0"
+ * followed by SUBSYSTEM=, so "SUBSYSTEM=" sits at an odd offset of
+ * 2 * (action + devpath) + 19. Classic BPF has no loops: the scan is
+ * unrolled over the odd offsets up to SCAN_END, devpaths up to ~240
+ * characters. Anything the filter can't place is let through and left
+ * to the listener.
+ *
+ * The packet length is checked once per block of offsets, every load
+ * of a block is in bounds or the block isn't scanned. At least
+ * "SUBSYSTEM=x\0SEQNUM=n\0" follows the match, so a block of 8 is
+ * always scanned when the match is in it.
+ */
+#define SCAN_START              27
+#define SCAN_END                512
+#define SCAN_POSITIONS          ((SCAN_END - SCAN_START + 1) / 2)
+#define SCAN_BLOCK              8
+
+#define ACCEPT                  0xffffffff
+#define DROP                    0
+
+#define WORD(a, b, c, d)        (((a) << 24) | ((b) << 16) | ((c) << 8) | (d))
+
+struct program {
+    struct sock_filter* insns;
+    uint32_t count;
+};
+
+static void emit(struct program* program, uint16_t code, uint8_t jt,
+        uint8_t jf, uint32_t k) {
+    struct sock_filter* insn = &program->insns[program->count++];
+
+    insn->code = code;
+    insn->jt = jt;
+    insn->jf = jf;
+    insn->k = k;
+}
+
+static uint32_t chunk_count(const char* name) {
+    uint32_t length = strlen(name) + 1;
+
+    return length / 4 + (length % 4 >= 2) + (length % 2);
+}
+
+/*
+ * Match the value after "SUBSYSTEM=" against @name including its
+ * NUL, X holds the offset of "SUBSYSTEM="
+ */
+static void emit_match(struct program* program, const char* name) {
+    uint32_t length = strlen(name) + 1;
+    uint32_t chunks = chunk_count(name);
+    uint32_t offset = 0;
+    uint32_t value;
+    int size;
+    const uint8_t* p = (const uint8_t*) name;
+
+    while (offset < length) {
+        size = length - offset >= 4 ? 4 : length - offset >= 2 ? 2 : 1;
+
+        if (size == 4)
+            value = WORD(p[offset], p[offset + 1], p[offset + 2],
+                    p[offset + 3]);
+        else if (size == 2)
+            value = (p[offset] << 8) | p[offset + 1];
+        else
+            value = p[offset];
+
+        emit(program, BPF_LD | BPF_IND | (size == 4 ? BPF_W
+                : size == 2 ? BPF_H : BPF_B), 0, 0, 10 + offset);
+
+        /*
+         * On mismatch skip the rest of this name and its accept
+         */
+        chunks--;
+        emit(program, BPF_JMP | BPF_JEQ | BPF_K, 0, chunks * 2 + 1, value);
+
+        offset += size;
+    }
+
+    emit(program, BPF_RET | BPF_K, 0, 0, ACCEPT);
+}
+
+int uevent_filter_attach(int socket, const char** subsystems, int count) {
+    struct sock_fprog fprog;
+    struct program program;
+    uint32_t compare;
+    uint32_t scan_end;
+    uint32_t size;
+    uint32_t first;
+    uint32_t n;
+    uint32_t j;
+    uint32_t k;
+    int i;
+
+    assert_die_if(subsystems == NULL && count, "subsystems is NULL\n");
+
+    if (count > UEVENT_FILTER_MAX_SUBSYSTEMS)
+        return -1;
+
+    /*
+     * Prologue, scan blocks, scan fallthrough, "YSTEM=" check, names,
+     * drop
+     */
+    size = 3 + (SCAN_POSITIONS + SCAN_BLOCK - 1) / SCAN_BLOCK * 5
+            + SCAN_POSITIONS * 3 + 1 + 6 + 1;
+    for (i = 0; i < count; i++) {
+        if (strlen(subsystems[i]) > UEVENT_FILTER_MAX_NAME)
+            return -1;
+
+        size += chunk_count(subsystems[i]) * 2 + 1;
+    }
+
+    if (size > BPF_MAXINSNS)
+        return -1;
+
+    program.insns = calloc(size, sizeof(struct sock_filter));
+    if (program.insns == NULL) {
+        LOGE("Failed to allocate uevent filter\n");
+        return -1;
+    }
+
+    program.count = 0;
+
+    /*
+     * udevd's own broadcasts are not decoded by the listener
+     */
+    emit(&program, BPF_LD | BPF_W | BPF_ABS, 0, 0, 0);
+    emit(&program, BPF_JMP | BPF_JEQ | BPF_K, 0, 1, WORD('l', 'i', 'b', 'u'));
+    emit(&program, BPF_RET | BPF_K, 0, 0, DROP);
+
+    scan_end = size - 1 - 6 - 1;
+    for (i = 0; i < count; i++)
+        scan_end -= chunk_count(subsystems[i]) * 2 + 1;
+    compare = scan_end + 1;
+
+    for (first = 0; first < SCAN_POSITIONS; first += SCAN_BLOCK) {
+        n = MIN(SCAN_BLOCK, SCAN_POSITIONS - first);
+        k = SCAN_START + first * 2;
+
+        emit(&program, BPF_LD | BPF_W | BPF_LEN, 0, 0, 0);
+        emit(&program, BPF_JMP | BPF_JGE | BPF_K, 1, 0, k + (n - 1) * 2 + 4);
+        emit(&program, BPF_JMP | BPF_JA, 0, 0, scan_end - program.count - 1);
+
+        /*
+         * A hit jumps to the JA compare closing the block, with X at
+         * the offset
+         */
+        for (j = 0; j < n; j++, k += 2) {
+            emit(&program, BPF_LDX | BPF_W | BPF_IMM, 0, 0, k);
+            emit(&program, BPF_LD | BPF_W | BPF_IND, 0, 0, 0);
+            emit(&program, BPF_JMP | BPF_JEQ | BPF_K, (n - 1 - j) * 3 + 1, 0,
+                    WORD('S', 'U', 'B', 'S'));
+        }
+
+        emit(&program, BPF_JMP | BPF_JA, 0, 0, 1);
+        emit(&program, BPF_JMP | BPF_JA, 0, 0, compare - program.count - 1);
+    }
+
+    assert_die_if(program.count != scan_end, "Bad uevent filter layout\n");
+
+    emit(&program, BPF_RET | BPF_K, 0, 0, ACCEPT);
+
+    emit(&program, BPF_LD | BPF_W | BPF_IND, 0, 0, 4);
+    emit(&program, BPF_JMP | BPF_JEQ | BPF_K, 1, 0, WORD('Y', 'S', 'T', 'E'));
+    emit(&program, BPF_RET | BPF_K, 0, 0, ACCEPT);
+    emit(&program, BPF_LD | BPF_H | BPF_IND, 0, 0, 8);
+    emit(&program, BPF_JMP | BPF_JEQ | BPF_K, 1, 0, ('M' << 8) | '=');
+    emit(&program, BPF_RET | BPF_K, 0, 0, ACCEPT);
+
+    for (i = 0; i < count; i++)
+        emit_match(&program, subsystems[i]);
+
+    emit(&program, BPF_RET | BPF_K, 0, 0, DROP);
+
+    assert_die_if(program.count != size, "Bad uevent filter size\n");
+
+    fprog.len = program.count;
+    fprog.filter = program.insns;
+
+    /*
+     * A replaced filter is freed only after the new one is charged to
+     * the socket's option memory, which a big filter can exceed
+     */
+    uevent_filter_detach(socket);
+
+    if (setsockopt(socket, SOL_SOCKET, SO_ATTACH_FILTER, &fprog,
+            sizeof(fprog)) < 0) {
+        LOGE("Failed to attach uevent filter: %s\n", strerror(errno));
+        free(program.insns);
+        return -1;
+    }
+
+    free(program.insns);
+
+    return 0;
+}
+
+int uevent_filter_detach(int socket) {
+    int dummy = 0;
+
+    if (setsockopt(socket, SOL_SOCKET, SO_DETACH_FILTER, &dummy,
+            sizeof(dummy)) < 0 && errno != ENOENT) {
+        LOGE("Failed to detach uevent filter: %s\n", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
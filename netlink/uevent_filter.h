@@ -0,0 +1,31 @@
+/*
+ *  Copyright (C) 2017, Zhang YanMing <yanmin.zhang@ingenic.com, jamincheung@126.com>
+ *
+ *  Ingenic Linux plarform SDK project
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef UEVENT_FILTER_H
+#define UEVENT_FILTER_H
+
+#define UEVENT_FILTER_MAX_SUBSYSTEMS    16
+#define UEVENT_FILTER_MAX_NAME          31
+
+/*
+ * Socket filter on the uevent socket: kernel uevents of other
+ * subsystems are dropped before they reach the socket queue. Returns
+ * -1 when the list can't be expressed, the socket then takes everything.
+ */
+int uevent_filter_attach(int socket, const char** subsystems, int count);
+int uevent_filter_detach(int socket);
+
+#endif /* UEVENT_FILTER_H */
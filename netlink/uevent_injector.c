@@ -0,0 +1,343 @@
+/*
+ *  Copyright (C) 2017, Zhang YanMing <yanmin.zhang@ingenic.com, jamincheung@126.com>
+ *
+ *  Ingenic Linux plarform SDK project
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include <types.h>
+#include <utils/log.h>
+#include <utils/assert.h>
+#include <netlink/netlink_event.h>
+#include <netlink/netlink_manager.h>
+#include <netlink/uevent_injector.h>
+
+#define LOG_TAG "uevent_injector"
+
+#define UEVENT_MAX_SIZE     8192
+#define FIXTURE_LINE_MAX    1024
+
+static struct netlink_manager* netlink_manager;
+static pthread_mutex_t init_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t init_count;
+static int peer_socket = -1;
+static uint32_t next_seqnum = 1;
+
+static int inject(const char* uevent, int size) {
+    assert_die_if(uevent == NULL, "uevent is NULL\n");
+
+    ssize_t sent;
+
+    if (peer_socket < 0) {
+        LOGE("Injector is not initialized\n");
+        return -1;
+    }
+
+    do {
+        sent = send(peer_socket, uevent, size, 0);
+    } while (sent < 0 && errno == EINTR);
+
+    if (sent < 0) {
+        LOGE("Failed to inject uevent: %s\n", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+static int append(char* buffer, int* length, const char* param) {
+    int size = strlen(param) + 1;
+
+    if (*length + size > UEVENT_MAX_SIZE) {
+        LOGE("uevent larger than %d bytes\n", UEVENT_MAX_SIZE);
+        return -1;
+    }
+
+    memcpy(buffer + *length, param, size);
+    *length += size;
+
+    return 0;
+}
+
+static int has_key(const char* param, const char* key) {
+    int length = strlen(key);
+
+    return !strncmp(param, key, length) && param[length] == '=';
+}
+
+/*
+ * Lay the event out as the kernel does, ACTION, DEVPATH and SUBSYSTEM
+ * first: the listener's socket filter looks for SUBSYSTEM there
+ */
+static int build_event(char* buffer, const char* action, const char* devpath,
+        const char* subsystem, const char** params, int count, int* seqnum) {
+    char line[FIXTURE_LINE_MAX];
+    int length;
+    int has_seqnum = 0;
+    int i;
+
+    length = snprintf(buffer, UEVENT_MAX_SIZE, "%s@%s", action, devpath) + 1;
+    if (length > UEVENT_MAX_SIZE)
+        return -1;
+
+    snprintf(line, sizeof(line), "ACTION=%s", action);
+    if (append(buffer, &length, line) < 0)
+        return -1;
+
+    snprintf(line, sizeof(line), "DEVPATH=%s", devpath);
+    if (append(buffer, &length, line) < 0)
+        return -1;
+
+    snprintf(line, sizeof(line), "SUBSYSTEM=%s", subsystem);
+    if (append(buffer, &length, line) < 0)
+        return -1;
+
+    for (i = 0; i < count; i++) {
+        if (has_key(params[i], "ACTION") || has_key(params[i], "DEVPATH")
+                || has_key(params[i], "SUBSYSTEM"))
+            continue;
+
+        if (has_key(params[i], "SEQNUM")) {
+            has_seqnum = 1;
+            *seqnum = strtol(params[i] + 7, NULL, 10);
+        }
+
+        if (append(buffer, &length, params[i]) < 0)
+            return -1;
+    }
+
+    if (!has_seqnum) {
+        *seqnum = __atomic_fetch_add(&next_seqnum, 1, __ATOMIC_RELAXED);
+
+        snprintf(line, sizeof(line), "SEQNUM=%d", *seqnum);
+        if (append(buffer, &length, line) < 0)
+            return -1;
+    }
+
+    return length;
+}
+
+static int inject_event(const char* action, const char* devpath,
+        const char* subsystem, const char** params) {
+    assert_die_if(action == NULL, "action is NULL\n");
+    assert_die_if(devpath == NULL, "devpath is NULL\n");
+    assert_die_if(subsystem == NULL, "subsystem is NULL\n");
+
+    char buffer[UEVENT_MAX_SIZE];
+    int count = 0;
+    int seqnum;
+    int length;
+
+    while (params && params[count])
+        count++;
+
+    length = build_event(buffer, action, devpath, subsystem, params, count,
+            &seqnum);
+    if (length < 0)
+        return -1;
+
+    if (inject(buffer, length) < 0)
+        return -1;
+
+    return seqnum;
+}
+
+static const char* find_value(char** params, int count, const char* key) {
+    int i;
+
+    for (i = 0; i < count; i++)
+        if (has_key(params[i], key))
+            return params[i] + strlen(key) + 1;
+
+    return NULL;
+}
+
+/*
+ * Sleep until event @index of a replay that began at @start is due
+ */
+static void pace(const struct timespec* start, uint32_t index, int rate) {
+    struct timespec due;
+    uint64_t offset_ns;
+
+    if (rate <= 0)
+        return;
+
+    offset_ns = (uint64_t) index * 1000000000 / rate;
+
+    due.tv_sec = start->tv_sec + (start->tv_nsec + offset_ns) / 1000000000;
+    due.tv_nsec = (start->tv_nsec + offset_ns) % 1000000000;
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL)
+            == EINTR)
+        continue;
+}
+
+static int flush_fixture(char** params, int count, const struct timespec* start,
+        uint32_t index, int rate) {
+    char buffer[UEVENT_MAX_SIZE];
+    const char* action;
+    const char* devpath;
+    const char* subsystem;
+    int seqnum;
+    int length;
+
+    action = find_value(params, count, "ACTION");
+    devpath = find_value(params, count, "DEVPATH");
+    subsystem = find_value(params, count, "SUBSYSTEM");
+
+    if (!action || !devpath || !subsystem) {
+        LOGW("Skip fixture event without ACTION, DEVPATH or SUBSYSTEM\n");
+        return 0;
+    }
+
+    length = build_event(buffer, action, devpath, subsystem,
+            (const char**) params, count, &seqnum);
+    if (length < 0)
+        return -1;
+
+    pace(start, index, rate);
+
+    if (inject(buffer, length) < 0)
+        return -1;
+
+    return 1;
+}
+
+static int inject_fixture(const char* path, int rate) {
+    assert_die_if(path == NULL, "path is NULL\n");
+
+    char* params[NL_PARAMS_MAX];
+    char line[FIXTURE_LINE_MAX];
+    struct timespec start;
+    uint32_t injected = 0;
+    int count = 0;
+    int error = 0;
+    int ret;
+    int i;
+    FILE* fp;
+
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        LOGE("Failed to open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (;;) {
+        char* eol;
+        int end = fgets(line, sizeof(line), fp) == NULL;
+
+        if (!end) {
+            eol = strpbrk(line, "\r\n");
+            if (eol)
+                *eol = '\0';
+        }
+
+        if (end || line[0] == '\0') {
+            if (count) {
+                ret = flush_fixture(params, count, &start, injected, rate);
+                if (ret < 0)
+                    error = -1;
+                else
+                    injected += ret;
+
+                for (i = 0; i < count; i++)
+                    free(params[i]);
+                count = 0;
+            }
+
+            if (end || error)
+                break;
+
+            continue;
+        }
+
+        if (strchr(line, '=') == NULL || count == NL_PARAMS_MAX)
+            continue;
+
+        params[count] = strdup(line);
+        if (params[count])
+            count++;
+    }
+
+    for (i = 0; i < count; i++)
+        free(params[i]);
+
+    fclose(fp);
+
+    if (error)
+        return -1;
+
+    LOGI("Injected %u uevents from %s\n", injected, path);
+
+    return injected;
+}
+
+static int init(void) {
+    int error = 0;
+
+    pthread_mutex_lock(&init_lock);
+
+    if (init_count == 0) {
+        netlink_manager = get_netlink_manager();
+
+        error = netlink_manager->init_local(&peer_socket);
+        if (error < 0) {
+            LOGE("Failed to init netlink manager on a socketpair\n");
+            goto out;
+        }
+    }
+
+    init_count++;
+
+out:
+    pthread_mutex_unlock(&init_lock);
+
+    return error;
+}
+
+static int deinit(void) {
+    pthread_mutex_lock(&init_lock);
+
+    if (init_count && --init_count == 0) {
+        netlink_manager->deinit();
+
+        close(peer_socket);
+        peer_socket = -1;
+    }
+
+    pthread_mutex_unlock(&init_lock);
+
+    return 0;
+}
+
+static struct uevent_injector this = {
+        .init = init,
+        .deinit = deinit,
+        .inject = inject,
+        .inject_event = inject_event,
+        .inject_fixture = inject_fixture,
+};
+
+struct uevent_injector* get_uevent_injector(void) {
+    return &this;
+}
@@ -0,0 +1,740 @@
+/*
+ *  Copyright (C) 2017, Zhang YanMing <yanmin.zhang@ingenic.com, jamincheung@126.com>
+ *
+ *  Ingenic Linux plarform SDK project
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include <types.h>
+#include <utils/log.h>
+#include <utils/assert.h>
+#include <utils/common.h>
+#include <utils/list.h>
+#include <pmem/pmem_manager.h>
+
+#define LOG_TAG "pmem_manager"
+
+#define IMEM_PROC_NAME          "/proc/jz/mem/imem"
+#define IMEM_RELEASE_ALL        0xff
+#define DEV_MEM_NAME            "/dev/mem"
+
+/*
+ * Plain backend: 4MB pool by default, physical addresses are faked
+ * from a base aligned to the largest pool so buddy alignment holds
+ */
+#define PLAIN_DEFAULT_ORDER     10
+#define PLAIN_PHYS_BASE         0x10000000
+
+#define SLAB_MIN_SHIFT          5
+#define SLAB_MAX_SHIFT          (PMEM_PAGE_SHIFT - 1)
+#define SLAB_CLASSES            (SLAB_MAX_SHIFT - SLAB_MIN_SHIFT + 1)
+#define SLAB_NONE               0xffff
+
+enum page_state {
+    PAGE_TAIL = 0,
+    PAGE_FREE,
+    PAGE_USED,
+    PAGE_SLAB,
+};
+
+/*
+ * One descriptor per pool page, only the head page of a buddy block
+ * carries state and order, the rest stay PAGE_TAIL
+ */
+struct pmem_page {
+    struct list_head node;
+    uint8_t state;
+    uint8_t order;
+    uint8_t slab_class;
+    uint16_t inuse;
+    uint16_t free_object;
+};
+
+struct pmem_backend_ops {
+    const char* name;
+    int (*open)(uint32_t order);
+    void (*close)(void);
+};
+
+static uint32_t init_count;
+static pthread_mutex_t init_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const struct pmem_backend_ops* backend;
+static uint8_t* base_vaddr;
+static uint32_t base_paddr;
+static uint32_t base_align;             /* of both base addresses */
+static uint32_t max_order;
+static uint32_t nr_pages;
+static struct pmem_page* pages;
+static struct list_head free_area[PMEM_MAX_ORDER + 1];
+static uint32_t nr_free[PMEM_MAX_ORDER + 1];
+static struct list_head slab_partial[SLAB_CLASSES];
+static struct pmem_stat stats;
+static int mem_fd = -1;
+
+static uint32_t size_to_order(uint32_t size) {
+    uint32_t order = 0;
+
+    while (order < 31 && ((uint32_t) PMEM_PAGE_SIZE << order) < size)
+        order++;
+
+    return order;
+}
+
+static uint32_t roundup_pow_of_two(uint32_t value) {
+    uint32_t pow = 1;
+
+    while (pow < value)
+        pow <<= 1;
+
+    return pow;
+}
+
+static inline uint8_t* page_to_virt(uint32_t pfn) {
+    return base_vaddr + ((uintptr_t) pfn << PMEM_PAGE_SHIFT);
+}
+
+static inline int virt_in_pool(const void* addr) {
+    return (const uint8_t*) addr >= base_vaddr
+            && (const uint8_t*) addr < base_vaddr
+                    + ((uintptr_t) nr_pages << PMEM_PAGE_SHIFT);
+}
+
+/*
+ * Backend: imem
+ */
+static int imem_write(uint32_t value) {
+    char buf[16];
+    int fd, len;
+
+    fd = open(IMEM_PROC_NAME, O_WRONLY);
+    if (fd < 0) {
+        LOGE("Failed to open %s: %s\n", IMEM_PROC_NAME, strerror(errno));
+        return -1;
+    }
+
+    len = snprintf(buf, sizeof(buf), "%x\n", value);
+    if (write(fd, buf, len) != len) {
+        LOGE("Failed to write %s: %s\n", IMEM_PROC_NAME, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    close(fd);
+
+    return 0;
+}
+
+static uint32_t imem_read_paddr(void) {
+    uint32_t paddr = 0;
+    int fd;
+
+    fd = open(IMEM_PROC_NAME, O_RDONLY);
+    if (fd < 0)
+        return 0;
+
+    if (read(fd, &paddr, sizeof(paddr)) != sizeof(paddr))
+        paddr = 0;
+
+    close(fd);
+
+    return paddr;
+}
+
+/*
+ * Map @size bytes of /dev/mem at a virtual address aligned to @size:
+ * reserve twice that and map over the aligned half
+ */
+static void* mmap_aligned(uint32_t size, uint32_t paddr) {
+    uint8_t* reserve;
+    uint8_t* vaddr;
+    uint32_t slack;
+    int error;
+
+    reserve = mmap(NULL, size * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS,
+            -1, 0);
+    if (reserve == MAP_FAILED)
+        return MAP_FAILED;
+
+    vaddr = (uint8_t*) (((uintptr_t) reserve + size - 1)
+            & ~((uintptr_t) size - 1));
+
+    if (mmap(vaddr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+            mem_fd, paddr) == MAP_FAILED) {
+        error = errno;
+        munmap(reserve, size * 2);
+        errno = error;
+        return MAP_FAILED;
+    }
+
+    slack = vaddr - reserve;
+    if (slack)
+        munmap(reserve, slack);
+    munmap(vaddr + size, size - slack);
+
+    return vaddr;
+}
+
+static int imem_open(uint32_t order) {
+    uint32_t paddr = 0;
+    uint32_t size;
+    void* vaddr;
+
+    if (order > PMEM_MAX_ORDER)
+        order = PMEM_MAX_ORDER;
+
+    if (imem_write(IMEM_RELEASE_ALL) < 0)
+        return -1;
+
+    mem_fd = open(DEV_MEM_NAME, O_RDWR);
+    if (mem_fd < 0) {
+        LOGE("Failed to open %s: %s\n", DEV_MEM_NAME, strerror(errno));
+        return -1;
+    }
+
+    /*
+     * Ask for 2^order pages, halve the request until the reserved
+     * region can satisfy it
+     */
+    for (;;) {
+        if (imem_write(order) < 0)
+            goto error;
+
+        paddr = imem_read_paddr();
+        if (paddr != 0 || order <= PMEM_MIN_ORDER)
+            break;
+
+        order--;
+    }
+
+    if (paddr == 0) {
+        LOGE("Failed to get reserved memory\n");
+        goto error;
+    }
+
+    size = PMEM_PAGE_SIZE << order;
+    vaddr = mmap_aligned(size, paddr);
+    if (vaddr == MAP_FAILED) {
+        LOGE("Failed to mmap %s: %s\n", DEV_MEM_NAME, strerror(errno));
+        imem_write(IMEM_RELEASE_ALL);
+        goto error;
+    }
+
+    /*
+     * Touch every page so the TLB entries exist before the first
+     * frame is written by hardware
+     */
+    for (uint32_t i = 0; i < size; i += PMEM_PAGE_SIZE)
+        *(volatile uint32_t*) ((uint8_t*) vaddr + i) = 0;
+
+    base_vaddr = vaddr;
+    base_paddr = paddr;
+    max_order = order;
+
+    return 0;
+
+error:
+    close(mem_fd);
+    mem_fd = -1;
+
+    return -1;
+}
+
+static void imem_close(void) {
+    munmap(base_vaddr, PMEM_PAGE_SIZE << max_order);
+    imem_write(IMEM_RELEASE_ALL);
+
+    close(mem_fd);
+    mem_fd = -1;
+}
+
+/*
+ * Backend: plain
+ */
+static int plain_open(uint32_t order) {
+    void* vaddr;
+
+    if (order > PMEM_MAX_ORDER)
+        order = PMEM_MAX_ORDER;
+
+    if (posix_memalign(&vaddr, PMEM_PAGE_SIZE << order,
+            PMEM_PAGE_SIZE << order)) {
+        LOGE("Failed to allocate memory\n");
+        return -1;
+    }
+
+    memset(vaddr, 0, PMEM_PAGE_SIZE << order);
+
+    base_vaddr = vaddr;
+    base_paddr = PLAIN_PHYS_BASE;
+    max_order = order;
+
+    return 0;
+}
+
+static void plain_close(void) {
+    free(base_vaddr);
+}
+
+static const struct pmem_backend_ops backends[] = {
+    [PMEM_BACKEND_IMEM] = {
+        .name = "imem",
+        .open = imem_open,
+        .close = imem_close,
+    },
+    [PMEM_BACKEND_PLAIN] = {
+        .name = "plain",
+        .open = plain_open,
+        .close = plain_close,
+    },
+};
+
+/*
+ * Buddy
+ */
+static void buddy_add_free(uint32_t pfn, uint32_t order) {
+    pages[pfn].state = PAGE_FREE;
+    pages[pfn].order = order;
+    list_add(&pages[pfn].node, &free_area[order]);
+    nr_free[order]++;
+}
+
+static void buddy_del_free(uint32_t pfn) {
+    list_del(&pages[pfn].node);
+    nr_free[pages[pfn].order]--;
+    pages[pfn].state = PAGE_TAIL;
+}
+
+static int buddy_alloc(uint32_t order) {
+    struct pmem_page* page;
+    uint32_t pfn;
+    uint32_t current;
+
+    for (current = order; current <= max_order; current++)
+        if (!list_empty(&free_area[current]))
+            break;
+
+    if (current > max_order)
+        return -1;
+
+    page = list_first_entry(&free_area[current], struct pmem_page, node);
+    pfn = page - pages;
+    buddy_del_free(pfn);
+
+    /*
+     * Split, upper halves go back to the free lists
+     */
+    while (current > order) {
+        current--;
+        buddy_add_free(pfn + (1 << current), current);
+    }
+
+    pages[pfn].state = PAGE_USED;
+    pages[pfn].order = order;
+
+    return pfn;
+}
+
+static void buddy_free(uint32_t pfn, uint32_t order) {
+    pages[pfn].state = PAGE_TAIL;
+
+    while (order < max_order) {
+        uint32_t buddy = pfn ^ (1 << order);
+
+        if (pages[buddy].state != PAGE_FREE || pages[buddy].order != order)
+            break;
+
+        buddy_del_free(buddy);
+        pfn = MIN(pfn, buddy);
+        order++;
+    }
+
+    buddy_add_free(pfn, order);
+}
+
+/*
+ * Slab, one page per slab, free objects are chained through their
+ * first two bytes
+ */
+static inline uint32_t slab_object_size(uint32_t class) {
+    return 1 << (class + SLAB_MIN_SHIFT);
+}
+
+static int slab_grow(uint32_t class) {
+    uint32_t object_size = slab_object_size(class);
+    uint32_t count = PMEM_PAGE_SIZE / object_size;
+    struct pmem_page* page;
+    uint8_t* vaddr;
+    int pfn;
+
+    pfn = buddy_alloc(0);
+    if (pfn < 0)
+        return -1;
+
+    page = &pages[pfn];
+    page->state = PAGE_SLAB;
+    page->slab_class = class;
+    page->inuse = 0;
+    page->free_object = 0;
+
+    vaddr = page_to_virt(pfn);
+    for (uint32_t i = 0; i < count; i++)
+        *(uint16_t*) (vaddr + i * object_size) =
+                i + 1 < count ? i + 1 : SLAB_NONE;
+
+    list_add(&page->node, &slab_partial[class]);
+    stats.slab_pages++;
+
+    return 0;
+}
+
+static void* slab_alloc(uint32_t class) {
+    struct pmem_page* page;
+    uint8_t* object;
+
+    if (list_empty(&slab_partial[class]) && slab_grow(class) < 0)
+        return NULL;
+
+    page = list_first_entry(&slab_partial[class], struct pmem_page, node);
+
+    object = page_to_virt(page - pages)
+            + page->free_object * slab_object_size(class);
+    page->free_object = *(uint16_t*) object;
+    page->inuse++;
+
+    if (page->free_object == SLAB_NONE)
+        list_del(&page->node);
+
+    return object;
+}
+
+static int slab_free(uint32_t pfn, uint8_t* object) {
+    struct pmem_page* page = &pages[pfn];
+    uint32_t object_size = slab_object_size(page->slab_class);
+    uint32_t offset = object - page_to_virt(pfn);
+
+    if (offset % object_size)
+        return -1;
+
+    if (page->free_object == SLAB_NONE)
+        list_add(&page->node, &slab_partial[page->slab_class]);
+
+    *(uint16_t*) object = page->free_object;
+    page->free_object = offset / object_size;
+    page->inuse--;
+
+    if (page->inuse == 0) {
+        list_del(&page->node);
+        buddy_free(pfn, 0);
+        stats.slab_pages--;
+    }
+
+    return 0;
+}
+
+/*
+ * Pool
+ */
+static void pool_reset(void) {
+    for (int i = 0; i <= PMEM_MAX_ORDER; i++) {
+        INIT_LIST_HEAD(&free_area[i]);
+        nr_free[i] = 0;
+    }
+
+    for (int i = 0; i < SLAB_CLASSES; i++)
+        INIT_LIST_HEAD(&slab_partial[i]);
+
+    memset(&stats, 0, sizeof(stats));
+}
+
+static void* alloc(uint32_t size, uint32_t align) {
+    uint32_t object_size;
+    uint32_t order;
+    void* addr = NULL;
+    int pfn;
+
+    assert_die_if(size == 0, "size is zero\n");
+
+    align = roundup_pow_of_two(align ? align : 1);
+
+    pthread_mutex_lock(&pool_lock);
+
+    if (pages == NULL) {
+        LOGE("pmem manager not init\n");
+        goto out;
+    }
+
+    if (align > base_align) {
+        LOGE("Align %u is beyond the pool's %u\n", align, base_align);
+        stats.failed_count++;
+        goto out;
+    }
+
+    object_size = MAX(roundup_pow_of_two(size), align);
+    if (object_size <= (1 << SLAB_MAX_SHIFT)) {
+        object_size = MAX(object_size, 1 << SLAB_MIN_SHIFT);
+
+        addr = slab_alloc(__builtin_ctz(object_size) - SLAB_MIN_SHIFT);
+        if (addr)
+            stats.used_size += object_size;
+
+    } else {
+        order = MAX(size_to_order(size), size_to_order(align));
+
+        if (order <= max_order) {
+            pfn = buddy_alloc(order);
+            if (pfn >= 0) {
+                addr = page_to_virt(pfn);
+                stats.used_size += PMEM_PAGE_SIZE << order;
+            }
+        }
+    }
+
+    if (addr) {
+        stats.alloc_count++;
+        stats.peak_used_size = MAX(stats.peak_used_size, stats.used_size);
+    } else {
+        stats.failed_count++;
+        LOGE("Failed to alloc %u bytes, align %u\n", size, align);
+    }
+
+out:
+    pthread_mutex_unlock(&pool_lock);
+
+    return addr;
+}
+
+static void pmem_free(void* addr) {
+    uint32_t pfn;
+    uint32_t size;
+
+    if (addr == NULL)
+        return;
+
+    pthread_mutex_lock(&pool_lock);
+
+    if (pages == NULL || !virt_in_pool(addr)) {
+        LOGE("Invalid address %p\n", addr);
+        goto out;
+    }
+
+    pfn = ((uint8_t*) addr - base_vaddr) >> PMEM_PAGE_SHIFT;
+
+    switch (pages[pfn].state) {
+    case PAGE_SLAB:
+        size = slab_object_size(pages[pfn].slab_class);
+        if (slab_free(pfn, addr) < 0)
+            goto invalid;
+        break;
+
+    case PAGE_USED:
+        if (addr != page_to_virt(pfn))
+            goto invalid;
+        size = PMEM_PAGE_SIZE << pages[pfn].order;
+        buddy_free(pfn, pages[pfn].order);
+        break;
+
+    default:
+        goto invalid;
+    }
+
+    stats.used_size -= size;
+    stats.free_count++;
+
+    goto out;
+
+invalid:
+    LOGE("Invalid or double free %p\n", addr);
+
+out:
+    pthread_mutex_unlock(&pool_lock);
+}
+
+static uint32_t virt_to_phys(void* addr) {
+    if (pages == NULL || !virt_in_pool(addr)) {
+        LOGE("vaddr %p get phy addr failed\n", addr);
+        return 0;
+    }
+
+    return base_paddr + ((uint8_t*) addr - base_vaddr);
+}
+
+static void* phys_to_virt(uint32_t paddr) {
+    if (pages == NULL || paddr < base_paddr
+            || paddr - base_paddr >= nr_pages * PMEM_PAGE_SIZE)
+        return NULL;
+
+    return base_vaddr + (paddr - base_paddr);
+}
+
+static void get_stat(struct pmem_stat* stat) {
+    assert_die_if(stat == NULL, "stat is NULL\n");
+
+    pthread_mutex_lock(&pool_lock);
+
+    *stat = stats;
+    stat->total_size = nr_pages * PMEM_PAGE_SIZE;
+    stat->largest_free_size = 0;
+
+    for (int i = 0; i <= PMEM_MAX_ORDER; i++) {
+        stat->free_blocks[i] = nr_free[i];
+        if (nr_free[i])
+            stat->largest_free_size = PMEM_PAGE_SIZE << i;
+    }
+
+    pthread_mutex_unlock(&pool_lock);
+}
+
+static void dump(void) {
+    struct pmem_stat stat;
+
+    get_stat(&stat);
+
+    LOGI("========================================\n");
+    LOGI("Backend:      %s\n", backend ? backend->name : "none");
+    LOGI("Total:        %u\n", stat.total_size);
+    LOGI("Used:         %u\n", stat.used_size);
+    LOGI("Peak used:    %u\n", stat.peak_used_size);
+    LOGI("Largest free: %u\n", stat.largest_free_size);
+    LOGI("Alloc/free:   %u/%u\n", stat.alloc_count, stat.free_count);
+    LOGI("Failed:       %u\n", stat.failed_count);
+    LOGI("Slab pages:   %u\n", stat.slab_pages);
+    for (int i = 0; i <= PMEM_MAX_ORDER; i++)
+        if (stat.free_blocks[i])
+            LOGI("Order %2d:     %u free\n", i, stat.free_blocks[i]);
+    LOGI("========================================\n");
+}
+
+static int init(enum pmem_backend type, uint32_t size) {
+    uint32_t order;
+
+    assert_die_if(type > PMEM_BACKEND_PLAIN, "Invalid backend\n");
+
+    pthread_mutex_lock(&init_lock);
+
+    if (init_count++ == 0) {
+        if (size)
+            order = size_to_order(size);
+        else
+            order = type == PMEM_BACKEND_PLAIN ? PLAIN_DEFAULT_ORDER
+                    : PMEM_MAX_ORDER;
+
+        if (order > PMEM_MAX_ORDER) {
+            LOGE("Pool size %u is too large\n", size);
+            goto error;
+        }
+
+        backend = &backends[type];
+        if (backend->open(order) < 0) {
+            LOGE("Failed to open %s backend\n", backend->name);
+            backend = NULL;
+            goto error;
+        }
+
+        nr_pages = 1 << max_order;
+
+        /*
+         * The virtual base is aligned to the pool, the imem physical
+         * base may not be
+         */
+        base_align = nr_pages * PMEM_PAGE_SIZE;
+        while (((uintptr_t) base_vaddr | base_paddr) & (base_align - 1))
+            base_align >>= 1;
+
+        /*
+         * Blocks aligned to their size inside a pool whose virtual base
+         * is aligned to it never cross PMEM_BOUNDARY_SIZE
+         */
+        assert_die_if((uintptr_t) base_vaddr & (MIN(nr_pages * PMEM_PAGE_SIZE,
+                PMEM_BOUNDARY_SIZE) - 1), "Pool base %p is misaligned\n",
+                base_vaddr);
+        pages = calloc(nr_pages, sizeof(struct pmem_page));
+        if (pages == NULL) {
+            LOGE("Failed to allocate memory\n");
+            backend->close();
+            backend = NULL;
+            goto error;
+        }
+
+        pthread_mutex_lock(&pool_lock);
+        pool_reset();
+        buddy_add_free(0, max_order);
+        pthread_mutex_unlock(&pool_lock);
+
+        LOGD("%s pool: vaddr=%p, paddr=0x%x, size=0x%x, align=0x%x\n",
+                backend->name, base_vaddr, base_paddr,
+                nr_pages * PMEM_PAGE_SIZE, base_align);
+    }
+
+    pthread_mutex_unlock(&init_lock);
+
+    return 0;
+
+error:
+    init_count--;
+    pthread_mutex_unlock(&init_lock);
+
+    return -1;
+}
+
+static int deinit(void) {
+    pthread_mutex_lock(&init_lock);
+
+    if (init_count && --init_count == 0) {
+        pthread_mutex_lock(&pool_lock);
+
+        if (stats.used_size)
+            LOGW("%u bytes still in use\n", stats.used_size);
+
+        free(pages);
+        pages = NULL;
+        nr_pages = 0;
+
+        backend->close();
+        backend = NULL;
+        base_vaddr = NULL;
+        base_paddr = 0;
+        base_align = 0;
+
+        pthread_mutex_unlock(&pool_lock);
+    }
+
+    pthread_mutex_unlock(&init_lock);
+
+    return 0;
+}
+
+static struct pmem_manager this = {
+    .init = init,
+    .deinit = deinit,
+    .alloc = alloc,
+    .free = pmem_free,
+    .virt_to_phys = virt_to_phys,
+    .phys_to_virt = phys_to_virt,
+    .get_stat = get_stat,
+    .dump = dump,
+};
+
+struct pmem_manager* get_pmem_manager(void) {
+    return &this;
+}
@@ -0,0 +1,651 @@
+/*
+ *  Copyright (C) 2017, Zhang YanMing <yanmin.zhang@ingenic.com, jamincheung@126.com>
+ *
+ *  Ingenic Linux plarform SDK project
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+
+#include <types.h>
+#include <utils/log.h>
+#include <utils/assert.h>
+#include <utils/common.h>
+#include <utils/list.h>
+#include <thread/thread.h>
+#include <lib/png/png.h>
+#include <zlib.h>
+#include <snapshot/snapshot_manager.h>
+
+#define LOG_TAG "snapshot_manager"
+
+#define IO_ALIGNMENT            4096
+#define IO_CHUNK_SIZE           (128 * 1024)
+#define BMP_HEADER_SIZE         54
+
+struct snapshot_job {
+    char path[PATH_MAX];
+    uint8_t* frame;
+    uint32_t frame_size;
+    uint32_t width;
+    uint32_t height;
+    enum snapshot_pixel_format pixel_format;
+    struct snapshot_param param;
+    snapshot_complete_t callback;
+    void* callback_param;
+    struct list_head node;
+};
+
+struct aligned_writer {
+    int fd;
+    int direct;
+    uint8_t* buf;
+    uint32_t pos;
+    int error;
+};
+
+static uint32_t init_count;
+static pthread_mutex_t init_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t idle_cond = PTHREAD_COND_INITIALIZER;
+static LIST_HEAD(free_list);
+static LIST_HEAD(pending_list);
+static struct snapshot_job* jobs;
+static int job_count;
+static int pending_count;
+static int quit;
+static struct thread* thread;
+static struct snapshot_stat stats;
+
+static const struct snapshot_param default_param = {
+    .format = SNAPSHOT_FORMAT_BMP,
+    .compress_level = -1,
+    .filter = SNAPSHOT_FILTER_DEFAULT,
+    .strategy = SNAPSHOT_STRATEGY_DEFAULT,
+};
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static inline uint8_t clamp_u8(int v) {
+    if (v < 0)
+        return 0;
+    if (v > 255)
+        return 255;
+    return v;
+}
+
+/*
+ * Same fixed point coefficients as utils/yuv2bmp.c
+ */
+static void yuyv_row_to_rgb(const uint8_t* yuyv, uint8_t* out,
+        uint32_t width, int bgr) {
+    int ri = bgr ? 2 : 0;
+    int bi = bgr ? 0 : 2;
+
+    for (uint32_t x = 0; x + 1 < width; x += 2) {
+        int y0 = yuyv[0];
+        int u = yuyv[1] - 128;
+        int y1 = yuyv[2];
+        int v = yuyv[3] - 128;
+
+        int dr = (351 * v) >> 8;
+        int dg = ((179 * v) >> 8) + ((86 * u) >> 8);
+        int db = (444 * u) >> 8;
+
+        out[ri] = clamp_u8(y0 + dr);
+        out[1] = clamp_u8(y0 - dg);
+        out[bi] = clamp_u8(y0 + db);
+        out[ri + 3] = clamp_u8(y1 + dr);
+        out[4] = clamp_u8(y1 - dg);
+        out[bi + 3] = clamp_u8(y1 + db);
+
+        yuyv += 4;
+        out += 6;
+    }
+}
+
+static void bgr_row_to_rgb(const uint8_t* bgr, uint8_t* out, uint32_t width) {
+    for (uint32_t x = 0; x < width; x++) {
+        out[0] = bgr[2];
+        out[1] = bgr[1];
+        out[2] = bgr[0];
+        bgr += 3;
+        out += 3;
+    }
+}
+
+static void convert_row(struct snapshot_job* job, uint32_t y, uint8_t* out,
+        int bgr) {
+    if (job->pixel_format == SNAPSHOT_PIXEL_YUYV) {
+        yuyv_row_to_rgb(job->frame + y * job->width * 2, out, job->width, bgr);
+
+    } else {
+        const uint8_t* in = job->frame + y * job->width * 3;
+
+        if (bgr)
+            memcpy(out, in, job->width * 3);
+        else
+            bgr_row_to_rgb(in, out, job->width);
+    }
+}
+
+static int writer_open(struct aligned_writer* w, const char* path) {
+    memset(w, 0, sizeof(*w));
+
+    if (posix_memalign((void **) &w->buf, IO_ALIGNMENT, IO_CHUNK_SIZE)) {
+        LOGE("Failed to allocate memory\n");
+        return -1;
+    }
+
+    /*
+     * Try O_DIRECT first so large stills bypass the page cache and
+     * never trigger writeback stalls, not every filesystem allows it
+     */
+    w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    if (w->fd >= 0) {
+        w->direct = 1;
+
+    } else {
+        w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (w->fd < 0) {
+            LOGE("Failed to open %s: %s\n", path, strerror(errno));
+            free(w->buf);
+            w->buf = NULL;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int writer_flush(struct aligned_writer* w) {
+    uint32_t offset = 0;
+
+    if (w->error)
+        return -1;
+
+    /*
+     * O_DIRECT needs block sized transfers, the tail goes buffered
+     */
+    if (w->direct && (w->pos % IO_ALIGNMENT)) {
+        fcntl(w->fd, F_SETFL, fcntl(w->fd, F_GETFL) & ~O_DIRECT);
+        w->direct = 0;
+    }
+
+    while (offset < w->pos) {
+        ssize_t ret = write(w->fd, w->buf + offset, w->pos - offset);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+
+            LOGE("Failed to write: %s\n", strerror(errno));
+            w->error = -1;
+            return -1;
+        }
+
+        offset += ret;
+    }
+
+    w->pos = 0;
+
+    return 0;
+}
+
+static int writer_write(struct aligned_writer* w, const uint8_t* data,
+        uint32_t size) {
+    while (size) {
+        uint32_t count = MIN(size, IO_CHUNK_SIZE - w->pos);
+
+        memcpy(w->buf + w->pos, data, count);
+        w->pos += count;
+        data += count;
+        size -= count;
+
+        if (w->pos == IO_CHUNK_SIZE && writer_flush(w) < 0)
+            return -1;
+    }
+
+    return w->error;
+}
+
+static int writer_close(struct aligned_writer* w) {
+    int error = 0;
+
+    if (w->pos)
+        error = writer_flush(w);
+
+    error |= w->error;
+
+    if (close(w->fd) < 0)
+        error = -1;
+
+    free(w->buf);
+    w->buf = NULL;
+    w->fd = -1;
+
+    return error;
+}
+
+static void put_le16(uint8_t* p, uint16_t v) {
+    p[0] = v & 0xff;
+    p[1] = v >> 8;
+}
+
+static void put_le32(uint8_t* p, uint32_t v) {
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+    p[2] = (v >> 16) & 0xff;
+    p[3] = v >> 24;
+}
+
+static int encode_bmp(struct snapshot_job* job, struct aligned_writer* w) {
+    uint8_t header[BMP_HEADER_SIZE];
+    uint32_t line_size = (job->width * 3 + 3) & ~3;
+    uint32_t image_size = line_size * job->height;
+    uint8_t* line;
+    int error = 0;
+
+    memset(header, 0, sizeof(header));
+
+    header[0] = 'B';
+    header[1] = 'M';
+    put_le32(header + 2, BMP_HEADER_SIZE + image_size);
+    put_le32(header + 10, BMP_HEADER_SIZE);
+    put_le32(header + 14, 40);
+    put_le32(header + 18, job->width);
+    put_le32(header + 22, job->height);
+    put_le16(header + 26, 1);
+    put_le16(header + 28, 24);
+    put_le32(header + 34, image_size);
+
+    if (writer_write(w, header, sizeof(header)) < 0)
+        return -1;
+
+    line = calloc(1, line_size);
+    if (line == NULL) {
+        LOGE("Failed to allocate memory\n");
+        return -1;
+    }
+
+    /*
+     * BMP is bottom-up
+     */
+    for (int y = job->height - 1; y >= 0; y--) {
+        convert_row(job, y, line, 1);
+
+        error = writer_write(w, line, line_size);
+        if (error < 0)
+            break;
+    }
+
+    free(line);
+
+    return error;
+}
+
+static void png_write_data(png_structp png_ptr, png_bytep data,
+        png_size_t length) {
+    struct aligned_writer* w = png_get_io_ptr(png_ptr);
+
+    if (writer_write(w, data, length) < 0)
+        png_error(png_ptr, "write error");
+}
+
+static void png_flush_data(png_structp png_ptr) {
+
+}
+
+static int encode_png(struct snapshot_job* job, struct aligned_writer* w) {
+    static const int strategy_table[] = {
+        [SNAPSHOT_STRATEGY_DEFAULT] = Z_DEFAULT_STRATEGY,
+        [SNAPSHOT_STRATEGY_FILTERED] = Z_FILTERED,
+        [SNAPSHOT_STRATEGY_HUFFMAN_ONLY] = Z_HUFFMAN_ONLY,
+        [SNAPSHOT_STRATEGY_RLE] = Z_RLE,
+    };
+
+    png_structp png_ptr = NULL;
+    png_infop info_ptr = NULL;
+    uint8_t* volatile row = NULL;
+
+    png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if (png_ptr == NULL) {
+        LOGE("Failed to create png structure\n");
+        return -1;
+    }
+
+    info_ptr = png_create_info_struct(png_ptr);
+    if (info_ptr == NULL) {
+        LOGE("Failed to create png info structure\n");
+        png_destroy_write_struct(&png_ptr, NULL);
+        return -1;
+    }
+
+    if (setjmp(png_jmpbuf(png_ptr))) {
+        LOGE("Failed to encode png: %s\n", job->path);
+        png_destroy_write_struct(&png_ptr, &info_ptr);
+        free(row);
+        return -1;
+    }
+
+    row = malloc(job->width * 3);
+    if (row == NULL) {
+        LOGE("Failed to allocate memory\n");
+        png_destroy_write_struct(&png_ptr, &info_ptr);
+        return -1;
+    }
+
+    png_set_write_fn(png_ptr, w, png_write_data, png_flush_data);
+
+    if (job->param.compress_level >= 0)
+        png_set_compression_level(png_ptr, MIN(job->param.compress_level, 9));
+
+    if (job->param.strategy < ARRAY_SIZE(strategy_table))
+        png_set_compression_strategy(png_ptr,
+                strategy_table[job->param.strategy]);
+
+    if (job->param.filter)
+        png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE,
+                job->param.filter & PNG_ALL_FILTERS);
+
+    png_set_IHDR(png_ptr, info_ptr, job->width, job->height, 8,
+            PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
+            PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+
+    png_write_info(png_ptr, info_ptr);
+
+    for (uint32_t y = 0; y < job->height; y++) {
+        convert_row(job, y, row, 0);
+        png_write_row(png_ptr, row);
+    }
+
+    png_write_end(png_ptr, info_ptr);
+    png_destroy_write_struct(&png_ptr, &info_ptr);
+
+    free(row);
+
+    return 0;
+}
+
+static int encode_job(struct snapshot_job* job) {
+    struct aligned_writer writer;
+    int error;
+
+    if (writer_open(&writer, job->path) < 0)
+        return -1;
+
+    if (job->param.format == SNAPSHOT_FORMAT_PNG)
+        error = encode_png(job, &writer);
+    else
+        error = encode_bmp(job, &writer);
+
+    if (writer_close(&writer) < 0)
+        error = -1;
+
+    if (error < 0)
+        unlink(job->path);
+
+    return error;
+}
+
+static void thread_loop(struct pthread_wrapper* pthread, void* param) {
+    struct snapshot_job* job;
+    uint64_t start_us, used_us;
+    int error;
+
+    for (;;) {
+        pthread_mutex_lock(&queue_lock);
+
+        while (!quit && list_empty(&pending_list))
+            pthread_cond_wait(&queue_cond, &queue_lock);
+
+        if (quit) {
+            pthread_mutex_unlock(&queue_lock);
+            break;
+        }
+
+        job = list_first_entry(&pending_list, struct snapshot_job, node);
+        list_del(&job->node);
+
+        pthread_mutex_unlock(&queue_lock);
+
+        start_us = now_us();
+        error = encode_job(job);
+        used_us = now_us() - start_us;
+
+        LOGD("Encode %s: %s, %llu us\n", job->path, error ? "failed" : "done",
+                (unsigned long long) used_us);
+
+        if (job->callback)
+            job->callback(job->path, error, job->callback_param);
+
+        pthread_mutex_lock(&queue_lock);
+
+        if (error < 0) {
+            stats.failed++;
+
+        } else {
+            stats.encoded++;
+            stats.total_encode_us += used_us;
+            if (used_us > stats.max_encode_us)
+                stats.max_encode_us = used_us;
+        }
+
+        list_add_tail(&job->node, &free_list);
+        pending_count--;
+
+        if (!pending_count)
+            pthread_cond_broadcast(&idle_cond);
+
+        pthread_mutex_unlock(&queue_lock);
+    }
+
+    pthread_exit(NULL);
+}
+
+static int take(const char* path, const uint8_t* frame, uint32_t width,
+        uint32_t height, enum snapshot_pixel_format pixel_format,
+        const struct snapshot_param* param, snapshot_complete_t callback,
+        void* callback_param) {
+    assert_die_if(path == NULL, "path is NULL\n");
+    assert_die_if(frame == NULL, "frame is NULL\n");
+    assert_die_if(width == 0 || height == 0, "Invalid resolution\n");
+    assert_die_if(pixel_format == SNAPSHOT_PIXEL_YUYV && (width & 1),
+            "YUYV width must be even\n");
+
+    struct snapshot_job* job;
+    uint32_t size = width * height *
+            (pixel_format == SNAPSHOT_PIXEL_YUYV ? 2 : 3);
+
+    if (strlen(path) >= PATH_MAX) {
+        LOGE("Path too long: %s\n", path);
+        return -1;
+    }
+
+    pthread_mutex_lock(&queue_lock);
+
+    job = list_first_entry_or_null(&free_list, struct snapshot_job, node);
+    if (job == NULL) {
+        stats.rejected++;
+        pthread_mutex_unlock(&queue_lock);
+
+        LOGW("No free snapshot slot, drop %s\n", path);
+        return -1;
+    }
+
+    list_del(&job->node);
+
+    pthread_mutex_unlock(&queue_lock);
+
+    /*
+     * Slots keep their buffer across snapshots, only grow when the
+     * resolution changes
+     */
+    if (job->frame_size < size) {
+        uint8_t* frame_buf = realloc(job->frame, size);
+        if (frame_buf == NULL) {
+            LOGE("Failed to allocate memory\n");
+
+            pthread_mutex_lock(&queue_lock);
+            list_add(&job->node, &free_list);
+            pthread_mutex_unlock(&queue_lock);
+            return -1;
+        }
+
+        job->frame = frame_buf;
+        job->frame_size = size;
+    }
+
+    memcpy(job->frame, frame, size);
+    strcpy(job->path, path);
+    job->width = width;
+    job->height = height;
+    job->pixel_format = pixel_format;
+    job->param = param ? *param : default_param;
+    job->callback = callback;
+    job->callback_param = callback_param;
+
+    pthread_mutex_lock(&queue_lock);
+
+    list_add_tail(&job->node, &pending_list);
+    pending_count++;
+    stats.taken++;
+    pthread_cond_signal(&queue_cond);
+
+    pthread_mutex_unlock(&queue_lock);
+
+    return 0;
+}
+
+static int wait_idle(void) {
+    pthread_mutex_lock(&queue_lock);
+
+    while (pending_count)
+        pthread_cond_wait(&idle_cond, &queue_lock);
+
+    pthread_mutex_unlock(&queue_lock);
+
+    return 0;
+}
+
+static int get_pending(void) {
+    pthread_mutex_lock(&queue_lock);
+    int count = pending_count;
+    pthread_mutex_unlock(&queue_lock);
+
+    return count;
+}
+
+static void get_stat(struct snapshot_stat* s) {
+    assert_die_if(s == NULL, "stat is NULL\n");
+
+    pthread_mutex_lock(&queue_lock);
+    *s = stats;
+    pthread_mutex_unlock(&queue_lock);
+}
+
+static int init(int queue_depth) {
+    pthread_mutex_lock(&init_lock);
+
+    if (init_count++ == 0) {
+        if (queue_depth <= 0)
+            queue_depth = SNAPSHOT_DEFAULT_QUEUE_DEPTH;
+
+        jobs = calloc(queue_depth, sizeof(struct snapshot_job));
+        if (jobs == NULL) {
+            LOGE("Failed to allocate memory\n");
+            goto error;
+        }
+
+        job_count = queue_depth;
+        for (int i = 0; i < job_count; i++)
+            list_add_tail(&jobs[i].node, &free_list);
+
+        pending_count = 0;
+        quit = 0;
+        memset(&stats, 0, sizeof(stats));
+
+        thread = _new(struct thread, thread);
+        thread->runnable.run = thread_loop;
+        if (thread->start(thread, NULL) < 0) {
+            LOGE("Failed to start snapshot thread\n");
+            _delete(thread);
+            INIT_LIST_HEAD(&free_list);
+            free(jobs);
+            jobs = NULL;
+            goto error;
+        }
+    }
+
+    pthread_mutex_unlock(&init_lock);
+
+    return 0;
+
+error:
+    init_count = 0;
+    pthread_mutex_unlock(&init_lock);
+
+    return -1;
+}
+
+static int deinit(void) {
+    pthread_mutex_lock(&init_lock);
+
+    if (init_count && --init_count == 0) {
+        wait_idle();
+
+        pthread_mutex_lock(&queue_lock);
+        quit = 1;
+        pthread_cond_broadcast(&queue_cond);
+        pthread_mutex_unlock(&queue_lock);
+
+        thread->wait(thread);
+        _delete(thread);
+        thread = NULL;
+
+        for (int i = 0; i < job_count; i++)
+            free(jobs[i].frame);
+
+        INIT_LIST_HEAD(&free_list);
+        INIT_LIST_HEAD(&pending_list);
+        free(jobs);
+        jobs = NULL;
+        job_count = 0;
+    }
+
+    pthread_mutex_unlock(&init_lock);
+
+    return 0;
+}
+
+static struct snapshot_manager this = {
+    .init = init,
+    .deinit = deinit,
+    .take = take,
+    .wait_idle = wait_idle,
+    .get_pending = get_pending,
+    .get_stat = get_stat,
+};
+
+struct snapshot_manager* get_snapshot_manager(void) {
+    return &this;
+}
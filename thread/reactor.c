@@ -0,0 +1,755 @@
+/*
+ *  Copyright (C) 2017, Zhang YanMing <yanmin.zhang@ingenic.com, jamincheung@126.com>
+ *
+ *  Ingenic Linux plarform SDK project
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
+
+#include <types.h>
+#include <utils/log.h>
+#include <utils/assert.h>
+#include <utils/common.h>
+#include <thread/thread.h>
+#include <thread/reactor.h>
+
+#define LOG_TAG "reactor"
+
+#define MAX_EVENTS          32
+#define SOURCE_HASH_SIZE    64
+
+enum source_type {
+    SOURCE_FD,
+    SOURCE_TIMER,
+    SOURCE_SIGNAL,
+    SOURCE_EVENT,
+};
+
+struct loop;
+
+struct source {
+    int id;
+    int fd;
+    enum source_type type;
+    int removed;
+    union {
+        reactor_fd_handler_t fd;
+        reactor_timer_handler_t timer;
+        reactor_signal_handler_t signal;
+        reactor_event_handler_t event;
+        void* ptr;
+    } handler;
+    void* arg;
+    struct loop* loop;
+    struct source* hash_next;
+    struct source* dead_next;
+};
+
+/*
+ * Removed sources are freed by their loop before it waits again, an
+ * event already taken for them may still be in its batch
+ */
+struct loop {
+    int index;
+    int epoll_fd;
+    int wakeup_fd;
+    int quit;
+    int sources;
+    int running;
+    pthread_t tid;
+    struct source* current;
+    struct source* dead;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct thread* thread;
+
+    uint32_t wakeups;
+    uint32_t dispatched;
+    uint32_t max_dispatch_us;
+};
+
+static struct loop loops[REACTOR_MAX_LOOPS];
+static int loop_count;
+
+static struct source* source_table[SOURCE_HASH_SIZE];
+static int next_id = 1;
+static pthread_mutex_t source_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t init_count;
+static pthread_mutex_t init_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t now_us(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void us_to_timespec(uint32_t us, struct timespec* ts) {
+    ts->tv_sec = us / 1000000;
+    ts->tv_nsec = (us % 1000000) * 1000;
+}
+
+/*
+ * Called with source_lock held
+ */
+static struct source* find_source_locked(int id) {
+    struct source* source;
+
+    for (source = source_table[id % SOURCE_HASH_SIZE]; source;
+            source = source->hash_next)
+        if (source->id == id)
+            return source;
+
+    return NULL;
+}
+
+static void unlink_source_locked(struct source* source) {
+    struct source** s;
+
+    for (s = &source_table[source->id % SOURCE_HASH_SIZE]; *s;
+            s = &(*s)->hash_next) {
+        if (*s == source) {
+            *s = source->hash_next;
+            break;
+        }
+    }
+}
+
+static void free_source(struct source* source) {
+    if (source->type != SOURCE_FD)
+        close(source->fd);
+
+    free(source);
+}
+
+static void free_dead(struct loop* loop) {
+    struct source* dead;
+    struct source* next;
+
+    pthread_mutex_lock(&loop->lock);
+    dead = loop->dead;
+    loop->dead = NULL;
+    pthread_mutex_unlock(&loop->lock);
+
+    for (; dead; dead = next) {
+        next = dead->dead_next;
+        free_source(dead);
+    }
+}
+
+static void call_handler(struct source* source, uint32_t events) {
+    struct signalfd_siginfo info;
+    uint64_t count;
+
+    switch (source->type) {
+    case SOURCE_FD:
+        source->handler.fd(source->id, source->fd, events, source->arg);
+        break;
+
+    case SOURCE_TIMER:
+        if (read(source->fd, &count, sizeof(count)) == sizeof(count))
+            source->handler.timer(source->id, count, source->arg);
+        break;
+
+    case SOURCE_SIGNAL:
+        while (read(source->fd, &info, sizeof(info)) == sizeof(info))
+            source->handler.signal(source->id, &info, source->arg);
+        break;
+
+    case SOURCE_EVENT:
+        if (read(source->fd, &count, sizeof(count)) == sizeof(count))
+            source->handler.event(source->id, count, source->arg);
+        break;
+    }
+}
+
+static void dispatch(struct loop* loop, struct source* source,
+        uint32_t events) {
+    uint32_t start;
+    uint32_t elapsed;
+
+    pthread_mutex_lock(&loop->lock);
+
+    if (source->removed) {
+        pthread_mutex_unlock(&loop->lock);
+        return;
+    }
+
+    loop->current = source;
+    pthread_mutex_unlock(&loop->lock);
+
+    start = now_us();
+    call_handler(source, events);
+    elapsed = now_us() - start;
+
+    loop->dispatched++;
+    if (elapsed > loop->max_dispatch_us)
+        loop->max_dispatch_us = elapsed;
+
+    pthread_mutex_lock(&loop->lock);
+    loop->current = NULL;
+    pthread_cond_broadcast(&loop->cond);
+    pthread_mutex_unlock(&loop->lock);
+}
+
+static void bind_cpu(struct loop* loop) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t set;
+
+    if (loop_count < 2 || cpus < 2)
+        return;
+
+    CPU_ZERO(&set);
+    CPU_SET(loop->index % cpus, &set);
+
+    if (sched_setaffinity(0, sizeof(set), &set) < 0)
+        LOGW("Failed to bind loop %d to cpu %ld: %s\n", loop->index,
+                loop->index % cpus, strerror(errno));
+}
+
+static void loop_thread(struct pthread_wrapper* pthread, void* param) {
+    struct epoll_event events[MAX_EVENTS];
+    struct loop* loop = param;
+    uint64_t value;
+    sigset_t mask;
+    int count;
+
+    /*
+     * Signals are only taken through signalfd here
+     */
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    bind_cpu(loop);
+
+    pthread_mutex_lock(&loop->lock);
+    loop->tid = pthread_self();
+    loop->running = 1;
+    pthread_mutex_unlock(&loop->lock);
+
+    while (!__atomic_load_n(&loop->quit, __ATOMIC_ACQUIRE)) {
+        free_dead(loop);
+
+        count = epoll_wait(loop->epoll_fd, events, MAX_EVENTS, -1);
+        if (count < 0) {
+            if (errno != EINTR) {
+                LOGE("Failed to wait epoll: %s\n", strerror(errno));
+                break;
+            }
+
+            continue;
+        }
+
+        loop->wakeups++;
+
+        for (int i = 0; i < count; i++) {
+            if (events[i].data.ptr == NULL) {
+                read(loop->wakeup_fd, &value, sizeof(value));
+                continue;
+            }
+
+            dispatch(loop, events[i].data.ptr, events[i].events);
+        }
+    }
+
+    pthread_mutex_lock(&loop->lock);
+    loop->running = 0;
+    pthread_mutex_unlock(&loop->lock);
+
+    free_dead(loop);
+}
+
+static struct loop* pick_loop_locked(void) {
+    struct loop* loop = &loops[0];
+
+    for (int i = 1; i < loop_count; i++)
+        if (loops[i].sources < loop->sources)
+            loop = &loops[i];
+
+    return loop;
+}
+
+static int add_source(enum source_type type, int fd, uint32_t events,
+        void* handler, void* arg) {
+    struct epoll_event event;
+    struct source* source;
+    int id;
+
+    source = calloc(1, sizeof(struct source));
+    if (source == NULL) {
+        LOGE("Failed to allocate source\n");
+        return -1;
+    }
+
+    source->fd = fd;
+    source->type = type;
+    source->handler.ptr = handler;
+    source->arg = arg;
+
+    pthread_mutex_lock(&source_lock);
+
+    if (loop_count == 0) {
+        LOGE("Reactor not init\n");
+        goto error;
+    }
+
+    do {
+        source->id = next_id;
+        next_id = next_id == INT32_MAX ? 1 : next_id + 1;
+    } while (find_source_locked(source->id));
+
+    source->loop = pick_loop_locked();
+
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.ptr = source;
+
+    if (epoll_ctl(source->loop->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        LOGE("Failed to add fd %d to epoll: %s\n", fd, strerror(errno));
+        goto error;
+    }
+
+    source->hash_next = source_table[source->id % SOURCE_HASH_SIZE];
+    source_table[source->id % SOURCE_HASH_SIZE] = source;
+    source->loop->sources++;
+    id = source->id;
+
+    pthread_mutex_unlock(&source_lock);
+
+    return id;
+
+error:
+    pthread_mutex_unlock(&source_lock);
+    free(source);
+
+    return -1;
+}
+
+static int add_fd(int fd, uint32_t events, reactor_fd_handler_t handler,
+        void* arg) {
+    assert_die_if(fd < 0, "Invalid fd\n");
+    assert_die_if(handler == NULL, "handler is NULL\n");
+
+    return add_source(SOURCE_FD, fd, events, handler, arg);
+}
+
+static int modify_fd(int id, uint32_t events) {
+    struct epoll_event event;
+    struct source* source;
+    int error = -1;
+
+    pthread_mutex_lock(&source_lock);
+
+    source = find_source_locked(id);
+    if (source == NULL || source->type != SOURCE_FD) {
+        LOGE("No fd source %d\n", id);
+        goto out;
+    }
+
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.ptr = source;
+
+    error = epoll_ctl(source->loop->epoll_fd, EPOLL_CTL_MOD, source->fd,
+            &event);
+    if (error < 0)
+        LOGE("Failed to modify fd %d: %s\n", source->fd, strerror(errno));
+
+out:
+    pthread_mutex_unlock(&source_lock);
+
+    return error;
+}
+
+static int arm_timer(int fd, uint32_t initial_us, uint32_t interval_us) {
+    struct itimerspec spec;
+
+    us_to_timespec(initial_us, &spec.it_value);
+    us_to_timespec(interval_us, &spec.it_interval);
+
+    if (timerfd_settime(fd, 0, &spec, NULL) < 0) {
+        LOGE("Failed to set timer: %s\n", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+static int add_timer(uint32_t initial_us, uint32_t interval_us,
+        reactor_timer_handler_t handler, void* arg) {
+    assert_die_if(handler == NULL, "handler is NULL\n");
+
+    int fd;
+    int id;
+
+    fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0) {
+        LOGE("Failed to create timerfd: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if (arm_timer(fd, initial_us, interval_us) < 0)
+        goto error;
+
+    id = add_source(SOURCE_TIMER, fd, EPOLLIN, handler, arg);
+    if (id < 0)
+        goto error;
+
+    return id;
+
+error:
+    close(fd);
+
+    return -1;
+}
+
+static int set_timer(int id, uint32_t initial_us, uint32_t interval_us) {
+    struct source* source;
+    int error = -1;
+
+    pthread_mutex_lock(&source_lock);
+
+    source = find_source_locked(id);
+    if (source == NULL || source->type != SOURCE_TIMER)
+        LOGE("No timer source %d\n", id);
+    else
+        error = arm_timer(source->fd, initial_us, interval_us);
+
+    pthread_mutex_unlock(&source_lock);
+
+    return error;
+}
+
+static int add_signal(int signo, reactor_signal_handler_t handler,
+        void* arg) {
+    assert_die_if(handler == NULL, "handler is NULL\n");
+
+    sigset_t mask;
+    int fd;
+    int id;
+
+    sigemptyset(&mask);
+    if (sigaddset(&mask, signo) < 0) {
+        LOGE("Invalid signal %d\n", signo);
+        return -1;
+    }
+
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd < 0) {
+        LOGE("Failed to create signalfd: %s\n", strerror(errno));
+        return -1;
+    }
+
+    id = add_source(SOURCE_SIGNAL, fd, EPOLLIN, handler, arg);
+    if (id < 0)
+        close(fd);
+
+    return id;
+}
+
+static int add_event(reactor_event_handler_t handler, void* arg) {
+    assert_die_if(handler == NULL, "handler is NULL\n");
+
+    int fd;
+    int id;
+
+    fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < 0) {
+        LOGE("Failed to create eventfd: %s\n", strerror(errno));
+        return -1;
+    }
+
+    id = add_source(SOURCE_EVENT, fd, EPOLLIN, handler, arg);
+    if (id < 0)
+        close(fd);
+
+    return id;
+}
+
+static int notify_event(int id) {
+    struct source* source;
+    uint64_t value = 1;
+    int error = -1;
+
+    pthread_mutex_lock(&source_lock);
+
+    source = find_source_locked(id);
+    if (source == NULL || source->type != SOURCE_EVENT)
+        LOGE("No event source %d\n", id);
+    else if (write(source->fd, &value, sizeof(value)) == sizeof(value))
+        error = 0;
+
+    pthread_mutex_unlock(&source_lock);
+
+    return error;
+}
+
+static int remove_source(int id) {
+    struct source* source;
+    struct loop* loop;
+
+    pthread_mutex_lock(&source_lock);
+
+    source = find_source_locked(id);
+    if (source == NULL) {
+        pthread_mutex_unlock(&source_lock);
+        LOGE("No source %d\n", id);
+        return -1;
+    }
+
+    unlink_source_locked(source);
+
+    loop = source->loop;
+    loop->sources--;
+
+    /*
+     * The caller may close its fd right after, take it off epoll
+     * before that
+     */
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, source->fd, NULL);
+
+    pthread_mutex_unlock(&source_lock);
+
+    pthread_mutex_lock(&loop->lock);
+
+    source->removed = 1;
+
+    while (loop->current == source && !pthread_equal(loop->tid, pthread_self()))
+        pthread_cond_wait(&loop->cond, &loop->lock);
+
+    if (loop->running) {
+        source->dead_next = loop->dead;
+        loop->dead = source;
+        source = NULL;
+    }
+
+    pthread_mutex_unlock(&loop->lock);
+
+    if (source)
+        free_source(source);
+
+    return 0;
+}
+
+static int get_stat(struct reactor_stat* stat) {
+    assert_die_if(stat == NULL, "stat is NULL\n");
+
+    memset(stat, 0, sizeof(*stat));
+
+    pthread_mutex_lock(&source_lock);
+
+    stat->loops = loop_count;
+
+    for (int i = 0; i < loop_count; i++) {
+        stat->sources += loops[i].sources;
+        stat->wakeups += loops[i].wakeups;
+        stat->dispatched += loops[i].dispatched;
+        if (loops[i].max_dispatch_us > stat->max_dispatch_us)
+            stat->max_dispatch_us = loops[i].max_dispatch_us;
+    }
+
+    pthread_mutex_unlock(&source_lock);
+
+    return 0;
+}
+
+static void stop_loop(struct loop* loop) {
+    uint64_t value = 1;
+
+    if (loop->thread) {
+        __atomic_store_n(&loop->quit, 1, __ATOMIC_RELEASE);
+        write(loop->wakeup_fd, &value, sizeof(value));
+
+        loop->thread->wait(loop->thread);
+        _delete(loop->thread);
+        loop->thread = NULL;
+    }
+
+    if (loop->wakeup_fd >= 0)
+        close(loop->wakeup_fd);
+
+    if (loop->epoll_fd >= 0)
+        close(loop->epoll_fd);
+
+    pthread_mutex_destroy(&loop->lock);
+    pthread_cond_destroy(&loop->cond);
+}
+
+static int start_loop(struct loop* loop, int index) {
+    struct epoll_event event;
+
+    memset(loop, 0, sizeof(*loop));
+    loop->index = index;
+    loop->wakeup_fd = -1;
+    pthread_mutex_init(&loop->lock, NULL);
+    pthread_cond_init(&loop->cond, NULL);
+
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epoll_fd < 0) {
+        LOGE("Failed to create epoll: %s\n", strerror(errno));
+        return -1;
+    }
+
+    loop->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (loop->wakeup_fd < 0) {
+        LOGE("Failed to create eventfd: %s\n", strerror(errno));
+        return -1;
+    }
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wakeup_fd,
+            &event) < 0) {
+        LOGE("Failed to add wakeup fd: %s\n", strerror(errno));
+        return -1;
+    }
+
+    loop->thread = _new(struct thread, thread);
+    loop->thread->runnable.run = loop_thread;
+
+    if (loop->thread->start(loop->thread, loop) < 0) {
+        LOGE("Failed to start loop %d\n", index);
+        _delete(loop->thread);
+        loop->thread = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+static void free_all_sources(void) {
+    struct source* source;
+
+    for (int i = 0; i < SOURCE_HASH_SIZE; i++) {
+        while ((source = source_table[i])) {
+            source_table[i] = source->hash_next;
+
+            LOGW("Source %d still added at deinit\n", source->id);
+            free_source(source);
+        }
+    }
+}
+
+static int init(int count) {
+    int i;
+
+    pthread_mutex_lock(&init_lock);
+
+    if (init_count++ == 0) {
+        if (count <= 0)
+            count = sysconf(_SC_NPROCESSORS_ONLN);
+
+        if (count < 1)
+            count = 1;
+        else if (count > REACTOR_MAX_LOOPS)
+            count = REACTOR_MAX_LOOPS;
+
+        for (i = 0; i < count; i++) {
+            if (start_loop(&loops[i], i) < 0) {
+                stop_loop(&loops[i]);
+                goto error;
+            }
+        }
+
+        pthread_mutex_lock(&source_lock);
+        loop_count = count;
+        pthread_mutex_unlock(&source_lock);
+
+        LOGI("Reactor running %d loops\n", count);
+    }
+
+    pthread_mutex_unlock(&init_lock);
+
+    return 0;
+
+error:
+    while (i--)
+        stop_loop(&loops[i]);
+
+    init_count = 0;
+    pthread_mutex_unlock(&init_lock);
+
+    return -1;
+}
+
+static int deinit(void) {
+    int count;
+
+    pthread_mutex_lock(&init_lock);
+
+    if (init_count == 0)
+        goto out;
+
+    if (--init_count == 0) {
+        pthread_mutex_lock(&source_lock);
+        count = loop_count;
+        loop_count = 0;
+        pthread_mutex_unlock(&source_lock);
+
+        for (int i = 0; i < count; i++)
+            stop_loop(&loops[i]);
+
+        pthread_mutex_lock(&source_lock);
+        free_all_sources();
+        pthread_mutex_unlock(&source_lock);
+    }
+
+out:
+    pthread_mutex_unlock(&init_lock);
+
+    return 0;
+}
+
+static int is_init(void) {
+    pthread_mutex_lock(&init_lock);
+    int inited = init_count != 0;
+    pthread_mutex_unlock(&init_lock);
+
+    return inited;
+}
+
+static struct reactor this = {
+        .init = init,
+        .deinit = deinit,
+        .is_init = is_init,
+        .add_fd = add_fd,
+        .modify_fd = modify_fd,
+        .add_timer = add_timer,
+        .set_timer = set_timer,
+        .add_signal = add_signal,
+        .add_event = add_event,
+        .notify_event = notify_event,
+        .remove = remove_source,
+        .get_stat = get_stat,
+};
+
+struct reactor* get_reactor(void) {
+    return &this;
+}
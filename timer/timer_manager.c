@@ -24,6 +24,7 @@
 #include <utils/list.h>
 #include <utils/assert.h>
 #include <thread/thread.h>
+#include <thread/reactor.h>
 #include <timer/timer_manager.h>
 
 #define LOG_TAG "timer_manager"
@@ -49,6 +50,7 @@ static struct thread* thread;
 static pthread_mutex_t list_lock = PTHREAD_MUTEX_INITIALIZER;
 static LIST_HEAD(timer_list);
 static int epoll_fd;
+static int reactor_id = -1;
 
 static struct timer_info* find_timer_info_by_id(int id) {
     struct timer_info* info = NULL;
@@ -105,34 +107,45 @@ static int epoll_del_event(int id) {
     return 0;
 }
 
-static void thread_loop(struct pthread_wrapper* pthread, void* param) {
+static void dispatch_timers(int timeout) {
     struct epoll_event events[TIMER_MAX_COUNT];
     int count;
 
-    for (;;) {
-        do {
-            count = epoll_wait(epoll_fd, events, ARRAY_SIZE(events), -1);
-        } while (count <= 0 && errno == EINTR);
+    do {
+        count = epoll_wait(epoll_fd, events, ARRAY_SIZE(events), timeout);
+    } while (count < 0 && errno == EINTR);
 
-        for (int i = 0; i < count; i++) {
-            struct timer_info* info = events[i].data.ptr;
+    for (int i = 0; i < count; i++) {
+        struct timer_info* info = events[i].data.ptr;
 
-            if (events[i].events & EPOLLIN) {
-                uint64_t exp;
+        if (events[i].events & EPOLLIN) {
+            uint64_t exp;
 
-                read(info->timer_fd, &exp, sizeof(uint64_t));
+            read(info->timer_fd, &exp, sizeof(uint64_t));
 
-                info->callback(info->id, exp);
+            info->callback(info->id, exp);
 
-                if (info->oneshot)
-                    free_timer(info->id);
-            }
+            if (info->oneshot)
+                free_timer(info->id);
         }
     }
+}
+
+static void thread_loop(struct pthread_wrapper* pthread, void* param) {
+    for (;;)
+        dispatch_timers(-1);
 
     pthread_exit(NULL);
 }
 
+/*
+ * On the reactor the timer epoll is one more fd of its loop, taken
+ * without blocking whenever it turns readable
+ */
+static void reactor_handler(int id, int fd, uint32_t events, void* arg) {
+    dispatch_timers(0);
+}
+
 
 static int start(int id) {
     int error = 0;
@@ -163,7 +176,7 @@ static int start(int id) {
 
     pthread_mutex_lock(&list_lock);
 
-    if (get_list_size_locked(&timer_list) == 1)
+    if (thread && get_list_size_locked(&timer_list) == 1)
         thread->start(thread, NULL);
 
     pthread_mutex_unlock(&list_lock);
@@ -180,7 +193,7 @@ static int start(int id) {
 
 error:
     epoll_del_event(id);
-    if (get_list_size_locked(&timer_list) == 1)
+    if (thread && get_list_size_locked(&timer_list) == 1)
         thread->stop(thread);
 
     return -1;
@@ -212,7 +225,7 @@ static int stop(int id) {
 
     pthread_mutex_lock(&list_lock);
 
-    if (get_list_size_locked(&timer_list) == 1)
+    if (thread && get_list_size_locked(&timer_list) == 1)
         thread->stop(thread);
 
     pthread_mutex_unlock(&list_lock);
@@ -371,8 +384,20 @@ static int init(void) {
             goto error;
         }
 
-        thread = _new(struct thread, thread);
-        thread->runnable.run = thread_loop;
+        /*
+         * Run on the reactor when the application has it up
+         */
+        if (get_reactor()->is_init()) {
+            reactor_id = get_reactor()->add_fd(epoll_fd, EPOLLIN,
+                    reactor_handler, NULL);
+            if (reactor_id < 0) {
+                close(epoll_fd);
+                goto error;
+            }
+        } else {
+            thread = _new(struct thread, thread);
+            thread->runnable.run = thread_loop;
+        }
     }
 
     pthread_mutex_unlock(&init_lock);
@@ -390,12 +415,20 @@ static int deinit(void) {
     pthread_mutex_lock(&init_lock);
 
     if (--init_count == 0) {
+        if (reactor_id > 0) {
+            get_reactor()->remove(reactor_id);
+            reactor_id = -1;
+        }
+
         free_all_timer();
 
-        if (thread->is_running(thread))
-            thread->stop(thread);
+        if (thread) {
+            if (thread->is_running(thread))
+                thread->stop(thread);
 
-        _delete(thread);
+            _delete(thread);
+            thread = NULL;
+        }
 
         close(epoll_fd);
         epoll_fd = -1;
@@ -29,15 +29,47 @@
 #include <sys/wait.h>
 #include <errno.h>
 #include <pwd.h>
+#include <pthread.h>
+#include <limits.h>
 
 #include <types.h>
 #include <utils/log.h>
 #include <utils/assert.h>
 #include <utils/file_ops.h>
 #include <utils/common.h>
+#include <utils/thread_pool.h>
 
 #define LOG_TAG "common"
 
+/*
+ * Subtrees handed to a pool thread at a time, and batches queued per
+ * pool thread before the walk waits for them
+ */
+#define COLD_BOOT_BATCH     8
+#define COLD_BOOT_PENDING   4
+
+struct cold_boot_context {
+    const char **subsystems;
+    int count;
+    int root_fd;
+    uint32_t uevents;
+    uint32_t failed;
+    uint32_t pending;
+    uint32_t max_pending;
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+};
+
+/*
+ * Subtrees are two levels below the root and named relative to it,
+ * queued batches hold no fds
+ */
+struct cold_boot_work {
+    struct cold_boot_context *context;
+    char names[COLD_BOOT_BATCH][2 * NAME_MAX + 2];
+    int count;
+};
+
 static const char* prefix_platform_xburst = "Ingenic Xburst";
 
 void msleep(uint64_t msec) {
@@ -121,19 +153,54 @@ char* get_user_system_dir(uid_t user_id) {
     return buf;
 }
 
-static void do_cold_boot(DIR *d, int lvl) {
+static int subsystem_allowed(struct cold_boot_context *context, int dfd) {
+    char link[PATH_MAX];
+    const char *name;
+    ssize_t size;
+    int i;
+
+    size = readlinkat(dfd, "subsystem", link, sizeof(link) - 1);
+    if (size < 0)
+        return 0;
+
+    link[size] = '\0';
+    name = strrchr(link, '/');
+    name = name ? name + 1 : link;
+
+    for (i = 0; i < context->count; i++)
+        if (!strcmp(name, context->subsystems[i]))
+            return 1;
+
+    return 0;
+}
+
+static void trigger_uevent(struct cold_boot_context *context, int dfd) {
+    int fd;
+
+    if (context && context->count && !subsystem_allowed(context, dfd))
+        return;
+
+    fd = openat(dfd, "uevent", O_WRONLY);
+    if (fd < 0)
+        return;
+
+    if (write(fd, "add\n", 4) < 0) {
+        if (context)
+            __atomic_add_fetch(&context->failed, 1, __ATOMIC_RELAXED);
+    } else if (context) {
+        __atomic_add_fetch(&context->uevents, 1, __ATOMIC_RELAXED);
+    }
+
+    close(fd);
+}
+
+static void do_cold_boot(struct cold_boot_context *context, DIR *d, int lvl) {
     struct dirent *de;
     int dfd, fd;
 
     dfd = dirfd(d);
 
-    fd = openat(dfd, "uevent", O_WRONLY);
-    if (fd >= 0) {
-        if (write(fd, "add\n", 4) < 0)
-            close(fd);
-        else
-            close(fd);
-    }
+    trigger_uevent(context, dfd);
 
     while ((de = readdir(d))) {
         DIR *d2;
@@ -152,7 +219,7 @@ static void do_cold_boot(DIR *d, int lvl) {
         if (d2 == 0)
             close(fd);
         else {
-            do_cold_boot(d2, lvl + 1);
+            do_cold_boot(context, d2, lvl + 1);
             closedir(d2);
         }
     }
@@ -161,11 +228,199 @@ static void do_cold_boot(DIR *d, int lvl) {
 void cold_boot(const char *path) {
     DIR *d = opendir(path);
     if (d) {
-        do_cold_boot(d, 0);
+        do_cold_boot(NULL, d, 0);
         closedir(d);
     }
 }
 
+static void cold_boot_work_run(void *arg) {
+    struct cold_boot_work *work = arg;
+    struct cold_boot_context *context = work->context;
+    DIR *d;
+    int i;
+
+    int fd;
+
+    for (i = 0; i < work->count; i++) {
+        fd = openat(context->root_fd, work->names[i], O_RDONLY | O_DIRECTORY);
+        if (fd < 0) {
+            /*
+             * Gone since it was listed is fine, anything else loses
+             * the devices below
+             */
+            if (errno != ENOENT) {
+                LOGW("Failed to open %s: %s\n", work->names[i],
+                        strerror(errno));
+                __atomic_add_fetch(&context->failed, 1, __ATOMIC_RELAXED);
+            }
+            continue;
+        }
+
+        d = fdopendir(fd);
+        if (d == NULL) {
+            close(fd);
+            continue;
+        }
+
+        do_cold_boot(context, d, 2);
+        closedir(d);
+    }
+
+    free(work);
+
+    pthread_mutex_lock(&context->lock);
+    context->pending--;
+    pthread_cond_broadcast(&context->done);
+    pthread_mutex_unlock(&context->lock);
+}
+
+/*
+ * Queue a batch on the pool, or walk it here when there is no pool.
+ * Waits while the pool is max_pending batches behind.
+ */
+static void submit_cold_boot_work(struct thread_pool_manager *pm,
+        struct cold_boot_work *work) {
+    struct cold_boot_context *context = work->context;
+
+    pthread_mutex_lock(&context->lock);
+    while (pm && context->pending >= context->max_pending)
+        pthread_cond_wait(&context->done, &context->lock);
+    context->pending++;
+    pthread_mutex_unlock(&context->lock);
+
+    if (pm == NULL || pm->add_work(pm, cold_boot_work_run, work, NULL,
+            NULL) < 0)
+        cold_boot_work_run(work);
+}
+
+int cold_boot_parallel(const char *path, const char **subsystems, int count,
+        int threads, struct cold_boot_stat *stat) {
+    assert_die_if(path == NULL, "path is NULL\n");
+    assert_die_if(subsystems == NULL && count, "subsystems is NULL\n");
+
+    struct cold_boot_context context;
+    struct cold_boot_work *work = NULL;
+    struct thread_pool_manager *pm;
+    struct dirent *de;
+    struct dirent *child;
+    struct timespec start;
+    struct timespec end;
+    uint32_t elapsed_ms;
+    DIR *root;
+    DIR *d;
+    int fd;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    root = opendir(path);
+    if (root == NULL) {
+        LOGE("Failed to open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    if (threads <= 0)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads <= 0)
+        threads = 1;
+
+    memset(&context, 0, sizeof(context));
+    context.subsystems = subsystems;
+    context.count = count;
+    context.root_fd = dirfd(root);
+    context.max_pending = threads * COLD_BOOT_PENDING;
+    pthread_mutex_init(&context.lock, NULL);
+    pthread_cond_init(&context.done, NULL);
+
+    pm = construct_thread_pool_manager();
+    if (pm && pm->init(pm, threads, 0, 0) < 0) {
+        LOGW("No thread pool, coldplug %s serially\n", path);
+        deconstruct_thread_pool_manager(&pm);
+    }
+
+    if (pm)
+        pm->start(pm);
+
+    /*
+     * The first two levels are walked here, like do_cold_boot() does,
+     * and everything below goes to the pool in batches of subtrees
+     */
+    trigger_uevent(&context, dirfd(root));
+
+    while ((de = readdir(root))) {
+        if (de->d_name[0] == '.')
+            continue;
+
+        fd = openat(dirfd(root), de->d_name, O_RDONLY | O_DIRECTORY);
+        if (fd < 0)
+            continue;
+
+        d = fdopendir(fd);
+        if (d == NULL) {
+            close(fd);
+            continue;
+        }
+
+        trigger_uevent(&context, fd);
+
+        while ((child = readdir(d))) {
+            if (child->d_name[0] == '.' || child->d_type != DT_DIR)
+                continue;
+
+            if (work == NULL) {
+                work = calloc(1, sizeof(*work));
+                if (work == NULL) {
+                    LOGE("Failed to allocate coldplug work\n");
+                    break;
+                }
+
+                work->context = &context;
+            }
+
+            snprintf(work->names[work->count], sizeof(work->names[0]),
+                    "%s/%s", de->d_name, child->d_name);
+
+            if (++work->count == COLD_BOOT_BATCH) {
+                submit_cold_boot_work(pm, work);
+                work = NULL;
+            }
+        }
+
+        closedir(d);
+    }
+
+    if (work)
+        submit_cold_boot_work(pm, work);
+
+    pthread_mutex_lock(&context.lock);
+    while (context.pending)
+        pthread_cond_wait(&context.done, &context.lock);
+    pthread_mutex_unlock(&context.lock);
+
+    closedir(root);
+
+    if (pm) {
+        pm->destroy(pm, threads);
+        deconstruct_thread_pool_manager(&pm);
+    }
+
+    pthread_mutex_destroy(&context.lock);
+    pthread_cond_destroy(&context.done);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    elapsed_ms = (end.tv_sec - start.tv_sec) * 1000
+            + (end.tv_nsec - start.tv_nsec) / 1000000;
+
+    LOGI("Coldplug %s: %u uevents, %u failed, %u ms on %d threads\n", path,
+            context.uevents, context.failed, elapsed_ms, threads);
+
+    if (stat) {
+        stat->uevents = context.uevents;
+        stat->failed = context.failed;
+        stat->elapsed_ms = elapsed_ms;
+    }
+
+    return 0;
+}
 
 #if 0
 /**
@@ -0,0 +1,476 @@
+/*
+ *  Copyright (C) 2017, Zhang YanMing <yanmin.zhang@ingenic.com, jamincheung@126.com>
+ *
+ *  Ingenic Linux plarform SDK project
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <string.h>
+#include <stdlib.h>
+
+#include <types.h>
+#include <utils/log.h>
+#include <utils/assert.h>
+#include <utils/common.h>
+#include <utils/image_process.h>
+
+#define LOG_TAG "image_process"
+
+#define ROTATE_TILE         16
+#define BILINEAR_BITS       8
+#define BILINEAR_ONE        (1 << BILINEAR_BITS)
+
+static inline uint32_t load32(const uint8_t* p) {
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+
+    return v;
+}
+
+static inline void store32(uint8_t* p, uint32_t v) {
+    memcpy(p, &v, sizeof(v));
+}
+
+/*
+ * Pick Y0 Y1 of two YUYV words and pack them in memory order
+ */
+static inline uint32_t pack_luma(uint32_t w0, uint32_t w1) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return (w0 & 0xff000000) | ((w0 << 8) & 0x00ff0000) |
+            ((w1 >> 16) & 0x0000ff00) | ((w1 >> 8) & 0x000000ff);
+#else
+    return (w0 & 0x000000ff) | ((w0 >> 8) & 0x0000ff00) |
+            ((w1 << 16) & 0x00ff0000) | ((w1 << 8) & 0xff000000);
+#endif
+}
+
+static void yuyv_row_extract_y(const uint8_t* __restrict src,
+        uint8_t* __restrict dst, uint32_t width) {
+    uint32_t x = 0;
+
+    for (; x + 8 <= width; x += 8) {
+        store32(dst + x, pack_luma(load32(src), load32(src + 4)));
+        store32(dst + x + 4, pack_luma(load32(src + 8), load32(src + 12)));
+        src += 16;
+    }
+
+    for (; x < width; x++) {
+        dst[x] = *src;
+        src += 2;
+    }
+}
+
+void image_yuyv_extract_y(const uint8_t* yuyv, uint32_t width, uint32_t height,
+        uint32_t stride, uint8_t* y) {
+    assert_die_if(yuyv == NULL, "yuyv is NULL\n");
+    assert_die_if(y == NULL, "y is NULL\n");
+
+    for (uint32_t row = 0; row < height; row++)
+        yuyv_row_extract_y(yuyv + row * stride, y + row * width, width);
+}
+
+void image_yuyv_extract_y_rotate(const uint8_t* yuyv, uint32_t width,
+        uint32_t height, uint32_t stride, uint8_t* y, enum image_rotate rotate) {
+    assert_die_if(yuyv == NULL, "yuyv is NULL\n");
+    assert_die_if(y == NULL, "y is NULL\n");
+
+    if (rotate == IMAGE_ROTATE_NONE) {
+        image_yuyv_extract_y(yuyv, width, height, stride, y);
+        return;
+    }
+
+    /*
+     * Walk the source in tiles so both the source lines and the
+     * destination columns of a tile stay in cache
+     */
+    for (uint32_t ty = 0; ty < height; ty += ROTATE_TILE) {
+        uint32_t ey = MIN(ty + ROTATE_TILE, height);
+
+        for (uint32_t tx = 0; tx < width; tx += ROTATE_TILE) {
+            uint32_t ex = MIN(tx + ROTATE_TILE, width);
+
+            for (uint32_t sy = ty; sy < ey; sy++) {
+                const uint8_t* src = yuyv + sy * stride;
+
+                if (rotate == IMAGE_ROTATE_CCW90) {
+                    for (uint32_t sx = tx; sx < ex; sx++)
+                        y[(width - 1 - sx) * height + sy] = src[sx * 2];
+
+                } else {
+                    for (uint32_t sx = tx; sx < ex; sx++)
+                        y[sx * height + (height - 1 - sy)] = src[sx * 2];
+                }
+            }
+        }
+    }
+}
+
+void image_nv12_extract_y(const uint8_t* nv12, uint32_t width, uint32_t height,
+        uint32_t stride, uint8_t* y) {
+    assert_die_if(nv12 == NULL, "nv12 is NULL\n");
+    assert_die_if(y == NULL, "y is NULL\n");
+
+    if (stride == width) {
+        memcpy(y, nv12, width * height);
+        return;
+    }
+
+    for (uint32_t row = 0; row < height; row++)
+        memcpy(y + row * width, nv12 + row * stride, width);
+}
+
+static int check_roi(uint32_t src_width, uint32_t src_height, uint32_t x,
+        uint32_t y, uint32_t width, uint32_t height) {
+    if (!width || !height || x >= src_width || y >= src_height ||
+            width > src_width - x || height > src_height - y) {
+        LOGE("Invalid ROI %ux%u+%u+%u of %ux%u\n", width, height, x, y,
+                src_width, src_height);
+        return -1;
+    }
+
+    return 0;
+}
+
+int image_crop(const uint8_t* src, uint32_t src_width, uint32_t src_height,
+        uint32_t src_stride, uint32_t x, uint32_t y, uint32_t width,
+        uint32_t height, uint8_t* dst, uint32_t dst_stride) {
+    assert_die_if(src == NULL, "src is NULL\n");
+    assert_die_if(dst == NULL, "dst is NULL\n");
+
+    if (check_roi(src_width, src_height, x, y, width, height) < 0)
+        return -1;
+
+    src += y * src_stride + x;
+
+    for (uint32_t row = 0; row < height; row++)
+        memcpy(dst + row * dst_stride, src + row * src_stride, width);
+
+    return 0;
+}
+
+int image_yuyv_crop_y(const uint8_t* yuyv, uint32_t src_width,
+        uint32_t src_height, uint32_t src_stride, uint32_t x, uint32_t y,
+        uint32_t width, uint32_t height, uint8_t* dst, uint32_t dst_stride) {
+    assert_die_if(yuyv == NULL, "yuyv is NULL\n");
+    assert_die_if(dst == NULL, "dst is NULL\n");
+
+    x &= ~1;
+
+    if (check_roi(src_width, src_height, x, y, width, height) < 0)
+        return -1;
+
+    yuyv += y * src_stride + x * 2;
+
+    for (uint32_t row = 0; row < height; row++)
+        yuyv_row_extract_y(yuyv + row * src_stride, dst + row * dst_stride,
+                width);
+
+    return 0;
+}
+
+int image_resize_box(const uint8_t* src, uint32_t src_width,
+        uint32_t src_height, uint32_t src_stride, uint8_t* dst,
+        uint32_t dst_width, uint32_t dst_height, uint32_t dst_stride) {
+    assert_die_if(src == NULL, "src is NULL\n");
+    assert_die_if(dst == NULL, "dst is NULL\n");
+
+    uint32_t* column_sum;
+    uint32_t* x_start;
+
+    if (!src_width || !src_height || !dst_width || !dst_height) {
+        LOGE("Invalid resolution\n");
+        return -1;
+    }
+
+    if (dst_width > src_width || dst_height > src_height)
+        return image_resize_bilinear(src, src_width, src_height, src_stride,
+                dst, dst_width, dst_height, dst_stride);
+
+    column_sum = malloc(src_width * sizeof(uint32_t) +
+            (dst_width + 1) * sizeof(uint32_t));
+    if (column_sum == NULL) {
+        LOGE("Failed to allocate memory\n");
+        return -1;
+    }
+
+    x_start = column_sum + src_width;
+    for (uint32_t dx = 0; dx <= dst_width; dx++)
+        x_start[dx] = (uint64_t) dx * src_width / dst_width;
+
+    for (uint32_t dy = 0; dy < dst_height; dy++) {
+        uint32_t y0 = (uint64_t) dy * src_height / dst_height;
+        uint32_t y1 = (uint64_t) (dy + 1) * src_height / dst_height;
+        uint8_t* out = dst + dy * dst_stride;
+
+        /*
+         * Sum the source lines vertically once, then every output
+         * pixel only walks its columns
+         */
+        memset(column_sum, 0, src_width * sizeof(uint32_t));
+        for (uint32_t sy = y0; sy < y1; sy++) {
+            const uint8_t* in = src + sy * src_stride;
+
+            for (uint32_t sx = 0; sx < src_width; sx++)
+                column_sum[sx] += in[sx];
+        }
+
+        /*
+         * A span is always q or q + 1 columns wide, so two reciprocals
+         * per line replace the per pixel division. 32 fraction bits
+         * keep boxes of millions of pixels exact to half a level, the
+         * product of up to 255 * 2^32 needs 64 bits.
+         */
+        uint32_t q = src_width / dst_width;
+        uint64_t count_q = (uint64_t) q * (y1 - y0);
+        uint64_t count_q1 = (uint64_t) (q + 1) * (y1 - y0);
+        uint64_t recip_q = ((1ULL << 32) + count_q / 2) / count_q;
+        uint64_t recip_q1 = ((1ULL << 32) + count_q1 / 2) / count_q1;
+
+        for (uint32_t dx = 0; dx < dst_width; dx++) {
+            uint32_t x0 = x_start[dx];
+            uint32_t x1 = x_start[dx + 1];
+            uint64_t recip = (x1 - x0) == q ? recip_q : recip_q1;
+            uint64_t sum = 0;
+
+            for (uint32_t sx = x0; sx < x1; sx++)
+                sum += column_sum[sx];
+
+            out[dx] = MIN((sum * recip + (1ULL << 31)) >> 32, 255);
+        }
+    }
+
+    free(column_sum);
+
+    return 0;
+}
+
+struct bilinear_cache {
+    uint16_t* rows[2];
+    int32_t line[2];
+    uint8_t* padded;
+    const uint32_t* x_index;
+    const uint8_t* x_frac;
+};
+
+static void bilinear_row(const uint8_t* in, uint16_t* out,
+        const uint32_t* x_index, const uint8_t* x_frac, uint32_t dst_width) {
+    for (uint32_t dx = 0; dx < dst_width; dx++) {
+        uint32_t sx = x_index[dx];
+        uint32_t f = x_frac[dx];
+
+        out[dx] = in[sx] * (BILINEAR_ONE - f) + in[sx + 1] * f;
+    }
+}
+
+/*
+ * Horizontal pass is reused while consecutive output lines map to
+ * the same source lines, @keep is the line that must not be evicted
+ */
+static const uint16_t* bilinear_fetch(struct bilinear_cache* cache,
+        const uint8_t* src, uint32_t src_width, uint32_t src_stride,
+        uint32_t dst_width, int32_t line, int32_t keep) {
+    int slot;
+
+    if (cache->line[0] == line)
+        return cache->rows[0];
+    if (cache->line[1] == line)
+        return cache->rows[1];
+
+    slot = cache->line[0] == keep ? 1 : 0;
+
+    memcpy(cache->padded, src + line * src_stride, src_width);
+    cache->padded[src_width] = cache->padded[src_width - 1];
+
+    bilinear_row(cache->padded, cache->rows[slot], cache->x_index,
+            cache->x_frac, dst_width);
+    cache->line[slot] = line;
+
+    return cache->rows[slot];
+}
+
+int image_resize_bilinear(const uint8_t* src, uint32_t src_width,
+        uint32_t src_height, uint32_t src_stride, uint8_t* dst,
+        uint32_t dst_width, uint32_t dst_height, uint32_t dst_stride) {
+    assert_die_if(src == NULL, "src is NULL\n");
+    assert_die_if(dst == NULL, "dst is NULL\n");
+
+    struct bilinear_cache cache;
+    uint8_t* buffer;
+    uint32_t* x_index;
+    uint8_t* x_frac;
+
+    if (!src_width || !src_height || !dst_width || !dst_height) {
+        LOGE("Invalid resolution\n");
+        return -1;
+    }
+
+    buffer = malloc(dst_width * (sizeof(uint32_t) + sizeof(uint8_t)) +
+            2 * dst_width * sizeof(uint16_t) + src_width + 1);
+    if (buffer == NULL) {
+        LOGE("Failed to allocate memory\n");
+        return -1;
+    }
+
+    cache.rows[0] = (uint16_t *) buffer;
+    cache.rows[1] = cache.rows[0] + dst_width;
+    x_index = (uint32_t *) (cache.rows[1] + dst_width);
+    x_frac = (uint8_t *) (x_index + dst_width);
+    cache.padded = x_frac + dst_width;
+    cache.line[0] = cache.line[1] = -1;
+    cache.x_index = x_index;
+    cache.x_frac = x_frac;
+
+    /*
+     * Pixel centers are aligned, coordinates are 16.16 fixed point
+     */
+    for (uint32_t dx = 0; dx < dst_width; dx++) {
+        int64_t fx = (((int64_t) dx * 2 + 1) * src_width << 16) /
+                (dst_width * 2) - (1 << 15);
+
+        if (fx < 0)
+            fx = 0;
+        if (fx > ((int64_t) (src_width - 1) << 16))
+            fx = (int64_t) (src_width - 1) << 16;
+
+        x_index[dx] = fx >> 16;
+        x_frac[dx] = (fx & 0xffff) >> (16 - BILINEAR_BITS);
+    }
+
+    for (uint32_t dy = 0; dy < dst_height; dy++) {
+        int64_t fy = (((int64_t) dy * 2 + 1) * src_height << 16) /
+                (dst_height * 2) - (1 << 15);
+        uint32_t sy, f;
+        const uint16_t* r0;
+        const uint16_t* r1;
+        uint8_t* out = dst + dy * dst_stride;
+
+        if (fy < 0)
+            fy = 0;
+        if (fy > ((int64_t) (src_height - 1) << 16))
+            fy = (int64_t) (src_height - 1) << 16;
+
+        sy = fy >> 16;
+        f = (fy & 0xffff) >> (16 - BILINEAR_BITS);
+
+        r0 = bilinear_fetch(&cache, src, src_width, src_stride, dst_width,
+                sy, -1);
+        r1 = bilinear_fetch(&cache, src, src_width, src_stride, dst_width,
+                MIN(sy + 1, src_height - 1), sy);
+
+        for (uint32_t dx = 0; dx < dst_width; dx++) {
+            uint32_t v = r0[dx] * (BILINEAR_ONE - f) + r1[dx] * f;
+
+            out[dx] = (v + (1 << (2 * BILINEAR_BITS - 1))) >>
+                    (2 * BILINEAR_BITS);
+        }
+    }
+
+    free(buffer);
+
+    return 0;
+}
+
+void image_histogram(const uint8_t* src, uint32_t width, uint32_t height,
+        uint32_t stride, uint32_t hist[256]) {
+    assert_die_if(src == NULL, "src is NULL\n");
+    assert_die_if(hist == NULL, "hist is NULL\n");
+
+    /*
+     * Four partial histograms break the store to load dependency
+     * when neighbouring pixels share a value
+     */
+    uint32_t partial[4][256];
+
+    memset(partial, 0, sizeof(partial));
+
+    for (uint32_t row = 0; row < height; row++) {
+        const uint8_t* in = src + row * stride;
+        uint32_t x = 0;
+
+        for (; x + 4 <= width; x += 4) {
+            partial[0][in[x]]++;
+            partial[1][in[x + 1]]++;
+            partial[2][in[x + 2]]++;
+            partial[3][in[x + 3]]++;
+        }
+
+        for (; x < width; x++)
+            partial[0][in[x]]++;
+    }
+
+    for (int i = 0; i < 256; i++)
+        hist[i] = partial[0][i] + partial[1][i] + partial[2][i] +
+                partial[3][i];
+}
+
+void image_equalize_hist(const uint8_t* src, uint32_t width, uint32_t height,
+        uint32_t src_stride, uint8_t* dst, uint32_t dst_stride) {
+    assert_die_if(src == NULL, "src is NULL\n");
+    assert_die_if(dst == NULL, "dst is NULL\n");
+
+    uint32_t hist[256];
+    uint8_t lut[256];
+    uint32_t total = width * height;
+    uint32_t cdf = 0;
+    uint32_t cdf_min = 0;
+
+    image_histogram(src, width, height, src_stride, hist);
+
+    for (int i = 0; i < 256; i++) {
+        if (hist[i]) {
+            cdf_min = hist[i];
+            break;
+        }
+    }
+
+    for (int i = 0; i < 256; i++) {
+        cdf += hist[i];
+
+        if (total == cdf_min)
+            lut[i] = i;
+        else
+            lut[i] = ((uint64_t) (cdf - MIN(cdf, cdf_min)) * 255 +
+                    (total - cdf_min) / 2) / (total - cdf_min);
+    }
+
+    for (uint32_t row = 0; row < height; row++) {
+        const uint8_t* in = src + row * src_stride;
+        uint8_t* out = dst + row * dst_stride;
+
+        for (uint32_t x = 0; x < width; x++)
+            out[x] = lut[in[x]];
+    }
+}
+
+void image_integral(const uint8_t* src, uint32_t width, uint32_t height,
+        uint32_t stride, uint32_t* integral) {
+    assert_die_if(src == NULL, "src is NULL\n");
+    assert_die_if(integral == NULL, "integral is NULL\n");
+
+    uint32_t line = width + 1;
+
+    memset(integral, 0, line * sizeof(uint32_t));
+
+    for (uint32_t row = 0; row < height; row++) {
+        const uint8_t* in = src + row * stride;
+        const uint32_t* above = integral + row * line;
+        uint32_t* out = integral + (row + 1) * line;
+        uint32_t sum = 0;
+
+        out[0] = 0;
+        for (uint32_t x = 0; x < width; x++) {
+            sum += in[x];
+            out[x + 1] = above[x + 1] + sum;
+        }
+    }
+}
@@ -15,6 +15,9 @@
  */
 
 #include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 
 #include <utils/log.h>
 #include <utils/assert.h>
@@ -22,12 +25,19 @@
 
 #define LOG_TAG "wave_parser"
 
+#define HEADER_READ_SIZE        512
+#define HEADER_MAX_SIZE         (64 * 1024)
+
 const char* format_to_string(uint16_t format) {
     switch(format) {
     case WAV_FMT_PCM:
         return "PCM";
     case WAV_FMT_IEEE_FLOAT:
         return "IEEE FLOAT";
+    case WAV_FMT_IMA_ADPCM:
+        return "IMA ADPCM";
+    case WAV_FMT_LOSSLESS:
+        return "LOSSLESS";
     case WAV_FMT_DOLBY_AC3_SPDIF:
         return "DOLBY AC3 SPDIF";
     case WAV_FMT_EXTENSIBLE:
@@ -73,12 +83,20 @@ static void dump_header(WaveContainer* container) {
     LOGD("========================================\n");
 }
 
+static int is_codec_format(uint16_t format) {
+    return format == LE_SHORT(WAV_FMT_IMA_ADPCM)
+            || format == LE_SHORT(WAV_FMT_LOSSLESS);
+}
+
 static int check_vaild(WaveContainer* container) {
+    uint32_t format_size = is_codec_format(container->format.format) ? 20 : 16;
+
     if (container->header.magic != WAV_RIFF ||
             container->header.type != WAV_WAVE ||
             container->format.magic != WAV_FMT ||
-            container->format.format != WAV_FMT_PCM ||
-            container->format.format_size != LE_INT(16) ||
+            (container->format.format != LE_SHORT(WAV_FMT_PCM) &&
+                    !is_codec_format(container->format.format)) ||
+            container->format.format_size != LE_INT(format_size) ||
            (container->format.channels != LE_SHORT(1) && container->format.channels != LE_SHORT(2)) ||
             container->chunk_header.type != WAV_DATA ) {
 
@@ -89,146 +107,155 @@ static int check_vaild(WaveContainer* container) {
     return 0;
 }
 
-int wave_read_header(int fd, WaveContainer* container) {
-    assert_die_if(fd < 0, "Invalid fd\n");
+/*
+ * Chunks are walked by their length, LIST and other chunks before the
+ * data chunk are skipped. fmt and fact must be whole in @buffer.
+ */
+int wave_parse_header(const uint8_t* buffer, uint32_t size,
+        WaveContainer* container, uint32_t* data_offset) {
+    assert_die_if(buffer == NULL, "buffer is NULL\n");
     assert_die_if(container == NULL, "container is NULL\n");
+    assert_die_if(data_offset == NULL, "data_offset is NULL\n");
 
-    int error = 0;
-    uint32_t magic;
-    uint32_t length;
-    uint32_t type;
-    uint32_t fmt_magic;
-    uint32_t fmt_size;
-    uint16_t audio_fmt;
-    uint16_t channels;
-    uint32_t sample_fq;
-    uint32_t byte_p_sec;
-    uint16_t byte_p_spl;
-    uint16_t bit_p_spl;
+    uint32_t pos = sizeof(WaveHeader);
     uint32_t chunk_type;
-    uint16_t chunk_type_hi;
-    uint16_t chunk_type_low;
     uint32_t chunk_size;
-    uint32_t skip;
+    int has_fmt = 0;
 
-    error = read(fd, &magic, sizeof(uint32_t));
-    if (error != sizeof(uint32_t) || magic != WAV_RIFF) {
+    if (size < sizeof(WaveHeader))
+        return -EAGAIN;
+
+    memcpy(&container->header, buffer, sizeof(WaveHeader));
+    if (container->header.magic != WAV_RIFF
+            || container->header.type != WAV_WAVE) {
         LOGE("Parse wave magic error\n");
         goto error;
     }
 
-    error = read(fd, &length, sizeof(uint32_t));
-    if (error != sizeof(uint32_t)) {
-        LOGE("Parse wave length error\n");
-        goto error;
-    }
+    memset(&container->codec, 0, sizeof(container->codec));
+    memset(&container->fact, 0, sizeof(container->fact));
 
-    error = read(fd, &type, sizeof(uint32_t));
-    if (error != sizeof(uint32_t) || type != WAV_WAVE) {
-        LOGE("Parse wave type error\n");
-        goto error;
-    }
+    for (;;) {
+        if (size - pos < 8)
+            return -EAGAIN;
 
-    error = read(fd, &fmt_magic, sizeof(uint32_t));
-    if (error != sizeof(uint32_t) || fmt_magic != WAV_FMT) {
-        LOGE("Parse wave fmt id error\n");
-        goto error;
-    }
+        memcpy(&chunk_type, buffer + pos, sizeof(uint32_t));
+        memcpy(&chunk_size, buffer + pos + 4, sizeof(uint32_t));
+        chunk_size = LE_INT(chunk_size);
 
-    error = read(fd, &fmt_size, sizeof(uint32_t));
-    if (error != sizeof(uint32_t)) {
-        LOGE("Parse wave fmt size error\n");
-        goto error;
-    }
+        if (chunk_type == WAV_DATA) {
+            if (!has_fmt) {
+                LOGE("Parse wave data chunk before fmt error\n");
+                goto error;
+            }
 
-    error = read(fd, &audio_fmt, sizeof(uint16_t));
-    if (error != sizeof(uint16_t)) {
-        LOGE("Parse wave audio fmt error\n");
-        goto error;
-    }
+            container->chunk_header.type = chunk_type;
+            container->chunk_header.length = LE_INT(chunk_size);
+            *data_offset = pos + 8;
 
-    error = read(fd, &channels, sizeof(uint16_t));
-    if (error != sizeof(uint16_t)) {
-        LOGE("Parse wave channels error\n");
-        goto error;
-    }
+            dump_header(container);
 
-    error = read(fd, &sample_fq, sizeof(uint32_t));
-    if (error != sizeof(uint32_t)) {
-        LOGE("Parse wave sample rate error\n");
-        goto error;
-    }
+            return 0;
+        }
 
-    error = read(fd, &byte_p_sec, sizeof(uint32_t));
-    if (error != sizeof(uint32_t)) {
-        LOGE("Parse wave byte per second error\n");
-        goto error;
-    }
+        if (size - pos - 8 < chunk_size)
+            return -EAGAIN;
 
-    error = read(fd, &byte_p_spl, sizeof(uint16_t));
-    if (error != sizeof(uint16_t)) {
-        LOGE("Parse wave byte per sample error\n");
-        goto error;
-    }
+        if (chunk_type == WAV_FMT) {
+            if (chunk_size < sizeof(WaveFmtBody) - 8) {
+                LOGE("Parse wave fmt size error\n");
+                goto error;
+            }
 
-    error = read(fd, &bit_p_spl, sizeof(uint16_t));
-    if (error != sizeof(uint16_t)) {
-        LOGE("Parse wave bits per sample error\n");
-        goto error;
-    }
+            memcpy(&container->format, buffer + pos, sizeof(WaveFmtBody));
 
-    skip = 8 + fmt_size - sizeof(WaveFmtBody);
-    lseek(fd, skip, SEEK_CUR);
+            /*
+             * Compressed formats carry samples per block in the extension
+             */
+            if (is_codec_format(container->format.format) && chunk_size
+                    >= sizeof(WaveFmtBody) - 8 + sizeof(WaveFmtCodecExt))
+                memcpy(&container->codec, buffer + pos + sizeof(WaveFmtBody),
+                        sizeof(WaveFmtCodecExt));
 
-    for (;;) {
+            has_fmt = 1;
+
+        } else if (chunk_type == WAV_FACT && chunk_size >= sizeof(uint32_t)) {
+            memcpy(&container->fact, buffer + pos, sizeof(WaveFactChunk));
+        }
 
         /*
-         * The standard WAVE data chunk area is little endian
+         * Chunks are padded to an even length
          */
-        if (read(fd, &chunk_type_low, sizeof(uint16_t)) != sizeof(uint16_t)) {
-            LOGE("Parse wave data chunk type low bits error\n");
-            goto error;
-        }
+        pos += 8 + chunk_size;
+        if (pos == size)
+            return -EAGAIN;
+        pos += chunk_size & 1;
+    }
 
-        if (chunk_type_low == (WAV_DATA & 0xffff)) {
-            if (read(fd, &chunk_type_hi, sizeof(uint16_t)) != sizeof(uint16_t)) {
-                LOGE("Parse wave data chunk type high bits error\n");
-                goto error;
+error:
+    LOGE("Not standard wave file.\n");
+    return -1;
+}
+
+/*
+ * One read for ordinary headers, the fd is left at the start of the
+ * sample data
+ */
+int wave_read_header(int fd, WaveContainer* container) {
+    assert_die_if(fd < 0, "Invalid fd\n");
+    assert_die_if(container == NULL, "container is NULL\n");
+
+    uint8_t* buffer = NULL;
+    uint8_t* grown;
+    uint32_t capacity = 0;
+    uint32_t size = 0;
+    uint32_t data_offset;
+    off_t start;
+    int error = -EAGAIN;
+    int ret;
+
+    start = lseek(fd, 0, SEEK_CUR);
+
+    while (error == -EAGAIN) {
+        if (size == capacity) {
+            if (capacity >= HEADER_MAX_SIZE) {
+                LOGE("Parse wave header too long error\n");
+                break;
             }
-        }
 
-        chunk_type = (chunk_type_hi<< 16 | chunk_type_low);
-        if (chunk_type == WAV_DATA) {
-            if (read(fd, &chunk_size, sizeof(uint32_t)) != sizeof(uint32_t)) {
-                LOGE("Parse wave data chunk size error\n");
-                goto error;
+            capacity = capacity ? capacity * 2 : HEADER_READ_SIZE;
+            grown = realloc(buffer, capacity);
+            if (grown == NULL) {
+                LOGE("Failed to allocate header buffer\n");
+                break;
             }
+            buffer = grown;
+        }
+
+        ret = read(fd, buffer + size, capacity - size);
+        if (ret < 0 && errno == EINTR)
+            continue;
 
+        if (ret <= 0) {
+            LOGE("Parse wave header truncated error\n");
             break;
         }
+
+        size += ret;
+        error = wave_parse_header(buffer, size, container, &data_offset);
     }
 
-    container->header.magic = magic;
-    container->header.length = length;
-    container->header.type = type;
-    container->format.magic = fmt_magic;
-    container->format.format_size = fmt_size;
-    container->format.format = audio_fmt;
-    container->format.channels = channels;
-    container->format.sample_fq = sample_fq;
-    container->format.byte_p_sec = byte_p_sec;
-    container->format.byte_p_spl = byte_p_spl;
-    container->format.bit_p_spl = bit_p_spl;
-    container->chunk_header.type = chunk_type;
-    container->chunk_header.length = chunk_size;
+    free(buffer);
 
-    dump_header(container);
+    if (error < 0)
+        return -1;
 
-    return 0;
+    if (lseek(fd, start + data_offset, SEEK_SET) < 0) {
+        LOGE("Failed to seek to wave data: %s\n", strerror(errno));
+        return -1;
+    }
 
-error:
-    LOGE("Not standard wave file.\n");
-    return -1;
+    return 0;
 }
 
 int wave_write_header(int fd, WaveContainer* container) {
@@ -239,12 +266,21 @@ int wave_write_header(int fd, WaveContainer* container) {
         return -1;
 
     if (write(fd, &container->header, sizeof(container->header)) != sizeof(container->header) ||
-        write(fd, &container->format, sizeof(container->format)) != sizeof(container->format) ||
-        write(fd, &container->chunk_header, sizeof(container->chunk_header)) != sizeof(container->chunk_header)) {
+        write(fd, &container->format, sizeof(container->format)) != sizeof(container->format)) {
 
         return -1;
     }
 
+    if (is_codec_format(container->format.format) &&
+        (write(fd, &container->codec, sizeof(container->codec)) != sizeof(container->codec) ||
+        write(fd, &container->fact, sizeof(container->fact)) != sizeof(container->fact))) {
+
+        return -1;
+    }
+
+    if (write(fd, &container->chunk_header, sizeof(container->chunk_header)) != sizeof(container->chunk_header))
+        return -1;
+
     dump_header(container);
 
     return 0;
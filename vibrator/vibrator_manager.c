@@ -17,6 +17,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <time.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -27,8 +28,12 @@
 #include <utils/log.h>
 #include <utils/assert.h>
 #include <sys/ioctl.h>
+#include <sys/timerfd.h>
+#include <poll.h>
 #include <pthread.h>
 #include <utils/list.h>
+#include <utils/common.h>
+#include <thread/thread.h>
 #include <netlink/netlink_handler.h>
 #include <netlink/netlink_event.h>
 #include <vibrator/vibrator_manager.h>
@@ -43,6 +48,8 @@
 
 #define LOG_TAG "vibrator"
 
+#define MOTOR_SPEED_MAX             10
+
 typedef enum _motor_ioctl_direction {
     MOTOR_IOCTL_SET = 0x0,
     MOTOR_IOCTL_GET = 0x01,
@@ -53,19 +60,55 @@ struct event_callback_t {
     struct list_head node;
 };
 
+/*
+ * A pattern queued or playing on a motor, steps are copied in
+ */
+struct pattern_t {
+    int32_t id;
+    uint32_t motor_id;
+    struct vibrator_step* steps;
+    uint32_t count;
+    uint32_t repeat;
+    vibrator_pattern_callback_t callback;
+    uint32_t step;
+    uint32_t played;
+    uint64_t late_total_ns;
+    struct vibrator_pattern_stat stat;
+    int cancelled;
+    struct list_head node;
+};
+
 struct motor_device_t {
     int32_t motor_id;
     int32_t motor_fd;
     struct list_head callback_head;
     struct list_head device_node;
+    struct list_head pattern_head;      /* first one is playing */
+    uint64_t deadline_ns;               /* of the next step, 0 idle */
+    uint32_t speed;                     /* as last set, or unknown */
 };
 
+/*
+ * set_speed/set_function bypass the pattern thread, the next step
+ * can't tell what the motor is doing after them
+ */
+#define MOTOR_SPEED_UNKNOWN     UINT32_MAX
+
 static struct netlink_handler* netlink_handler;
 static LIST_HEAD(device_head);
 
 static pthread_mutex_t init_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t device_lock = PTHREAD_MUTEX_INITIALIZER;
 
+/*
+ * Patterns of every motor run off one thread and one timerfd armed
+ * for the earliest step due, steps are scheduled on absolute times so
+ * a late wakeup doesn't push the rest of the pattern back
+ */
+static struct thread* pattern_thread;
+static int pattern_timer_fd = -1;
+static int32_t next_pattern_id = 1;
+
 static void handle_switch_event(struct netlink_handler* nh,
         struct netlink_event* event) {
     uint32_t motor_id;
@@ -74,8 +117,8 @@ static void handle_switch_event(struct netlink_handler* nh,
     struct list_head* device_pos;
     struct list_head* callback_pos;
     const int action = event->get_action(event);
-    const char* name = event->find_param(event, "SWITCH_NAME");
-    const char* state = event->find_param(event, "SWITCH_STATE");
+    const char* name = event->find_key(event, NL_KEY_SWITCH_NAME);
+    const char* state = event->find_key(event, NL_KEY_SWITCH_STATE);
     motor_status status = MOTOR_COAST;
 
     if (strncmp(name, "motor",5))
@@ -115,6 +158,382 @@ static void handle_event(struct netlink_handler* nh,
 
 }
 
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void set_motor_speed(struct motor_device_t* motor_device, uint32_t speed) {
+    if (speed == motor_device->speed)
+        return;
+
+    if (speed) {
+        if (ioctl(motor_device->motor_fd, MOTOR_SET_SPEED, speed)
+                || ((motor_device->speed == 0
+                        || motor_device->speed == MOTOR_SPEED_UNKNOWN)
+                        && ioctl(motor_device->motor_fd,
+                        MOTOR_SET_FUNCTION, MOTOR_FORWARD)))
+            LOGE("motor%d pattern ioctl failed: %s\n", motor_device->motor_id,
+                    strerror(errno));
+    } else if (ioctl(motor_device->motor_fd, MOTOR_SET_FUNCTION, MOTOR_COAST)) {
+        LOGE("motor%d pattern ioctl failed: %s\n", motor_device->motor_id,
+                strerror(errno));
+    }
+
+    motor_device->speed = speed;
+}
+
+/*
+ * Re-arm the timer for the earliest deadline, with device_lock held
+ */
+static void arm_pattern_timer(void) {
+    struct itimerspec spec;
+    struct list_head* pos;
+    struct motor_device_t* motor_device;
+    uint64_t earliest = 0;
+
+    list_for_each(pos, &device_head) {
+        motor_device = list_entry(pos, struct motor_device_t, device_node);
+        if (motor_device->deadline_ns && (!earliest
+                || motor_device->deadline_ns < earliest))
+            earliest = motor_device->deadline_ns;
+    }
+
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = earliest / 1000000000;
+    spec.it_value.tv_nsec = earliest % 1000000000;
+
+    if (timerfd_settime(pattern_timer_fd, TFD_TIMER_ABSTIME, &spec, NULL))
+        LOGE("Failed to arm pattern timer: %s\n", strerror(errno));
+}
+
+/*
+ * Patterns finished or cancelled go to @done, their callbacks run
+ * once device_lock is released
+ */
+static void finish_pattern(struct pattern_t* pattern, int cancelled,
+        struct list_head* done) {
+    pattern->cancelled = cancelled;
+    pattern->stat.repeats = pattern->played;
+    if (pattern->stat.steps)
+        pattern->stat.late_avg_us = pattern->late_total_ns / 1000
+                / pattern->stat.steps;
+
+    list_del(&pattern->node);
+    list_add_tail(&pattern->node, done);
+}
+
+static void complete_patterns(struct list_head* done) {
+    struct list_head* pos;
+    struct list_head* next_pos;
+    struct pattern_t* pattern;
+
+    list_for_each_safe(pos, next_pos, done) {
+        pattern = list_entry(pos, struct pattern_t, node);
+
+        if (pattern->callback)
+            pattern->callback(pattern->motor_id, pattern->id,
+                    pattern->cancelled, &pattern->stat);
+
+        list_del(&pattern->node);
+        free(pattern->steps);
+        free(pattern);
+    }
+}
+
+/*
+ * Play every step of @motor_device due by @now, starting the next
+ * queued pattern when one ends
+ */
+static void run_motor_patterns(struct motor_device_t* motor_device,
+        uint64_t now, struct list_head* done) {
+    struct pattern_t* pattern;
+    uint64_t late;
+
+    while (motor_device->deadline_ns && motor_device->deadline_ns <= now) {
+        pattern = list_first_entry(&motor_device->pattern_head,
+                struct pattern_t, node);
+
+        if (pattern->step == pattern->count) {
+            pattern->step = 0;
+            pattern->played++;
+
+            if (pattern->repeat && pattern->played == pattern->repeat) {
+                finish_pattern(pattern, 0, done);
+
+                if (list_empty(&motor_device->pattern_head)) {
+                    set_motor_speed(motor_device, 0);
+                    motor_device->deadline_ns = 0;
+                }
+
+                continue;
+            }
+        }
+
+        late = now - motor_device->deadline_ns;
+        pattern->late_total_ns += late;
+        pattern->stat.steps++;
+        if (late / 1000 > pattern->stat.late_max_us)
+            pattern->stat.late_max_us = late / 1000;
+
+        set_motor_speed(motor_device, pattern->steps[pattern->step].speed);
+
+        motor_device->deadline_ns += (uint64_t)
+                pattern->steps[pattern->step].duration_ms * 1000000;
+        pattern->step++;
+    }
+}
+
+static void pattern_loop(struct pthread_wrapper* pthread, void* param) {
+    struct list_head* pos;
+    struct motor_device_t* motor_device;
+    struct pollfd fds;
+    uint64_t expirations;
+    uint64_t now;
+    int old_state;
+    LIST_HEAD(done);
+
+    fds.fd = pattern_timer_fd;
+    fds.events = POLLIN;
+
+    for (;;) {
+        fds.revents = 0;
+
+        if (poll(&fds, 1, -1) <= 0)
+            continue;
+
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &old_state);
+
+        if (read(pattern_timer_fd, &expirations, sizeof(expirations)) < 0
+                && errno != EAGAIN)
+            LOGE("Failed to read pattern timer: %s\n", strerror(errno));
+
+        pthread_mutex_lock(&device_lock);
+
+        now = now_ns();
+
+        list_for_each(pos, &device_head) {
+            motor_device = list_entry(pos, struct motor_device_t, device_node);
+            run_motor_patterns(motor_device, now, &done);
+        }
+
+        arm_pattern_timer();
+
+        pthread_mutex_unlock(&device_lock);
+
+        complete_patterns(&done);
+
+        pthread_setcancelstate(old_state, NULL);
+    }
+}
+
+/*
+ * Thread and timer come up with the first pattern, with init_lock held
+ */
+static int32_t start_pattern_thread(void) {
+    if (pattern_thread)
+        return 0;
+
+    pattern_timer_fd = timerfd_create(CLOCK_MONOTONIC,
+            TFD_NONBLOCK | TFD_CLOEXEC);
+    if (pattern_timer_fd < 0) {
+        LOGE("Failed to create pattern timer: %s\n", strerror(errno));
+        return -1;
+    }
+
+    pattern_thread = _new(struct thread, thread);
+    pattern_thread->runnable.run = pattern_loop;
+
+    if (pattern_thread->start(pattern_thread, NULL) < 0) {
+        LOGE("Failed to start pattern thread\n");
+        _delete(pattern_thread);
+        pattern_thread = NULL;
+        close(pattern_timer_fd);
+        pattern_timer_fd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+static void stop_pattern_thread(void) {
+    if (pattern_thread == NULL)
+        return;
+
+    pattern_thread->stop(pattern_thread);
+    _delete(pattern_thread);
+    pattern_thread = NULL;
+
+    close(pattern_timer_fd);
+    pattern_timer_fd = -1;
+}
+
+/*
+ * With device_lock held, into @done
+ */
+static void cancel_motor_patterns(struct motor_device_t* motor_device,
+        int32_t pattern_id, struct list_head* done) {
+    struct list_head* pos;
+    struct list_head* next_pos;
+    struct pattern_t* pattern;
+    int playing = 1;
+
+    list_for_each_safe(pos, next_pos, &motor_device->pattern_head) {
+        pattern = list_entry(pos, struct pattern_t, node);
+
+        if (pattern_id <= 0 || pattern->id == pattern_id) {
+            finish_pattern(pattern, 1, done);
+
+            /*
+             * The next one starts where the cancelled one stopped
+             */
+            if (playing)
+                motor_device->deadline_ns = now_ns();
+        }
+
+        playing = 0;
+    }
+
+    if (list_empty(&motor_device->pattern_head) && motor_device->deadline_ns) {
+        set_motor_speed(motor_device, 0);
+        motor_device->deadline_ns = 0;
+    }
+}
+
+static struct motor_device_t* find_motor_device_locked(uint32_t motor_id) {
+    struct list_head* pos;
+    struct motor_device_t* motor_device;
+
+    list_for_each(pos, &device_head) {
+        motor_device = list_entry(pos, struct motor_device_t, device_node);
+        if (motor_device->motor_id == motor_id)
+            return motor_device;
+    }
+
+    return NULL;
+}
+
+static int32_t play_pattern(uint32_t motor_id,
+        const struct vibrator_pattern* pattern, int queue,
+        vibrator_pattern_callback_t callback) {
+    assert_die_if(pattern == NULL, "pattern is NULL\n");
+
+    struct motor_device_t* motor_device;
+    struct pattern_t* entry;
+    uint64_t length_ms = 0;
+    int32_t id;
+    LIST_HEAD(done);
+
+    if (pattern->count == 0 || pattern->steps == NULL) {
+        LOGE("motor%d: empty pattern\n", motor_id);
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < pattern->count; i++) {
+        if (pattern->steps[i].speed > MOTOR_SPEED_MAX) {
+            LOGE("motor%d: step %u speed %u over %d\n", motor_id, i,
+                    pattern->steps[i].speed, MOTOR_SPEED_MAX);
+            return -1;
+        }
+
+        length_ms += pattern->steps[i].duration_ms;
+    }
+
+    /*
+     * A zero length pattern played forever would spin the thread
+     */
+    if (length_ms == 0) {
+        LOGE("motor%d: pattern of no duration\n", motor_id);
+        return -1;
+    }
+
+    pthread_mutex_lock(&init_lock);
+    if (start_pattern_thread() < 0) {
+        pthread_mutex_unlock(&init_lock);
+        return -1;
+    }
+    pthread_mutex_unlock(&init_lock);
+
+    entry = calloc(1, sizeof(*entry));
+    if (entry)
+        entry->steps = malloc(pattern->count * sizeof(*pattern->steps));
+    if (entry == NULL || entry->steps == NULL) {
+        LOGE("play_pattern: malloc pattern fail\n");
+        free(entry);
+        return -1;
+    }
+
+    memcpy(entry->steps, pattern->steps,
+            pattern->count * sizeof(*pattern->steps));
+    entry->count = pattern->count;
+    entry->repeat = pattern->repeat;
+    entry->callback = callback;
+    entry->motor_id = motor_id;
+
+    pthread_mutex_lock(&device_lock);
+
+    motor_device = find_motor_device_locked(motor_id);
+    if (motor_device == NULL) {
+        LOGE("motor%d device is not open!\n", motor_id);
+        pthread_mutex_unlock(&device_lock);
+        free(entry->steps);
+        free(entry);
+        return -1;
+    }
+
+    id = entry->id = next_pattern_id++;
+    if (next_pattern_id <= 0)
+        next_pattern_id = 1;
+
+    if (!queue)
+        cancel_motor_patterns(motor_device, 0, &done);
+
+    list_add_tail(&entry->node, &motor_device->pattern_head);
+
+    if (motor_device->deadline_ns == 0) {
+        motor_device->speed = MOTOR_SPEED_UNKNOWN;
+        motor_device->deadline_ns = now_ns();
+        arm_pattern_timer();
+    }
+
+    pthread_mutex_unlock(&device_lock);
+
+    complete_patterns(&done);
+
+    return id;
+}
+
+static int32_t cancel_pattern(uint32_t motor_id, int32_t pattern_id) {
+    struct motor_device_t* motor_device;
+    LIST_HEAD(done);
+
+    pthread_mutex_lock(&device_lock);
+
+    motor_device = find_motor_device_locked(motor_id);
+    if (motor_device == NULL) {
+        LOGE("motor%d device is not open!\n", motor_id);
+        pthread_mutex_unlock(&device_lock);
+        return -1;
+    }
+
+    cancel_motor_patterns(motor_device, pattern_id, &done);
+
+    if (pattern_thread)
+        arm_pattern_timer();
+
+    pthread_mutex_unlock(&device_lock);
+
+    if (list_empty(&done))
+        return -1;
+
+    complete_patterns(&done);
+
+    return 0;
+}
+
 static int32_t motor_init(void) {
     pthread_mutex_lock(&init_lock);
 
@@ -127,7 +546,7 @@ static int32_t motor_init(void) {
         }
         netlink_handler->construct = construct_netlink_handler;
         netlink_handler->deconstruct = destruct_netlink_handler;
-        netlink_handler->construct(netlink_handler, "all sub-system", 0, handle_event, NULL);
+        netlink_handler->construct(netlink_handler, "switch", 0, handle_event, NULL);
     }
 
     pthread_mutex_unlock(&init_lock);
@@ -135,6 +554,7 @@ static int32_t motor_init(void) {
 }
 
 static void motor_deinit(void) {
+    LIST_HEAD(done);
     struct list_head* device_pos;
     struct list_head* device_next_pos;
     struct list_head* callback_pos;
@@ -151,13 +571,17 @@ static void motor_deinit(void) {
             list_del(&event_callback->node);
             free(event_callback);
         }
+        cancel_motor_patterns(motor_device, 0, &done);
         close(motor_device->motor_fd);
         list_del(&motor_device->device_node);
         free(motor_device);
     }
     pthread_mutex_unlock(&device_lock);
 
+    complete_patterns(&done);
+
     pthread_mutex_lock(&init_lock);
+    stop_pattern_thread();
     netlink_handler->deconstruct(netlink_handler);
     free(netlink_handler);
     netlink_handler = NULL;
@@ -197,7 +621,10 @@ static int32_t motor_open(uint32_t motor_id) {
 
     motor_device->motor_id = motor_id;
     motor_device->motor_fd = fd;
+    motor_device->deadline_ns = 0;
+    motor_device->speed = MOTOR_SPEED_UNKNOWN;
     INIT_LIST_HEAD(&motor_device->callback_head);
+    INIT_LIST_HEAD(&motor_device->pattern_head);
     list_add_tail(&motor_device->device_node, &device_head);
 
     pthread_mutex_unlock(&device_lock);
@@ -205,6 +632,7 @@ static int32_t motor_open(uint32_t motor_id) {
 }
 
 static void motor_close(uint32_t motor_id) {
+    LIST_HEAD(done);
     struct list_head* device_pos;
     struct list_head* device_next_pos;
     struct list_head* callback_pos;
@@ -221,15 +649,17 @@ static void motor_close(uint32_t motor_id) {
                 list_del(&event_callback->node);
                 free(event_callback);
             }
+            cancel_motor_patterns(motor_device, 0, &done);
             close(motor_device->motor_fd);
             list_del(&motor_device->device_node);
             free(motor_device);
-            pthread_mutex_unlock(&device_lock);
-            return;
+            break;
         }
     }
 
     pthread_mutex_unlock(&device_lock);
+
+    complete_patterns(&done);
 }
 
 static int32_t motor_ioctl(uint32_t motor_id, int32_t command,
@@ -243,9 +673,11 @@ static int32_t motor_ioctl(uint32_t motor_id, int32_t command,
     list_for_each(pos, &device_head) {
         motor_device = list_entry(pos, struct motor_device_t, device_node);
         if (motor_device->motor_id == motor_id) {
-            if(dir == MOTOR_IOCTL_SET)
+            if(dir == MOTOR_IOCTL_SET) {
                 error = ioctl(motor_device->motor_fd, command, function);
-            else
+                if (command == MOTOR_SET_SPEED || command == MOTOR_SET_FUNCTION)
+                    motor_device->speed = MOTOR_SPEED_UNKNOWN;
+            } else
                 error = ioctl(motor_device->motor_fd, command, &data);
 
             if(error) {
@@ -365,6 +797,8 @@ static struct vibrator_manager vibrator_manager = {
     .register_event_callback = register_event_callback,
     .unregister_event_callback = unregister_event_callback,
     .get_netlink_handler = get_netlink_handler,
+    .play_pattern = play_pattern,
+    .cancel_pattern = cancel_pattern,
 };
 
 struct vibrator_manager* get_vibrator_manager(void) {